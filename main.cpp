@@ -1,10 +1,75 @@
 #define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
 #include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#include <OpenGL/OpenGL.h>
 #include <GLUT/glut.h>
+#else
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glut.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GLOBE_HAS_EGL 1 // Linux 服务器上通过 EGL 做无窗口渲染
+#endif
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF // GL 3.3 / EXT_timer_query
+#endif
+#ifdef __APPLE__
+#define glGetQueryObjectui64v glGetQueryObjectui64vEXT
+#define glDrawArraysInstanced glDrawArraysInstancedARB
+#define glVertexAttribDivisor glVertexAttribDivisorARB
+#define glFenceSync glFenceSyncAPPLE
+#define glClientWaitSync glClientWaitSyncAPPLE
+#define glDeleteSync glDeleteSyncAPPLE
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117 // GL 3.2 / ARB_sync
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GLOBE_SIMD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GLOBE_SIMD_NEON 1
+#endif
 #include <iostream>
 #include <cmath>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
 #include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <csignal>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -19,16 +84,59 @@ float zoom = 1.0f;
 int lastMouseX = 0, lastMouseY = 0;
 bool mouseLeftDown = false;
 
+// 相机位置（始终看向原点）
+float cameraX = 0.0f;
+float cameraY = 0.0f;
+float cameraZ = 5.0f;
+
 // 纹理ID
 GLuint textureID = 0;
 GLuint shadowTextureID = 0; // 阴影纹理
 
+// 纹理像素的CPU副本（第0行对应 t=0），供软件渲染等CPU路径使用
+vector<unsigned char> earthPixels;  // RGB
+int earthTexWidth = 0, earthTexHeight = 0;
+// 供鼠标拾取读取的只读快照：纹理热重载在渲染线程替换 earthPixels，拾取在主线程进行，
+// 每次替换都发布一份新的不可变副本（atomic_store），读取方 atomic_load 后持有引用即可安全访问
+struct EarthImageSnapshot {
+    vector<unsigned char> pixels;  // RGB
+    int width, height;
+};
+shared_ptr<const EarthImageSnapshot> earthSnapshot;
+vector<unsigned char> shadowPixels; // RGBA
+const int shadowTexSize = 256;
+
 // 光源参数
 int currentLightPosition = 0; // 当前光源位置索引
 bool lightEnabled = true;     // 光照是否启用
 bool shadowEnabled = true;    // 阴影是否启用
 float shadowIntensity = 0.6f; // 阴影强度
 
+// 渲染后端
+bool softwareRenderer = false; // 是否使用CPU软件光栅化（无需GL上下文）
+int renderThreads = 0;         // CPU渲染线程数，0 表示使用全部核心
+bool softRaycastGlobe = false; // 软件渲染时逐像素求交绘制地球，不做三角化
+bool globeImpostor = false;    // GL渲染时用光线求交的替身四边形代替网格绘制地球
+
+// 统计
+int frameDrawCalls = 0;        // 当前帧的绘制调用次数（每个 glBegin/glDraw* 记一次）
+bool hudEnabled = false;       // 是否显示性能叠加层
+int sphereSlices = 36;         // 地球网格经向分段数
+int sphereStacks = 18;         // 地球网格纬向分段数
+
+// 云层
+string cloudFramePattern;      // --clouds 指定的帧文件模式，空表示没有云层
+double cloudFramesPerSecond = 10.0;
+bool cloudsEnabled = false;
+
+// 时间序列数据场
+string fieldPath;              // --field 指定的数据文件，空表示没有数据场
+string fieldLutPath;           // --field-lut 指定的色标图片，空表示内置色标
+double fieldFramesPerSecond = 0.0; // 自动播放速度（时间步/秒），0 表示只随按键移动
+bool fieldEnabled = false;
+double fieldCursor = 0.0;      // 时间轴游标（时间步，小数部分在相邻两帧之间插值）
+float fieldAppliedTime = 0.0f; // 最近一次从视图快照应用的游标，快照中的值变化时才覆盖播放进度
+
 // 地面参数
 float floorY = -1.5f;         // 地面Y坐标
 float floorSize = 4.0f;       // 地面大小
@@ -50,6 +158,27 @@ vector<LightPosition> lightPositions = {
     {0.0f, 0.0f, -10.0f, "正后方"}
 };
 
+// ========================
+// 数学工具
+// ========================
+
+const float PI = 3.14159265359f;
+
+// 线性同余伪随机数，返回 [0, 1)。演示数据和基准测试都用固定种子，结果可重复
+float randomUnit(unsigned int& state) {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 16777216.0f;
+}
+
+// 经纬度到地球物体空间的单位向量，参数化与 generateSphere 的纹理坐标一致
+void geoToSphere(float latitude, float longitude, float out[3]) {
+    float theta = 2.0f * PI * (longitude + 180.0f) / 360.0f;
+    float phi = PI * (90.0f - latitude) / 180.0f;
+    out[0] = sin(phi) * cos(theta);
+    out[1] = cos(phi);
+    out[2] = sin(phi) * sin(theta);
+}
+
 // ========================
 // BMP文件加载函数
 // ========================
@@ -117,7 +246,47 @@ bool loadBMPFile(const char* filename, unsigned char*& data, int& width, int& he
     return true;
 }
 
-void createDefaultTexture() {
+// 保存24位BMP文件
+// data 为自下而上、每行4字节对齐的BGR像素（与 glReadPixels(GL_BGR) 的输出一致）
+bool saveBMPFile(const char* filename, const unsigned char* data, int width, int height) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "错误: 无法写入文件 " << filename << endl;
+        return false;
+    }
+    
+    int rowSize = (width * 3 + 3) & ~3;
+    
+    BMPHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = 0x4D42;
+    header.offset = sizeof(BMPHeader);
+    header.size = header.offset + rowSize * height;
+    header.dibSize = 40;
+    header.width = width;
+    header.height = height;
+    header.planes = 1;
+    header.bitsPerPixel = 24;
+    header.imageSize = rowSize * height;
+    
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data), rowSize * height);
+    return file.good();
+}
+
+// 保存地球纹理的CPU副本
+void setEarthImage(const unsigned char* data, int width, int height) {
+    earthPixels.assign(data, data + width * height * 3);
+    earthTexWidth = width;
+    earthTexHeight = height;
+    shared_ptr<EarthImageSnapshot> snapshot = make_shared<EarthImageSnapshot>();
+    snapshot->pixels = earthPixels;
+    snapshot->width = width;
+    snapshot->height = height;
+    atomic_store(&earthSnapshot, shared_ptr<const EarthImageSnapshot>(snapshot));
+}
+
+void createDefaultTexture(vector<unsigned char>& image, int& width, int& height) {
     unsigned char pixels[64 * 64 * 3];
     
     for (int y = 0; y < 64; ++y) {
@@ -136,16 +305,12 @@ void createDefaultTexture() {
         }
     }
     
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 64, 64, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    image.assign(pixels, pixels + sizeof(pixels));
+    width = 64;
+    height = 64;
 }
 
-bool loadTextureFromJPG(const char* filename) {
+bool loadTextureFromJPG(const char* filename, vector<unsigned char>& image, int& width, int& height) {
     cout << "尝试加载JPG图片: " << filename << endl;
     
     ifstream testFile(filename);
@@ -172,17 +337,9 @@ bool loadTextureFromJPG(const char* filename) {
     bmpTest.close();
     
     unsigned char* imageData = nullptr;
-    int width = 0, height = 0;
     
     if (loadBMPFile(bmpFile.c_str(), imageData, width, height)) {
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-        
+        image.assign(imageData, imageData + width * height * 3);
         delete[] imageData;
         cout << "✓ 成功加载并转换图片: " << filename << " -> " << bmpFile << endl;
         cout << "  尺寸: " << width << "x" << height << endl;
@@ -192,13 +349,14 @@ bool loadTextureFromJPG(const char* filename) {
     return false;
 }
 
-void initTexture() {
+// 解码地球图片（不修改全局状态，也不涉及GL调用，可以在后台线程执行）
+void decodeEarthImage(vector<unsigned char>& image, int& width, int& height) {
     cout << "初始化纹理..." << endl;
     
-    if (loadTextureFromJPG("earth.jpg")) {
+    if (loadTextureFromJPG("earth.jpg", image, width, height)) {
         cout << "✓ 使用 earth.jpg 作为地球纹理" << endl;
     } 
-    else if (loadTextureFromJPG("world.jpg")) {
+    else if (loadTextureFromJPG("world.jpg", image, width, height)) {
         cout << "✓ 使用 world.jpg 作为地球纹理" << endl;
     }
     else {
@@ -211,17 +369,9 @@ void initTexture() {
             if (file.good()) {
                 file.close();
                 unsigned char* imageData = nullptr;
-                int width = 0, height = 0;
                 
                 if (loadBMPFile(possibleFiles[i], imageData, width, height)) {
-                    glGenTextures(1, &textureID);
-                    glBindTexture(GL_TEXTURE_2D, textureID);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-                    
+                    image.assign(imageData, imageData + width * height * 3);
                     delete[] imageData;
                     cout << "✓ 成功加载BMP文件: " << possibleFiles[i] << endl;
                     loaded = true;
@@ -232,18 +382,43 @@ void initTexture() {
         
         if (!loaded) {
             cout << "✗ 无法加载任何图片文件，使用默认棋盘格纹理" << endl;
-            createDefaultTexture();
+            createDefaultTexture(image, width, height);
         }
     }
 }
 
+// 加载地球图片到CPU内存（不涉及GL调用）
+void loadEarthImage() {
+    vector<unsigned char> image;
+    int width = 0, height = 0;
+    decodeEarthImage(image, width, height);
+    setEarthImage(image.data(), width, height);
+}
+
+void uploadEarthTexture() {
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, earthTexWidth, earthTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, earthPixels.data());
+}
+
+void initTexture() {
+    loadEarthImage();
+    uploadEarthTexture();
+}
+
 // ========================
 // 创建阴影纹理（软阴影）
 // ========================
 
-void createSoftShadowTexture() {
-    const int texSize = 256;
-    unsigned char* pixels = new unsigned char[texSize * texSize * 4];
+// 生成软阴影纹理像素（不涉及GL调用）
+void buildSoftShadowPixels() {
+    const int texSize = shadowTexSize;
+    shadowPixels.resize(texSize * texSize * 4);
+    unsigned char* pixels = shadowPixels.data();
     
     for (int y = 0; y < texSize; ++y) {
         for (int x = 0; x < texSize; ++x) {
@@ -280,15 +455,18 @@ void createSoftShadowTexture() {
         }
     }
     
+}
+
+void createSoftShadowTexture() {
+    buildSoftShadowPixels();
+    
     glGenTextures(1, &shadowTextureID);
     glBindTexture(GL_TEXTURE_2D, shadowTextureID);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texSize, texSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-    
-    delete[] pixels;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, shadowTexSize, shadowTexSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, shadowPixels.data());
 }
 
 // ========================
@@ -298,7 +476,6 @@ void createSoftShadowTexture() {
 void generateSphere(float radius, int slices, int stacks, 
                     vector<float>& vertices, vector<float>& normals, 
                     vector<float>& texCoords) {
-    const float PI = 3.14159265359f;
     
     for (int i = 0; i <= stacks; ++i) {
         float phi = PI * i / stacks;
@@ -327,21 +504,30 @@ void generateSphere(float radius, int slices, int stacks,
     }
 }
 
-void drawCustomSphere(float radius, int slices, int stacks) {
+// 用指定纹理绘制球体网格（地球和云层共用同一份缓存的网格）
+void drawSphereMesh(float radius, int slices, int stacks, GLuint texture) {
     static vector<float> vertices;
     static vector<float> normals;
     static vector<float> texCoords;
-    static bool initialized = false;
+    static float cachedRadius = 0.0f;
+    static int cachedSlices = 0, cachedStacks = 0;
     
-    if (!initialized) {
+    // 参数变化时（如基准测试切换细分级别）重新生成网格
+    if (radius != cachedRadius || slices != cachedSlices || stacks != cachedStacks) {
+        vertices.clear();
+        normals.clear();
+        texCoords.clear();
         generateSphere(radius, slices, stacks, vertices, normals, texCoords);
-        initialized = true;
+        cachedRadius = radius;
+        cachedSlices = slices;
+        cachedStacks = stacks;
     }
     
     glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    glBindTexture(GL_TEXTURE_2D, texture);
     
     for (int i = 0; i < stacks; ++i) {
+        ++frameDrawCalls;
         glBegin(GL_TRIANGLE_STRIP);
         
         for (int j = 0; j <= slices; ++j) {
@@ -366,549 +552,10939 @@ void drawCustomSphere(float radius, int slices, int stacks) {
     glDisable(GL_TEXTURE_2D);
 }
 
+void drawCustomSphere(float radius, int slices, int stacks) {
+    drawSphereMesh(radius, slices, stacks, textureID);
+}
+
 // ========================
-// 绘制地面
+// 并行工具
 // ========================
 
-void drawFloor() {
-    glDisable(GL_LIGHTING);
-    
-    // 首先绘制地面基础颜色
-    glColor3f(0.5f, 0.5f, 0.5f); // 中灰色地面
+int defaultThreadCount() {
+    if (renderThreads > 0) return renderThreads;
+    unsigned int cores = thread::hardware_concurrency();
+    return cores > 0 ? (int)cores : 1;
+}
+
+// 常驻工作线程，parallelFor 复用它们而不是每次调用都创建、销毁线程。线程按需要的数量补齐后一直保留。
+// 同一时刻只服务一个 parallelFor：另一个线程同时调用（如大气预计算与渲染并发）或在任务内嵌套调用时，
+// 改用临时线程。作为全局对象，它在所有 atexit 函数（停止渲染线程等）之后才析构
+class WorkerPool {
+public:
+    WorkerPool() : busy(false), job(nullptr), jobCount(0), jobThreads(0), pending(0), generation(0), stopping(false) {}
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+    }
     
-    glBegin(GL_QUADS);
-    glVertex3f(-floorSize, floorY, -floorSize);
-    glVertex3f(floorSize, floorY, -floorSize);
-    glVertex3f(floorSize, floorY, floorSize);
-    glVertex3f(-floorSize, floorY, floorSize);
-    glEnd();
+    // 池空闲时占用它并返回 true，由调用方在 run() 结束后调用 release()
+    bool acquire() {
+        bool expected = false;
+        return busy.compare_exchange_strong(expected, true);
+    }
+    void release() { busy.store(false); }
     
-    // 绘制网格线
-    glColor3f(0.7f, 0.7f, 0.7f);
-    glBegin(GL_LINES);
+    void run(int count, int threads, const function<void(int, int)>& body) {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            while ((int)workers.size() < threads - 1) {
+                workers.push_back(thread(&WorkerPool::workerLoop, this, (int)workers.size() + 1));
+            }
+            job = &body;
+            jobCount = count;
+            jobThreads = threads;
+            next.store(0);
+            pending = threads - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        work(0);
+        unique_lock<mutex> lock(poolMutex);
+        done.wait(lock, [this]() { return pending == 0; });
+        job = nullptr;
+    }
     
-    // X方向网格线
-    for (float x = -floorSize; x <= floorSize; x += 0.5f) {
-        glVertex3f(x, floorY + 0.001f, -floorSize);
-        glVertex3f(x, floorY + 0.001f, floorSize);
+private:
+    void work(int id) {
+        for (int i = next++; i < jobCount; i = next++) (*job)(i, id);
     }
     
-    // Z方向网格线
-    for (float z = -floorSize; z <= floorSize; z += 0.5f) {
-        glVertex3f(-floorSize, floorY + 0.001f, z);
-        glVertex3f(floorSize, floorY + 0.001f, z);
+    void workerLoop(int id) {
+        long long seen = 0;
+        unique_lock<mutex> lock(poolMutex);
+        for (;;) {
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (id >= jobThreads) continue;
+            lock.unlock();
+            work(id);
+            lock.lock();
+            if (--pending == 0) done.notify_one();
+        }
     }
-    glEnd();
     
-    glEnable(GL_LIGHTING);
-}
+    atomic<bool> busy;
+    mutex poolMutex;
+    condition_variable wake, done;
+    vector<thread> workers;
+    const function<void(int, int)>* job;
+    int jobCount, jobThreads, pending;
+    atomic<int> next;
+    long long generation;
+    bool stopping;
+};
 
-// ========================
-// 阴影计算函数
-// ========================
+WorkerPool workerPool;
 
-// 计算点光源投影
-void calculatePointShadow(float lightX, float lightY, float lightZ,
-                         float pointX, float pointY, float pointZ,
-                         float& shadowX, float& shadowZ, float& shadowSize) {
-    // 地面平面：y = floorY
-    // 从光源到点的向量
-    float dx = pointX - lightX;
-    float dy = pointY - lightY;
-    float dz = pointZ - lightZ;
-    
-    if (fabs(dy) < 0.0001f) {
-        // 光线与地面平行
-        shadowX = lightX;
-        shadowZ = lightZ;
-        shadowSize = 0.0f;
+// 将 [0, count) 的任务动态分配给 threads 个线程（当前线程也参与），
+// body(item, worker) 中 worker 为线程序号，可用于索引线程私有数据
+void parallelFor(int count, int threads, const function<void(int, int)>& body) {
+    if (threads > count) threads = count;
+    if (threads <= 1) {
+        for (int i = 0; i < count; ++i) body(i, 0);
         return;
     }
     
-    // 计算光线与地面的交点
-    float t = (floorY - lightY) / dy;
-    
-    if (t < 0) {
-        // 光线从下往上照射
-        shadowX = lightX;
-        shadowZ = lightZ;
-        shadowSize = 0.0f;
+    if (workerPool.acquire()) {
+        workerPool.run(count, threads, body);
+        workerPool.release();
         return;
     }
     
-    shadowX = lightX + t * dx;
-    shadowZ = lightZ + t * dz;
-    
-    // 计算阴影大小：考虑地球半径和透视效果
-    float earthRadius = 1.0f * zoom;
-    float distanceToLight = sqrt(dx*dx + dy*dy + dz*dz);
-    
-    // 简单的阴影大小计算
-    shadowSize = earthRadius * (1.0f + t * 0.5f);
+    atomic<int> next(0);
+    auto worker = [&](int id) {
+        for (int i = next++; i < count; i = next++) body(i, id);
+    };
     
-    // 根据光源高度调整阴影大小
-    float lightHeight = fabs(lightY - floorY);
-    if (lightHeight > 0) {
-        shadowSize *= (distanceToLight / lightHeight);
+    vector<thread> pool;
+    for (int t = 1; t < threads; ++t) pool.push_back(thread(worker, t));
+    worker(0);
+    for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+}
+
+// ========================
+// 四路 SIMD 向量（SSE2 / NEON / 标量回退）
+// ========================
+
+#if defined(GLOBE_SIMD_SSE2)
+struct F4 { __m128 v; };
+inline F4 f4Set1(float x) { F4 r; r.v = _mm_set1_ps(x); return r; }
+inline F4 f4Set(float a, float b, float c, float d) { F4 r; r.v = _mm_setr_ps(a, b, c, d); return r; }
+inline F4 f4Load(const float* p) { F4 r; r.v = _mm_loadu_ps(p); return r; }
+inline void f4Store(float* p, F4 a) { _mm_storeu_ps(p, a.v); }
+inline F4 f4Add(F4 a, F4 b) { F4 r; r.v = _mm_add_ps(a.v, b.v); return r; }
+inline F4 f4Sub(F4 a, F4 b) { F4 r; r.v = _mm_sub_ps(a.v, b.v); return r; }
+inline F4 f4Mul(F4 a, F4 b) { F4 r; r.v = _mm_mul_ps(a.v, b.v); return r; }
+inline F4 f4Min(F4 a, F4 b) { F4 r; r.v = _mm_min_ps(a.v, b.v); return r; }
+inline F4 f4Max(F4 a, F4 b) { F4 r; r.v = _mm_max_ps(a.v, b.v); return r; }
+inline F4 f4Div(F4 a, F4 b) { F4 r; r.v = _mm_div_ps(a.v, b.v); return r; }
+inline F4 f4Sqrt(F4 a) { F4 r; r.v = _mm_sqrt_ps(a.v); return r; }
+inline F4 f4CmpGE(F4 a, F4 b) { F4 r; r.v = _mm_cmpge_ps(a.v, b.v); return r; }
+inline F4 f4CmpGT(F4 a, F4 b) { F4 r; r.v = _mm_cmpgt_ps(a.v, b.v); return r; }
+inline F4 f4CmpLT(F4 a, F4 b) { F4 r; r.v = _mm_cmplt_ps(a.v, b.v); return r; }
+inline F4 f4And(F4 a, F4 b) { F4 r; r.v = _mm_and_ps(a.v, b.v); return r; }
+inline int f4Mask(F4 a) { return _mm_movemask_ps(a.v); }
+inline F4 f4Or(F4 a, F4 b) { F4 r; r.v = _mm_or_ps(a.v, b.v); return r; }
+inline F4 f4Select(F4 mask, F4 a, F4 b) { F4 r; r.v = _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); return r; }
+// 截断取整后对大于原值的通道减1，适用于 |x| < 2^31
+inline F4 f4Floor(F4 a) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    F4 r; r.v = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f))); return r;
+}
+#elif defined(GLOBE_SIMD_NEON)
+struct F4 { float32x4_t v; };
+inline F4 f4Set1(float x) { F4 r; r.v = vdupq_n_f32(x); return r; }
+inline F4 f4Set(float a, float b, float c, float d) { float t[4] = {a, b, c, d}; F4 r; r.v = vld1q_f32(t); return r; }
+inline F4 f4Load(const float* p) { F4 r; r.v = vld1q_f32(p); return r; }
+inline void f4Store(float* p, F4 a) { vst1q_f32(p, a.v); }
+inline F4 f4Add(F4 a, F4 b) { F4 r; r.v = vaddq_f32(a.v, b.v); return r; }
+inline F4 f4Sub(F4 a, F4 b) { F4 r; r.v = vsubq_f32(a.v, b.v); return r; }
+inline F4 f4Mul(F4 a, F4 b) { F4 r; r.v = vmulq_f32(a.v, b.v); return r; }
+inline F4 f4Min(F4 a, F4 b) { F4 r; r.v = vminq_f32(a.v, b.v); return r; }
+inline F4 f4Max(F4 a, F4 b) { F4 r; r.v = vmaxq_f32(a.v, b.v); return r; }
+inline F4 f4Div(F4 a, F4 b) { F4 r; r.v = vdivq_f32(a.v, b.v); return r; }
+inline F4 f4Sqrt(F4 a) { F4 r; r.v = vsqrtq_f32(a.v); return r; }
+inline F4 f4CmpGE(F4 a, F4 b) { F4 r; r.v = vreinterpretq_f32_u32(vcgeq_f32(a.v, b.v)); return r; }
+inline F4 f4CmpGT(F4 a, F4 b) { F4 r; r.v = vreinterpretq_f32_u32(vcgtq_f32(a.v, b.v)); return r; }
+inline F4 f4CmpLT(F4 a, F4 b) { F4 r; r.v = vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)); return r; }
+inline F4 f4And(F4 a, F4 b) {
+    F4 r; r.v = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); return r;
+}
+inline int f4Mask(F4 a) {
+    uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(a.v), 31);
+    return (int)(vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1) |
+                 (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3));
+}
+inline F4 f4Or(F4 a, F4 b) {
+    F4 r; r.v = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); return r;
+}
+inline F4 f4Select(F4 mask, F4 a, F4 b) { F4 r; r.v = vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v); return r; }
+inline F4 f4Floor(F4 a) {
+    float32x4_t t = vcvtq_f32_s32(vcvtq_s32_f32(a.v));
+    uint32x4_t greater = vcgtq_f32(t, a.v);
+    F4 r; r.v = vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(greater, vreinterpretq_u32_f32(vdupq_n_f32(1.0f))))); return r;
+}
+#else
+struct F4 { float v[4]; };
+inline F4 f4Set1(float x) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = x; return r; }
+inline F4 f4Set(float a, float b, float c, float d) { F4 r; r.v[0] = a; r.v[1] = b; r.v[2] = c; r.v[3] = d; return r; }
+inline F4 f4Load(const float* p) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+inline void f4Store(float* p, F4 a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+inline F4 f4Add(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] + b.v[i]; return r; }
+inline F4 f4Sub(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] - b.v[i]; return r; }
+inline F4 f4Mul(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] * b.v[i]; return r; }
+inline F4 f4Min(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+inline F4 f4Max(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+inline F4 f4Div(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] / b.v[i]; return r; }
+inline F4 f4Sqrt(F4 a) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = sqrt(a.v[i]); return r; }
+// 标量回退中掩码用 -1/0 表示（符号位即掩码位）
+inline F4 f4CmpGE(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] >= b.v[i] ? -1.0f : 0.0f; return r; }
+inline F4 f4CmpGT(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] > b.v[i] ? -1.0f : 0.0f; return r; }
+inline F4 f4CmpLT(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] < b.v[i] ? -1.0f : 0.0f; return r; }
+inline F4 f4And(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = (a.v[i] < 0 && b.v[i] < 0) ? -1.0f : 0.0f; return r; }
+inline int f4Mask(F4 a) { int m = 0; for (int i = 0; i < 4; ++i) if (a.v[i] < 0) m |= 1 << i; return m; }
+inline F4 f4Or(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = (a.v[i] < 0 || b.v[i] < 0) ? -1.0f : 0.0f; return r; }
+inline F4 f4Select(F4 mask, F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = mask.v[i] < 0 ? a.v[i] : b.v[i]; return r; }
+inline F4 f4Floor(F4 a) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = floor(a.v[i]); return r; }
+#endif
+
+// ========================
+// 批量坐标变换（结构数组 + SIMD）
+// ========================
+// 标记点、航线、标注都要把经纬度变换到地球物体空间再投影到屏幕。逐点调用 libm 的 sin/cos
+// 在百万级点数时会占满一帧，这里对结构数组（纬度、经度、x、y、z 各一个数组）每次处理4个点，
+// sin/cos/atan2 用多项式近似（Cephes 的单精度系数），误差在 1e-6 量级。
+// 地球物体空间即轴向重排后的地心地固坐标（ECEF）：y 轴指向北极，经度 -180° 在 +x 方向，
+// 与 generateSphere 的纹理参数化和 geoToSphere 一致，单位为赤道半径。
+// 可选 WGS84 椭球，默认与绘制用的单位球一致
+
+enum GeoShape {
+    GEO_SPHERE,
+    GEO_WGS84
+};
+
+const double WGS84_FLATTENING = 1.0 / 298.257223563;
+const double WGS84_SEMI_MAJOR = 6378137.0; // 米，换算基准测试中的误差
+
+// 同时求4个角度（弧度）的 sin 和 cos。先按 π/2 归约到 [-π/4, π/4]（π/2 分三段相减以保持精度），
+// 再按象限交换、变号
+inline void f4SinCos(F4 x, F4& sinOut, F4& cosOut) {
+    F4 zero = f4Set1(0.0f), one = f4Set1(1.0f);
+    F4 j = f4Floor(f4Add(f4Mul(x, f4Set1(0.636619772f)), f4Set1(0.5f)));
+    F4 r = f4Sub(x, f4Mul(j, f4Set1(1.5703125f)));
+    r = f4Sub(r, f4Mul(j, f4Set1(4.837512969970703125e-4f)));
+    r = f4Sub(r, f4Mul(j, f4Set1(7.54978995489188216e-8f)));
+    F4 z = f4Mul(r, r);
+    F4 s = f4Add(f4Mul(f4Set1(-1.9515295891e-4f), z), f4Set1(8.3321608736e-3f));
+    s = f4Add(f4Mul(s, z), f4Set1(-1.6666654611e-1f));
+    s = f4Add(f4Mul(f4Mul(s, z), r), r);
+    F4 c = f4Add(f4Mul(f4Set1(2.443315711809948e-5f), z), f4Set1(-1.388731625493765e-3f));
+    c = f4Add(f4Mul(c, z), f4Set1(4.166664568298827e-2f));
+    c = f4Add(f4Sub(f4Mul(f4Mul(c, z), z), f4Mul(f4Set1(0.5f), z)), one);
+    // 象限 q = j mod 4：q 为奇数时 sin/cos 互换，sin 在 q=2,3 变号，cos 在 q=1,2 变号
+    F4 q = f4Sub(j, f4Mul(f4Set1(4.0f), f4Floor(f4Mul(j, f4Set1(0.25f)))));
+    F4 odd = f4CmpGE(f4Sub(q, f4Mul(f4Set1(2.0f), f4Floor(f4Mul(q, f4Set1(0.5f))))), f4Set1(0.5f));
+    F4 sinNegative = f4CmpGE(q, f4Set1(1.5f));
+    F4 cosNegative = f4And(f4CmpGE(q, f4Set1(0.5f)), f4CmpLT(q, f4Set1(2.5f)));
+    F4 sv = f4Select(odd, c, s), cv = f4Select(odd, s, c);
+    sinOut = f4Select(sinNegative, f4Sub(zero, sv), sv);
+    cosOut = f4Select(cosNegative, f4Sub(zero, cv), cv);
+}
+
+// 4路 atan2(y, x)，结果在 [-π, π]。先求 atan(|y|/|x|)：大于 tan(3π/8) 时用 π/2 - atan(1/t)，
+// 大于 tan(π/8) 时用 π/4 + atan((t-1)/(t+1))，归约后的多项式在 |t| <= tan(π/8) 上足够精确
+inline F4 f4Atan2(F4 y, F4 x) {
+    F4 zero = f4Set1(0.0f), one = f4Set1(1.0f);
+    F4 ax = f4Max(x, f4Sub(zero, x)), ay = f4Max(y, f4Sub(zero, y));
+    F4 t = f4Div(ay, f4Max(ax, f4Set1(1e-30f))); // x = y = 0 时 t = 0
+    F4 big = f4CmpGT(t, f4Set1(2.414213562f));
+    F4 medium = f4CmpGT(t, f4Set1(0.414213562f)); // 与 big 重叠的部分由 big 优先
+    F4 base = f4Select(big, f4Set1(1.570796327f), f4Select(medium, f4Set1(0.785398163f), zero));
+    F4 reduced = f4Select(big, f4Div(f4Set1(-1.0f), f4Max(t, f4Set1(1e-30f))),
+                          f4Select(medium, f4Div(f4Sub(t, one), f4Add(t, one)), t));
+    F4 z = f4Mul(reduced, reduced);
+    F4 p = f4Add(f4Mul(f4Set1(8.05374449538e-2f), z), f4Set1(-1.38776856032e-1f));
+    p = f4Add(f4Mul(p, z), f4Set1(1.99777106478e-1f));
+    p = f4Add(f4Mul(p, z), f4Set1(-3.33329491539e-1f));
+    F4 a = f4Add(f4Add(f4Mul(f4Mul(p, z), reduced), reduced), base);
+    a = f4Select(f4CmpLT(x, zero), f4Sub(f4Set1(PI), a), a);
+    return f4Select(f4CmpLT(y, zero), f4Sub(zero, a), a);
+}
+
+// 椭球参数（以赤道半径为1）：第一偏心率平方、极半径、第二偏心率平方
+struct GeoShapeParams {
+    float e2, polar, ep2;
+    explicit GeoShapeParams(GeoShape shape) {
+        double f = shape == GEO_WGS84 ? WGS84_FLATTENING : 0.0;
+        double e = f * (2.0 - f);
+        e2 = (float)e;
+        polar = (float)(1.0 - f);
+        ep2 = (float)(e / (1.0 - e));
     }
-    
-    // 限制最大阴影大小
-    if (shadowSize > floorSize * 0.6f) {
-        shadowSize = floorSize * 0.6f;
+};
+
+// 数组长度不是4的倍数时，尾部拷进4个元素的临时数组处理
+struct F4Tail {
+    float v[4];
+    void load(const float* p, size_t n, float fill) {
+        for (size_t i = 0; i < 4; ++i) v[i] = i < n ? p[i] : fill;
     }
+    void store(float* p, size_t n) const {
+        for (size_t i = 0; i < n; ++i) p[i] = v[i];
+    }
+};
+
+inline void geodeticToGlobe4(F4 lat, F4 lon, F4 h, const GeoShapeParams& shape, F4& x, F4& y, F4& z) {
+    const float DEG = PI / 180.0f;
+    F4 sinLat, cosLat, sinLon, cosLon;
+    f4SinCos(f4Mul(lat, f4Set1(DEG)), sinLat, cosLat);
+    f4SinCos(f4Mul(lon, f4Set1(DEG)), sinLon, cosLon);
+    // 卯酉圈曲率半径 N = 1 / sqrt(1 - e² sin²φ)
+    F4 one = f4Set1(1.0f);
+    F4 n = f4Div(one, f4Sqrt(f4Sub(one, f4Mul(f4Set1(shape.e2), f4Mul(sinLat, sinLat)))));
+    F4 horizontal = f4Mul(f4Add(n, h), cosLat);
+    x = f4Sub(f4Set1(0.0f), f4Mul(horizontal, cosLon)); // 经度 θ = λ + 180°：cos θ = -cos λ
+    z = f4Sub(f4Set1(0.0f), f4Mul(horizontal, sinLon));
+    y = f4Mul(f4Add(f4Mul(n, f4Set1(1.0f - shape.e2)), h), sinLat);
 }
 
-// 计算阴影椭圆的拉伸参数
-void calculateShadowEllipse(float lightX, float lightY, float lightZ,
-                           float& stretchX, float& stretchZ, float& rotation) {
-    // 计算光源方向向量在地面上的投影
-    float lightLen = sqrt(lightX*lightX + lightY*lightY + lightZ*lightZ);
-    
-    if (lightLen < 0.0001f) {
-        stretchX = 1.0f;
-        stretchZ = 1.0f;
-        rotation = 0.0f;
-        return;
+// 大地坐标（纬度、经度，度；椭球面以上的高度，单位为赤道半径，可为 NULL）-> 地球物体空间。
+// GEO_SPHERE 且高度为0时与 geoToSphere 相同
+void batchGeodeticToGlobe(const float* lat, const float* lon, const float* height, size_t count, GeoShape shape,
+                          float* x, float* y, float* z) {
+    GeoShapeParams params(shape);
+    F4 zero = f4Set1(0.0f), px, py, pz;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        geodeticToGlobe4(f4Load(lat + i), f4Load(lon + i), height ? f4Load(height + i) : zero, params, px, py, pz);
+        f4Store(x + i, px);
+        f4Store(y + i, py);
+        f4Store(z + i, pz);
+    }
+    if (i < count) {
+        size_t n = count - i;
+        F4Tail a, b, h, ox, oy, oz;
+        a.load(lat + i, n, 0.0f);
+        b.load(lon + i, n, 0.0f);
+        h.load(height ? height + i : a.v, height ? n : 0, 0.0f);
+        geodeticToGlobe4(f4Load(a.v), f4Load(b.v), f4Load(h.v), params, px, py, pz);
+        f4Store(ox.v, px);
+        f4Store(oy.v, py);
+        f4Store(oz.v, pz);
+        ox.store(x + i, n);
+        oy.store(y + i, n);
+        oz.store(z + i, n);
+    }
+}
+
+// Bowring 单步法：先由参数纬度 u 的 sin/cos（不需要三角函数，直接由 tan u = y / (p·b) 得到）
+// 修正大地纬度，对近地面的点精度远高于单精度
+inline void globeToGeodetic4(F4 x, F4 y, F4 z, const GeoShapeParams& shape, F4& lat, F4& lon, F4& h) {
+    const float RAD = 180.0f / PI;
+    F4 zero = f4Set1(0.0f), one = f4Set1(1.0f);
+    F4 p = f4Sqrt(f4Add(f4Mul(x, x), f4Mul(z, z)));
+    F4 pb = f4Mul(p, f4Set1(shape.polar));
+    F4 inverse = f4Div(one, f4Max(f4Sqrt(f4Add(f4Mul(y, y), f4Mul(pb, pb))), f4Set1(1e-30f)));
+    F4 sinU = f4Mul(y, inverse), cosU = f4Mul(pb, inverse);
+    F4 numerator = f4Add(y, f4Mul(f4Set1(shape.ep2 * shape.polar), f4Mul(sinU, f4Mul(sinU, sinU))));
+    F4 denominator = f4Sub(p, f4Mul(f4Set1(shape.e2), f4Mul(cosU, f4Mul(cosU, cosU))));
+    lat = f4Mul(f4Atan2(numerator, denominator), f4Set1(RAD));
+    lon = f4Mul(f4Atan2(f4Sub(zero, z), f4Sub(zero, x)), f4Set1(RAD));
+    // h = p cos φ + y sin φ - sqrt(1 - e² sin²φ)
+    F4 length = f4Max(f4Sqrt(f4Add(f4Mul(numerator, numerator), f4Mul(denominator, denominator))), f4Set1(1e-30f));
+    F4 sinLat = f4Div(numerator, length), cosLat = f4Div(denominator, length);
+    F4 radius = f4Sqrt(f4Sub(one, f4Mul(f4Set1(shape.e2), f4Mul(sinLat, sinLat))));
+    h = f4Sub(f4Add(f4Mul(p, cosLat), f4Mul(y, sinLat)), radius);
+}
+
+// 地球物体空间 -> 大地坐标（纬度、经度，度；高度可为 NULL）
+void batchGlobeToGeodetic(const float* x, const float* y, const float* z, size_t count, GeoShape shape,
+                          float* lat, float* lon, float* height) {
+    GeoShapeParams params(shape);
+    F4 a, b, h;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        globeToGeodetic4(f4Load(x + i), f4Load(y + i), f4Load(z + i), params, a, b, h);
+        f4Store(lat + i, a);
+        f4Store(lon + i, b);
+        if (height) f4Store(height + i, h);
+    }
+    if (i < count) {
+        size_t n = count - i;
+        F4Tail px, py, pz, oa, ob, oh;
+        px.load(x + i, n, 1.0f);
+        py.load(y + i, n, 0.0f);
+        pz.load(z + i, n, 0.0f);
+        globeToGeodetic4(f4Load(px.v), f4Load(py.v), f4Load(pz.v), params, a, b, h);
+        f4Store(oa.v, a);
+        f4Store(ob.v, b);
+        f4Store(oh.v, h);
+        oa.store(lat + i, n);
+        ob.store(lon + i, n);
+        if (height) oh.store(height + i, n);
+    }
+}
+
+inline void globeToScreen4(const float m[16], F4 x, F4 y, F4 z, float width, float height, F4& sx, F4& sy, F4& depth,
+                           int& visible) {
+    F4 cx = f4Add(f4Add(f4Mul(f4Set1(m[0]), x), f4Mul(f4Set1(m[4]), y)), f4Add(f4Mul(f4Set1(m[8]), z), f4Set1(m[12])));
+    F4 cy = f4Add(f4Add(f4Mul(f4Set1(m[1]), x), f4Mul(f4Set1(m[5]), y)), f4Add(f4Mul(f4Set1(m[9]), z), f4Set1(m[13])));
+    F4 cz = f4Add(f4Add(f4Mul(f4Set1(m[2]), x), f4Mul(f4Set1(m[6]), y)), f4Add(f4Mul(f4Set1(m[10]), z), f4Set1(m[14])));
+    F4 cw = f4Add(f4Add(f4Mul(f4Set1(m[3]), x), f4Mul(f4Set1(m[7]), y)), f4Add(f4Mul(f4Set1(m[11]), z), f4Set1(m[15])));
+    F4 zero = f4Set1(0.0f), half = f4Set1(0.5f);
+    // 裁剪空间内：w > 0 且 -w <= x, y, z <= w
+    F4 negW = f4Sub(zero, cw);
+    F4 inside = f4And(f4CmpGT(cw, zero), f4And(f4And(f4CmpGE(cx, negW), f4CmpGE(cw, cx)),
+                                                 f4And(f4And(f4CmpGE(cy, negW), f4CmpGE(cw, cy)),
+                                                       f4And(f4CmpGE(cz, negW), f4CmpGE(cw, cz)))));
+    visible = f4Mask(inside);
+    F4 inverse = f4Select(f4CmpGT(cw, zero), f4Div(f4Set1(1.0f), f4Max(cw, f4Set1(1e-30f))), zero);
+    sx = f4Mul(f4Add(f4Mul(f4Mul(cx, inverse), half), half), f4Set1(width));
+    sy = f4Mul(f4Add(f4Mul(f4Mul(cy, inverse), half), half), f4Set1(height));
+    depth = f4Add(f4Mul(f4Mul(cz, inverse), half), half);
+}
+
+// 地球物体空间 -> 窗口坐标（与 gluProject 相同：原点在左下角，深度在 [0, 1]）。
+// matrix 为列主序的 投影 * 模型视图 矩阵；visible 可为 NULL，相机后方的点坐标输出为0
+void batchGlobeToScreen(const float matrix[16], const float* x, const float* y, const float* z, size_t count,
+                        int width, int height, float* sx, float* sy, float* depth, unsigned char* visible) {
+    F4 a, b, d;
+    int mask;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        globeToScreen4(matrix, f4Load(x + i), f4Load(y + i), f4Load(z + i), (float)width, (float)height, a, b, d, mask);
+        f4Store(sx + i, a);
+        f4Store(sy + i, b);
+        if (depth) f4Store(depth + i, d);
+        if (visible) {
+            for (int k = 0; k < 4; ++k) visible[i + k] = (unsigned char)((mask >> k) & 1);
+        }
+    }
+    if (i < count) {
+        size_t n = count - i;
+        F4Tail px, py, pz, oa, ob, od;
+        px.load(x + i, n, 0.0f);
+        py.load(y + i, n, 0.0f);
+        pz.load(z + i, n, 0.0f);
+        globeToScreen4(matrix, f4Load(px.v), f4Load(py.v), f4Load(pz.v), (float)width, (float)height, a, b, d, mask);
+        f4Store(oa.v, a);
+        f4Store(ob.v, b);
+        f4Store(od.v, d);
+        oa.store(sx + i, n);
+        ob.store(sy + i, n);
+        if (depth) od.store(depth + i, n);
+        if (visible) {
+            for (size_t k = 0; k < n; ++k) visible[i + k] = (unsigned char)((mask >> k) & 1);
+        }
     }
-    
-    // 归一化光源向量
-    float lx = lightX / lightLen;
-    float ly = lightY / lightLen;
-    float lz = lightZ / lightLen;
-    
-    // 计算光源在地面上的投影方向
-    float groundLX = lx;
-    float groundLZ = lz;
-    
-    // 拉伸参数：在光源方向上拉伸
-    float dotX = fabs(groundLX);
-    float dotZ = fabs(groundLZ);
-    
-    // 拉伸程度取决于光源方向
-    stretchX = 1.0f + dotX * 0.8f;
-    stretchZ = 1.0f + dotZ * 0.8f;
-    
-    // 旋转角度（弧度）
-    rotation = atan2(groundLZ, groundLX);
 }
 
 // ========================
-// 绘制自然阴影
+// 矩阵与四元数
 // ========================
+// 投影、相机和地球矩阵每帧在CPU上算一次（SceneMatrices），输入没变的部分沿用上一帧的结果。
+// GL后端用 glLoadMatrixf 直接载入，软件渲染、拾取、标记点剔除和文字标注都使用同一组矩阵，
+// 不再各自用 gluPerspective/gluLookAt/glRotatef 重建或用 glGetFloatv 从驱动读回
 
-void drawNaturalShadow() {
-    if (!shadowEnabled || !lightEnabled) return;
-    
-    // 获取光源位置
-    LightPosition light = lightPositions[currentLightPosition];
-    
-    // 计算阴影位置和大小
-    float shadowX, shadowZ, shadowSize;
-    calculatePointShadow(light.x, light.y, light.z, 0, 0, 0, shadowX, shadowZ, shadowSize);
-    
-    // 计算阴影椭圆参数
-    float stretchX, stretchZ, rotation;
-    calculateShadowEllipse(light.x, light.y, light.z, stretchX, stretchZ, rotation);
-    
-    // 如果阴影太小，不绘制
-    if (shadowSize < 0.1f) return;
-    
-    // 保存当前矩阵状态
-    glPushMatrix();
-    
-    // 移动到阴影位置
-    glLoadIdentity();
-    gluLookAt(0, 0, 5, 0, 0, 0, 0, 1, 0);
+// 4x4 矩阵，列主序，与 OpenGL 一致；每一列可以直接作为一个 F4 读写
+struct Mat4 {
+    float m[16];
+};
+
+// 单位四元数表示旋转，w 为实部
+struct Quat {
+    float x, y, z, w;
+};
+
+Mat4 mat4Identity() {
+    Mat4 r;
+    for (int i = 0; i < 16; ++i) r.m[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+    return r;
+}
+
+// r 的第 j 列 = a 的各列按 b 第 j 列的分量加权求和，每列一次 SIMD 运算
+Mat4 mat4Multiply(const Mat4& a, const Mat4& b) {
+    F4 c0 = f4Load(a.m), c1 = f4Load(a.m + 4), c2 = f4Load(a.m + 8), c3 = f4Load(a.m + 12);
+    Mat4 r;
+    for (int col = 0; col < 4; ++col) {
+        const float* e = b.m + col * 4;
+        F4 sum = f4Mul(c0, f4Set1(e[0]));
+        sum = f4Add(sum, f4Mul(c1, f4Set1(e[1])));
+        sum = f4Add(sum, f4Mul(c2, f4Set1(e[2])));
+        sum = f4Add(sum, f4Mul(c3, f4Set1(e[3])));
+        f4Store(r.m + col * 4, sum);
+    }
+    return r;
+}
+
+void mat4Transform(const Mat4& a, const float in[4], float out[4]) {
+    F4 sum = f4Mul(f4Load(a.m), f4Set1(in[0]));
+    sum = f4Add(sum, f4Mul(f4Load(a.m + 4), f4Set1(in[1])));
+    sum = f4Add(sum, f4Mul(f4Load(a.m + 8), f4Set1(in[2])));
+    sum = f4Add(sum, f4Mul(f4Load(a.m + 12), f4Set1(in[3])));
+    f4Store(out, sum);
+}
+
+// 仿射矩阵（最后一行为 0 0 0 1）的逆：3x3 部分用伴随矩阵求逆，平移取反后变换
+Mat4 mat4InverseAffine(const Mat4& a) {
+    const float* m = a.m;
+    float c00 = m[5] * m[10] - m[9] * m[6], c01 = m[9] * m[2] - m[1] * m[10], c02 = m[1] * m[6] - m[5] * m[2];
+    float c10 = m[8] * m[6] - m[4] * m[10], c11 = m[0] * m[10] - m[8] * m[2], c12 = m[4] * m[2] - m[0] * m[6];
+    float c20 = m[4] * m[9] - m[8] * m[5], c21 = m[8] * m[1] - m[0] * m[9], c22 = m[0] * m[5] - m[4] * m[1];
+    float det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+    float inv = det != 0.0f ? 1.0f / det : 0.0f;
+    Mat4 r = mat4Identity();
+    r.m[0] = c00 * inv; r.m[4] = c10 * inv; r.m[8] = c20 * inv;
+    r.m[1] = c01 * inv; r.m[5] = c11 * inv; r.m[9] = c21 * inv;
+    r.m[2] = c02 * inv; r.m[6] = c12 * inv; r.m[10] = c22 * inv;
+    for (int row = 0; row < 3; ++row) {
+        r.m[12 + row] = -(r.m[row] * m[12] + r.m[4 + row] * m[13] + r.m[8 + row] * m[14]);
+    }
+    return r;
+}
+
+// 与 gluPerspective 相同
+Mat4 mat4Perspective(float fovy, float aspect, float zNear, float zFar) {
+    Mat4 r;
+    memset(r.m, 0, sizeof(r.m));
+    float f = 1.0f / tan(fovy * (float)M_PI / 360.0f);
+    r.m[0] = f / aspect;
+    r.m[5] = f;
+    r.m[10] = (zFar + zNear) / (zNear - zFar);
+    r.m[11] = -1.0f;
+    r.m[14] = 2.0f * zFar * zNear / (zNear - zFar);
+    return r;
+}
+
+// 与 gluLookAt 相同
+Mat4 mat4LookAt(float eyeX, float eyeY, float eyeZ, float centerX, float centerY, float centerZ,
+                float upX, float upY, float upZ) {
+    float f[3] = {centerX - eyeX, centerY - eyeY, centerZ - eyeZ};
+    float fl = sqrt(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+    for (int i = 0; i < 3; ++i) f[i] /= fl;
     
-    // 应用阴影的变换
-    glTranslatef(shadowX, floorY + 0.002f, shadowZ);
-    glRotatef(rotation * 180.0f / M_PI, 0.0f, 1.0f, 0.0f);
-    glScalef(shadowSize * stretchX, 1.0f, shadowSize * stretchZ);
+    float sx = f[1]*upZ - f[2]*upY;
+    float sy = f[2]*upX - f[0]*upZ;
+    float sz = f[0]*upY - f[1]*upX;
+    float sl = sqrt(sx*sx + sy*sy + sz*sz);
+    sx /= sl; sy /= sl; sz /= sl;
     
-    // 禁用光照，启用混合和阴影纹理
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    float ux = sy*f[2] - sz*f[1];
+    float uy = sz*f[0] - sx*f[2];
+    float uz = sx*f[1] - sy*f[0];
     
-    // 使用阴影纹理
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, shadowTextureID);
+    Mat4 r = mat4Identity();
+    r.m[0] = sx;    r.m[4] = sy;    r.m[8] = sz;
+    r.m[1] = ux;    r.m[5] = uy;    r.m[9] = uz;
+    r.m[2] = -f[0]; r.m[6] = -f[1]; r.m[10] = -f[2];
+    r.m[12] = -(sx*eyeX + sy*eyeY + sz*eyeZ);
+    r.m[13] = -(ux*eyeX + uy*eyeY + uz*eyeZ);
+    r.m[14] = f[0]*eyeX + f[1]*eyeY + f[2]*eyeZ;
+    return r;
+}
+
+Mat4 mat4Translate(float x, float y, float z) {
+    Mat4 r = mat4Identity();
+    r.m[12] = x; r.m[13] = y; r.m[14] = z;
+    return r;
+}
+
+Mat4 mat4Scale(float x, float y, float z) {
+    Mat4 r = mat4Identity();
+    r.m[0] = x; r.m[5] = y; r.m[10] = z;
+    return r;
+}
+
+// 与 glRotatef 相同（角度制，绕任意轴）
+Quat quatAxisAngle(float degrees, float x, float y, float z) {
+    float len = sqrt(x*x + y*y + z*z);
+    float half = degrees * (float)M_PI / 360.0f;
+    float s = sin(half) / len;
+    Quat q = {x * s, y * s, z * s, cos(half)};
+    return q;
+}
+
+// a * b：先做 b 的旋转，再做 a 的旋转（与矩阵乘法的顺序一致）
+Quat quatMultiply(const Quat& a, const Quat& b) {
+    Quat r = {a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+              a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+              a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+              a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+    return r;
+}
+
+Mat4 mat4FromQuat(const Quat& q) {
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    Mat4 r = mat4Identity();
+    r.m[0] = 1.0f - 2.0f * (yy + zz); r.m[4] = 2.0f * (xy - wz);        r.m[8] = 2.0f * (xz + wy);
+    r.m[1] = 2.0f * (xy + wz);        r.m[5] = 1.0f - 2.0f * (xx + zz); r.m[9] = 2.0f * (yz - wx);
+    r.m[2] = 2.0f * (xz - wy);        r.m[6] = 2.0f * (yz + wx);        r.m[10] = 1.0f - 2.0f * (xx + yy);
+    return r;
+}
+
+Mat4 mat4Rotate(float degrees, float x, float y, float z) {
+    return mat4FromQuat(quatAxisAngle(degrees, x, y, z));
+}
+
+// 一帧用到的全部矩阵。update() 比较输入，只重算变化了的部分：
+// 窗口尺寸决定投影，相机位置决定视图，缩放和两个旋转角决定地球的模型矩阵
+struct SceneMatrices {
+    Mat4 projection;        // 45° 视角，近平面 0.1，远平面 100
+    Mat4 view;              // 相机看向原点，Y轴向上
+    Quat orientation;       // 地球朝向：先绕Y轴转 rotationY，再绕X轴转 rotationX
+    Mat4 model;             // 缩放 * 朝向
+    Mat4 globe;             // view * model，地球的模型视图矩阵
+    Mat4 globeInverse;      // 眼空间 -> 地球物体空间
+    Mat4 globeMvp;          // projection * globe
+    Mat4 contactModel;      // 只有缩放：接触阴影贴在地球底部的地面上，随缩放变大但不随地球转动
+    Mat4 contact;           // view * contactModel，接触阴影的模型视图矩阵
+    float cameraObject[3];  // 物体空间中的相机位置
+    unsigned int version;   // 任一矩阵变化时递增，依赖矩阵的缓存可据此判断是否失效
     
-    // 设置纹理环境为调制
-    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    SceneMatrices() : version(0), width(0), height(0), zoom(0.0f), rotationX(0.0f), rotationY(0.0f), valid(false) {
+        camera[0] = camera[1] = camera[2] = 0.0f;
+    }
     
-    // 使用黑色半透明颜色
-    glColor4f(0.0f, 0.0f, 0.0f, shadowIntensity);
+    void update(int w, int h, float cx, float cy, float cz, float z, float rx, float ry) {
+        bool projectionDirty = !valid || w != width || h != height;
+        bool viewDirty = !valid || cx != camera[0] || cy != camera[1] || cz != camera[2];
+        bool modelDirty = !valid || z != zoom || rx != rotationX || ry != rotationY;
+        if (!projectionDirty && !viewDirty && !modelDirty) return;
+        valid = true;
+        if (projectionDirty) {
+            width = w;
+            height = h;
+            projection = mat4Perspective(45.0f, h > 0 ? (float)w / h : 1.0f, 0.1f, 100.0f);
+        }
+        if (viewDirty) {
+            camera[0] = cx;
+            camera[1] = cy;
+            camera[2] = cz;
+            view = mat4LookAt(cx, cy, cz, 0, 0, 0, 0, 1, 0);
+        }
+        if (modelDirty) {
+            zoom = z;
+            rotationX = rx;
+            rotationY = ry;
+            orientation = quatMultiply(quatAxisAngle(rx, 1.0f, 0.0f, 0.0f), quatAxisAngle(ry, 0.0f, 1.0f, 0.0f));
+            contactModel = mat4Scale(z, z, z);
+            model = mat4Multiply(contactModel, mat4FromQuat(orientation));
+        }
+        if (viewDirty || modelDirty) {
+            globe = mat4Multiply(view, model);
+            globeInverse = mat4InverseAffine(globe);
+            contact = mat4Multiply(view, contactModel);
+            for (int i = 0; i < 3; ++i) cameraObject[i] = globeInverse.m[12 + i];
+        }
+        globeMvp = mat4Multiply(projection, globe);
+        ++version;
+    }
     
-    // 禁用深度写入，防止阴影遮挡地面
-    glDepthMask(GL_FALSE);
+    // 地球矩阵再整体放大 s 倍，贴在地表之上的叠加层（数据场、热力图、云层）用它代替 glScalef
+    Mat4 shell(float s) const {
+        return mat4Multiply(globe, mat4Scale(s, s, s));
+    }
     
-    // 绘制阴影四边形（使用纹理）
+private:
+    int width, height;
+    float camera[3];
+    float zoom, rotationX, rotationY;
+    bool valid;
+};
+
+SceneMatrices frameMatrices; // 渲染方每帧开始时更新（窗口CPU渲染模式下在渲染线程）
+
+void updateFrameMatrices() {
+    frameMatrices.update(WIDTH, HEIGHT, cameraX, cameraY, cameraZ, zoom, rotationX, rotationY);
+}
+
+// ========================
+// 着色器工具
+// ========================
+
+bool hasGLExtension(const char* name) {
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    return extensions && strstr(extensions, name) != NULL;
+}
+
+// 当前上下文是否支持栅栏同步（GL 3.2 或 ARB_sync），用于判断异步读回是否完成
+bool hasGLSync() {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    int major = 0, minor = 0;
+    if (version) sscanf(version, "%d.%d", &major, &minor);
+    return major > 3 || (major == 3 && minor >= 2) || hasGLExtension("GL_ARB_sync") || hasGLExtension("GL_APPLE_sync");
+}
+
+GLuint compileShader(GLenum type, const char* source, const char* name) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[2048];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        cerr << "错误: 着色器 " << name << " 编译失败:" << endl << log << endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// 编译并链接着色器程序，失败时返回0
+GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource, const char* name) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource, name);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource, name);
+    if (!vs || !fs) {
+        if (vs) glDeleteShader(vs);
+        if (fs) glDeleteShader(fs);
+        return 0;
+    }
+    
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[2048];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        cerr << "错误: 着色器程序 " << name << " 链接失败:" << endl << log << endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// ========================
+// 球体替身（Impostor）绘制
+// ========================
+// 每个球只画一个朝向相机的四边形，片元着色器中做光线-球体求交并写入正确深度，
+// 任何缩放下轮廓都精确到像素，顶点数固定为4，适合大量小地球或行星标记。
+// 光照使用 GL_LIGHT0 与当前材质（逐像素计算），纹理参数化与 generateSphere 一致
+
+const char* impostorVertexShader =
+    "#version 120\n"
+    "varying vec3 eyePos;\n"
+    "varying vec3 centerEye;\n"
+    "varying float radiusEye;\n"
+    "void main() {\n"
+    "    vec4 sphere = gl_MultiTexCoord1;\n" // xyz 球心（物体空间），w 半径
+    "    float scale = length(gl_ModelViewMatrix[0].xyz);\n"
+    "    centerEye = (gl_ModelViewMatrix * vec4(sphere.xyz, 1.0)).xyz;\n"
+    "    radiusEye = sphere.w * scale;\n"
+    // 四边形垂直于视线、过球心，半边长取切锥在该平面上的截面半径，保证覆盖整个轮廓
+    "    float dist = length(centerEye);\n"
+    "    vec3 axis = centerEye / dist;\n"
+    "    vec3 up = abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);\n"
+    "    vec3 right = normalize(cross(axis, up));\n"
+    "    up = cross(right, axis);\n"
+    "    float halfSize = radiusEye * dist / sqrt(max(dist * dist - radiusEye * radiusEye, 1e-6));\n"
+    "    eyePos = centerEye + (right * gl_Vertex.x + up * gl_Vertex.y) * halfSize;\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = gl_ProjectionMatrix * vec4(eyePos, 1.0);\n"
+    "}\n";
+
+const char* impostorFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D earth;\n"
+    "uniform bool lighting;\n"
+    "varying vec3 eyePos;\n"
+    "varying vec3 centerEye;\n"
+    "varying float radiusEye;\n"
+    "const float PI = 3.14159265359;\n"
+    "void main() {\n"
+    "    vec3 dir = normalize(eyePos);\n"
+    "    float b = dot(dir, centerEye);\n"
+    "    float disc = b * b - dot(centerEye, centerEye) + radiusEye * radiusEye;\n"
+    "    if (disc < 0.0) discard;\n"
+    "    vec3 hit = dir * (b - sqrt(disc));\n"
+    "    vec3 n = (hit - centerEye) / radiusEye;\n"
+    // 法线矩阵的转置把视空间方向变回物体空间，换算经纬度纹理坐标
+    "    vec3 o = normalize(transpose(gl_NormalMatrix) * n);\n"
+    "    float u = atan(o.z, o.x) / (2.0 * PI);\n"
+    "    if (u < 0.0) u += 1.0;\n"
+    "    float v = acos(clamp(o.y, -1.0, 1.0)) / PI;\n"
+    "    vec4 color = gl_Color;\n"
+    "    if (lighting) {\n"
+    // 与网格路径一致：未开启 GL_NORMALIZE 时法线长度随缩放变化
+    "        vec3 ln = n * length(gl_NormalMatrix[0]);\n"
+    "        vec3 L = normalize(gl_LightSource[0].position.xyz - hit);\n"
+    "        float nDotL = dot(ln, L);\n"
+    "        color = gl_FrontLightModelProduct.sceneColor + gl_FrontLightProduct[0].ambient\n"
+    "              + gl_FrontLightProduct[0].diffuse * max(nDotL, 0.0);\n"
+    "        if (nDotL > 0.0) {\n"
+    "            vec3 H = normalize(L + vec3(0.0, 0.0, 1.0));\n"
+    "            color += gl_FrontLightProduct[0].specular * pow(max(dot(ln, H), 0.0), gl_FrontMaterial.shininess);\n"
+    "        }\n"
+    "        color = vec4(clamp(color.rgb, 0.0, 1.0), gl_FrontMaterial.diffuse.a);\n"
+    "    }\n"
+    "    gl_FragColor = color * texture2D(earth, vec2(u, v));\n"
+    "    vec4 clip = gl_ProjectionMatrix * vec4(hit, 1.0);\n"
+    "    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;\n"
+    "}\n";
+
+GLuint impostorProgram = 0;
+bool impostorUnavailable = false;
+
+bool ensureImpostorProgram() {
+    if (impostorProgram == 0 && !impostorUnavailable) {
+        impostorProgram = createShaderProgram(impostorVertexShader, impostorFragmentShader, "impostor");
+        if (impostorProgram == 0) {
+            cerr << "警告: 替身着色器不可用，改用网格绘制地球" << endl;
+            impostorUnavailable = true;
+        }
+    }
+    return impostorProgram != 0;
+}
+
+// 为每个球发出一个四边形（球心和半径经纹理坐标1传给顶点着色器），着色程序由调用方设置
+void drawImpostorQuads(const float* spheres, int count) {
+    ++frameDrawCalls;
     glBegin(GL_QUADS);
-    glTexCoord2f(0.0f, 0.0f); glVertex3f(-1.0f, 0.0f, -1.0f);
-    glTexCoord2f(1.0f, 0.0f); glVertex3f(1.0f, 0.0f, -1.0f);
-    glTexCoord2f(1.0f, 1.0f); glVertex3f(1.0f, 0.0f, 1.0f);
-    glTexCoord2f(0.0f, 1.0f); glVertex3f(-1.0f, 0.0f, 1.0f);
+    for (int i = 0; i < count; ++i) {
+        const float* sphere = spheres + i * 4;
+        glMultiTexCoord4f(GL_TEXTURE1, sphere[0], sphere[1], sphere[2], sphere[3]);
+        glVertex2f(-1.0f, -1.0f);
+        glVertex2f(1.0f, -1.0f);
+        glVertex2f(1.0f, 1.0f);
+        glVertex2f(-1.0f, 1.0f);
+    }
     glEnd();
+}
+
+// 批量绘制球体替身，spheres 为 count 组 (x, y, z, radius)（当前模型视图矩阵下的物体空间）
+void drawSphereImpostors(const float* spheres, int count) {
+    if (!ensureImpostorProgram()) return;
     
-    // 恢复状态
-    glDepthMask(GL_TRUE);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
+    glUseProgram(impostorProgram);
+    glUniform1i(glGetUniformLocation(impostorProgram, "earth"), 0);
+    glUniform1i(glGetUniformLocation(impostorProgram, "lighting"), glIsEnabled(GL_LIGHTING) ? 1 : 0);
     
-    glPopMatrix();
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    drawImpostorQuads(spheres, count);
+    glDisable(GL_TEXTURE_2D);
+    glUseProgram(0);
+}
+
+// 以替身方式绘制地球（替代 drawCustomSphere）
+void drawGlobeImpostor(float radius) {
+    const float sphere[4] = {0.0f, 0.0f, 0.0f, radius};
+    drawSphereImpostors(sphere, 1);
 }
 
 // ========================
-// 绘制环境光遮蔽（AO）效果
+// 多光源分簇着色
 // ========================
+// 在 GL_LIGHT0 之外支持成百上千个点光源（城市灯光、事件信标）。每帧在CPU上把光源
+// 按视空间包围盒分配到屏幕分块 x 指数深度切片构成的簇中，结果存入浮点纹理；
+// 地面和地球再以叠加混合绘制一遍，片元只遍历自己所在簇内的光源，
+// 因此单个像素的着色开销只取决于局部光源密度，不随光源总数线性增长
 
-void drawAmbientOcclusion() {
-    if (!shadowEnabled) return;
+#ifndef GL_RGBA32F_ARB
+#define GL_RGBA32F_ARB 0x8814
+#endif
+#ifndef GL_LUMINANCE32F_ARB
+#define GL_LUMINANCE32F_ARB 0x8818
+#endif
+#ifndef GL_LUMINANCE_ALPHA32F_ARB
+#define GL_LUMINANCE_ALPHA32F_ARB 0x8819
+#endif
+
+struct PointLight {
+    float x, y, z;        // 城市灯光在地球物体空间，信标在世界空间
+    float radius;         // 影响半径，超出后贡献为0
+    float r, g, b;
+    bool onGlobe;         // 是否随地球旋转
+};
+
+const int CLUSTER_TILE_PIXELS = 32;
+const int CLUSTER_SLICES = 16;
+const int MAX_LIGHTS_PER_CLUSTER = 128;  // 着色器循环上限，超出的光源被截断
+const int CLUSTER_TEX_WIDTH = 1024;      // 所有数据纹理按行宽1024线性排布
+
+struct ClusterGrid {
+    int tilesX, tilesY;
+    vector<float> lightData;     // 每个光源两个RGBA：视空间位置+半径，颜色
+    vector<float> cells;         // 每个簇 (偏移, 数量)
+    vector<float> indices;       // 各簇的光源序号列表
+    int maxPerCluster;
+    double binMs;
+    GLuint lightTexture, cellTexture, indexTexture;
+    int lightRows, cellRows, indexRows;   // 各纹理已分配的行数
+};
+
+vector<PointLight> pointLights;
+int pointLightCount = 0;          // 当前点光源数量（0 表示关闭分簇光照）
+ClusterGrid clusterGrid = {0, 0, vector<float>(), vector<float>(), vector<float>(), 0, 0.0, 0, 0, 0, 0, 0, 0};
+GLuint clusteredProgram = 0;
+GLuint allLightsProgram = 0;      // 逐片元遍历全部光源，仅用于对比测试
+GLuint clusteredImpostorProgram = 0; // 以上两者的替身变体，地球以替身绘制时使用
+GLuint allLightsImpostorProgram = 0;
+bool clusteredUnavailable = false;
+bool clusteredForceAllLights = false;
+
+// 固定种子生成光源，同一数量下每次结果相同：约八成是地球表面的城市灯光，其余是地面上的信标
+void setPointLightCount(int count) {
+    pointLightCount = count;
+    pointLights.clear();
+    unsigned int seed = 12345u;
+    for (int i = 0; i < count; ++i) {
+        PointLight light;
+        if (i % 5 != 4) {
+            // 球面均匀分布：纬度按 asin 采样
+            float lon = randomUnit(seed) * 2.0f * PI;
+            float lat = asin(randomUnit(seed) * 2.0f - 1.0f);
+            float r = 1.03f;
+            light.x = r * cos(lat) * cos(lon);
+            light.y = r * sin(lat);
+            light.z = r * cos(lat) * sin(lon);
+            light.radius = 0.15f + 0.15f * randomUnit(seed);
+            light.r = 1.0f;
+            light.g = 0.75f + 0.15f * randomUnit(seed);
+            light.b = 0.4f + 0.2f * randomUnit(seed);
+            light.onGlobe = true;
+        } else {
+            light.x = (randomUnit(seed) * 2.0f - 1.0f) * floorSize;
+            light.y = floorY + 0.1f;
+            light.z = (randomUnit(seed) * 2.0f - 1.0f) * floorSize;
+            light.radius = 0.5f + 0.5f * randomUnit(seed);
+            float hue = randomUnit(seed);
+            light.r = 0.5f + 0.5f * cos(2.0f * PI * hue);
+            light.g = 0.5f + 0.5f * cos(2.0f * PI * (hue - 1.0f / 3.0f));
+            light.b = 0.5f + 0.5f * cos(2.0f * PI * (hue - 2.0f / 3.0f));
+            light.onGlobe = false;
+        }
+        pointLights.push_back(light);
+    }
+}
+
+// 列主序 4x4 矩阵变换一个点
+void transformPoint(const float m[16], const float in[3], float out[3]) {
+    for (int i = 0; i < 3; ++i) {
+        out[i] = m[i] * in[0] + m[4 + i] * in[1] + m[8 + i] * in[2] + m[12 + i];
+    }
+}
+
+// 把光源分配到簇中。view / globe 为地面与地球的模型视图矩阵，投影参数与 renderScene 一致
+void buildLightClusters(ClusterGrid& grid, const float view[16], const float globe[16],
+                        int width, int height, float fovy, float zNear, float zFar) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    grid.tilesX = (width + CLUSTER_TILE_PIXELS - 1) / CLUSTER_TILE_PIXELS;
+    grid.tilesY = (height + CLUSTER_TILE_PIXELS - 1) / CLUSTER_TILE_PIXELS;
+    int clusterCount = grid.tilesX * grid.tilesY * CLUSTER_SLICES;
     
-    // 保存当前矩阵状态
-    glPushMatrix();
+    float tanHalf = tan(fovy * 0.5f * PI / 180.0f);
+    float aspect = (float)width / height;
+    float logRange = log(zFar / zNear);
     
-    // 应用地球的变换
-    glScalef(zoom, zoom, zoom);
-    glRotatef(rotationX, 1.0f, 0.0f, 0.0f);
-    glRotatef(rotationY, 0.0f, 1.0f, 0.0f);
+    // 每个光源覆盖的簇范围：x0,x1,y0,y1,z0,z1
+    int lightCount = (int)pointLights.size();
+    vector<int> ranges(lightCount * 6);
+    vector<int> counts(clusterCount, 0);
+    grid.lightData.assign(lightCount * 8, 0.0f);
     
-    // 计算地球底部位置
-    float earthBottomY = -1.0f * zoom; // 地球半径为1
+    for (int i = 0; i < lightCount; ++i) {
+        const PointLight& light = pointLights[i];
+        const float local[3] = {light.x, light.y, light.z};
+        float p[3];
+        // 地球带缩放，半径按模型视图矩阵第一列的长度同比缩放
+        const float* m = light.onGlobe ? globe : view;
+        transformPoint(m, local, p);
+        float radius = light.radius * sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+        
+        float* data = &grid.lightData[i * 8];
+        data[0] = p[0]; data[1] = p[1]; data[2] = p[2]; data[3] = radius;
+        data[4] = light.r; data[5] = light.g; data[6] = light.b; data[7] = 1.0f;
+        
+        int* range = &ranges[i * 6];
+        range[0] = 1; range[1] = 0; // 默认不覆盖任何簇
+        float nearDepth = -p[2] - radius, farDepth = -p[2] + radius;
+        if (farDepth < zNear || nearDepth > zFar) continue;
+        nearDepth = max(nearDepth, zNear);
+        farDepth = min(farDepth, zFar);
+        
+        // 包围盒角点的投影极值给出保守的屏幕范围（x/(-z) 在盒内对每个变量单调）
+        float minX = 1e9f, maxX = -1e9f, minY = 1e9f, maxY = -1e9f;
+        for (int c = 0; c < 4; ++c) {
+            float depth = (c & 1) ? farDepth : nearDepth;
+            float offset = (c & 2) ? radius : -radius;
+            float sx = (p[0] + offset) / (depth * tanHalf * aspect);
+            float sy = (p[1] + offset) / (depth * tanHalf);
+            minX = min(minX, sx); maxX = max(maxX, sx);
+            minY = min(minY, sy); maxY = max(maxY, sy);
+        }
+        if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f) continue;
+        
+        range[0] = max(0, (int)floor((minX * 0.5f + 0.5f) * width / CLUSTER_TILE_PIXELS));
+        range[1] = min(grid.tilesX - 1, (int)floor((maxX * 0.5f + 0.5f) * width / CLUSTER_TILE_PIXELS));
+        range[2] = max(0, (int)floor((minY * 0.5f + 0.5f) * height / CLUSTER_TILE_PIXELS));
+        range[3] = min(grid.tilesY - 1, (int)floor((maxY * 0.5f + 0.5f) * height / CLUSTER_TILE_PIXELS));
+        range[4] = max(0, min(CLUSTER_SLICES - 1, (int)floor(log(nearDepth / zNear) / logRange * CLUSTER_SLICES)));
+        range[5] = max(0, min(CLUSTER_SLICES - 1, (int)floor(log(farDepth / zNear) / logRange * CLUSTER_SLICES)));
+        
+        for (int z = range[4]; z <= range[5]; ++z)
+            for (int y = range[2]; y <= range[3]; ++y)
+                for (int x = range[0]; x <= range[1]; ++x)
+                    ++counts[(z * grid.tilesY + y) * grid.tilesX + x];
+    }
     
-    // 禁用光照，启用混合
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // 前缀和得到每个簇在序号列表中的偏移，再按同样顺序填入光源序号
+    grid.cells.resize(clusterCount * 2);
+    grid.maxPerCluster = 0;
+    int total = 0;
+    for (int c = 0; c < clusterCount; ++c) {
+        int count = min(counts[c], MAX_LIGHTS_PER_CLUSTER);
+        grid.cells[c * 2] = (float)total;
+        grid.cells[c * 2 + 1] = (float)count;
+        grid.maxPerCluster = max(grid.maxPerCluster, counts[c]);
+        total += count;
+        counts[c] = 0;
+    }
+    grid.indices.assign(max(total, 1), 0.0f);
+    for (int i = 0; i < lightCount; ++i) {
+        const int* range = &ranges[i * 6];
+        for (int z = range[4]; z <= range[5] && range[0] <= range[1]; ++z)
+            for (int y = range[2]; y <= range[3]; ++y)
+                for (int x = range[0]; x <= range[1]; ++x) {
+                    int c = (z * grid.tilesY + y) * grid.tilesX + x;
+                    if (counts[c] < grid.cells[c * 2 + 1]) {
+                        grid.indices[(int)grid.cells[c * 2] + counts[c]++] = (float)i;
+                    }
+                }
+    }
+    grid.binMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 把按线性序号排布的数据上传为宽 CLUSTER_TEX_WIDTH 的浮点纹理，返回纹理高度。
+// 存储只在需要更多行时重新分配，否则用 glTexSubImage2D 覆盖用到的行
+int uploadClusterTexture(GLuint& texture, int& allocatedRows, GLenum internalFormat, GLenum format, int components,
+                         vector<float>& data) {
+    int texels = (int)data.size() / components;
+    int rows = max(1, (texels + CLUSTER_TEX_WIDTH - 1) / CLUSTER_TEX_WIDTH);
+    data.resize((size_t)rows * CLUSTER_TEX_WIDTH * components, 0.0f);
+    if (texture == 0) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+    if (rows > allocatedRows) {
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, CLUSTER_TEX_WIDTH, rows, 0, format, GL_FLOAT, data.data());
+        allocatedRows = rows;
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_TEX_WIDTH, rows, format, GL_FLOAT, data.data());
+    }
+    return allocatedRows;
+}
+
+const char* clusteredVertexShader =
+    "#version 120\n"
+    "varying vec3 viewPos;\n"
+    "varying vec3 viewNormal;\n"
+    "void main() {\n"
+    "    viewPos = (gl_ModelViewMatrix * gl_Vertex).xyz;\n"
+    "    viewNormal = gl_NormalMatrix * gl_Normal;\n"
+    "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+// ALL_LIGHTS 为 1 时不查簇，直接遍历全部光源（对比用）
+const char* clusteredFragmentShader =
+    "uniform sampler2D albedo;\n"
+    "uniform bool useTexture;\n"
+    "uniform sampler2D lightData;\n"
+    "uniform sampler2D clusterCells;\n"
+    "uniform sampler2D lightIndices;\n"
+    "uniform vec3 texRows;\n"           // 三张数据纹理的行数
+    "uniform vec3 clusterDims;\n"       // 分块列数、行数、深度切片数
+    "uniform float lightCount;\n"
+    "uniform float tilePixels;\n"
+    "uniform float zNear;\n"
+    "uniform float zLogRange;\n"
+    "#if IMPOSTOR\n"
+    "varying vec3 eyePos;\n"
+    "varying vec3 centerEye;\n"
+    "varying float radiusEye;\n"
+    "#else\n"
+    "varying vec3 viewPos;\n"
+    "varying vec3 viewNormal;\n"
+    "#endif\n"
+    "const float TEX_WIDTH = 1024.0;\n"
+    "const float PI = 3.14159265359;\n"
+    "vec4 fetch(sampler2D tex, float index, float rows) {\n"
+    "    vec2 uv = vec2((mod(index, TEX_WIDTH) + 0.5) / TEX_WIDTH, (floor(index / TEX_WIDTH) + 0.5) / rows);\n"
+    "    return texture2D(tex, uv);\n"
+    "}\n"
+    "vec3 shade(float light, vec3 viewPos, vec3 n) {\n"
+    "    vec4 posRadius = fetch(lightData, light * 2.0, texRows.x);\n"
+    "    vec3 color = fetch(lightData, light * 2.0 + 1.0, texRows.x).rgb;\n"
+    "    vec3 L = posRadius.xyz - viewPos;\n"
+    "    float d = length(L);\n"
+    "    float falloff = clamp(1.0 - d / posRadius.w, 0.0, 1.0);\n"
+    "    return color * (falloff * falloff * max(dot(n, L / max(d, 1e-4)), 0.0));\n"
+    "}\n"
+    "void main() {\n"
+    "#if IMPOSTOR\n"
+    // 与替身着色器相同的求交、纹理坐标和深度，叠加时与已写入的球面深度相等
+    "    vec3 dir = normalize(eyePos);\n"
+    "    float b = dot(dir, centerEye);\n"
+    "    float disc = b * b - dot(centerEye, centerEye) + radiusEye * radiusEye;\n"
+    "    if (disc < 0.0) discard;\n"
+    "    vec3 viewPos = dir * (b - sqrt(disc));\n"
+    "    vec3 n = (viewPos - centerEye) / radiusEye;\n"
+    "    vec3 o = normalize(transpose(gl_NormalMatrix) * n);\n"
+    "    float u = atan(o.z, o.x) / (2.0 * PI);\n"
+    "    if (u < 0.0) u += 1.0;\n"
+    "    vec2 uv = vec2(u, acos(clamp(o.y, -1.0, 1.0)) / PI);\n"
+    "    vec4 clip = gl_ProjectionMatrix * vec4(viewPos, 1.0);\n"
+    "    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;\n"
+    "#else\n"
+    "    vec3 n = normalize(viewNormal);\n"
+    "    vec2 uv = gl_TexCoord[0].st;\n"
+    "#endif\n"
+    "    vec3 base = gl_Color.rgb;\n"
+    "    if (useTexture) base *= texture2D(albedo, uv).rgb;\n"
+    "    vec3 sum = vec3(0.0);\n"
+    "#if ALL_LIGHTS\n"
+    "    for (int i = 0; i < 65536; ++i) {\n"
+    "        if (float(i) >= lightCount) break;\n"
+    "        sum += shade(float(i), viewPos, n);\n"
+    "    }\n"
+    "#else\n"
+    "    vec2 tile = floor(gl_FragCoord.xy / tilePixels);\n"
+    "    float slice = clamp(floor(log(-viewPos.z / zNear) / zLogRange * clusterDims.z), 0.0, clusterDims.z - 1.0);\n"
+    "    float cluster = (slice * clusterDims.y + tile.y) * clusterDims.x + tile.x;\n"
+    "    vec2 cell = fetch(clusterCells, cluster, texRows.y).ra;\n"
+    "    for (int i = 0; i < MAX_LIGHTS; ++i) {\n"
+    "        if (float(i) >= cell.y) break;\n"
+    "        sum += shade(fetch(lightIndices, cell.x + float(i), texRows.z).r, viewPos, n);\n"
+    "    }\n"
+    "#endif\n"
+    "    gl_FragColor = vec4(base * sum, 1.0);\n"
+    "}\n";
+
+bool ensureClusteredPrograms() {
+    if (clusteredProgram == 0 && !clusteredUnavailable) {
+        // 宏在 #version 之后拼接，各变体共用同一份源码
+        string header = "#version 120\n#define MAX_LIGHTS " + to_string(MAX_LIGHTS_PER_CLUSTER) + "\n";
+        string clustered = header + "#define ALL_LIGHTS 0\n#define IMPOSTOR 0\n" + clusteredFragmentShader;
+        string allLights = header + "#define ALL_LIGHTS 1\n#define IMPOSTOR 0\n" + clusteredFragmentShader;
+        string clusteredImpostor = header + "#define ALL_LIGHTS 0\n#define IMPOSTOR 1\n" + clusteredFragmentShader;
+        string allLightsImpostor = header + "#define ALL_LIGHTS 1\n#define IMPOSTOR 1\n" + clusteredFragmentShader;
+        clusteredProgram = createShaderProgram(clusteredVertexShader, clustered.c_str(), "clustered");
+        allLightsProgram = createShaderProgram(clusteredVertexShader, allLights.c_str(), "all-lights");
+        clusteredImpostorProgram = createShaderProgram(impostorVertexShader, clusteredImpostor.c_str(), "clustered-impostor");
+        allLightsImpostorProgram = createShaderProgram(impostorVertexShader, allLightsImpostor.c_str(), "all-lights-impostor");
+        if (clusteredProgram == 0 || allLightsProgram == 0 || clusteredImpostorProgram == 0 || allLightsImpostorProgram == 0) {
+            cerr << "警告: 分簇光照着色器不可用，点光源将被忽略" << endl;
+            clusteredUnavailable = true;
+        }
+    }
+    return !clusteredUnavailable && clusteredProgram != 0;
+}
+
+// 叠加绘制点光源的贡献。调用时模型视图矩阵为相机矩阵，globe 为地球的模型视图矩阵
+void drawClusteredLights(const float view[16], const float globe[16]) {
+    if (pointLights.empty() || !ensureClusteredPrograms()) return;
     
-    // 在地球底部绘制环境光遮蔽（接触阴影）
-    int segments = 32;
-    float contactRadius = 0.2f * zoom;
+    const float fovy = 45.0f, zNear = 0.1f, zFar = 100.0f;
+    buildLightClusters(clusterGrid, view, globe, WIDTH, HEIGHT, fovy, zNear, zFar);
     
-    glBegin(GL_TRIANGLE_FAN);
-    glColor4f(0.0f, 0.0f, 0.0f, 0.3f * shadowIntensity);
-    glVertex3f(0.0f, earthBottomY - 0.001f, 0.0f);
+    glActiveTexture(GL_TEXTURE1);
+    float lightRows = (float)uploadClusterTexture(clusterGrid.lightTexture, clusterGrid.lightRows, GL_RGBA32F_ARB, GL_RGBA, 4, clusterGrid.lightData);
+    glActiveTexture(GL_TEXTURE2);
+    float cellRows = (float)uploadClusterTexture(clusterGrid.cellTexture, clusterGrid.cellRows, GL_LUMINANCE_ALPHA32F_ARB, GL_LUMINANCE_ALPHA, 2, clusterGrid.cells);
+    glActiveTexture(GL_TEXTURE3);
+    float indexRows = (float)uploadClusterTexture(clusterGrid.indexTexture, clusterGrid.indexRows, GL_LUMINANCE32F_ARB, GL_LUMINANCE, 1, clusterGrid.indices);
+    glActiveTexture(GL_TEXTURE0);
     
-    glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
-    for (int i = 0; i <= segments; i++) {
-        float angle = 2.0f * M_PI * i / segments;
-        float x = contactRadius * cos(angle);
-        float z = contactRadius * sin(angle);
-        glVertex3f(x, earthBottomY - 0.001f, z);
+    GLuint program = clusteredForceAllLights ? allLightsProgram : clusteredProgram;
+    GLuint sphereProgram = clusteredForceAllLights ? allLightsImpostorProgram : clusteredImpostorProgram;
+    GLuint programs[2] = {program, sphereProgram};
+    for (int i = 0; i < 2; ++i) {
+        glUseProgram(programs[i]);
+        glUniform1i(glGetUniformLocation(programs[i], "albedo"), 0);
+        glUniform1i(glGetUniformLocation(programs[i], "lightData"), 1);
+        glUniform1i(glGetUniformLocation(programs[i], "clusterCells"), 2);
+        glUniform1i(glGetUniformLocation(programs[i], "lightIndices"), 3);
+        glUniform3f(glGetUniformLocation(programs[i], "texRows"), lightRows, cellRows, indexRows);
+        glUniform3f(glGetUniformLocation(programs[i], "clusterDims"), (float)clusterGrid.tilesX, (float)clusterGrid.tilesY, (float)CLUSTER_SLICES);
+        glUniform1f(glGetUniformLocation(programs[i], "lightCount"), (float)pointLights.size());
+        glUniform1f(glGetUniformLocation(programs[i], "tilePixels"), (float)CLUSTER_TILE_PIXELS);
+        glUniform1f(glGetUniformLocation(programs[i], "zNear"), zNear);
+        glUniform1f(glGetUniformLocation(programs[i], "zLogRange"), log(zFar / zNear));
+        glUniform1i(glGetUniformLocation(programs[i], "useTexture"), 1);
     }
-    glEnd();
+    glUseProgram(program);
     
-    // 恢复状态
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
+    // 与已绘制的表面深度相同处叠加，不写深度
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadMatrixf(view);
+    glUniform1i(glGetUniformLocation(program, "useTexture"), 0);
+    glColor3f(0.5f, 0.5f, 0.5f); // 与 drawFloor 的底色一致
+    ++frameDrawCalls;
+    glBegin(GL_QUADS);
+    glNormal3f(0.0f, 1.0f, 0.0f);
+    glVertex3f(-floorSize, floorY, -floorSize);
+    glVertex3f(floorSize, floorY, -floorSize);
+    glVertex3f(floorSize, floorY, floorSize);
+    glVertex3f(-floorSize, floorY, floorSize);
+    glEnd();
     
+    glLoadMatrixf(globe);
+    glUniform1i(glGetUniformLocation(program, "useTexture"), 1);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    if (globeImpostor && ensureImpostorProgram()) {
+        // 替身写入的是精确球面深度，网格的弦面在它后面，必须用同样求交的替身变体叠加
+        glUseProgram(sphereProgram);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        const float sphere[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        drawImpostorQuads(sphere, 1);
+    } else {
+        drawCustomSphere(1.0f, sphereSlices, sphereStacks);
+    }
     glPopMatrix();
+    
+    glPopAttrib();
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
 }
 
 // ========================
-// 光照设置函数
+// 大气散射
 // ========================
+// 单次散射的大气（Bruneton & Neyret 2008 的简化版）。逐像素沿视线积分散射太慢，
+// 因此预先在CPU上多线程计算两张查找表并缓存到磁盘：
+//   透射率表 T(r, mu)：高度 r 处沿天顶角余弦 mu 方向到大气顶的透射率（二维）
+//   内散射表 S(r, mu, muS, nu)：沿视线累积的瑞利/米氏单次散射（四维，nu 与 muS 拼在三维纹理的 x 轴）
+// 绘制时用替身四边形覆盖大气球壳，片元只做几次纹理查询：视线经过的大气加上内散射，
+// 落在地面上的像素再按透射率衰减。计算单位为千米，高度按 ATMOSPHERE_EXAGGERATION 放大、
+// 散射系数同比缩小（光学厚度不变），否则按真实比例大气只有地球半径的1%，在屏幕上看不到
 
-void setCurrentLight() {
-    if (!lightEnabled) return;
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+const float ATMOSPHERE_EXAGGERATION = 8.0f;
+const float ATMOSPHERE_RG = 6360.0f;                                    // 地面半径（千米），对应地球半径 1
+const float ATMOSPHERE_RT = ATMOSPHERE_RG + 60.0f * ATMOSPHERE_EXAGGERATION; // 大气顶半径
+const float ATMOSPHERE_HR = 8.0f * ATMOSPHERE_EXAGGERATION;             // 瑞利散射标高
+const float ATMOSPHERE_HM = 1.2f * ATMOSPHERE_EXAGGERATION;             // 米氏散射标高
+const float ATMOSPHERE_BETA_R[3] = {5.8e-3f / ATMOSPHERE_EXAGGERATION, 13.5e-3f / ATMOSPHERE_EXAGGERATION,
+                                    33.1e-3f / ATMOSPHERE_EXAGGERATION};
+const float ATMOSPHERE_BETA_M = 4e-3f / ATMOSPHERE_EXAGGERATION;        // 米氏散射系数（灰色）
+const float ATMOSPHERE_MIE_EXTINCTION = ATMOSPHERE_BETA_M / 0.9f;
+const float ATMOSPHERE_MIE_G = 0.8f;
+const float ATMOSPHERE_MU_MIN = -0.4f; // 透射率表覆盖的最小 mu（放大后的大气顶处地平线约为 -0.37）
+const float ATMOSPHERE_SUN_INTENSITY = 30.0f;
+
+const int TRANSMITTANCE_W = 256, TRANSMITTANCE_H = 64;   // mu x r
+const int INSCATTER_R = 32, INSCATTER_MU = 128, INSCATTER_MU_S = 32, INSCATTER_NU = 8;
+string atmosphereCachePath;        // --atmosphere-cache，空表示放在用户缓存目录下
+
+bool atmosphereEnabled = false;    // 是否绘制大气
+bool realSunEnabled = false;       // 太阳方向取真实太阳位置，而不是 lightPositions 中的光源
+double sunTimeOverride = -1.0;     // 真实太阳位置使用的 UTC 时间（Unix 秒），负数表示当前时间
+
+struct AtmosphereTables {
+    vector<float> transmittance;   // TRANSMITTANCE_W x TRANSMITTANCE_H x RGB
+    vector<float> inscatter;       // (MU_S*NU) x MU x R x RGBA，rgb 为瑞利散射，a 为米氏散射的红色分量
+    GLuint transmittanceTexture;
+    GLuint inscatterTexture;
+    bool ready;
+    bool unavailable;
+    AtmosphereTables() : transmittanceTexture(0), inscatterTexture(0), ready(false), unavailable(false) {}
+};
+
+AtmosphereTables atmosphere;
+atomic<bool> atmosphereCancel(false); // 程序退出时中止后台预计算
+
+// 从高度 r 沿 mu 方向到达半径 radius 的球面的距离（射线从球内出发）
+float atmosphereDistanceToSphere(float r, float mu, float radius) {
+    float disc = r * r * (mu * mu - 1.0f) + radius * radius;
+    return -r * mu + sqrt(max(disc, 0.0f));
+}
+
+// 射线到大气顶或地面（先到者）的距离
+float atmosphereLimit(float r, float mu) {
+    float dout = atmosphereDistanceToSphere(r, mu, ATMOSPHERE_RT);
+    float delta = r * r * (mu * mu - 1.0f) + ATMOSPHERE_RG * ATMOSPHERE_RG;
+    if (delta >= 0.0f) {
+        float din = -r * mu - sqrt(delta);
+        if (din >= 0.0f) dout = min(dout, din);
+    }
+    return dout;
+}
+
+void atmosphereTransmittanceCoords(float r, float mu, float& u, float& v) {
+    u = atan((mu - ATMOSPHERE_MU_MIN) / (1.0f - ATMOSPHERE_MU_MIN) * tan(1.5f)) / 1.5f;
+    v = sqrt(max(r - ATMOSPHERE_RG, 0.0f) / (ATMOSPHERE_RT - ATMOSPHERE_RG));
+}
+
+// 双线性查询透射率表（预计算内散射表时使用，与着色器中的查询方式一致）
+void atmosphereTransmittance(const AtmosphereTables& tables, float r, float mu, float out[3]) {
+    float u, v;
+    atmosphereTransmittanceCoords(r, mu, u, v);
+    float x = min(max(u, 0.0f), 1.0f) * (TRANSMITTANCE_W - 1);
+    float y = min(max(v, 0.0f), 1.0f) * (TRANSMITTANCE_H - 1);
+    int x0 = min((int)x, TRANSMITTANCE_W - 2), y0 = min((int)y, TRANSMITTANCE_H - 2);
+    float fx = x - x0, fy = y - y0;
+    const float* row0 = &tables.transmittance[(y0 * TRANSMITTANCE_W + x0) * 3];
+    const float* row1 = row0 + TRANSMITTANCE_W * 3;
+    for (int c = 0; c < 3; ++c) {
+        float top = row0[c] + (row0[c + 3] - row0[c]) * fx;
+        float bottom = row1[c] + (row1[c + 3] - row1[c]) * fx;
+        out[c] = top + (bottom - top) * fy;
+    }
+}
+
+// 从 (r, mu) 出发沿视线走 d 千米这一段的透射率，用两次查表相除得到
+void atmosphereTransmittanceTo(const AtmosphereTables& tables, float r, float mu, float d, float out[3]) {
+    float r1 = sqrt(max(r * r + d * d + 2.0f * r * mu * d, ATMOSPHERE_RG * ATMOSPHERE_RG));
+    float mu1 = (r * mu + d) / r1;
+    float a[3], b[3];
+    if (mu > 0.0f) {
+        atmosphereTransmittance(tables, r, mu, a);
+        atmosphereTransmittance(tables, r1, mu1, b);
+    } else {
+        atmosphereTransmittance(tables, r1, -mu1, a);
+        atmosphereTransmittance(tables, r, -mu, b);
+    }
+    for (int c = 0; c < 3; ++c) out[c] = min(a[c] / max(b[c], 1e-6f), 1.0f);
+}
+
+void computeTransmittanceTable(AtmosphereTables& tables, int threads) {
+    tables.transmittance.assign(TRANSMITTANCE_W * TRANSMITTANCE_H * 3, 0.0f);
+    parallelFor(TRANSMITTANCE_H, threads, [&tables](int y, int) {
+        if (atmosphereCancel.load(memory_order_relaxed)) return;
+        float v = (float)y / (TRANSMITTANCE_H - 1);
+        float r = ATMOSPHERE_RG + v * v * (ATMOSPHERE_RT - ATMOSPHERE_RG);
+        for (int x = 0; x < TRANSMITTANCE_W; ++x) {
+            float u = (float)x / (TRANSMITTANCE_W - 1);
+            float mu = ATMOSPHERE_MU_MIN + tan(1.5f * u) / tan(1.5f) * (1.0f - ATMOSPHERE_MU_MIN);
+            // 沿射线到大气顶（不考虑地面遮挡）积分两种粒子的光学厚度
+            const int samples = 500;
+            float d = atmosphereDistanceToSphere(r, mu, ATMOSPHERE_RT);
+            float dt = d / samples;
+            float depthR = 0.0f, depthM = 0.0f;
+            for (int i = 0; i <= samples; ++i) {
+                float t = i * dt;
+                float ri = sqrt(r * r + t * t + 2.0f * r * mu * t);
+                float weight = (i == 0 || i == samples) ? 0.5f : 1.0f;
+                depthR += weight * exp(-(ri - ATMOSPHERE_RG) / ATMOSPHERE_HR);
+                depthM += weight * exp(-(ri - ATMOSPHERE_RG) / ATMOSPHERE_HM);
+            }
+            float* out = &tables.transmittance[(y * TRANSMITTANCE_W + x) * 3];
+            for (int c = 0; c < 3; ++c) {
+                out[c] = exp(-(ATMOSPHERE_BETA_R[c] * depthR + ATMOSPHERE_MIE_EXTINCTION * depthM) * dt);
+            }
+        }
+    });
+}
+
+// 内散射表的参数化（与着色器中的 texture4D 互逆）：r 按到地平线切点的距离均匀分布，
+// mu 的上半部分是看向天空的射线、下半部分是落到地面的射线，各自按出射距离均匀分布
+void inscatterTexelParameters(int layer, int x, int y, float& r, float& mu, float& muS, float& nu) {
+    float H = sqrt(ATMOSPHERE_RT * ATMOSPHERE_RT - ATMOSPHERE_RG * ATMOSPHERE_RG);
+    float rho = H * layer / (INSCATTER_R - 1);
+    r = sqrt(ATMOSPHERE_RG * ATMOSPHERE_RG + rho * rho);
+    if (layer == 0) r += 0.01f;
+    else if (layer == INSCATTER_R - 1) r -= 0.001f;
+    rho = sqrt(max(r * r - ATMOSPHERE_RG * ATMOSPHERE_RG, 0.0f));
     
-    LightPosition light = lightPositions[currentLightPosition];
+    float half = INSCATTER_MU / 2;
+    if (y < INSCATTER_MU / 2) {
+        float dmin = r - ATMOSPHERE_RG, dmax = rho;
+        float d = 1.0f - y / (half - 1.0f);
+        d = min(max(dmin, d * dmax), dmax * 0.999f);
+        mu = (ATMOSPHERE_RG * ATMOSPHERE_RG - r * r - d * d) / (2.0f * r * d);
+        mu = min(mu, -sqrt(1.0f - (ATMOSPHERE_RG / r) * (ATMOSPHERE_RG / r)) - 0.001f);
+    } else {
+        float dmin = ATMOSPHERE_RT - r, dmax = rho + H;
+        float d = (y - half) / (half - 1.0f);
+        d = min(max(dmin, d * dmax), dmax * 0.999f);
+        mu = (ATMOSPHERE_RT * ATMOSPHERE_RT - r * r - d * d) / (2.0f * r * d);
+    }
     
-    // 设置光源位置
-    GLfloat lightPosition[] = {light.x, light.y, light.z, 1.0f};
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+    float s = (float)(x % INSCATTER_MU_S) / (INSCATTER_MU_S - 1);
+    muS = tan((2.0f * s - 1.0f + 0.26f) * 1.1f) / tan(1.26f * 1.1f);
+    nu = -1.0f + (float)(x / INSCATTER_MU_S) / (INSCATTER_NU - 1) * 2.0f;
     
-    // 设置光源颜色
-    GLfloat lightAmbient[] = {0.3f, 0.3f, 0.3f, 1.0f};
-    GLfloat lightDiffuse[] = {1.0f, 1.0f, 0.9f, 1.0f}; // 稍微偏暖色
-    GLfloat lightSpecular[] = {0.8f, 0.8f, 0.8f, 1.0f};
+    // 三个角度不独立，夹到几何上可能的范围内
+    mu = min(max(mu, -1.0f), 1.0f);
+    muS = min(max(muS, -1.0f), 1.0f);
+    float spread = sqrt(max((1.0f - mu * mu) * (1.0f - muS * muS), 0.0f));
+    nu = min(max(nu, mu * muS - spread), mu * muS + spread);
+}
+
+void computeInscatterTable(AtmosphereTables& tables, int threads) {
+    const int width = INSCATTER_MU_S * INSCATTER_NU;
+    tables.inscatter.assign((size_t)width * INSCATTER_MU * INSCATTER_R * 4, 0.0f);
+    parallelFor(INSCATTER_R * INSCATTER_MU, threads, [&tables, width](int item, int) {
+        if (atmosphereCancel.load(memory_order_relaxed)) return;
+        int layer = item / INSCATTER_MU;
+        int y = item % INSCATTER_MU;
+        for (int x = 0; x < width; ++x) {
+            float r, mu, muS, nu;
+            inscatterTexelParameters(layer, x, y, r, mu, muS, nu);
+            
+            const int samples = 50;
+            float dt = atmosphereLimit(r, mu) / samples;
+            float rayleigh[3] = {0.0f, 0.0f, 0.0f};
+            float mie[3] = {0.0f, 0.0f, 0.0f};
+            for (int i = 0; i <= samples; ++i) {
+                float t = i * dt;
+                float ri = sqrt(max(r * r + t * t + 2.0f * r * mu * t, ATMOSPHERE_RG * ATMOSPHERE_RG));
+                float muSi = (nu * t + muS * r) / ri;
+                // 太阳在该点的地平线以下时没有直射光
+                if (muSi < -sqrt(max(1.0f - (ATMOSPHERE_RG / ri) * (ATMOSPHERE_RG / ri), 0.0f))) continue;
+                float view[3], sun[3];
+                atmosphereTransmittanceTo(tables, r, mu, t, view);
+                atmosphereTransmittance(tables, ri, muSi, sun);
+                float weight = (i == 0 || i == samples) ? 0.5f : 1.0f;
+                float densityR = weight * exp(-(ri - ATMOSPHERE_RG) / ATMOSPHERE_HR);
+                float densityM = weight * exp(-(ri - ATMOSPHERE_RG) / ATMOSPHERE_HM);
+                for (int c = 0; c < 3; ++c) {
+                    rayleigh[c] += densityR * view[c] * sun[c];
+                    mie[c] += densityM * view[c] * sun[c];
+                }
+            }
+            float* out = &tables.inscatter[(((size_t)layer * INSCATTER_MU + y) * width + x) * 4];
+            for (int c = 0; c < 3; ++c) out[c] = rayleigh[c] * ATMOSPHERE_BETA_R[c] * dt;
+            out[3] = mie[0] * ATMOSPHERE_BETA_M * dt;
+        }
+    });
+}
+
+// 缓存文件头：参数或分辨率变化后旧缓存自动失效
+struct AtmosphereCacheHeader {
+    char magic[8];
+    int sizes[6];
+    float params[8];
+};
+
+AtmosphereCacheHeader atmosphereCacheHeader() {
+    AtmosphereCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ATMOLUT1", 8);
+    int sizes[6] = {TRANSMITTANCE_W, TRANSMITTANCE_H, INSCATTER_R, INSCATTER_MU, INSCATTER_MU_S, INSCATTER_NU};
+    float params[8] = {ATMOSPHERE_RG, ATMOSPHERE_RT, ATMOSPHERE_HR, ATMOSPHERE_HM, ATMOSPHERE_BETA_R[0],
+                       ATMOSPHERE_BETA_R[2], ATMOSPHERE_BETA_M, ATMOSPHERE_MU_MIN};
+    memcpy(header.sizes, sizes, sizeof(sizes));
+    memcpy(header.params, params, sizeof(params));
+    return header;
+}
+
+bool loadAtmosphereCache(AtmosphereTables& tables, const char* path) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return false;
+    AtmosphereCacheHeader expected = atmosphereCacheHeader(), header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || memcmp(&header, &expected, sizeof(header)) != 0) {
+        cout << "大气查找表缓存 " << path << " 与当前参数不符，重新计算" << endl;
+        return false;
+    }
+    tables.transmittance.resize(TRANSMITTANCE_W * TRANSMITTANCE_H * 3);
+    tables.inscatter.resize((size_t)INSCATTER_MU_S * INSCATTER_NU * INSCATTER_MU * INSCATTER_R * 4);
+    file.read(reinterpret_cast<char*>(tables.transmittance.data()), tables.transmittance.size() * sizeof(float));
+    file.read(reinterpret_cast<char*>(tables.inscatter.data()), tables.inscatter.size() * sizeof(float));
+    return (bool)file;
+}
+
+void saveAtmosphereCache(const AtmosphereTables& tables, const char* path) {
+    ofstream file(path, ios::binary);
+    AtmosphereCacheHeader header = atmosphereCacheHeader();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(tables.transmittance.data()), tables.transmittance.size() * sizeof(float));
+    file.write(reinterpret_cast<const char*>(tables.inscatter.data()), tables.inscatter.size() * sizeof(float));
+    if (!file) {
+        cerr << "警告: 无法写入大气查找表缓存 " << path << endl;
+    }
+}
+
+// 默认缓存位置：$XDG_CACHE_HOME（或 ~/.cache）下的 earth-globe 目录，都没有时不缓存
+string defaultAtmosphereCachePath() {
+    string dir;
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && xdg[0]) {
+        dir = xdg;
+    } else if (home && home[0]) {
+        dir = string(home) + "/.cache";
+        mkdir(dir.c_str(), 0755);
+    } else {
+        return "";
+    }
+    dir += "/earth-globe";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/atmosphere_lut.bin";
+}
+
+// 读取缓存或重新计算查找表（不涉及GL调用，在后台线程中运行），被取消时返回 false
+bool prepareAtmosphereTables(AtmosphereTables& tables) {
+    string path = atmosphereCachePath.empty() ? defaultAtmosphereCachePath() : atmosphereCachePath;
+    if (!path.empty() && loadAtmosphereCache(tables, path.c_str())) {
+        cout << "从 " << path << " 读取大气查找表" << endl;
+        return true;
+    }
+    int threads = defaultThreadCount();
+    auto start = chrono::steady_clock::now();
+    computeTransmittanceTable(tables, threads);
+    computeInscatterTable(tables, threads);
+    if (atmosphereCancel.load()) return false;
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "大气查找表预计算完成: " << ms << " ms（" << threads << " 线程）" << endl;
+    if (!path.empty()) saveAtmosphereCache(tables, path.c_str());
+    return true;
+}
+
+// 查找表在后台线程中读取或计算，完成后通过原子指针交给渲染方上传（与纹理重载相同），
+// 在此之前跳过大气绘制，不让打开大气的第一帧卡住数秒
+thread atmosphereBuilder;
+atomic<AtmosphereTables*> builtAtmosphere(nullptr);
+bool atmosphereWaitForTables = false; // 离屏渲染需要确定的画面，同步等待查找表
+
+// 退出时取消计算并等待后台线程结束
+void stopAtmosphereBuilder() {
+    atmosphereCancel.store(true);
+    if (atmosphereBuilder.joinable()) atmosphereBuilder.join();
+    delete builtAtmosphere.exchange(nullptr);
+}
+
+void startAtmosphereBuilder() {
+    static bool exitHandlerRegistered = false;
+    if (!exitHandlerRegistered) atexit(stopAtmosphereBuilder); // 窗口模式经 exit() 退出，先停掉计算线程
+    exitHandlerRegistered = true;
+    atmosphereBuilder = thread([]() {
+        AtmosphereTables* tables = new AtmosphereTables;
+        if (prepareAtmosphereTables(*tables)) {
+            builtAtmosphere.store(tables, memory_order_release);
+        } else {
+            delete tables;
+        }
+    });
+}
+
+const char* atmosphereFragmentShader =
+    "uniform sampler2D transmittanceTable;\n"
+    "uniform sampler3D inscatterTable;\n"
+    "uniform vec3 sunDir;\n" // 视空间
+    "uniform float sunIntensity;\n"
+    "varying vec3 eyePos;\n"
+    "varying vec3 centerEye;\n"
+    "varying float radiusEye;\n"
+    "const float PI = 3.14159265359;\n"
+    "vec3 transmittance(float r, float mu) {\n"
+    "    float u = atan((mu - MU_MIN) / (1.0 - MU_MIN) * tan(1.5)) / 1.5;\n"
+    "    float v = sqrt(max(r - RG, 0.0) / (RT - RG));\n"
+    "    vec2 size = vec2(TRANSMITTANCE_W, TRANSMITTANCE_H);\n"
+    "    return texture2D(transmittanceTable, (clamp(vec2(u, v), 0.0, 1.0) * (size - 1.0) + 0.5) / size).rgb;\n"
+    "}\n"
+    "vec3 transmittanceTo(float r, float mu, float d) {\n"
+    "    float r1 = sqrt(max(r * r + d * d + 2.0 * r * mu * d, RG * RG));\n"
+    "    float mu1 = (r * mu + d) / r1;\n"
+    "    if (mu > 0.0) return min(transmittance(r, mu) / max(transmittance(r1, mu1), 1e-6), 1.0);\n"
+    "    return min(transmittance(r1, -mu1) / max(transmittance(r, -mu), 1e-6), 1.0);\n"
+    "}\n"
+    "vec4 inscatter(float r, float mu, float muS, float nu) {\n"
+    "    float H = sqrt(RT * RT - RG * RG);\n"
+    "    float rho = sqrt(max(r * r - RG * RG, 0.0));\n"
+    "    float rmu = r * mu;\n"
+    "    float delta = rmu * rmu - r * r + RG * RG;\n"
+    "    vec4 cst = rmu < 0.0 && delta > 0.0 ? vec4(1.0, 0.0, 0.0, 0.5 - 0.5 / RES_MU)\n"
+    "                                         : vec4(-1.0, H * H, H, 0.5 + 0.5 / RES_MU);\n"
+    "    float uR = 0.5 / RES_R + rho / H * (1.0 - 1.0 / RES_R);\n"
+    "    float uMu = cst.w + (rmu * cst.x + sqrt(max(delta + cst.y, 0.0))) / (rho + cst.z) * (0.5 - 1.0 / RES_MU);\n"
+    "    float uMuS = 0.5 / RES_MU_S + (atan(max(muS, -0.1975) * tan(1.26 * 1.1)) / 1.1 + 0.74) * 0.5 * (1.0 - 1.0 / RES_MU_S);\n"
+    "    float lerp = (nu + 1.0) / 2.0 * (RES_NU - 1.0);\n"
+    "    float uNu = floor(lerp);\n"
+    "    lerp -= uNu;\n"
+    "    return texture3D(inscatterTable, vec3((uNu + uMuS) / RES_NU, uMu, uR)) * (1.0 - lerp)\n"
+    "         + texture3D(inscatterTable, vec3((uNu + uMuS + 1.0) / RES_NU, uMu, uR)) * lerp;\n"
+    "}\n"
+    "void main() {\n"
+    "    vec3 dir = normalize(eyePos);\n"
+    "    float b = dot(dir, centerEye);\n"
+    "    float disc = b * b - dot(centerEye, centerEye) + radiusEye * radiusEye;\n"
+    "    if (disc < 0.0) discard;\n"
+    // 相机在大气外时从进入大气的位置开始，换算到以地心为原点、单位为千米的坐标
+    "    float tEnter = max(b - sqrt(disc), 0.0);\n"
+    "    float km = RT / radiusEye;\n"
+    "    vec3 x = (dir * tEnter - centerEye) * km;\n"
+    "    float r = min(length(x), RT * 0.9999);\n"
+    "    float rmu = dot(x, dir);\n"
+    "    float mu = rmu / r;\n"
+    "    float muS = dot(x, sunDir) / r;\n"
+    "    float nu = dot(dir, sunDir);\n"
+    "    vec4 scatter = inscatter(r, mu, muS, nu);\n"
+    "    float alpha = 1.0;\n"
+    "    float ground = rmu * rmu - r * r + RG * RG;\n"
+    "    if (ground > 0.0 && -rmu - sqrt(ground) > 0.0) {\n"
+    // 视线落在地面上：减去地面点之后那一段的散射，并用透射率衰减已绘制的地球颜色
+    "        float d = -rmu - sqrt(ground);\n"
+    "        vec3 x0 = x + dir * d;\n"
+    "        float r0 = length(x0);\n"
+    "        vec3 attenuation = transmittanceTo(r, mu, d);\n"
+    "        scatter = max(scatter - attenuation.rgbr * inscatter(r0, dot(x0, dir) / r0, dot(x0, sunDir) / r0, nu), 0.0);\n"
+    "        alpha = dot(attenuation, vec3(1.0 / 3.0));\n"
+    "    }\n"
+    "    vec3 betaR = vec3(BETA_R);\n"
+    "    vec3 mie = scatter.rgb * scatter.a / max(scatter.r, 1e-4) * (betaR.r / betaR);\n"
+    "    float phaseR = 3.0 / (16.0 * PI) * (1.0 + nu * nu);\n"
+    "    float g = MIE_G;\n"
+    "    float phaseM = 1.5 / (4.0 * PI) * (1.0 - g * g) / (2.0 + g * g) * (1.0 + nu * nu) / pow(1.0 + g * g - 2.0 * g * nu, 1.5);\n"
+    "    vec3 color = sunIntensity * (scatter.rgb * phaseR + mie * phaseM);\n"
+    "    gl_FragColor = vec4(1.0 - exp(-color), alpha);\n" // 简单的曝光映射
+    "    vec4 clip = gl_ProjectionMatrix * vec4(dir * max(tEnter, 0.11), 1.0);\n"
+    "    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;\n"
+    "}\n";
+
+GLuint atmosphereProgram = 0;
+
+// 编译大气着色器
+bool compileAtmosphereProgram() {
+    // 常量以宏的形式拼在 #version 之后，与CPU端共用同一组参数
+    string header = "#version 120\n"
+        "#define RG " + to_string(ATMOSPHERE_RG) + "\n"
+        "#define RT " + to_string(ATMOSPHERE_RT) + "\n"
+        "#define MU_MIN " + to_string(ATMOSPHERE_MU_MIN) + "\n"
+        "#define MIE_G " + to_string(ATMOSPHERE_MIE_G) + "\n"
+        "#define BETA_R " + to_string(ATMOSPHERE_BETA_R[0] * 1e3f) + "e-3, " + to_string(ATMOSPHERE_BETA_R[1] * 1e3f) +
+        "e-3, " + to_string(ATMOSPHERE_BETA_R[2] * 1e3f) + "e-3\n"
+        "#define TRANSMITTANCE_W " + to_string(TRANSMITTANCE_W) + ".0\n"
+        "#define TRANSMITTANCE_H " + to_string(TRANSMITTANCE_H) + ".0\n"
+        "#define RES_R " + to_string(INSCATTER_R) + ".0\n"
+        "#define RES_MU " + to_string(INSCATTER_MU) + ".0\n"
+        "#define RES_MU_S " + to_string(INSCATTER_MU_S) + ".0\n"
+        "#define RES_NU " + to_string(INSCATTER_NU) + ".0\n";
+    string fragment = header + atmosphereFragmentShader;
+    atmosphereProgram = createShaderProgram(impostorVertexShader, fragment.c_str(), "atmosphere");
+    if (atmosphereProgram == 0) {
+        cerr << "警告: 大气着色器不可用，不绘制大气" << endl;
+        return false;
+    }
+    return true;
+}
+
+// 首次使用时编译着色器并在后台准备查找表，查找表就绪后上传为浮点纹理。返回本帧能否绘制大气
+bool ensureAtmosphere() {
+    if (atmosphere.ready || atmosphere.unavailable) return atmosphere.ready;
+    if (atmosphereProgram == 0 && !compileAtmosphereProgram()) {
+        atmosphere.unavailable = true;
+        return false;
+    }
+    if (!atmosphereBuilder.joinable()) startAtmosphereBuilder();
+    if (atmosphereWaitForTables) atmosphereBuilder.join();
+    AtmosphereTables* built = builtAtmosphere.exchange(nullptr, memory_order_acquire);
+    if (!built) return false;
+    atmosphere.transmittance.swap(built->transmittance);
+    atmosphere.inscatter.swap(built->inscatter);
+    delete built;
+    
+    glGenTextures(1, &atmosphere.transmittanceTexture);
+    glBindTexture(GL_TEXTURE_2D, atmosphere.transmittanceTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, TRANSMITTANCE_W, TRANSMITTANCE_H, 0, GL_RGB, GL_FLOAT,
+                 atmosphere.transmittance.data());
+    
+    glGenTextures(1, &atmosphere.inscatterTexture);
+    glBindTexture(GL_TEXTURE_3D, atmosphere.inscatterTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F_ARB, INSCATTER_MU_S * INSCATTER_NU, INSCATTER_MU, INSCATTER_R, 0,
+                 GL_RGBA, GL_FLOAT, atmosphere.inscatter.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    atmosphere.ready = true;
+    return true;
+}
+
+// 低精度太阳位置（天文年历的近似公式，误差约0.01度）：返回太阳直射点的纬度和经度（度）
+void subsolarPoint(double unixSeconds, double& latitude, double& longitude) {
+    const double DEG = M_PI / 180.0;
+    double n = unixSeconds / 86400.0 + 2440587.5 - 2451545.0; // 自 J2000.0 起的天数
+    double meanLongitude = 280.460 + 0.9856474 * n;
+    double meanAnomaly = (357.528 + 0.9856003 * n) * DEG;
+    double lambda = (meanLongitude + 1.915 * sin(meanAnomaly) + 0.020 * sin(2.0 * meanAnomaly)) * DEG;
+    double epsilon = (23.439 - 0.0000004 * n) * DEG;
+    double rightAscension = atan2(cos(epsilon) * sin(lambda), cos(lambda)) / DEG;
+    double greenwichSidereal = 280.46061837 + 360.98564736629 * n;
+    latitude = asin(sin(epsilon) * sin(lambda)) / DEG;
+    longitude = fmod(rightAscension - greenwichSidereal, 360.0);
+    if (longitude < -180.0) longitude += 360.0;
+    if (longitude >= 180.0) longitude -= 360.0;
+}
+
+// 解析 UTC 时间 "YYYY-MM-DDTHH:MM[:SS]"，返回 Unix 秒，格式错误时返回负数
+double parseUtcTime(const char* text) {
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    int fields = sscanf(text, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second);
+    if (fields < 5 || month < 1 || month > 12 || day < 1 || day > 31) return -1.0;
+    // 公历日期到自1970-01-01起的天数
+    int y = year - (month <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yearOfEra = y - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    double days = (double)era * 146097 + dayOfEra - 719468;
+    return days * 86400.0 + hour * 3600.0 + minute * 60.0 + second;
+}
+
+// 真实太阳在世界空间中的方向：直射点按与 generateSphere 相同的经纬度参数化换算到地球坐标，再随地球旋转
+void realSunDirection(float out[3]) {
+    double latitude, longitude;
+    subsolarPoint(sunTimeOverride >= 0.0 ? sunTimeOverride : (double)time(NULL), latitude, longitude);
+    float theta = (float)(2.0 * M_PI * (longitude + 180.0) / 360.0);
+    float phi = (float)(M_PI * (90.0 - latitude) / 180.0);
+    float local[3] = {sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta)};
+    // 地球的模型变换为 Rx(rotationX) * Ry(rotationY)
+    float ay = rotationY * (float)M_PI / 180.0f, ax = rotationX * (float)M_PI / 180.0f;
+    float x = cos(ay) * local[0] + sin(ay) * local[2];
+    float z = -sin(ay) * local[0] + cos(ay) * local[2];
+    float y = local[1];
+    out[0] = x;
+    out[1] = cos(ax) * y - sin(ax) * z;
+    out[2] = sin(ax) * y + cos(ax) * z;
+}
+
+// 当前生效的光源：真实太阳模式下放在太阳方向上10个单位处，阴影和光照都随之变化
+LightPosition currentLight() {
+    if (!realSunEnabled) return lightPositions[currentLightPosition];
+    float sun[3];
+    realSunDirection(sun);
+    LightPosition light = {sun[0] * 10.0f, sun[1] * 10.0f, sun[2] * 10.0f, "真实太阳"};
+    return light;
+}
+
+// 在地球绘制之后叠加大气。view 为相机矩阵，globe 为地球的模型视图矩阵
+void drawAtmosphere(const float view[16], const float globe[16]) {
+    if (!ensureAtmosphere()) return;
+    
+    LightPosition light = currentLight();
+    float world[3] = {light.x, light.y, light.z};
+    float sun[3];
+    for (int i = 0; i < 3; ++i) {
+        sun[i] = view[i] * world[0] + view[4 + i] * world[1] + view[8 + i] * world[2];
+    }
+    float length = sqrt(sun[0] * sun[0] + sun[1] * sun[1] + sun[2] * sun[2]);
+    
+    glUseProgram(atmosphereProgram);
+    glUniform1i(glGetUniformLocation(atmosphereProgram, "transmittanceTable"), 1);
+    glUniform1i(glGetUniformLocation(atmosphereProgram, "inscatterTable"), 2);
+    glUniform3f(glGetUniformLocation(atmosphereProgram, "sunDir"), sun[0] / length, sun[1] / length, sun[2] / length);
+    glUniform1f(glGetUniformLocation(atmosphereProgram, "sunIntensity"), ATMOSPHERE_SUN_INTENSITY);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, atmosphere.transmittanceTexture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, atmosphere.inscatterTexture);
+    glActiveTexture(GL_TEXTURE0);
+    
+    // 目标颜色按透射率衰减后加上内散射：dst * alpha + src；写入的深度是进入大气的位置，不写深度缓冲
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+    
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadMatrixf(globe);
+    ++frameDrawCalls;
+    glBegin(GL_QUADS);
+    glMultiTexCoord4f(GL_TEXTURE1, 0.0f, 0.0f, 0.0f, ATMOSPHERE_RT / ATMOSPHERE_RG);
+    glVertex2f(-1.0f, -1.0f);
+    glVertex2f(1.0f, -1.0f);
+    glVertex2f(1.0f, 1.0f);
+    glVertex2f(-1.0f, 1.0f);
+    glEnd();
+    glPopMatrix();
+    
+    glPopAttrib();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+// ========================
+// 地理标记点（实例化 + 层次LOD）
+// ========================
+// 城市、传感器、船舶位置等大规模点数据。所有点的位置和颜色一次性上传到顶点缓冲区，
+// 每个标记是一个实例化的屏幕对齐四边形，像素大小随 zoom 变化。点按经纬度四叉树组织：
+// 每个节点在自己的经纬度格子上分层抽样保留至多 MARKER_NODE_CAPACITY 个代表点，其余下放
+// 给子节点，缓冲区按深度优先顺序排列，因此每个节点（以及连续的一串节点）是一段连续的实例。
+// 每帧从根节点开始，剔除背向相机的节点，屏幕上点间距已经小于标记直径的节点不再细分，
+// 绘制的标记数只取决于屏幕上能分辨多少点，与数据总量无关
+
+const int MARKER_NODE_CAPACITY = 4096;   // 每个节点的抽样网格为 64x64
+const int MARKER_MAX_DEPTH = 14;         // 重复坐标无法再细分，到此深度后全部留在节点内
+const float MARKER_RADIUS = 1.002f;      // 标记略高于地表，避免深度冲突
+
+struct GeoMarker {
+    float latitude, longitude;
+    unsigned char r, g, b, a;
+};
+
+struct MarkerNode {
+    float latMin, latMax, lonMin, lonMax;
+    int first, count;          // 本节点自己的实例范围
+    int children[4];           // -1 表示没有
+    float center[3];           // 格子中心在地球上的方向
+    float angularRadius;       // 覆盖整个格子的球冠半角（弧度）
+    float area;                // 格子在单位球上的面积
+};
+
+struct MarkerLayer {
+    vector<MarkerNode> nodes;
+    size_t pointCount;
+    GLuint instanceBuffer;
+    GLuint cornerBuffer;
+    // 最近一帧的统计
+    long long drawnMarkers;
+    int drawnNodes;
+    int drawCalls;
+    double traverseMs;
+    MarkerLayer() : pointCount(0), instanceBuffer(0), cornerBuffer(0), drawnMarkers(0), drawnNodes(0),
+                    drawCalls(0), traverseMs(0.0) {}
+};
+
+MarkerLayer markerLayer;
+vector<GeoMarker> markerData;      // 等待建树上传的数据（上传后释放）
+bool markersEnabled = false;
+bool markerLodEnabled = true;      // 关闭后每帧绘制全部标记（仅用于对比测试）
+float markerPixels = 4.0f;         // zoom 为1时标记的直径（像素）
+float markerLodScale = 1.0f;       // 屏幕上点间距小于标记直径的该倍数时不再细分
+GLuint markerProgram = 0;
+bool markerUnavailable = false;
+
+// 读取标记文件：每行 "纬度,经度[,r,g,b]"，# 开头为注释
+bool loadMarkerFile(const char* path, vector<GeoMarker>& markers) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "错误: 无法打开标记文件 " << path << endl;
+        return false;
+    }
+    markers.clear();
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#') continue;
+        GeoMarker marker;
+        int r = 255, g = 140, b = 40;
+        int fields = sscanf(line.c_str(), "%f,%f,%d,%d,%d", &marker.latitude, &marker.longitude, &r, &g, &b);
+        if (fields < 2 || fabs(marker.latitude) > 90.0f || fabs(marker.longitude) > 180.0f) {
+            cerr << "警告: " << path << " 第 " << lineNumber << " 行无法解析，已跳过" << endl;
+            continue;
+        }
+        marker.r = (unsigned char)min(max(r, 0), 255);
+        marker.g = (unsigned char)min(max(g, 0), 255);
+        marker.b = (unsigned char)min(max(b, 0), 255);
+        marker.a = 255;
+        markers.push_back(marker);
+    }
+    cout << "从 " << path << " 读取 " << markers.size() << " 个标记" << endl;
+    return true;
+}
+
+// 固定种子生成测试数据：八成聚集在若干"城市"周围（大小不一），其余在球面上均匀分布
+void generateMarkers(size_t count, vector<GeoMarker>& markers) {
+    unsigned int seed = 24680u;
+    const int cities = 500;
+    float cityLat[cities], cityLon[cities], citySpread[cities];
+    for (int i = 0; i < cities; ++i) {
+        cityLat[i] = asin(randomUnit(seed) * 1.6f - 0.8f) * 180.0f / PI;
+        cityLon[i] = randomUnit(seed) * 360.0f - 180.0f;
+        citySpread[i] = 0.2f + 3.0f * randomUnit(seed) * randomUnit(seed);
+    }
+    markers.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        GeoMarker& marker = markers[i];
+        if (i % 5 != 4) {
+            int city = (int)(randomUnit(seed) * randomUnit(seed) * cities); // 偏向排在前面的大城市
+            // Box-Muller 正态分布
+            float u1 = max(randomUnit(seed), 1e-7f), u2 = randomUnit(seed);
+            float radius = sqrt(-2.0f * log(u1)) * citySpread[city];
+            marker.latitude = min(max(cityLat[city] + radius * sin(2.0f * PI * u2), -90.0f), 90.0f);
+            float lon = cityLon[city] + radius * cos(2.0f * PI * u2);
+            marker.longitude = lon - 360.0f * floor((lon + 180.0f) / 360.0f);
+            marker.r = 255; marker.g = 170; marker.b = 60;
+        } else {
+            marker.latitude = asin(randomUnit(seed) * 2.0f - 1.0f) * 180.0f / PI;
+            marker.longitude = randomUnit(seed) * 360.0f - 180.0f;
+            marker.r = 90; marker.g = 200; marker.b = 255;
+        }
+        marker.a = 255;
+    }
+}
+
+void computeNodeBounds(MarkerNode& node) {
+    geoToSphere(0.5f * (node.latMin + node.latMax), 0.5f * (node.lonMin + node.lonMax), node.center);
+    // 在格子边界上取样估计覆盖球冠的半角（纬线在高纬度会向外凸，所以边中点也要取）
+    float minDot = 1.0f;
+    for (int i = 0; i <= 2; ++i) {
+        for (int j = 0; j <= 2; ++j) {
+            float p[3];
+            geoToSphere(node.latMin + (node.latMax - node.latMin) * i * 0.5f,
+                        node.lonMin + (node.lonMax - node.lonMin) * j * 0.5f, p);
+            minDot = min(minDot, p[0] * node.center[0] + p[1] * node.center[1] + p[2] * node.center[2]);
+        }
+    }
+    const float DEG = PI / 180.0f;
+    node.area = (node.lonMax - node.lonMin) * DEG * (sin(node.latMax * DEG) - sin(node.latMin * DEG));
+    node.angularRadius = node.lonMax - node.lonMin >= 180.0f ? PI
+                                                            : min(acos(max(minDot, -1.0f)) * 1.1f, PI);
+}
+
+// 对 order[begin, end) 建立节点：先在格子上分层抽样选出代表点放在最前面，剩下的按象限划分后递归
+int buildMarkerNode(MarkerLayer& layer, const vector<GeoMarker>& markers, vector<unsigned int>& order,
+                    int begin, int end, float latMin, float latMax, float lonMin, float lonMax, int depth,
+                    vector<unsigned char>& occupied) {
+    int index = (int)layer.nodes.size();
+    layer.nodes.push_back(MarkerNode());
+    MarkerNode node;
+    node.latMin = latMin; node.latMax = latMax;
+    node.lonMin = lonMin; node.lonMax = lonMax;
+    node.first = begin;
+    for (int c = 0; c < 4; ++c) node.children[c] = -1;
+    computeNodeBounds(node);
+    
+    int count = end - begin;
+    if (count <= MARKER_NODE_CAPACITY || depth >= MARKER_MAX_DEPTH) {
+        node.count = count;
+        layer.nodes[index] = node;
+        return index;
+    }
+    
+    // 64x64 网格每格只取第一个落入的点
+    const int grid = 64;
+    occupied.assign(grid * grid, 0);
+    float latScale = grid / (latMax - latMin), lonScale = grid / (lonMax - lonMin);
+    int selected = begin;
+    for (int i = begin; i < end; ++i) {
+        const GeoMarker& m = markers[order[i]];
+        int gy = min(max((int)((m.latitude - latMin) * latScale), 0), grid - 1);
+        int gx = min(max((int)((m.longitude - lonMin) * lonScale), 0), grid - 1);
+        if (!occupied[gy * grid + gx]) {
+            occupied[gy * grid + gx] = 1;
+            swap(order[i], order[selected++]);
+        }
+    }
+    node.count = selected - begin;
+    
+    // 其余的点按纬度、经度二分到四个子格子
+    float latMid = 0.5f * (latMin + latMax), lonMid = 0.5f * (lonMin + lonMax);
+    unsigned int* base = order.data();
+    unsigned int* split = partition(base + selected, base + end,
+                                    [&](unsigned int i) { return markers[i].latitude < latMid; });
+    unsigned int* southWest = partition(base + selected, split,
+                                        [&](unsigned int i) { return markers[i].longitude < lonMid; });
+    unsigned int* northWest = partition(split, base + end,
+                                        [&](unsigned int i) { return markers[i].longitude < lonMid; });
+    int bounds[5] = {selected, (int)(southWest - base), (int)(split - base), (int)(northWest - base), end};
+    float quads[4][4] = {{latMin, latMid, lonMin, lonMid}, {latMin, latMid, lonMid, lonMax},
+                         {latMid, latMax, lonMin, lonMid}, {latMid, latMax, lonMid, lonMax}};
+    for (int c = 0; c < 4; ++c) {
+        if (bounds[c + 1] > bounds[c]) {
+            node.children[c] = buildMarkerNode(layer, markers, order, bounds[c], bounds[c + 1],
+                                               quads[c][0], quads[c][1], quads[c][2], quads[c][3], depth + 1, occupied);
+        }
+    }
+    layer.nodes[index] = node;
+    return index;
+}
+
+// 建树并上传实例数据（每个实例：物体空间单位向量 xyz + RGBA8，共16字节）
+void buildMarkerLayer(MarkerLayer& layer, const vector<GeoMarker>& markers) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    layer.nodes.clear();
+    layer.pointCount = markers.size();
+    vector<unsigned int> order(markers.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = (unsigned int)i;
+    vector<unsigned char> occupied;
+    if (!markers.empty()) {
+        buildMarkerNode(layer, markers, order, 0, (int)markers.size(), -90.0f, 90.0f, -180.0f, 180.0f, 0, occupied);
+    }
+    
+    struct Instance {
+        float position[3];
+        unsigned char color[4];
+    };
+    // 按树的顺序取出经纬度，批量变换到物体空间
+    vector<float> lat(order.size()), lon(order.size()), x(order.size()), y(order.size()), z(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        lat[i] = markers[order[i]].latitude;
+        lon[i] = markers[order[i]].longitude;
+    }
+    batchGeodeticToGlobe(lat.data(), lon.data(), NULL, order.size(), GEO_SPHERE, x.data(), y.data(), z.data());
+    vector<Instance> instances(markers.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        const GeoMarker& m = markers[order[i]];
+        instances[i].position[0] = x[i];
+        instances[i].position[1] = y[i];
+        instances[i].position[2] = z[i];
+        instances[i].color[0] = m.r;
+        instances[i].color[1] = m.g;
+        instances[i].color[2] = m.b;
+        instances[i].color[3] = m.a;
+    }
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    
+    if (layer.instanceBuffer == 0) glGenBuffers(1, &layer.instanceBuffer);
+    if (layer.cornerBuffer == 0) {
+        const float corners[8] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+        glGenBuffers(1, &layer.cornerBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, layer.cornerBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, layer.instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    cout << "标记图层: " << markers.size() << " 个点，" << layer.nodes.size() << " 个节点，建树 "
+         << buildMs << " ms" << endl;
+}
+
+const char* markerVertexShader =
+    "#version 120\n"
+    "attribute vec2 corner;\n"
+    "attribute vec3 markerPosition;\n" // 每个实例一份
+    "attribute vec4 markerColor;\n"
+    "uniform float markerPixels;\n"
+    "uniform vec2 viewport;\n"
+    "uniform float markerRadius;\n"
+    "varying vec2 offset;\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "    vec4 eye = gl_ModelViewMatrix * vec4(markerPosition * markerRadius, 1.0);\n"
+    "    vec3 normal = gl_NormalMatrix * markerPosition;\n"
+    "    offset = corner;\n"
+    "    color = markerColor;\n"
+    // 背面的标记直接移出裁剪空间，不产生片元
+    "    if (dot(normal, eye.xyz) > 0.0) {\n"
+    "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "        return;\n"
+    "    }\n"
+    "    vec4 clip = gl_ProjectionMatrix * eye;\n"
+    "    clip.xy += corner * markerPixels / viewport * clip.w;\n"
+    "    gl_Position = clip;\n"
+    "}\n";
+
+const char* markerFragmentShader =
+    "#version 120\n"
+    "varying vec2 offset;\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "    float d = dot(offset, offset);\n"
+    "    if (d > 1.0) discard;\n"
+    "    gl_FragColor = vec4(color.rgb * (1.0 - 0.4 * d), color.a);\n" // 边缘稍暗，密集时仍能分辨单个点
+    "}\n";
+
+bool ensureMarkerProgram() {
+    if (markerProgram == 0 && !markerUnavailable) {
+        markerProgram = createShaderProgram(markerVertexShader, markerFragmentShader, "markers");
+        if (markerProgram == 0) {
+            cerr << "警告: 标记着色器不可用，不绘制标记" << endl;
+            markerUnavailable = true;
+        }
+    }
+    return markerProgram != 0;
+}
+
+// 选出本帧要绘制的节点，合并为实例范围 (起点, 数量)，返回选中的节点数。
+// matrices 为本帧的矩阵（与渲染器相同），lodPixels 为停止细分的点间距（像素）
+int selectMarkerNodes(const MarkerLayer& layer, const SceneMatrices& matrices, int width, int height, float lodPixels,
+                      vector<pair<int, int> >& ranges) {
+    ranges.clear();
+    if (layer.nodes.empty()) return 0;
+    
+    // 地球矩阵的线性部分是 zoom 倍的正交矩阵
+    const float* globe = matrices.globe.m;
+    float scale = sqrt(globe[0] * globe[0] + globe[1] * globe[1] + globe[2] * globe[2]);
+    const float* camera = matrices.cameraObject;
+    float distance = sqrt(camera[0] * camera[0] + camera[1] * camera[1] + camera[2] * camera[2]);
+    float dir[3] = {camera[0] / distance, camera[1] / distance, camera[2] / distance};
+    float horizon = distance > MARKER_RADIUS ? acos(MARKER_RADIUS / distance) : PI;
+    
+    // 视锥的半角正切直接取自投影矩阵
+    const float zNear = 0.1f;
+    float tanHalfY = 1.0f / matrices.projection.m[5];
+    float tanHalfX = 1.0f / matrices.projection.m[0];
+    float focalPixels = height * 0.5f / tanHalfY;
+    // 视锥四个侧面的单位法线（视空间，指向视锥内）
+    float lenX = sqrt(1.0f + tanHalfX * tanHalfX), lenY = sqrt(1.0f + tanHalfY * tanHalfY);
+    const float planes[4][3] = {{1.0f / lenX, 0.0f, -tanHalfX / lenX}, {-1.0f / lenX, 0.0f, -tanHalfX / lenX},
+                                {0.0f, 1.0f / lenY, -tanHalfY / lenY}, {0.0f, -1.0f / lenY, -tanHalfY / lenY}};
+    
+    vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        const MarkerNode& node = layer.nodes[stack.back()];
+        stack.pop_back();
+        
+        // 球冠整个在地平线之后则剔除
+        float cosAngle = node.center[0] * dir[0] + node.center[1] * dir[1] + node.center[2] * dir[2];
+        float angle = acos(min(max(cosAngle, -1.0f), 1.0f));
+        if (angle > horizon + node.angularRadius) continue;
+        
+        // 小于半球的球冠用包围球（球心 cos(a)*c，半径 sin(a)）做视锥剔除和屏幕尺寸估计，更大的用整个球
+        float local[3] = {0.0f, 0.0f, 0.0f}, eye[3];
+        float radius = MARKER_RADIUS * scale;
+        if (node.angularRadius < 1.5707963f) {
+            float offset = cos(node.angularRadius) * MARKER_RADIUS;
+            for (int i = 0; i < 3; ++i) local[i] = node.center[i] * offset;
+            radius *= sin(node.angularRadius);
+        }
+        transformPoint(globe, local, eye);
+        bool outside = false;
+        for (int k = 0; k < 4 && !outside; ++k) {
+            outside = planes[k][0] * eye[0] + planes[k][1] * eye[1] + planes[k][2] * eye[2] < -radius;
+        }
+        if (outside) continue;
+        // 格子正对相机时在屏幕上的面积开方，除以本节点的点数开方，近似为屏幕上的点间距；
+        // 子节点的点间距约为一半，本节点间距不到两倍阈值时细分只会让点互相重叠。
+        // 比屏幕还大的格子大部分点不在屏幕上，总是细分
+        float extent = sqrt(node.area) * MARKER_RADIUS * scale / max(-eye[2], zNear) * focalPixels;
+        float spacing = extent / sqrt((float)max(node.count, 1));
+        bool refine = spacing >= 2.0f * lodPixels || extent > max(width, height);
+        
+        if (node.count > 0) ranges.push_back(make_pair(node.first, node.count));
+        if (!refine) continue;
+        for (int c = 0; c < 4; ++c) {
+            if (node.children[c] >= 0) stack.push_back(node.children[c]);
+        }
+    }
+    
+    // 深度优先排列下相邻的节点在缓冲区里也相邻，合并成一次绘制
+    int selected = (int)ranges.size();
+    if (ranges.empty()) return 0;
+    sort(ranges.begin(), ranges.end());
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[merged].first + ranges[merged].second == ranges[i].first) {
+            ranges[merged].second += ranges[i].second;
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    ranges.resize(merged + 1);
+    return selected;
+}
+
+// 绘制标记图层。调用时模型视图矩阵为地球矩阵（matrices.globe）
+void drawMarkers(const SceneMatrices& matrices) {
+    if (!markerData.empty()) {
+        buildMarkerLayer(markerLayer, markerData);
+        vector<GeoMarker>().swap(markerData);
+    }
+    if (markerLayer.pointCount == 0 || !ensureMarkerProgram()) return;
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    float pixels = markerPixels * min(max(sqrt(zoom), 0.5f), 3.0f); // 标记直径随缩放变化，但限制在一定范围内
+    static vector<pair<int, int> > ranges;
+    if (markerLodEnabled) {
+        markerLayer.drawnNodes = selectMarkerNodes(markerLayer, matrices, WIDTH, HEIGHT, pixels * markerLodScale, ranges);
+    } else {
+        ranges.assign(1, make_pair(0, (int)markerLayer.pointCount));
+        markerLayer.drawnNodes = (int)markerLayer.nodes.size();
+    }
+    markerLayer.traverseMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    
+    glUseProgram(markerProgram);
+    glUniform1f(glGetUniformLocation(markerProgram, "markerPixels"), pixels);
+    glUniform2f(glGetUniformLocation(markerProgram, "viewport"), (float)WIDTH, (float)HEIGHT);
+    glUniform1f(glGetUniformLocation(markerProgram, "markerRadius"), MARKER_RADIUS);
+    GLint corner = glGetAttribLocation(markerProgram, "corner");
+    GLint position = glGetAttribLocation(markerProgram, "markerPosition");
+    GLint color = glGetAttribLocation(markerProgram, "markerColor");
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, markerLayer.cornerBuffer);
+    glEnableVertexAttribArray(corner);
+    glVertexAttribPointer(corner, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, markerLayer.instanceBuffer);
+    glEnableVertexAttribArray(position);
+    glEnableVertexAttribArray(color);
+    glVertexAttribDivisor(position, 1);
+    glVertexAttribDivisor(color, 1);
+    
+    const GLsizei stride = 16;
+    long long drawn = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        // 没有 base instance（GL 4.2）时通过属性指针的偏移选择实例范围
+        const char* offset = (const char*)0 + (size_t)ranges[i].first * stride;
+        glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, stride, offset);
+        glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, offset + 12);
+        ++frameDrawCalls;
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, ranges[i].second);
+        drawn += ranges[i].second;
+    }
+    markerLayer.drawnMarkers = drawn;
+    markerLayer.drawCalls = (int)ranges.size();
+    
+    glVertexAttribDivisor(position, 0);
+    glVertexAttribDivisor(color, 0);
+    glDisableVertexAttribArray(corner);
+    glDisableVertexAttribArray(position);
+    glDisableVertexAttribArray(color);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopAttrib();
+    glUseProgram(0);
+}
+
+// ========================
+// 海岸线与国界（多分辨率折线）
+// ========================
+// 完整精度的海岸线和国界有数百万个顶点，缩小时绝大多数线段在屏幕上不到一个像素。
+// 加载时对每条折线做一次 Douglas-Peucker 简化，记下每个顶点被保留所需的容差，
+// 按一组倍增的容差生成嵌套的若干级索引（所有级别共享同一份顶点缓冲）。每帧由相机到
+// 地表最近点的距离换算一个像素对应的角度，选取容差不超过它的最粗一级，每类线一次绘制
+
+const int BORDER_LEVELS = 8;               // 第0级为完整精度
+const float BORDER_BASE_TOLERANCE = 1.25e-4f; // 第1级的容差（弧度），之后每级加倍
+const float BORDER_RADIUS = 1.001f;        // 略高于地表，避免与地球表面深度冲突
+
+enum BorderKind {
+    BORDER_COASTLINE,
+    BORDER_COUNTRY,
+    BORDER_KIND_COUNT
+};
+
+struct BorderPolyline {
+    vector<float> points;      // 经度、纬度交替（度）
+    int kind;
+};
+
+struct BorderLayer {
+    size_t vertexCount;
+    GLuint vertexBuffer;
+    GLuint indexBuffer;
+    // 每级每类线段在索引缓冲中的范围（按索引计）
+    size_t levelFirst[BORDER_LEVELS][BORDER_KIND_COUNT];
+    size_t levelCount[BORDER_LEVELS][BORDER_KIND_COUNT];
+    // 最近一帧的统计
+    int level;
+    long long drawnSegments;
+    BorderLayer() : vertexCount(0), vertexBuffer(0), indexBuffer(0), level(0), drawnSegments(0) {
+        memset(levelFirst, 0, sizeof(levelFirst));
+        memset(levelCount, 0, sizeof(levelCount));
+    }
+};
+
+BorderLayer borderLayer;
+vector<BorderPolyline> borderData; // 等待简化上传的数据（上传后释放）
+bool bordersEnabled = false;
+float borderPixelTolerance = 0.5f; // 简化误差允许的屏幕像素数
+int borderForcedLevel = -1;        // 大于等于0时固定使用该级（仅用于对比测试）
+
+float borderLevelTolerance(int level) {
+    return level == 0 ? 0.0f : BORDER_BASE_TOLERANCE * (float)(1 << (level - 1));
+}
+
+// 读取 GMT 多段格式的折线文件：以 '>' 开头的行开始一条新折线，数据行为 "经度 纬度"
+// （空格、制表符或逗号分隔），# 开头为注释
+bool loadBorderFile(const char* path, int kind, vector<BorderPolyline>& polylines) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "错误: 无法打开折线文件 " << path << endl;
+        return false;
+    }
+    size_t before = polylines.size(), points = 0;
+    BorderPolyline current;
+    current.kind = kind;
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#') continue;
+        if (line[0] == '>') {
+            if (current.points.size() >= 4) polylines.push_back(current);
+            current.points.clear();
+            continue;
+        }
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == ',' || line[i] == '\t') line[i] = ' ';
+        }
+        float lon, lat;
+        if (sscanf(line.c_str(), "%f %f", &lon, &lat) != 2 || fabs(lat) > 90.0f) {
+            cerr << "警告: " << path << " 第 " << lineNumber << " 行无法解析，已跳过" << endl;
+            continue;
+        }
+        if (lon > 180.0f) lon -= 360.0f; // 也接受 0~360 的经度
+        current.points.push_back(lon);
+        current.points.push_back(lat);
+        ++points;
+    }
+    if (current.points.size() >= 4) polylines.push_back(current);
+    cout << "从 " << path << " 读取 " << polylines.size() - before << " 条折线，" << points << " 个顶点" << endl;
+    return true;
+}
+
+// 固定种子生成测试数据：若干个中点位移得到的分形"大陆"轮廓，外加穿过大陆的分形"国界"，
+// 总顶点数约为 count
+void generateBorders(size_t count, vector<BorderPolyline>& polylines) {
+    unsigned int seed = 13579u;
+    struct Coastline {
+        // 每一轮在相邻两点之间插入一个沿法向随机偏移的中点
+        static void subdivide(vector<float>& points, float roughness, unsigned int& s) {
+            vector<float> refined;
+            refined.reserve(points.size() * 2);
+            for (size_t i = 0; i + 2 < points.size(); i += 2) {
+                float dx = points[i + 2] - points[i], dy = points[i + 3] - points[i + 1];
+                float offset = (randomUnit(s) - 0.5f) * roughness;
+                refined.push_back(points[i]);
+                refined.push_back(points[i + 1]);
+                refined.push_back(points[i] + 0.5f * dx - dy * offset);
+                refined.push_back(points[i + 1] + 0.5f * dy + dx * offset);
+            }
+            refined.push_back(points[points.size() - 2]);
+            refined.push_back(points.back());
+            points.swap(refined);
+        }
+    };
+    const int continents = 40, bordersPerContinent = 3;
+    // 海岸线约占八成顶点，每个轮廓从8段开始，每轮细分顶点数加倍
+    int coastRounds = 0, borderRounds = 0;
+    while ((size_t)continents * (8u << (coastRounds + 1)) <= count * 4 / 5) ++coastRounds;
+    while ((size_t)continents * bordersPerContinent * (2u << (borderRounds + 1)) <= count / 5) ++borderRounds;
+    polylines.clear();
+    for (int c = 0; c < continents; ++c) {
+        float centerLat = asin(randomUnit(seed) * 1.4f - 0.7f) * 180.0f / PI;
+        float centerLon = randomUnit(seed) * 360.0f - 180.0f;
+        float radius = 3.0f + 15.0f * randomUnit(seed) * randomUnit(seed);
+        float stretch = 1.0f / max(cos(centerLat * PI / 180.0f), 0.3f); // 高纬度经度方向拉长，保持大致的圆形
+        BorderPolyline coast;
+        coast.kind = BORDER_COASTLINE;
+        for (int i = 0; i < 8; ++i) {
+            float angle = 2.0f * PI * i / 8.0f;
+            float r = radius * (0.7f + 0.6f * randomUnit(seed));
+            coast.points.push_back(centerLon + r * cos(angle) * stretch);
+            coast.points.push_back(centerLat + r * sin(angle));
+        }
+        float closeLon = coast.points[0], closeLat = coast.points[1]; // 闭合轮廓
+        coast.points.push_back(closeLon);
+        coast.points.push_back(closeLat);
+        for (int round = 0; round < coastRounds; ++round) Coastline::subdivide(coast.points, 0.8f, seed);
+        polylines.push_back(coast);
+        
+        for (int b = 0; b < bordersPerContinent; ++b) {
+            float a0 = 2.0f * PI * randomUnit(seed), a1 = a0 + PI * (0.6f + 0.8f * randomUnit(seed));
+            BorderPolyline border;
+            border.kind = BORDER_COUNTRY;
+            const float ends[2] = {a0, a1};
+            for (int e = 0; e < 2; ++e) {
+                border.points.push_back(centerLon + 0.8f * radius * cos(ends[e]) * stretch);
+                border.points.push_back(centerLat + 0.8f * radius * sin(ends[e]));
+            }
+            for (int round = 0; round < borderRounds; ++round) Coastline::subdivide(border.points, 0.6f, seed);
+            polylines.push_back(border);
+        }
+    }
+    for (size_t i = 0; i < polylines.size(); ++i) {
+        vector<float>& points = polylines[i].points;
+        for (size_t j = 1; j < points.size(); j += 2) points[j] = min(max(points[j], -89.0f), 89.0f);
+    }
+}
+
+// 点 p 到弦 ab 的距离（单位球上的向量，小角度时近似为弧度）
+float chordDistance(const float* p, const float* a, const float* b) {
+    float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float ap[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+    float length2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+    float t = length2 > 0.0f ? (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / length2 : 0.0f;
+    t = min(max(t, 0.0f), 1.0f);
+    float d[3] = {ap[0] - t * ab[0], ap[1] - t * ab[1], ap[2] - t * ab[2]};
+    return sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+}
+
+// Douglas-Peucker：importance[i] 为保留第 i 个顶点所需的最大容差。子区间的值不超过父区间，
+// 因此任意容差 t 下保留 importance > t 的顶点，恰好等于以 t 为容差做一次简化的结果，各级自然嵌套
+void computeBorderImportance(const float* positions, int count, vector<float>& importance) {
+    importance.assign(count, 0.0f);
+    if (count < 2) return;
+    importance[0] = importance[count - 1] = 1e30f;
+    struct Span {
+        int first, last;
+        float limit;
+    };
+    vector<Span> stack;
+    Span root = {0, count - 1, 1e30f};
+    stack.push_back(root);
+    while (!stack.empty()) {
+        Span span = stack.back();
+        stack.pop_back();
+        if (span.last - span.first < 2) continue;
+        const float* a = positions + span.first * 3;
+        const float* b = positions + span.last * 3;
+        int farthest = span.first + 1;
+        float maxDistance = -1.0f;
+        for (int i = span.first + 1; i < span.last; ++i) {
+            float d = chordDistance(positions + i * 3, a, b);
+            if (d > maxDistance) {
+                maxDistance = d;
+                farthest = i;
+            }
+        }
+        float value = min(maxDistance, span.limit);
+        importance[farthest] = value;
+        Span left = {span.first, farthest, value}, right = {farthest, span.last, value};
+        stack.push_back(left);
+        stack.push_back(right);
+    }
+}
+
+// 简化全部折线并上传：顶点缓冲保存完整精度的顶点，索引缓冲按 级别 -> 类别 排列 GL_LINES 线段
+void buildBorderLayer(BorderLayer& layer, const vector<BorderPolyline>& polylines) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    size_t vertexCount = 0;
+    for (size_t i = 0; i < polylines.size(); ++i) vertexCount += polylines[i].points.size() / 2;
+    vector<float> positions(vertexCount * 3);
+    vector<float> importance(vertexCount);
+    vector<size_t> firstVertex(polylines.size() + 1, 0);
+    for (size_t i = 0; i < polylines.size(); ++i) firstVertex[i + 1] = firstVertex[i] + polylines[i].points.size() / 2;
+    // 每条折线独立简化，互不依赖，可以并行
+    parallelFor((int)polylines.size(), defaultThreadCount(), [&](int i, int) {
+        const vector<float>& points = polylines[i].points;
+        int count = (int)(points.size() / 2);
+        float* p = &positions[firstVertex[i] * 3];
+        for (int j = 0; j < count; ++j) geoToSphere(points[j * 2 + 1], points[j * 2], p + j * 3);
+        vector<float> local;
+        computeBorderImportance(p, count, local);
+        copy(local.begin(), local.end(), importance.begin() + firstVertex[i]);
+    });
+    
+    vector<unsigned int> indices;
+    size_t levelSize[BORDER_LEVELS] = {0};
+    for (int level = 0; level < BORDER_LEVELS; ++level) {
+        float tolerance = borderLevelTolerance(level);
+        for (int kind = 0; kind < BORDER_KIND_COUNT; ++kind) {
+            layer.levelFirst[level][kind] = indices.size();
+            for (size_t i = 0; i < polylines.size(); ++i) {
+                if (polylines[i].kind != kind) continue;
+                size_t first = firstVertex[i], last = firstVertex[i + 1] - 1;
+                // 整条折线都小于容差（如小岛）时不画
+                float extent = chordDistance(&positions[first * 3], &positions[first * 3], &positions[last * 3]);
+                float detail = 0.0f;
+                for (size_t j = first + 1; j < last; ++j) detail = max(detail, importance[j]);
+                if (level > 0 && extent <= tolerance && detail <= tolerance) continue;
+                size_t previous = first;
+                for (size_t j = first + 1; j <= last; ++j) {
+                    if (j != last && importance[j] <= tolerance && level > 0) continue;
+                    indices.push_back((unsigned int)previous);
+                    indices.push_back((unsigned int)j);
+                    previous = j;
+                }
+            }
+            layer.levelCount[level][kind] = indices.size() - layer.levelFirst[level][kind];
+            levelSize[level] += layer.levelCount[level][kind] / 2;
+        }
+    }
+    for (size_t i = 0; i < positions.size(); ++i) positions[i] *= BORDER_RADIUS;
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    
+    if (layer.vertexBuffer == 0) glGenBuffers(1, &layer.vertexBuffer);
+    if (layer.indexBuffer == 0) glGenBuffers(1, &layer.indexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, layer.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, layer.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    layer.vertexCount = vertexCount;
+    
+    cout << "折线图层: " << polylines.size() << " 条，" << vertexCount << " 个顶点，简化 " << buildMs << " ms，各级线段数:";
+    for (int level = 0; level < BORDER_LEVELS; ++level) cout << " " << levelSize[level];
+    cout << endl;
+}
+
+// 选取本帧的简化级别。matrices 为本帧的矩阵（与渲染器相同）
+int selectBorderLevel(const SceneMatrices& matrices, int height, float pixelTolerance) {
+    const float* camera = matrices.cameraObject;
+    float distance = sqrt(camera[0] * camera[0] + camera[1] * camera[1] + camera[2] * camera[2]);
+    // 透视投影下，距离 depth 处一个像素对应 depth / focalPixels 个物体空间单位（与 zoom 无关，
+    // zoom 只改变相机在物体空间中的距离）。取离相机最近的地表点，保证屏幕上任何位置的误差都不超过阈值
+    float focalPixels = height * 0.5f * matrices.projection.m[5];
+    float depth = max(distance - BORDER_RADIUS, 1e-6f);
+    float tolerance = pixelTolerance * depth / focalPixels;
+    int level = 0;
+    while (level + 1 < BORDER_LEVELS && borderLevelTolerance(level + 1) <= tolerance) ++level;
+    return level;
+}
+
+// 绘制折线图层。调用时模型视图矩阵为地球矩阵（matrices.globe）
+void drawBorders(const SceneMatrices& matrices) {
+    if (!borderData.empty()) {
+        buildBorderLayer(borderLayer, borderData);
+        vector<BorderPolyline>().swap(borderData);
+    }
+    if (borderLayer.vertexCount == 0) return;
+    
+    int level = borderForcedLevel >= 0 ? min(borderForcedLevel, BORDER_LEVELS - 1)
+                                       : selectBorderLevel(matrices, HEIGHT, borderPixelTolerance);
+    const float colors[BORDER_KIND_COUNT][4] = {{0.85f, 0.95f, 1.0f, 0.9f}, {1.0f, 0.85f, 0.3f, 0.8f}};
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, borderLayer.vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, borderLayer.indexBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, 0);
+    long long drawn = 0;
+    for (int kind = 0; kind < BORDER_KIND_COUNT; ++kind) {
+        size_t count = borderLayer.levelCount[level][kind];
+        if (count == 0) continue;
+        glColor4fv(colors[kind]);
+        ++frameDrawCalls;
+        glDrawElements(GL_LINES, (GLsizei)count, GL_UNSIGNED_INT,
+                       (const char*)0 + borderLayer.levelFirst[level][kind] * sizeof(unsigned int));
+        drawn += count / 2;
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopAttrib();
+    
+    borderLayer.level = level;
+    borderLayer.drawnSegments = drawn;
+}
+
+// ========================
+// 航线（大圆弧批量绘制）
+// ========================
+// 航班、航运的起讫点对可以有十万条以上。每条航线沿大圆插值，中间抬高形成弧，分段数由
+// 弧的角长度和当前缩放级别决定。所有弧的顶点放在同一个常驻顶点缓冲中，每条弧占一个槽位，
+// 用一次 glMultiDrawArrays 画完。数据更新时只重新生成变化的弧：新顶点数放得下就原地改写，
+// 否则把它移到缓冲末尾，变化的槽位合并成连续区间后用 glBufferSubData 上传。
+// 缩放级别改变（分段数整体变化）或废弃的槽位过多时才整体重建
+
+const float ROUTE_BASE_STEP = 6.0f;        // 缩放级别0时每段最多跨越的角度（度），每升一级减半
+const int ROUTE_MAX_DETAIL = 5;
+const int ROUTE_MAX_SEGMENTS = 512;
+const float ROUTE_HEIGHT = 0.06f;          // 弧顶抬高 = 该系数 * 弧的角长度（弧度）
+const float ROUTE_RADIUS = 1.002f;
+
+struct RouteArc {
+    float lat0, lon0, lat1, lon1;
+    unsigned char r, g, b, a;
+};
+
+struct RouteVertex {
+    float position[3];
+    unsigned char color[4];
+};
+
+struct RouteLayer {
+    vector<RouteArc> arcs;
+    vector<GLint> first;          // 每条弧的槽位起点（顶点）
+    vector<GLsizei> count;        // 每条弧当前的顶点数
+    vector<int> capacity;         // 槽位容量（顶点）
+    vector<RouteVertex> vertices; // 缓冲内容的CPU副本，增长或重建时整体上传
+    size_t used;                  // 已分配到的位置
+    size_t wasted;                // 搬走的弧留下的空槽位
+    vector<int> dirty;            // 待重新生成的弧
+    vector<unsigned char> dirtyFlag;
+    bool rebuild;                 // 下次绘制前整体重建
+    int detail;                   // 当前顶点对应的缩放级别，-1 表示尚未生成
+    GLuint buffer;
+    size_t bufferVertices;        // GPU缓冲容量（顶点）
+    // 最近一次同步的统计
+    int updatedArcs;
+    size_t uploadedBytes;
+    int uploadCalls;
+    double updateMs;
+    RouteLayer() : used(0), wasted(0), rebuild(true), detail(-1), buffer(0), bufferVertices(0), updatedArcs(0),
+                   uploadedBytes(0), uploadCalls(0), updateMs(0.0) {}
+};
+
+RouteLayer routeLayer;
+bool routesEnabled = false;
+
+// 缩放级别：zoom 每翻一倍，屏幕上弧长翻一倍，分段数也翻一倍
+int routeDetailLevel(float zoomFactor) {
+    int level = 0;
+    while (level < ROUTE_MAX_DETAIL && zoomFactor > (float)(1 << level) * 1.0001f) ++level;
+    return level;
+}
+
+// 弧两端的单位向量和角长度（弧度）
+float routeEndpoints(const RouteArc& arc, float a[3], float b[3]) {
+    geoToSphere(arc.lat0, arc.lon0, a);
+    geoToSphere(arc.lat1, arc.lon1, b);
+    float d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acos(min(max(d, -1.0f), 1.0f));
+}
+
+int routeSegmentCount(float angle, int detail) {
+    float step = ROUTE_BASE_STEP / (float)(1 << detail) * PI / 180.0f;
+    return min(max((int)ceil(angle / step), 1), ROUTE_MAX_SEGMENTS);
+}
+
+// 沿大圆生成 segments + 1 个顶点：p(t) = a cos(t*angle) + (n x a) sin(t*angle)，n 为大圆法向，
+// 两端重合或正好相对时也有定义（相对时任取一个过两点的大圆）
+void tessellateRoute(const RouteArc& arc, const float a[3], const float b[3], float angle, int segments,
+                     RouteVertex* out) {
+    float n[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    float length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length < 1e-6f) {
+        float axis[3] = {fabs(a[0]) < 0.9f ? 1.0f : 0.0f, fabs(a[0]) < 0.9f ? 0.0f : 1.0f, 0.0f};
+        n[0] = a[1] * axis[2] - a[2] * axis[1];
+        n[1] = a[2] * axis[0] - a[0] * axis[2];
+        n[2] = a[0] * axis[1] - a[1] * axis[0];
+        length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    }
+    for (int i = 0; i < 3; ++i) n[i] /= length;
+    float tangent[3] = {n[1] * a[2] - n[2] * a[1], n[2] * a[0] - n[0] * a[2], n[0] * a[1] - n[1] * a[0]};
+    for (int s = 0; s <= segments; ++s) {
+        float t = (float)s / segments;
+        float c = cos(t * angle), sn = sin(t * angle);
+        float radius = ROUTE_RADIUS + ROUTE_HEIGHT * angle * sin(PI * t);
+        for (int i = 0; i < 3; ++i) out[s].position[i] = (a[i] * c + tangent[i] * sn) * radius;
+        out[s].color[0] = arc.r;
+        out[s].color[1] = arc.g;
+        out[s].color[2] = arc.b;
+        out[s].color[3] = arc.a;
+    }
+}
+
+// 替换全部航线（下次绘制前整体重建）
+void setRoutes(RouteLayer& layer, const vector<RouteArc>& arcs) {
+    layer.arcs = arcs;
+    layer.dirty.clear();
+    layer.dirtyFlag.assign(arcs.size(), 0);
+    layer.rebuild = true;
+}
+
+// 修改一条航线，下次绘制前只重新生成它
+void updateRoute(RouteLayer& layer, size_t index, const RouteArc& arc) {
+    if (index >= layer.arcs.size()) return;
+    layer.arcs[index] = arc;
+    if (!layer.dirtyFlag[index]) {
+        layer.dirtyFlag[index] = 1;
+        layer.dirty.push_back((int)index);
+    }
+}
+
+// 整体重建：先串行分配槽位（前缀和），再并行生成顶点
+void rebuildRouteVertices(RouteLayer& layer, int detail) {
+    size_t n = layer.arcs.size();
+    layer.first.resize(n);
+    layer.count.resize(n);
+    layer.capacity.resize(n);
+    vector<float> angles(n);
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        float a[3], b[3];
+        angles[i] = routeEndpoints(layer.arcs[i], a, b);
+        int vertices = routeSegmentCount(angles[i], detail) + 1;
+        layer.first[i] = (GLint)total;
+        layer.count[i] = vertices;
+        layer.capacity[i] = vertices;
+        total += vertices;
+    }
+    layer.vertices.resize(total);
+    const int CHUNK = 1024;
+    parallelFor((int)((n + CHUNK - 1) / CHUNK), defaultThreadCount(), [&](int chunk, int) {
+        size_t end = min(n, (size_t)(chunk + 1) * CHUNK);
+        for (size_t i = (size_t)chunk * CHUNK; i < end; ++i) {
+            float a[3], b[3];
+            routeEndpoints(layer.arcs[i], a, b);
+            tessellateRoute(layer.arcs[i], a, b, angles[i], layer.count[i] - 1, &layer.vertices[layer.first[i]]);
+        }
+    });
+    layer.used = total;
+    layer.wasted = 0;
+    layer.detail = detail;
+}
+
+// 把顶点同步到GPU：需要整体重建时重建并整体上传，否则只重新生成并上传变化的弧
+void syncRouteBuffer(RouteLayer& layer, int detail) {
+    if (!layer.rebuild && layer.dirty.empty() && detail == layer.detail) return;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (layer.buffer == 0) glGenBuffers(1, &layer.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, layer.buffer);
+    layer.uploadedBytes = 0;
+    layer.uploadCalls = 0;
+    
+    bool full = layer.rebuild || detail != layer.detail;
+    vector<pair<size_t, size_t> > ranges; // 需要上传的顶点区间 [起点, 终点)
+    if (!full) {
+        for (size_t k = 0; k < layer.dirty.size(); ++k) {
+            int i = layer.dirty[k];
+            float a[3], b[3];
+            float angle = routeEndpoints(layer.arcs[i], a, b);
+            int vertices = routeSegmentCount(angle, detail) + 1;
+            if (vertices > layer.capacity[i]) {
+                // 原槽位放不下，搬到末尾，容量留一倍余量，避免下次变长又要搬
+                layer.wasted += layer.capacity[i];
+                layer.first[i] = (GLint)layer.used;
+                layer.capacity[i] = min(vertices * 2, ROUTE_MAX_SEGMENTS + 1);
+                layer.used += layer.capacity[i];
+                if (layer.used > layer.vertices.size()) layer.vertices.resize(max(layer.used, layer.vertices.size() * 3 / 2));
+            }
+            layer.count[i] = vertices;
+            tessellateRoute(layer.arcs[i], a, b, angle, vertices - 1, &layer.vertices[layer.first[i]]);
+            ranges.push_back(make_pair((size_t)layer.first[i], (size_t)layer.first[i] + vertices));
+        }
+        layer.updatedArcs = (int)layer.dirty.size();
+        // 空槽位超过一半时整体重建，压缩缓冲
+        full = layer.wasted > layer.used / 2 || layer.used > layer.bufferVertices;
+    }
+    if (full) {
+        if (layer.rebuild || detail != layer.detail || layer.wasted > layer.used / 2) {
+            rebuildRouteVertices(layer, detail);
+            layer.updatedArcs = (int)layer.arcs.size();
+        }
+        // 缓冲按1.5倍增长，之后的小更新不必重新分配
+        layer.bufferVertices = max(layer.vertices.size(), layer.used * 3 / 2);
+        layer.vertices.resize(layer.bufferVertices);
+        glBufferData(GL_ARRAY_BUFFER, layer.bufferVertices * sizeof(RouteVertex), layer.vertices.data(), GL_DYNAMIC_DRAW);
+        layer.uploadedBytes = layer.bufferVertices * sizeof(RouteVertex);
+        layer.uploadCalls = 1;
+    } else {
+        // 按起点排序，间隔不超过64个顶点的区间合并，减少调用次数
+        sort(ranges.begin(), ranges.end());
+        size_t merged = 0;
+        for (size_t k = 1; k < ranges.size(); ++k) {
+            if (ranges[k].first <= ranges[merged].second + 64) {
+                ranges[merged].second = max(ranges[merged].second, ranges[k].second);
+            } else {
+                ranges[++merged] = ranges[k];
+            }
+        }
+        if (!ranges.empty()) ranges.resize(merged + 1);
+        for (size_t k = 0; k < ranges.size(); ++k) {
+            size_t bytes = (ranges[k].second - ranges[k].first) * sizeof(RouteVertex);
+            glBufferSubData(GL_ARRAY_BUFFER, ranges[k].first * sizeof(RouteVertex), bytes, &layer.vertices[ranges[k].first]);
+            layer.uploadedBytes += bytes;
+            ++layer.uploadCalls;
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    for (size_t k = 0; k < layer.dirty.size(); ++k) layer.dirtyFlag[layer.dirty[k]] = 0;
+    layer.dirty.clear();
+    layer.rebuild = false;
+    layer.updateMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 读取航线文件：每行 "起点纬度,起点经度,终点纬度,终点经度[,r,g,b[,a]]"，# 开头为注释
+bool loadRouteFile(const char* path, vector<RouteArc>& arcs) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "错误: 无法打开航线文件 " << path << endl;
+        return false;
+    }
+    arcs.clear();
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#') continue;
+        RouteArc arc;
+        int r = 255, g = 200, b = 80, a = 160;
+        int fields = sscanf(line.c_str(), "%f,%f,%f,%f,%d,%d,%d,%d", &arc.lat0, &arc.lon0, &arc.lat1, &arc.lon1,
+                            &r, &g, &b, &a);
+        if (fields < 4 || fabs(arc.lat0) > 90.0f || fabs(arc.lat1) > 90.0f) {
+            cerr << "警告: " << path << " 第 " << lineNumber << " 行无法解析，已跳过" << endl;
+            continue;
+        }
+        arc.r = (unsigned char)min(max(r, 0), 255);
+        arc.g = (unsigned char)min(max(g, 0), 255);
+        arc.b = (unsigned char)min(max(b, 0), 255);
+        arc.a = (unsigned char)min(max(a, 0), 255);
+        arcs.push_back(arc);
+    }
+    cout << "从 " << path << " 读取 " << arcs.size() << " 条航线" << endl;
+    return true;
+}
+
+// 固定种子生成测试数据：在若干"机场"之间连线，大机场的航线更多，颜色按距离从黄到红
+void generateRoutes(size_t count, vector<RouteArc>& arcs) {
+    unsigned int seed = 97531u;
+    const int airports = 300;
+    float lat[airports], lon[airports];
+    for (int i = 0; i < airports; ++i) {
+        lat[i] = asin(randomUnit(seed) * 1.5f - 0.7f) * 180.0f / PI;
+        lon[i] = randomUnit(seed) * 360.0f - 180.0f;
+    }
+    arcs.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        int from = (int)(randomUnit(seed) * randomUnit(seed) * airports); // 偏向排在前面的大机场
+        int to = (int)(randomUnit(seed) * airports);
+        if (to == from) to = (to + 1) % airports;
+        RouteArc& arc = arcs[i];
+        arc.lat0 = lat[from]; arc.lon0 = lon[from];
+        arc.lat1 = lat[to]; arc.lon1 = lon[to];
+        float a[3], b[3];
+        float t = routeEndpoints(arc, a, b) / PI;
+        arc.r = 255;
+        arc.g = (unsigned char)(220 - 180 * t);
+        arc.b = (unsigned char)(90 - 70 * t);
+        arc.a = 60;
+    }
+}
+
+// 绘制航线图层。调用时模型视图矩阵为地球矩阵
+void drawRoutes() {
+    if (routeLayer.arcs.empty()) return;
+    syncRouteBuffer(routeLayer, routeDetailLevel(zoom));
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE); // 半透明的弧互相叠加，不遮挡彼此
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, routeLayer.buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(RouteVertex), (const char*)0);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(RouteVertex), (const char*)0 + 12);
+    ++frameDrawCalls;
+    glMultiDrawArrays(GL_LINE_STRIP, routeLayer.first.data(), routeLayer.count.data(), (GLsizei)routeLayer.arcs.size());
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopAttrib();
+}
+
+// ========================
+// 事件密度热力图（CPU累加，分块增量上传）
+// ========================
+// 事件（告警、签到、交易等）按经纬度和权重以高斯核累加到等经纬度网格上，作为半透明图层
+// 覆盖在地球外面。事件不断到达和过期，每次只把新增和删除的点累加（删除即以负权重累加），
+// 不重新计算整张网格。一批点较多时分给多个线程，各自累加到线程私有的局部网格，再按块用
+// SIMD 把各线程写过的块加回主网格并清零。网格分成 64x64 的块，只有被改动的块用
+// glTexSubImage2D 重新上传；纹理存原始密度，归一化放在着色器中，最大值变化时不必重传
+
+const int HEATMAP_WIDTH = 1024;
+const int HEATMAP_HEIGHT = 512;
+const int HEATMAP_TILE = 64;
+const int HEATMAP_TILES_X = HEATMAP_WIDTH / HEATMAP_TILE;
+const int HEATMAP_TILES_Y = HEATMAP_HEIGHT / HEATMAP_TILE;
+const float HEATMAP_SIGMA = 1.5f;           // 高斯核标准差（格点，按赤道处的格距）
+const int HEATMAP_RADIUS = 4;               // 核的纬向半径（格点）
+const int HEATMAP_MAX_RADIUS_X = HEATMAP_TILE; // 高纬度处经向半径按 1/cos(纬度) 放宽，但不超过此值
+const size_t HEATMAP_PARALLEL_MIN = 4096;   // 一批少于这么多点时直接串行累加到主网格
+const float HEATMAP_LAYER_SCALE = 1.004f;
+const float HEATMAP_STREAM_LIFETIME = 8.0f; // 模拟事件流中每个事件存在的秒数
+
+struct HeatPoint {
+    float lat, lon, weight;
+};
+
+struct HeatmapLayer {
+    vector<float> grid;                 // 主网格，第0行为北纬90°（与地球纹理 t=0 一致）
+    vector<vector<float> > partial;     // 每个线程的局部网格，归并后清零
+    vector<vector<unsigned char> > partialTouched; // 每个线程写过的块
+    vector<unsigned char> dirtyTile;    // 待上传的块
+    vector<float> tileMax;              // 每块的最大密度
+    vector<HeatPoint> points;           // 按编号存放，weight 为0表示空闲
+    vector<int> freeIds;
+    vector<HeatPoint> pending;          // 尚未累加的点，删除的点权重取负
+    size_t livePoints;
+    float maxDensity;
+    GLuint texture;
+    // 最近一次更新的统计
+    size_t splattedPoints;
+    int uploadedTiles;
+    int uploadCalls;
+    double splatMs, reduceMs, uploadMs;
+    HeatmapLayer() : livePoints(0), maxDensity(0.0f), texture(0), splattedPoints(0), uploadedTiles(0), uploadCalls(0),
+                     splatMs(0.0), reduceMs(0.0), uploadMs(0.0) {}
+};
+
+HeatmapLayer heatmapLayer;
+bool heatmapEnabled = false;
+bool heatmapFailed = false;
+GLuint heatmapProgram = 0;
+float heatmapOpacity = 0.8f;
+double heatmapStreamRate = 0.0;              // --heatmap-stream 每秒到达的模拟事件数，0 表示不模拟
+deque<pair<double, int> > heatmapStreamLive; // 模拟事件的到达时间和编号，按时间顺序过期
+chrono::steady_clock::time_point heatmapStreamClock;
+
+void initHeatmapLayer(HeatmapLayer& layer) {
+    if (!layer.grid.empty()) return;
+    layer.grid.assign((size_t)HEATMAP_WIDTH * HEATMAP_HEIGHT, 0.0f);
+    layer.dirtyTile.assign(HEATMAP_TILES_X * HEATMAP_TILES_Y, 0);
+    layer.tileMax.assign(HEATMAP_TILES_X * HEATMAP_TILES_Y, 0.0f);
+}
+
+// 新增一个点，返回编号（供删除时使用）。累加推迟到下一次 updateHeatmap
+int addHeatPoint(HeatmapLayer& layer, float lat, float lon, float weight) {
+    if (!(weight > 0.0f) || fabs(lat) > 90.0f) return -1;
+    HeatPoint point = {lat, lon, weight};
+    int id;
+    if (!layer.freeIds.empty()) {
+        id = layer.freeIds.back();
+        layer.freeIds.pop_back();
+        layer.points[id] = point;
+    } else {
+        id = (int)layer.points.size();
+        layer.points.push_back(point);
+    }
+    layer.pending.push_back(point);
+    ++layer.livePoints;
+    return id;
+}
+
+void removeHeatPoint(HeatmapLayer& layer, int id) {
+    if (id < 0 || id >= (int)layer.points.size() || layer.points[id].weight == 0.0f) return;
+    HeatPoint point = layer.points[id];
+    point.weight = -point.weight;
+    layer.pending.push_back(point);
+    layer.points[id].weight = 0.0f;
+    layer.freeIds.push_back(id);
+    --layer.livePoints;
+}
+
+// 把一个点的高斯核累加到 target（主网格或局部网格），并标记写过的块。
+// 核可分离：exp(-(dx²+dy²)/2σ²) = exp(-dx²/2σ²)·exp(-dy²/2σ²)，每个点只需 O(宽+高) 次 exp。
+// 经向格距随纬度按 cos 缩小，经向半径相应放宽，使核在球面上大致是圆的；经度方向首尾相接
+void splatHeatPoint(const HeatPoint& point, float* target, unsigned char* touched) {
+    const float DEG = PI / 180.0f;
+    float cx = (point.lon + 180.0f) / 360.0f * HEATMAP_WIDTH - 0.5f;
+    float cy = (90.0f - point.lat) / 180.0f * HEATMAP_HEIGHT - 0.5f;
+    float shrink = max(cos(point.lat * DEG), 1e-3f);
+    int radiusX = min((int)ceil(HEATMAP_RADIUS / shrink), HEATMAP_MAX_RADIUS_X);
+    int x0 = (int)floor(cx) - radiusX + 1, y0 = (int)floor(cy) - HEATMAP_RADIUS + 1;
+    int spanX = 2 * radiusX, spanY = 2 * HEATMAP_RADIUS;
+    float inverse = -0.5f / (HEATMAP_SIGMA * HEATMAP_SIGMA);
+    
+    float kernelX[2 * HEATMAP_MAX_RADIUS_X], kernelY[2 * HEATMAP_RADIUS];
+    for (int i = 0; i < spanX; ++i) {
+        float d = (x0 + i - cx) * shrink;
+        kernelX[i] = exp(d * d * inverse);
+    }
+    for (int j = 0; j < spanY; ++j) {
+        float d = y0 + j - cy;
+        kernelY[j] = point.weight * exp(d * d * inverse);
+    }
+    for (int j = 0; j < spanY; ++j) {
+        int y = y0 + j;
+        if (y < 0 || y >= HEATMAP_HEIGHT) continue;
+        float* row = target + (size_t)y * HEATMAP_WIDTH;
+        unsigned char* tileRow = touched + (y / HEATMAP_TILE) * HEATMAP_TILES_X;
+        float wy = kernelY[j];
+        for (int i = 0; i < spanX; ++i) {
+            int x = ((x0 + i) % HEATMAP_WIDTH + HEATMAP_WIDTH) % HEATMAP_WIDTH;
+            row[x] += wy * kernelX[i];
+            tileRow[x / HEATMAP_TILE] = 1;
+        }
+    }
+}
+
+// 把各线程的局部网格中属于一个块的部分加回主网格并清零，再把负值（删除时的舍入误差）截为0、
+// 更新该块的最大值。每次处理4个格点
+void reduceHeatmapTile(HeatmapLayer& layer, int tile, int workers) {
+    int x0 = (tile % HEATMAP_TILES_X) * HEATMAP_TILE, y0 = (tile / HEATMAP_TILES_X) * HEATMAP_TILE;
+    F4 zero = f4Set1(0.0f), peak = zero;
+    for (int y = y0; y < y0 + HEATMAP_TILE; ++y) {
+        float* dst = &layer.grid[(size_t)y * HEATMAP_WIDTH + x0];
+        for (int w = 0; w < workers; ++w) {
+            if (!layer.partialTouched[w][tile]) continue;
+            float* src = &layer.partial[w][(size_t)y * HEATMAP_WIDTH + x0];
+            for (int x = 0; x < HEATMAP_TILE; x += 4) {
+                f4Store(dst + x, f4Add(f4Load(dst + x), f4Load(src + x)));
+                f4Store(src + x, zero);
+            }
+        }
+        for (int x = 0; x < HEATMAP_TILE; x += 4) {
+            F4 v = f4Max(f4Load(dst + x), zero);
+            f4Store(dst + x, v);
+            peak = f4Max(peak, v);
+        }
+    }
+    float lanes[4];
+    f4Store(lanes, peak);
+    layer.tileMax[tile] = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+    layer.dirtyTile[tile] = 1;
+}
+
+// 累加所有待处理的点。threads <= 0 时使用默认线程数
+void updateHeatmap(HeatmapLayer& layer, int threads) {
+    initHeatmapLayer(layer);
+    layer.splattedPoints = layer.pending.size();
+    layer.splatMs = layer.reduceMs = 0.0;
+    if (layer.pending.empty()) return;
+    if (threads <= 0) threads = defaultThreadCount();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const int tiles = HEATMAP_TILES_X * HEATMAP_TILES_Y;
+    
+    if (layer.livePoints == 0) {
+        // 全部删除：直接清零非空的块，不累积舍入误差
+        for (int tile = 0; tile < tiles; ++tile) {
+            if (layer.tileMax[tile] == 0.0f) continue;
+            int x0 = (tile % HEATMAP_TILES_X) * HEATMAP_TILE, y0 = (tile / HEATMAP_TILES_X) * HEATMAP_TILE;
+            for (int y = y0; y < y0 + HEATMAP_TILE; ++y) {
+                memset(&layer.grid[(size_t)y * HEATMAP_WIDTH + x0], 0, HEATMAP_TILE * sizeof(float));
+            }
+            layer.tileMax[tile] = 0.0f;
+            layer.dirtyTile[tile] = 1;
+        }
+    } else if (layer.pending.size() < HEATMAP_PARALLEL_MIN || threads == 1) {
+        vector<unsigned char> touched(tiles, 0);
+        for (size_t i = 0; i < layer.pending.size(); ++i) splatHeatPoint(layer.pending[i], layer.grid.data(), touched.data());
+        chrono::steady_clock::time_point splatted = chrono::steady_clock::now();
+        layer.splatMs = chrono::duration<double, milli>(splatted - start).count();
+        // 没有局部网格参与，归并只做截断和求最大值
+        for (int tile = 0; tile < tiles; ++tile) {
+            if (touched[tile]) reduceHeatmapTile(layer, tile, 0);
+        }
+        layer.reduceMs = chrono::duration<double, milli>(chrono::steady_clock::now() - splatted).count();
+    } else {
+        if ((int)layer.partial.size() < threads) {
+            layer.partial.resize(threads);
+            layer.partialTouched.resize(threads);
+        }
+        for (int w = 0; w < threads; ++w) {
+            if (layer.partial[w].empty()) layer.partial[w].assign(layer.grid.size(), 0.0f);
+            layer.partialTouched[w].assign(tiles, 0);
+        }
+        // 按块分给线程，块比线程多，快的线程多领几块
+        const int chunks = threads * 8;
+        size_t count = layer.pending.size();
+        parallelFor(chunks, threads, [&](int chunk, int worker) {
+            size_t begin = count * chunk / chunks, end = count * (chunk + 1) / chunks;
+            float* target = layer.partial[worker].data();
+            unsigned char* touched = layer.partialTouched[worker].data();
+            for (size_t i = begin; i < end; ++i) splatHeatPoint(layer.pending[i], target, touched);
+        });
+        chrono::steady_clock::time_point splatted = chrono::steady_clock::now();
+        layer.splatMs = chrono::duration<double, milli>(splatted - start).count();
+        
+        vector<int> touchedTiles;
+        for (int tile = 0; tile < tiles; ++tile) {
+            for (int w = 0; w < threads; ++w) {
+                if (layer.partialTouched[w][tile]) {
+                    touchedTiles.push_back(tile);
+                    break;
+                }
+            }
+        }
+        parallelFor((int)touchedTiles.size(), threads, [&](int i, int) {
+            reduceHeatmapTile(layer, touchedTiles[i], threads);
+        });
+        layer.reduceMs = chrono::duration<double, milli>(chrono::steady_clock::now() - splatted).count();
+    }
+    layer.pending.clear();
+    layer.maxDensity = *max_element(layer.tileMax.begin(), layer.tileMax.end());
+}
+
+// 只上传改动过的块（需要当前GL上下文）。同一行中相邻的脏块合并为一次 glTexSubImage2D，
+// UNPACK_ROW_LENGTH / SKIP_* 让 GL 直接从主网格中取出矩形区域，不需要先拷贝到临时缓冲
+void uploadHeatmapTiles(HeatmapLayer& layer) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    layer.uploadedTiles = 0;
+    layer.uploadCalls = 0;
+    if (layer.texture == 0) {
+        glGenTextures(1, &layer.texture);
+        glBindTexture(GL_TEXTURE_2D, layer.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // 空网格直接以全0分配，之后只更新有改动的块
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE32F_ARB, HEATMAP_WIDTH, HEATMAP_HEIGHT, 0, GL_LUMINANCE, GL_FLOAT,
+                     layer.grid.data());
+    } else {
+        glBindTexture(GL_TEXTURE_2D, layer.texture);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, HEATMAP_WIDTH);
+    for (int ty = 0; ty < HEATMAP_TILES_Y; ++ty) {
+        unsigned char* dirty = &layer.dirtyTile[ty * HEATMAP_TILES_X];
+        for (int tx = 0; tx < HEATMAP_TILES_X;) {
+            if (!dirty[tx]) {
+                ++tx;
+                continue;
+            }
+            int end = tx;
+            while (end < HEATMAP_TILES_X && dirty[end]) dirty[end++] = 0;
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, tx * HEATMAP_TILE);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, ty * HEATMAP_TILE);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, tx * HEATMAP_TILE, ty * HEATMAP_TILE, (end - tx) * HEATMAP_TILE,
+                            HEATMAP_TILE, GL_LUMINANCE, GL_FLOAT, layer.grid.data());
+            layer.uploadedTiles += end - tx;
+            ++layer.uploadCalls;
+            tx = end;
+        }
+    }
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    layer.uploadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 读取事件文件：每行 "纬度,经度[,权重]"，# 开头为注释
+bool loadHeatmapFile(const char* path, HeatmapLayer& layer) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "错误: 无法打开热力图文件 " << path << endl;
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    size_t loaded = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#') continue;
+        float lat, lon, weight = 1.0f;
+        int fields = sscanf(line.c_str(), "%f,%f,%f", &lat, &lon, &weight);
+        if (fields < 2 || addHeatPoint(layer, lat, lon, weight) < 0) {
+            cerr << "警告: " << path << " 第 " << lineNumber << " 行无法解析，已跳过" << endl;
+            continue;
+        }
+        ++loaded;
+    }
+    cout << "从 " << path << " 读取 " << loaded << " 个事件" << endl;
+    return true;
+}
+
+// 固定种子生成一个测试事件：集中在若干热点附近（越靠前的热点越密集），少数散布各处
+struct HeatEventGenerator {
+    unsigned int seed;
+    float hotLat[64], hotLon[64];
+    explicit HeatEventGenerator(unsigned int s) : seed(s) {
+        for (int i = 0; i < 64; ++i) {
+            hotLat[i] = asin(next() * 1.6f - 0.75f) * 180.0f / PI;
+            hotLon[i] = next() * 360.0f - 180.0f;
+        }
+    }
+    float next() { return randomUnit(seed); }
+    HeatPoint event() {
+        HeatPoint point;
+        if (next() < 0.1f) {
+            point.lat = asin(next() * 2.0f - 1.0f) * 180.0f / PI;
+            point.lon = next() * 360.0f - 180.0f;
+        } else {
+            int hot = (int)(next() * next() * 64);
+            float spread = 1.0f + 6.0f * next() * next(); // 大多数事件紧挨着热点
+            float angle = next() * 2.0f * PI;
+            point.lat = min(max(hotLat[hot] + spread * sin(angle), -89.9f), 89.9f);
+            point.lon = hotLon[hot] + spread * cos(angle);
+            point.lon -= floor((point.lon + 180.0f) / 360.0f) * 360.0f;
+        }
+        point.weight = 0.5f + next();
+        return point;
+    }
+};
+
+void generateHeatPoints(size_t count, HeatmapLayer& layer) {
+    HeatEventGenerator generator(24680u);
+    for (size_t i = 0; i < count; ++i) {
+        HeatPoint point = generator.event();
+        addHeatPoint(layer, point.lat, point.lon, point.weight);
+    }
+}
+
+// 模拟事件流：按 --heatmap-stream 的速率到达，存在 HEATMAP_STREAM_LIFETIME 秒后删除
+void streamHeatmapEvents() {
+    static HeatEventGenerator generator(13579u);
+    static double elapsed = 0.0, owed = 0.0;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double dt = min(chrono::duration<double>(now - heatmapStreamClock).count(), 0.25);
+    heatmapStreamClock = now;
+    elapsed += dt;
+    owed += dt * heatmapStreamRate;
+    for (; owed >= 1.0; owed -= 1.0) {
+        HeatPoint point = generator.event();
+        heatmapStreamLive.push_back(make_pair(elapsed, addHeatPoint(heatmapLayer, point.lat, point.lon, point.weight)));
+    }
+    while (!heatmapStreamLive.empty() && heatmapStreamLive.front().first < elapsed - HEATMAP_STREAM_LIFETIME) {
+        removeHeatPoint(heatmapLayer, heatmapStreamLive.front().second);
+        heatmapStreamLive.pop_front();
+    }
+}
+
+const char* heatmapVertexShader =
+    "#version 120\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    uv = gl_MultiTexCoord0.xy;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+// 对数归一化后按 蓝 - 青 - 黄 - 红 着色，密度很低处透明
+const char* heatmapFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D density;\n"
+    "uniform float logMax;\n"
+    "uniform float opacity;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    float t = log(1.0 + max(texture2D(density, uv).r, 0.0)) / logMax;\n"
+    "    if (t < 0.02) discard;\n"
+    "    vec3 color = t < 0.33 ? mix(vec3(0.1, 0.2, 0.9), vec3(0.1, 0.9, 0.9), t / 0.33)\n"
+    "               : t < 0.66 ? mix(vec3(0.1, 0.9, 0.9), vec3(1.0, 0.9, 0.1), (t - 0.33) / 0.33)\n"
+    "               : mix(vec3(1.0, 0.9, 0.1), vec3(0.9, 0.1, 0.05), (t - 0.66) / 0.34);\n"
+    "    gl_FragColor = vec4(color, opacity * smoothstep(0.02, 0.35, t));\n"
+    "}\n";
+
+bool ensureHeatmapProgram() {
+    if (heatmapProgram != 0) return true;
+    if (heatmapFailed) return false;
+    heatmapProgram = createShaderProgram(heatmapVertexShader, heatmapFragmentShader, "heatmap");
+    if (heatmapProgram == 0) {
+        cerr << "警告: 热力图着色器不可用，不绘制热力图" << endl;
+        heatmapFailed = true;
+        return false;
+    }
+    return true;
+}
+
+// 累加新到的事件、上传改动的块并绘制，使用 frameMatrices 中放大后的地球矩阵
+void drawHeatmap() {
+    if (heatmapStreamRate > 0.0) streamHeatmapEvents();
+    if (!ensureHeatmapProgram()) return;
+    updateHeatmap(heatmapLayer, 0);
+    uploadHeatmapTiles(heatmapLayer);
+    if (heatmapLayer.maxDensity <= 0.0f) return;
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(heatmapProgram);
+    glUniform1i(glGetUniformLocation(heatmapProgram, "density"), 0);
+    glUniform1f(glGetUniformLocation(heatmapProgram, "logMax"), log(1.0f + heatmapLayer.maxDensity));
+    glUniform1f(glGetUniformLocation(heatmapProgram, "opacity"), heatmapOpacity);
+    glPushMatrix();
+    glLoadMatrixf(frameMatrices.shell(HEATMAP_LAYER_SCALE).m);
+    drawSphereMesh(1.0f, sphereSlices, sphereStacks, heatmapLayer.texture);
+    glPopMatrix();
+    glUseProgram(0);
+    glPopAttrib();
+}
+
+// ========================
+// 文字标注（SDF字形图集）
+// ========================
+// 地名标注在地球上随地球转动，光源描述等界面文字固定在屏幕上，两者都是中文为主，GLUT 的位图字体
+// 只有 ASCII。字形取自 GNU Unifont 的 .hex 文件（半角 8x16、全角 16x16 的点阵，覆盖全部常用汉字），
+// 用到的字形按需烘焙成有向距离场（SDF）放进一张图集，缩放后边缘依然平滑，还能顺便画出描边。
+// 每帧把候选标注批量投影到屏幕，按优先级依次放入屏幕空间的网格，与已放入的标注重叠则丢弃；
+// 每个标注只和它覆盖的几个格子里的标注比较，总耗时与标注数大致成线性。
+// 所有留下来的标注拼成一个顶点数组，一次绘制调用画完
+
+const int LABEL_GLYPH_HEIGHT = 16;  // 点阵字形的高度（像素）
+const int LABEL_SDF_SCALE = 2;      // 图集中每个点阵像素对应的纹素数
+const int LABEL_SDF_PAD = 4;        // 字形四周保留的距离场范围（纹素）
+const int LABEL_ATLAS_SIZE = 1024;
+const int LABEL_GRID_CELL = 32;     // 碰撞网格的格子大小（像素）
+const float LABEL_HALO = 0.12f;     // 描边宽度（距离场取值，0.25 约等于一个点阵像素）
+
+struct HexGlyph {
+    unsigned char width;                    // 8 或 16
+    unsigned short rows[LABEL_GLYPH_HEIGHT]; // 每行从最高位开始，第0行在最上面
+};
+
+struct LabelGlyph {
+    float u0, v0, u1, v1; // 图集中的纹理坐标（v0 为字形上边）
+    int width;            // 点阵宽度，也是前进宽度
+};
+
+struct GlyphAtlas {
+    unordered_map<unsigned int, HexGlyph> font;
+    unordered_map<unsigned int, int> index; // 码位 -> glyphs 下标，0 号为缺字方框
+    vector<LabelGlyph> glyphs;
+    vector<unsigned char> pixels;           // 图集的CPU副本
+    int shelfX, shelfY, shelfHeight;        // 按行（货架）排布
+    int dirtyMin, dirtyMax;                 // 待上传的行范围
+    bool full;
+    GLuint texture;
+    GlyphAtlas() : shelfX(0), shelfY(0), shelfHeight(0), dirtyMin(LABEL_ATLAS_SIZE), dirtyMax(0), full(false), texture(0) {}
+};
+
+struct Label {
+    string text;   // UTF-8
+    float lat, lon;
+    float priority; // 越大越优先保留
+    unsigned char color[4];
+};
+
+struct LabelVertex {
+    float position[2];
+    float uv[2];
+    unsigned char color[4];
+};
+
+struct LabelLayer {
+    vector<Label> labels;           // 按优先级从高到低排列
+    bool prepared;                  // 字形和锚点已经生成
+    vector<int> glyphFirst;         // 每个标注在 glyphIds 中的起点
+    vector<int> glyphIds;
+    vector<float> advance;          // 每个标注的宽度（点阵像素）
+    vector<float> x, y, z;          // 锚点（地球物体空间）
+    vector<float> sx, sy;           // 本帧的屏幕坐标
+    vector<unsigned char> visible;
+    // 碰撞网格：每个格子一条链表，stamp 不等于当前帧号的格子视为空，不必每帧清空
+    vector<int> cellHead, cellStamp;
+    vector<int> entryRect, entryNext;
+    vector<float> rects;            // 已放入的矩形 x0, y0, x1, y1
+    int frame;
+    vector<LabelVertex> vertices;
+    GLuint buffer;
+    // 最近一帧的统计
+    int candidates, placed;
+    double layoutMs;
+    LabelLayer() : prepared(false), frame(0), buffer(0), candidates(0), placed(0), layoutMs(0.0) {}
+};
+
+GlyphAtlas glyphAtlas;
+LabelLayer labelLayer;
+bool labelsEnabled = false;
+bool labelGridEnabled = true;  // 关闭后逐个与全部已放入的标注比较（仅用于对比测试）
+float labelPixels = 16.0f;     // 字高（像素）
+string labelFontPath;          // --font 指定的 .hex 字形文件
+bool labelFontLoaded = false;
+GLuint labelProgram = 0;
+bool labelUnavailable = false;
+
+// 逐个解出 UTF-8 码位，非法字节按 U+FFFD 处理
+void decodeUtf8(const string& text, vector<unsigned int>& out) {
+    out.clear();
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c = (unsigned char)text[i];
+        int length = c < 0x80 ? 1 : (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 0;
+        if (length == 0 || i + length > text.size()) {
+            out.push_back(0xFFFD);
+            ++i;
+            continue;
+        }
+        unsigned int code = length == 1 ? c : c & (0x7F >> length);
+        for (int k = 1; k < length; ++k) code = (code << 6) | ((unsigned char)text[i + k] & 0x3F);
+        out.push_back(code);
+        i += length;
+    }
+}
+
+// 读取 GNU Unifont 的 .hex 文件：每行 "码位:点阵"，点阵为32个（8x16）或64个（16x16）十六进制数字
+bool loadHexFont(const string& path, unordered_map<unsigned int, HexGlyph>& font) {
+    ifstream file(path.c_str());
+    if (!file.is_open()) return false;
+    string line;
+    while (getline(file, line)) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        unsigned int code = (unsigned int)strtoul(line.substr(0, colon).c_str(), NULL, 16);
+        string bits = line.substr(colon + 1);
+        while (!bits.empty() && isspace((unsigned char)bits[bits.size() - 1])) bits.erase(bits.size() - 1);
+        if (bits.size() != 32 && bits.size() != 64) continue;
+        HexGlyph glyph;
+        glyph.width = bits.size() == 32 ? 8 : 16;
+        int digits = glyph.width / 4;
+        for (int row = 0; row < LABEL_GLYPH_HEIGHT; ++row) {
+            unsigned int value = (unsigned int)strtoul(bits.substr(row * digits, digits).c_str(), NULL, 16);
+            glyph.rows[row] = (unsigned short)(glyph.width == 8 ? value << 8 : value);
+        }
+        font[code] = glyph;
+    }
+    cout << "字形文件: " << path << "，" << font.size() << " 个字形" << endl;
+    return true;
+}
+
+// 点阵 -> 距离场：每个纹素找最近的状态相反的点阵像素（按方块求距离），内部为正，
+// 0.5 为边缘，±LABEL_SDF_PAD 纹素对应 1 和 0
+void bakeGlyphSdf(const HexGlyph& glyph, unsigned char* out, int stride) {
+    int cellWidth = glyph.width * LABEL_SDF_SCALE + 2 * LABEL_SDF_PAD;
+    int cellHeight = LABEL_GLYPH_HEIGHT * LABEL_SDF_SCALE + 2 * LABEL_SDF_PAD;
+    const float maxDistance = (float)LABEL_SDF_PAD / LABEL_SDF_SCALE; // 点阵像素
+    const int search = LABEL_SDF_PAD / LABEL_SDF_SCALE + 1;
+    struct Bitmap {
+        static bool at(const HexGlyph& g, int x, int y) {
+            return x >= 0 && y >= 0 && x < g.width && y < LABEL_GLYPH_HEIGHT && ((g.rows[y] >> (15 - x)) & 1);
+        }
+    };
+    for (int ty = 0; ty < cellHeight; ++ty) {
+        float v = (ty + 0.5f - LABEL_SDF_PAD) / LABEL_SDF_SCALE;
+        int py = (int)floor(v);
+        for (int tx = 0; tx < cellWidth; ++tx) {
+            float u = (tx + 0.5f - LABEL_SDF_PAD) / LABEL_SDF_SCALE;
+            int px = (int)floor(u);
+            bool inside = Bitmap::at(glyph, px, py);
+            float best = maxDistance * maxDistance;
+            for (int j = py - search; j <= py + search; ++j) {
+                for (int i = px - search; i <= px + search; ++i) {
+                    if (Bitmap::at(glyph, i, j) == inside) continue;
+                    float dx = max(max(i - u, u - (i + 1)), 0.0f), dy = max(max(j - v, v - (j + 1)), 0.0f);
+                    best = min(best, dx * dx + dy * dy);
+                }
+            }
+            float d = sqrt(best) * (inside ? 1.0f : -1.0f);
+            float value = 0.5f + d / (2.0f * maxDistance);
+            out[ty * stride + tx] = (unsigned char)(min(max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+// 把字形放进图集，返回 glyphs 下标；图集满了返回缺字方框
+int addAtlasGlyph(GlyphAtlas& atlas, const HexGlyph& glyph) {
+    if (atlas.pixels.empty()) atlas.pixels.assign((size_t)LABEL_ATLAS_SIZE * LABEL_ATLAS_SIZE, 0);
+    int cellWidth = glyph.width * LABEL_SDF_SCALE + 2 * LABEL_SDF_PAD;
+    int cellHeight = LABEL_GLYPH_HEIGHT * LABEL_SDF_SCALE + 2 * LABEL_SDF_PAD;
+    if (atlas.shelfX + cellWidth > LABEL_ATLAS_SIZE) {
+        atlas.shelfX = 0;
+        atlas.shelfY += atlas.shelfHeight;
+        atlas.shelfHeight = 0;
+    }
+    if (atlas.shelfY + cellHeight > LABEL_ATLAS_SIZE) {
+        if (!atlas.full) cerr << "警告: 字形图集已满，其余的字显示为方框" << endl;
+        atlas.full = true;
+        return 0;
+    }
+    bakeGlyphSdf(glyph, &atlas.pixels[(size_t)atlas.shelfY * LABEL_ATLAS_SIZE + atlas.shelfX], LABEL_ATLAS_SIZE);
+    LabelGlyph entry;
+    entry.u0 = (float)atlas.shelfX / LABEL_ATLAS_SIZE;
+    entry.v0 = (float)atlas.shelfY / LABEL_ATLAS_SIZE;
+    entry.u1 = (float)(atlas.shelfX + cellWidth) / LABEL_ATLAS_SIZE;
+    entry.v1 = (float)(atlas.shelfY + cellHeight) / LABEL_ATLAS_SIZE;
+    entry.width = glyph.width;
+    atlas.glyphs.push_back(entry);
+    atlas.dirtyMin = min(atlas.dirtyMin, atlas.shelfY);
+    atlas.dirtyMax = max(atlas.dirtyMax, atlas.shelfY + cellHeight);
+    atlas.shelfX += cellWidth;
+    atlas.shelfHeight = max(atlas.shelfHeight, cellHeight);
+    return (int)atlas.glyphs.size() - 1;
+}
+
+// 码位对应的图集字形，第一次用到时烘焙；字形文件中没有的字显示为方框
+int atlasGlyph(GlyphAtlas& atlas, unsigned int code) {
+    if (atlas.glyphs.empty()) {
+        HexGlyph box;
+        box.width = 8;
+        for (int row = 0; row < LABEL_GLYPH_HEIGHT; ++row) {
+            box.rows[row] = row < 2 || row > 13 ? 0 : row == 2 || row == 13 ? 0x7E00 : 0x4200;
+        }
+        addAtlasGlyph(atlas, box);
+    }
+    unordered_map<unsigned int, int>::const_iterator found = atlas.index.find(code);
+    if (found != atlas.index.end()) return found->second;
+    int id = 0;
+    unordered_map<unsigned int, HexGlyph>::const_iterator glyph = atlas.font.find(code);
+    if (glyph != atlas.font.end()) id = addAtlasGlyph(atlas, glyph->second);
+    atlas.index[code] = id;
+    return id;
+}
+
+// 首次使用时读取字形文件：--font 指定的文件，或者当前目录、系统目录下的 unifont.hex
+void ensureLabelFont() {
+    if (labelFontLoaded) return;
+    labelFontLoaded = true;
+    vector<string> candidates;
+    if (!labelFontPath.empty()) candidates.push_back(labelFontPath);
+    candidates.push_back("unifont.hex");
+    candidates.push_back("/usr/share/unifont/unifont.hex");
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (loadHexFont(candidates[i], glyphAtlas.font)) return;
+        if (i == 0 && !labelFontPath.empty()) cerr << "警告: 无法读取字形文件 " << labelFontPath << endl;
+    }
+    cerr << "警告: 没有找到 .hex 字形文件（--font），标注文字全部显示为方框" << endl;
+}
+
+// 把文字排成字形序列，返回宽度（点阵像素）
+float layoutLabelText(const string& text, vector<int>& glyphIds) {
+    ensureLabelFont();
+    static vector<unsigned int> codes;
+    decodeUtf8(text, codes);
+    float width = 0.0f;
+    for (size_t i = 0; i < codes.size(); ++i) {
+        int id = atlasGlyph(glyphAtlas, codes[i]);
+        glyphIds.push_back(id);
+        width += glyphAtlas.glyphs[id].width;
+    }
+    return width;
+}
+
+void setLabels(LabelLayer& layer, const vector<Label>& labels) {
+    layer.labels = labels;
+    stable_sort(layer.labels.begin(), layer.labels.end(),
+                [](const Label& a, const Label& b) { return a.priority > b.priority; });
+    layer.prepared = false;
+}
+
+// 排版全部标注并批量计算锚点
+void prepareLabels(LabelLayer& layer) {
+    if (layer.prepared) return;
+    size_t count = layer.labels.size();
+    layer.glyphFirst.assign(count + 1, 0);
+    layer.glyphIds.clear();
+    layer.advance.resize(count);
+    vector<float> lat(count), lon(count);
+    for (size_t i = 0; i < count; ++i) {
+        layer.glyphFirst[i] = (int)layer.glyphIds.size();
+        layer.advance[i] = layoutLabelText(layer.labels[i].text, layer.glyphIds);
+        lat[i] = layer.labels[i].lat;
+        lon[i] = layer.labels[i].lon;
+    }
+    layer.glyphFirst[count] = (int)layer.glyphIds.size();
+    layer.x.resize(count);
+    layer.y.resize(count);
+    layer.z.resize(count);
+    batchGeodeticToGlobe(lat.data(), lon.data(), NULL, count, GEO_SPHERE, layer.x.data(), layer.y.data(), layer.z.data());
+    layer.sx.resize(count);
+    layer.sy.resize(count);
+    layer.visible.resize(count);
+    layer.prepared = true;
+    cout << "标注图层: " << count << " 个标注，" << glyphAtlas.glyphs.size() << " 个字形" << endl;
+}
+
+// 把一段文字的字形四边形追加到顶点数组，(x, y) 为文字左下角的屏幕坐标
+void appendLabelQuads(vector<LabelVertex>& vertices, const int* glyphIds, int count, float x, float y,
+                      const unsigned char color[4]) {
+    float scale = labelPixels / LABEL_GLYPH_HEIGHT;                 // 屏幕像素 / 点阵像素
+    float texel = scale / LABEL_SDF_SCALE;                          // 屏幕像素 / 纹素
+    float pad = LABEL_SDF_PAD * texel;
+    float height = (LABEL_GLYPH_HEIGHT * LABEL_SDF_SCALE + 2 * LABEL_SDF_PAD) * texel;
+    for (int k = 0; k < count; ++k) {
+        const LabelGlyph& glyph = glyphAtlas.glyphs[glyphIds[k]];
+        float width = (glyph.width * LABEL_SDF_SCALE + 2 * LABEL_SDF_PAD) * texel;
+        float x0 = x - pad, y0 = y - pad;
+        LabelVertex quad[4] = {{{x0, y0}, {glyph.u0, glyph.v1}, {color[0], color[1], color[2], color[3]}},
+                               {{x0 + width, y0}, {glyph.u1, glyph.v1}, {color[0], color[1], color[2], color[3]}},
+                               {{x0 + width, y0 + height}, {glyph.u1, glyph.v0}, {color[0], color[1], color[2], color[3]}},
+                               {{x0, y0 + height}, {glyph.u0, glyph.v0}, {color[0], color[1], color[2], color[3]}}};
+        vertices.insert(vertices.end(), quad, quad + 4);
+        x += glyph.width * scale;
+    }
+}
+
+// 矩形放进碰撞网格前检查是否与已放入的矩形重叠，不重叠则放入并返回 true
+bool placeLabelRect(LabelLayer& layer, int gridWidth, int gridHeight, float x0, float y0, float x1, float y1) {
+    if (!labelGridEnabled) {
+        for (size_t r = 0; r < layer.rects.size(); r += 4) {
+            if (x0 < layer.rects[r + 2] && layer.rects[r] < x1 && y0 < layer.rects[r + 3] && layer.rects[r + 1] < y1) {
+                return false;
+            }
+        }
+        float rect[4] = {x0, y0, x1, y1};
+        layer.rects.insert(layer.rects.end(), rect, rect + 4);
+        return true;
+    }
+    int cx0 = max((int)(x0 / LABEL_GRID_CELL), 0), cx1 = min((int)(x1 / LABEL_GRID_CELL), gridWidth - 1);
+    int cy0 = max((int)(y0 / LABEL_GRID_CELL), 0), cy1 = min((int)(y1 / LABEL_GRID_CELL), gridHeight - 1);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            int cell = cy * gridWidth + cx;
+            if (layer.cellStamp[cell] != layer.frame) continue;
+            for (int e = layer.cellHead[cell]; e >= 0; e = layer.entryNext[e]) {
+                const float* r = &layer.rects[layer.entryRect[e] * 4];
+                if (x0 < r[2] && r[0] < x1 && y0 < r[3] && r[1] < y1) return false;
+            }
+        }
+    }
+    int rect = (int)(layer.rects.size() / 4);
+    float bounds[4] = {x0, y0, x1, y1};
+    layer.rects.insert(layer.rects.end(), bounds, bounds + 4);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            int cell = cy * gridWidth + cx;
+            if (layer.cellStamp[cell] != layer.frame) {
+                layer.cellStamp[cell] = layer.frame;
+                layer.cellHead[cell] = -1;
+            }
+            layer.entryRect.push_back(rect);
+            layer.entryNext.push_back(layer.cellHead[cell]);
+            layer.cellHead[cell] = (int)layer.entryRect.size() - 1;
+        }
+    }
+    return true;
+}
+
+// 每帧：批量投影锚点，剔除地平线之后和屏幕之外的，再按优先级做碰撞剔除，生成顶点。
+// 屏幕标注（光源描述）最先放入，不会被地名挡住。矩阵与渲染器使用的 frameMatrices 相同
+void layoutLabels(LabelLayer& layer, const SceneMatrices& matrices, int width, int height) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    prepareLabels(layer);
+    ++layer.frame;
+    layer.rects.clear();
+    layer.entryRect.clear();
+    layer.entryNext.clear();
+    layer.vertices.clear();
+    int gridWidth = (width + LABEL_GRID_CELL - 1) / LABEL_GRID_CELL, gridHeight = (height + LABEL_GRID_CELL - 1) / LABEL_GRID_CELL;
+    if ((int)layer.cellHead.size() < gridWidth * gridHeight) {
+        layer.cellHead.assign(gridWidth * gridHeight, -1);
+        layer.cellStamp.assign(gridWidth * gridHeight, 0);
+    }
+    float scale = labelPixels / LABEL_GLYPH_HEIGHT;
+    
+    // 屏幕标注：左下角显示当前光源
+    static vector<int> screenGlyphs;
+    screenGlyphs.clear();
+    string lightText = string("光源: ") + currentLight().name;
+    float lightWidth = layoutLabelText(lightText, screenGlyphs) * scale;
+    const unsigned char lightColor[4] = {255, 240, 160, 255};
+    placeLabelRect(layer, gridWidth, gridHeight, 8.0f, 8.0f, 8.0f + lightWidth, 8.0f + labelPixels);
+    appendLabelQuads(layer.vertices, screenGlyphs.data(), (int)screenGlyphs.size(), 8.0f, 8.0f, lightColor);
+    
+    size_t count = layer.labels.size();
+    batchGlobeToScreen(matrices.globeMvp.m, layer.x.data(), layer.y.data(), layer.z.data(), count, width, height, layer.sx.data(),
+                       layer.sy.data(), NULL, layer.visible.data());
+    // 单位球面上的点 p 在物体空间中的相机 c 看来不被球挡住当且仅当 p·c > 1
+    const float* camera = matrices.cameraObject;
+    layer.candidates = 0;
+    layer.placed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!layer.visible[i]) continue;
+        if (layer.x[i] * camera[0] + layer.y[i] * camera[1] + layer.z[i] * camera[2] <= 1.0f) continue;
+        ++layer.candidates;
+        float w = layer.advance[i] * scale;
+        float x0 = floor(layer.sx[i] - 0.5f * w + 0.5f), y0 = floor(layer.sy[i] - 0.5f * labelPixels + 0.5f);
+        if (x0 < 0.0f || y0 < 0.0f || x0 + w > width || y0 + labelPixels > height) continue;
+        if (!placeLabelRect(layer, gridWidth, gridHeight, x0, y0, x0 + w, y0 + labelPixels)) continue;
+        ++layer.placed;
+        appendLabelQuads(layer.vertices, &layer.glyphIds[layer.glyphFirst[i]], layer.glyphFirst[i + 1] - layer.glyphFirst[i],
+                         x0, y0, layer.labels[i].color);
+    }
+    layer.layoutMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 读取标注文件：每行 "纬度,经度,名称[,优先级]"，# 开头为注释
+bool loadLabelFile(const char* path, vector<Label>& labels) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "错误: 无法打开标注文件 " << path << endl;
+        return false;
+    }
+    labels.clear();
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#') continue;
+        if (line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        Label label;
+        size_t first = line.find(','), second = first == string::npos ? first : line.find(',', first + 1);
+        if (second == string::npos || sscanf(line.c_str(), "%f,%f", &label.lat, &label.lon) != 2 ||
+            fabs(label.lat) > 90.0f) {
+            cerr << "警告: " << path << " 第 " << lineNumber << " 行无法解析，已跳过" << endl;
+            continue;
+        }
+        size_t third = line.find(',', second + 1);
+        label.text = line.substr(second + 1, third == string::npos ? string::npos : third - second - 1);
+        label.priority = third == string::npos ? 0.0f : (float)atof(line.c_str() + third + 1);
+        label.color[0] = label.color[1] = label.color[2] = label.color[3] = 255;
+        labels.push_back(label);
+    }
+    cout << "从 " << path << " 读取 " << labels.size() << " 个标注" << endl;
+    return true;
+}
+
+// 固定种子生成测试标注：名称为"城市"加编号，优先级（人口）按幂律分布
+void generateLabels(size_t count, vector<Label>& labels) {
+    unsigned int seed = 11213u;
+    labels.resize(count);
+    char name[32];
+    for (size_t i = 0; i < count; ++i) {
+        Label& label = labels[i];
+        label.lat = asin(randomUnit(seed) * 1.7f - 0.8f) * 180.0f / PI;
+        label.lon = randomUnit(seed) * 360.0f - 180.0f;
+        label.priority = 1.0f / max(randomUnit(seed), 1e-4f);
+        snprintf(name, sizeof(name), "城市%zu", i + 1);
+        label.text = name;
+        bool large = label.priority > 20.0f;
+        label.color[0] = 255;
+        label.color[1] = large ? 230 : 255;
+        label.color[2] = large ? 140 : 255;
+        label.color[3] = 255;
+    }
+}
+
+const char* labelVertexShader =
+    "#version 120\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    uv = gl_MultiTexCoord0.xy;\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+// 距离场 0.5 处为字形边缘，fwidth 给出一个屏幕像素对应的取值变化，据此抗锯齿；
+// 边缘外 LABEL_HALO 范围内画半透明的黑色描边，文字压在亮色地表上也能看清
+const char* labelFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D atlas;\n"
+    "uniform float halo;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    float d = texture2D(atlas, uv).r;\n"
+    "    float w = max(fwidth(d) * 0.7, 1e-3);\n"
+    "    float fill = smoothstep(0.5 - w, 0.5 + w, d);\n"
+    "    float outline = smoothstep(0.5 - halo - w, 0.5 - halo + w, d);\n"
+    "    float alpha = max(fill, outline * 0.75);\n"
+    "    if (alpha <= 0.0) discard;\n"
+    "    gl_FragColor = vec4(gl_Color.rgb * fill / max(alpha, 1e-3), alpha * gl_Color.a);\n"
+    "}\n";
+
+bool ensureLabelProgram() {
+    if (labelProgram != 0) return true;
+    if (labelUnavailable) return false;
+    labelProgram = createShaderProgram(labelVertexShader, labelFragmentShader, "label");
+    if (labelProgram == 0) {
+        cerr << "警告: 标注着色器不可用，不绘制标注" << endl;
+        labelUnavailable = true;
+        return false;
+    }
+    return true;
+}
+
+// 新烘焙的字形所在的行上传到图集纹理
+void uploadGlyphAtlas(GlyphAtlas& atlas) {
+    if (atlas.texture == 0) {
+        glGenTextures(1, &atlas.texture);
+        glBindTexture(GL_TEXTURE_2D, atlas.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8, LABEL_ATLAS_SIZE, LABEL_ATLAS_SIZE, 0, GL_LUMINANCE,
+                     GL_UNSIGNED_BYTE, NULL);
+        atlas.dirtyMin = 0;
+        atlas.dirtyMax = atlas.pixels.empty() ? 0 : LABEL_ATLAS_SIZE;
+    } else {
+        glBindTexture(GL_TEXTURE_2D, atlas.texture);
+    }
+    if (atlas.dirtyMax > atlas.dirtyMin) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, atlas.dirtyMin, LABEL_ATLAS_SIZE, atlas.dirtyMax - atlas.dirtyMin,
+                        GL_LUMINANCE, GL_UNSIGNED_BYTE, &atlas.pixels[(size_t)atlas.dirtyMin * LABEL_ATLAS_SIZE]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        atlas.dirtyMin = LABEL_ATLAS_SIZE;
+        atlas.dirtyMax = 0;
+    }
+}
+
+// 在最后绘制标注（屏幕空间，不做深度测试）
+void drawLabels() {
+    if (!ensureLabelProgram()) return;
+    layoutLabels(labelLayer, frameMatrices, WIDTH, HEIGHT);
+    if (labelLayer.vertices.empty()) return;
+    uploadGlyphAtlas(glyphAtlas);
+    
+    if (labelLayer.buffer == 0) glGenBuffers(1, &labelLayer.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, labelLayer.buffer);
+    glBufferData(GL_ARRAY_BUFFER, labelLayer.vertices.size() * sizeof(LabelVertex), labelLayer.vertices.data(),
+                 GL_STREAM_DRAW);
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0.0, WIDTH, 0.0, HEIGHT, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    glUseProgram(labelProgram);
+    glUniform1i(glGetUniformLocation(labelProgram, "atlas"), 0);
+    glUniform1f(glGetUniformLocation(labelProgram, "halo"), LABEL_HALO);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(LabelVertex), (const char*)0);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(LabelVertex), (const char*)0 + 8);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(LabelVertex), (const char*)0 + 16);
+    ++frameDrawCalls;
+    glDrawArrays(GL_QUADS, 0, (GLsizei)labelLayer.vertices.size());
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glUseProgram(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
+
+// ========================
+// 绘制地面
+// ========================
+
+void drawFloor() {
+    glDisable(GL_LIGHTING);
+    
+    // 首先绘制地面基础颜色
+    glColor3f(0.5f, 0.5f, 0.5f); // 中灰色地面
+    
+    ++frameDrawCalls;
+    glBegin(GL_QUADS);
+    glVertex3f(-floorSize, floorY, -floorSize);
+    glVertex3f(floorSize, floorY, -floorSize);
+    glVertex3f(floorSize, floorY, floorSize);
+    glVertex3f(-floorSize, floorY, floorSize);
+    glEnd();
+    
+    // 绘制网格线
+    glColor3f(0.7f, 0.7f, 0.7f);
+    ++frameDrawCalls;
+    glBegin(GL_LINES);
+    
+    // X方向网格线
+    for (float x = -floorSize; x <= floorSize; x += 0.5f) {
+        glVertex3f(x, floorY + 0.001f, -floorSize);
+        glVertex3f(x, floorY + 0.001f, floorSize);
+    }
+    
+    // Z方向网格线
+    for (float z = -floorSize; z <= floorSize; z += 0.5f) {
+        glVertex3f(-floorSize, floorY + 0.001f, z);
+        glVertex3f(floorSize, floorY + 0.001f, z);
+    }
+    glEnd();
+    
+    glEnable(GL_LIGHTING);
+}
+
+// ========================
+// 阴影计算函数
+// ========================
+
+// 计算点光源投影
+void calculatePointShadow(float lightX, float lightY, float lightZ,
+                         float pointX, float pointY, float pointZ,
+                         float& shadowX, float& shadowZ, float& shadowSize) {
+    // 地面平面：y = floorY
+    // 从光源到点的向量
+    float dx = pointX - lightX;
+    float dy = pointY - lightY;
+    float dz = pointZ - lightZ;
+    
+    if (fabs(dy) < 0.0001f) {
+        // 光线与地面平行
+        shadowX = lightX;
+        shadowZ = lightZ;
+        shadowSize = 0.0f;
+        return;
+    }
+    
+    // 计算光线与地面的交点
+    float t = (floorY - lightY) / dy;
+    
+    if (t < 0) {
+        // 光线从下往上照射
+        shadowX = lightX;
+        shadowZ = lightZ;
+        shadowSize = 0.0f;
+        return;
+    }
+    
+    shadowX = lightX + t * dx;
+    shadowZ = lightZ + t * dz;
+    
+    // 计算阴影大小：考虑地球半径和透视效果
+    float earthRadius = 1.0f * zoom;
+    float distanceToLight = sqrt(dx*dx + dy*dy + dz*dz);
+    
+    // 简单的阴影大小计算
+    shadowSize = earthRadius * (1.0f + t * 0.5f);
+    
+    // 根据光源高度调整阴影大小
+    float lightHeight = fabs(lightY - floorY);
+    if (lightHeight > 0) {
+        shadowSize *= (distanceToLight / lightHeight);
+    }
+    
+    // 限制最大阴影大小
+    if (shadowSize > floorSize * 0.6f) {
+        shadowSize = floorSize * 0.6f;
+    }
+}
+
+// 计算阴影椭圆的拉伸参数
+void calculateShadowEllipse(float lightX, float lightY, float lightZ,
+                           float& stretchX, float& stretchZ, float& rotation) {
+    // 计算光源方向向量在地面上的投影
+    float lightLen = sqrt(lightX*lightX + lightY*lightY + lightZ*lightZ);
+    
+    if (lightLen < 0.0001f) {
+        stretchX = 1.0f;
+        stretchZ = 1.0f;
+        rotation = 0.0f;
+        return;
+    }
+    
+    // 归一化光源向量
+    float lx = lightX / lightLen;
+    float ly = lightY / lightLen;
+    float lz = lightZ / lightLen;
+    
+    // 计算光源在地面上的投影方向
+    float groundLX = lx;
+    float groundLZ = lz;
+    
+    // 拉伸参数：在光源方向上拉伸
+    float dotX = fabs(groundLX);
+    float dotZ = fabs(groundLZ);
+    
+    // 拉伸程度取决于光源方向
+    stretchX = 1.0f + dotX * 0.8f;
+    stretchZ = 1.0f + dotZ * 0.8f;
+    
+    // 旋转角度（弧度）
+    rotation = atan2(groundLZ, groundLX);
+}
+
+// 阴影四边形的模型矩阵：移到阴影位置，沿光源方向旋转并拉伸成椭圆。
+// 阴影太小不需要绘制时返回 false（GL和软件渲染共用）
+bool shadowModelMatrix(Mat4& model) {
+    // 获取光源位置
+    LightPosition light = currentLight();
+    
+    // 计算阴影位置和大小
+    float shadowX, shadowZ, shadowSize;
+    calculatePointShadow(light.x, light.y, light.z, 0, 0, 0, shadowX, shadowZ, shadowSize);
+    
+    // 计算阴影椭圆参数
+    float stretchX, stretchZ, rotation;
+    calculateShadowEllipse(light.x, light.y, light.z, stretchX, stretchZ, rotation);
+    
+    // 如果阴影太小，不绘制
+    if (shadowSize < 0.1f) return false;
+    
+    model = mat4Translate(shadowX, floorY + 0.002f, shadowZ);
+    model = mat4Multiply(model, mat4Rotate(rotation * 180.0f / M_PI, 0.0f, 1.0f, 0.0f));
+    model = mat4Multiply(model, mat4Scale(shadowSize * stretchX, 1.0f, shadowSize * stretchZ));
+    return true;
+}
+
+// ========================
+// 绘制自然阴影
+// ========================
+
+// 调用时模型视图矩阵为 相机 * 阴影矩阵（场景图中阴影节点的模型视图矩阵，见 shadowModelMatrix）
+void drawNaturalShadow() {
+    if (!shadowEnabled || !lightEnabled) return;
+    
+    // 禁用光照，启用混合和阴影纹理
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    // 使用阴影纹理
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, shadowTextureID);
+    
+    // 设置纹理环境为调制
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    
+    // 使用黑色半透明颜色
+    glColor4f(0.0f, 0.0f, 0.0f, shadowIntensity);
+    
+    // 禁用深度写入，防止阴影遮挡地面
+    glDepthMask(GL_FALSE);
+    
+    // 绘制阴影四边形（使用纹理）
+    ++frameDrawCalls;
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f); glVertex3f(-1.0f, 0.0f, -1.0f);
+    glTexCoord2f(1.0f, 0.0f); glVertex3f(1.0f, 0.0f, -1.0f);
+    glTexCoord2f(1.0f, 1.0f); glVertex3f(1.0f, 0.0f, 1.0f);
+    glTexCoord2f(0.0f, 1.0f); glVertex3f(-1.0f, 0.0f, 1.0f);
+    glEnd();
+    
+    // 恢复状态
+    glDepthMask(GL_TRUE);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_BLEND);
+    glEnable(GL_LIGHTING);
+}
+
+// ========================
+// 绘制环境光遮蔽（AO）效果
+// ========================
+
+// 接触阴影画在地球底部、与地面平行的圆盘上。坐标以地球半径为单位，
+// 调用时模型视图矩阵为 frameMatrices.contact（场景图中接触阴影节点的模型视图矩阵）
+void drawAmbientOcclusion() {
+    if (!shadowEnabled) return;
+    
+    // 计算地球底部位置
+    float earthBottomY = -1.0f; // 地球半径为1
+    
+    // 禁用光照，启用混合
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    // 在地球底部绘制环境光遮蔽（接触阴影）
+    int segments = 32;
+    float contactRadius = 0.2f;
+    
+    ++frameDrawCalls;
+    glBegin(GL_TRIANGLE_FAN);
+    glColor4f(0.0f, 0.0f, 0.0f, 0.3f * shadowIntensity);
+    glVertex3f(0.0f, earthBottomY - 0.001f, 0.0f);
+    
+    glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int i = 0; i <= segments; i++) {
+        float angle = 2.0f * M_PI * i / segments;
+        float x = contactRadius * cos(angle);
+        float z = contactRadius * sin(angle);
+        glVertex3f(x, earthBottomY - 0.001f, z);
+    }
+    glEnd();
+    
+    // 恢复状态
+    glDisable(GL_BLEND);
+    glEnable(GL_LIGHTING);
+}
+
+// ========================
+// 场景图
+// ========================
+// 地面、阴影、地球、接触阴影和卫星等物体都是场景图中的节点。节点的各项数据分别存放在连续数组中
+// （下标即节点号），父节点总排在子节点之前。修改局部变换只把节点记入脏列表，更新时只重算脏节点所在
+// 子树的世界矩阵和包围球，静态内容不产生每帧的CPU开销。绘制列表按 (图层, 类型, 节点号) 排序，
+// 只在可见性或结构变化时重建；相机和世界矩阵都没变时，视锥剔除的结果和模型视图矩阵也沿用上一帧
+
+// 图层对应 renderScene 中的绘制阶段，同一图层的节点在一起绘制
+enum SceneLayer {
+    SCENE_LAYER_FLOOR,
+    SCENE_LAYER_SHADOW,
+    SCENE_LAYER_GLOBE,
+    SCENE_LAYER_CONTACT,
+    SCENE_LAYER_COUNT
+};
+
+enum SceneKind {
+    SCENE_GROUP,      // 只用于组织层次，不绘制
+    SCENE_FLOOR,
+    SCENE_SHADOW,
+    SCENE_GLOBE,
+    SCENE_CONTACT,
+    SCENE_SATELLITE
+};
+
+struct SceneGraph {
+    vector<int> parent, firstChild, nextSibling;
+    vector<Mat4> local, world;
+    vector<float> boundsLocal;          // 局部空间的包围球 (x, y, z, r)，r < 0 表示不做剔除
+    vector<float> boundsWorld;
+    vector<unsigned char> kind, layer, visible, dirty;
+    vector<int> dirtyList;
+    
+    vector<int> drawList;               // 可见的可绘制节点，已排序
+    bool drawListDirty;
+    // 剔除结果：通过剔除的节点、各图层的起点和模型视图矩阵
+    vector<int> culled;
+    vector<Mat4> modelView;
+    int layerBegin[SCENE_LAYER_COUNT + 1];
+    unsigned int culledVersion;         // 对应的 frameMatrices.version
+    bool culledValid;
+    bool worldChanged;                  // 上次剔除后有世界矩阵被重算
+    
+    // 最近一帧的统计
+    int updatedNodes;
+    bool cullReused;
+    double updateMs, cullMs;
+    
+    SceneGraph() : drawListDirty(true), culledVersion(0), culledValid(false), worldChanged(true), updatedNodes(0),
+                   cullReused(false), updateMs(0.0), cullMs(0.0) {
+        for (int i = 0; i <= SCENE_LAYER_COUNT; ++i) layerBegin[i] = 0;
+    }
+    size_t size() const { return parent.size(); }
+};
+
+SceneGraph sceneGraph;
+int sceneRoot = -1, sceneFloor = -1, sceneShadow = -1, sceneGlobe = -1, sceneContact = -1, sceneSatellites = -1;
+// 卫星共用的单位球网格：三角形列表，每个顶点为位置 (x, y, z) 和纹理坐标 (u, v)，单位球上位置即法线。
+// 在 ensureSceneGraph 中生成一次（那里可能还没有GL上下文），首次绘制时上传为常驻顶点缓冲。
+// 不走 drawSphereMesh，以免和地球争用那份按参数缓存的网格
+const int SATELLITE_SLICES = 16, SATELLITE_STACKS = 8;
+vector<float> satelliteMesh;
+GLuint satelliteBuffer = 0;
+
+// 添加节点，返回节点号。parent 为 -1 表示根节点；bounds 为局部空间的包围球，NULL 表示不做剔除
+int addSceneNode(SceneGraph& graph, int parent, SceneKind kind, SceneLayer layer, const Mat4& local,
+                 const float bounds[4]) {
+    int id = (int)graph.size();
+    graph.parent.push_back(parent);
+    graph.firstChild.push_back(-1);
+    graph.nextSibling.push_back(-1);
+    if (parent >= 0) {
+        graph.nextSibling[id] = graph.firstChild[parent];
+        graph.firstChild[parent] = id;
+    }
+    graph.local.push_back(local);
+    graph.world.push_back(local);
+    const float none[4] = {0.0f, 0.0f, 0.0f, -1.0f};
+    graph.boundsLocal.insert(graph.boundsLocal.end(), bounds ? bounds : none, (bounds ? bounds : none) + 4);
+    graph.boundsWorld.insert(graph.boundsWorld.end(), none, none + 4);
+    graph.kind.push_back((unsigned char)kind);
+    graph.layer.push_back((unsigned char)layer);
+    graph.visible.push_back(1);
+    graph.dirty.push_back(1);
+    graph.dirtyList.push_back(id);
+    graph.drawListDirty = true;
+    return id;
+}
+
+// 修改局部变换；与原值相同时什么都不做
+void setSceneLocal(SceneGraph& graph, int id, const Mat4& local) {
+    if (memcmp(graph.local[id].m, local.m, sizeof(local.m)) == 0) return;
+    graph.local[id] = local;
+    if (!graph.dirty[id]) {
+        graph.dirty[id] = 1;
+        graph.dirtyList.push_back(id);
+    }
+}
+
+// 隐藏的节点连同子树都不绘制
+void setSceneVisible(SceneGraph& graph, int id, bool visible) {
+    if ((graph.visible[id] != 0) == visible) return;
+    graph.visible[id] = visible ? 1 : 0;
+    graph.drawListDirty = true;
+}
+
+// 重算脏节点所在子树的世界矩阵和包围球。脏列表按节点号排序后，祖先总是先于后代处理，
+// 已经随祖先一起更新过的后代清除了脏标记，不会重复计算
+void updateSceneGraph(SceneGraph& graph) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    graph.updatedNodes = 0;
+    sort(graph.dirtyList.begin(), graph.dirtyList.end());
+    static vector<int> stack;
+    for (size_t d = 0; d < graph.dirtyList.size(); ++d) {
+        int root = graph.dirtyList[d];
+        if (!graph.dirty[root]) continue;
+        stack.assign(1, root);
+        while (!stack.empty()) {
+            int id = stack.back();
+            stack.pop_back();
+            int parent = graph.parent[id];
+            graph.world[id] = parent < 0 ? graph.local[id] : mat4Multiply(graph.world[parent], graph.local[id]);
+            graph.dirty[id] = 0;
+            ++graph.updatedNodes;
+            
+            // 包围球：球心按世界矩阵变换，半径乘以线性部分最大的列长度
+            const float* bounds = &graph.boundsLocal[id * 4];
+            float* out = &graph.boundsWorld[id * 4];
+            if (bounds[3] >= 0.0f) {
+                const float* m = graph.world[id].m;
+                float center[4] = {bounds[0], bounds[1], bounds[2], 1.0f}, transformed[4];
+                mat4Transform(graph.world[id], center, transformed);
+                float scale2 = 0.0f;
+                for (int c = 0; c < 3; ++c) {
+                    scale2 = max(scale2, m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+                }
+                out[0] = transformed[0];
+                out[1] = transformed[1];
+                out[2] = transformed[2];
+                out[3] = bounds[3] * sqrt(scale2);
+            } else {
+                out[3] = -1.0f;
+            }
+            for (int child = graph.firstChild[id]; child >= 0; child = graph.nextSibling[child]) stack.push_back(child);
+        }
+    }
+    graph.dirtyList.clear();
+    if (graph.updatedNodes > 0) graph.worldChanged = true;
+    graph.updateMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 可见性或结构变化后重建绘制列表
+void buildSceneDrawList(SceneGraph& graph) {
+    if (!graph.drawListDirty) return;
+    graph.drawListDirty = false;
+    graph.culledValid = false;
+    graph.drawList.clear();
+    static vector<unsigned char> shown;
+    shown.resize(graph.size());
+    for (size_t i = 0; i < graph.size(); ++i) {
+        int parent = graph.parent[i];
+        shown[i] = graph.visible[i] && (parent < 0 || shown[parent]);
+        if (shown[i] && graph.kind[i] != SCENE_GROUP) graph.drawList.push_back((int)i);
+    }
+    const SceneGraph& g = graph;
+    stable_sort(graph.drawList.begin(), graph.drawList.end(), [&g](int a, int b) {
+        if (g.layer[a] != g.layer[b]) return g.layer[a] < g.layer[b];
+        return g.kind[a] < g.kind[b];
+    });
+}
+
+// 视锥剔除（只测侧面和近平面，与标记点剔除相同），并算好每个节点的模型视图矩阵
+void cullSceneGraph(SceneGraph& graph, const SceneMatrices& matrices) {
+    if (graph.culledValid && graph.culledVersion == matrices.version && !graph.worldChanged) {
+        graph.cullReused = true;
+        graph.cullMs = 0.0;
+        return;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    graph.cullReused = false;
+    float tanHalfX = 1.0f / matrices.projection.m[0], tanHalfY = 1.0f / matrices.projection.m[5];
+    float lenX = sqrt(1.0f + tanHalfX * tanHalfX), lenY = sqrt(1.0f + tanHalfY * tanHalfY);
+    const float planes[4][3] = {{1.0f / lenX, 0.0f, -tanHalfX / lenX}, {-1.0f / lenX, 0.0f, -tanHalfX / lenX},
+                                {0.0f, 1.0f / lenY, -tanHalfY / lenY}, {0.0f, -1.0f / lenY, -tanHalfY / lenY}};
+    graph.culled.clear();
+    graph.modelView.clear();
+    int layer = 0;
+    graph.layerBegin[0] = 0;
+    for (size_t k = 0; k < graph.drawList.size(); ++k) {
+        int id = graph.drawList[k];
+        while (layer < graph.layer[id]) graph.layerBegin[++layer] = (int)graph.culled.size();
+        const float* bounds = &graph.boundsWorld[id * 4];
+        if (bounds[3] >= 0.0f) {
+            float center[4] = {bounds[0], bounds[1], bounds[2], 1.0f}, eye[4];
+            mat4Transform(matrices.view, center, eye);
+            bool outside = eye[2] > bounds[3] - 0.1f;
+            for (int p = 0; p < 4 && !outside; ++p) {
+                outside = planes[p][0] * eye[0] + planes[p][1] * eye[1] + planes[p][2] * eye[2] < -bounds[3];
+            }
+            if (outside) continue;
+        }
+        graph.culled.push_back(id);
+        graph.modelView.push_back(mat4Multiply(matrices.view, graph.world[id]));
+    }
+    while (layer < SCENE_LAYER_COUNT) graph.layerBegin[++layer] = (int)graph.culled.size();
+    graph.culledVersion = matrices.version;
+    graph.culledValid = true;
+    graph.worldChanged = false;
+    graph.cullMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 地球：设置材质后绘制网格或替身
+void drawGlobe() {
+    // 设置地球材质属性
+    if (lightEnabled) {
+        GLfloat matAmbient[] = {0.7f, 0.7f, 0.7f, 1.0f};
+        GLfloat matDiffuse[] = {0.9f, 0.9f, 0.9f, 1.0f};
+        GLfloat matSpecular[] = {0.3f, 0.3f, 0.3f, 1.0f};
+        GLfloat matShininess = 30.0f;
+    
+        glMaterialfv(GL_FRONT, GL_AMBIENT, matAmbient);
+        glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
+        glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
+        glMaterialf(GL_FRONT, GL_SHININESS, matShininess);
+    } else {
+        glDisable(GL_LIGHTING);
+        glColor3f(1.0f, 1.0f, 1.0f);
+    }
+    
+    // 绘制地球
+    if (globeImpostor && ensureImpostorProgram()) {
+        drawGlobeImpostor(1.0f);
+    } else {
+        drawCustomSphere(1.0f, sphereSlices, sphereStacks);
+    }
+}
+
+// 由 generateSphere 的网格点展开成三角形列表
+void buildSatelliteMesh(vector<float>& mesh) {
+    vector<float> vertices, normals, texCoords;
+    generateSphere(1.0f, SATELLITE_SLICES, SATELLITE_STACKS, vertices, normals, texCoords);
+    mesh.clear();
+    for (int i = 0; i < SATELLITE_STACKS; ++i) {
+        for (int j = 0; j < SATELLITE_SLICES; ++j) {
+            int a = i * (SATELLITE_SLICES + 1) + j, b = a + SATELLITE_SLICES + 1;
+            const int corners[6] = {a, b, a + 1, a + 1, b, b + 1};
+            for (int c = 0; c < 6; ++c) {
+                mesh.insert(mesh.end(), &vertices[corners[c] * 3], &vertices[corners[c] * 3] + 3);
+                mesh.insert(mesh.end(), &texCoords[corners[c] * 2], &texCoords[corners[c] * 2] + 2);
+            }
+        }
+    }
+}
+
+// 用常驻顶点缓冲绘制一颗卫星，调用时模型视图矩阵为卫星节点的模型视图矩阵
+void drawSatelliteMesh() {
+    if (satelliteBuffer == 0) {
+        glGenBuffers(1, &satelliteBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, satelliteBuffer);
+        glBufferData(GL_ARRAY_BUFFER, satelliteMesh.size() * sizeof(float), satelliteMesh.data(), GL_STATIC_DRAW);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, satelliteBuffer);
+    }
+    const GLsizei stride = 5 * sizeof(float);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, (const void*)0);
+    glNormalPointer(GL_FLOAT, stride, (const void*)0);
+    glTexCoordPointer(2, GL_FLOAT, stride, (const void*)(3 * sizeof(float)));
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    ++frameDrawCalls;
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(satelliteMesh.size() / 5));
+    glDisable(GL_TEXTURE_2D);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// 绘制一个图层中通过剔除的节点。相邻的卫星合并为一次替身绘制（世界空间的球心和半径，
+// 模型视图矩阵为相机矩阵）；其余节点载入各自的模型视图矩阵后调用对应的绘制函数
+void drawSceneLayer(const SceneGraph& graph, SceneLayer layer) {
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    static vector<float> spheres;
+    for (int k = graph.layerBegin[layer]; k < graph.layerBegin[layer + 1]; ++k) {
+        int id = graph.culled[k];
+        if (graph.kind[id] == SCENE_SATELLITE && ensureImpostorProgram()) {
+            spheres.clear();
+            for (; k < graph.layerBegin[layer + 1] && graph.kind[graph.culled[k]] == SCENE_SATELLITE; ++k) {
+                const float* bounds = &graph.boundsWorld[graph.culled[k] * 4];
+                spheres.insert(spheres.end(), bounds, bounds + 4);
+            }
+            --k;
+            glLoadMatrixf(frameMatrices.view.m);
+            drawSphereImpostors(spheres.data(), (int)(spheres.size() / 4));
+            continue;
+        }
+        glLoadMatrixf(graph.modelView[k].m);
+        switch (graph.kind[id]) {
+            case SCENE_FLOOR: drawFloor(); break;
+            case SCENE_SHADOW: drawNaturalShadow(); break;
+            case SCENE_GLOBE: drawGlobe(); break;
+            case SCENE_CONTACT: drawAmbientOcclusion(); break;
+            case SCENE_SATELLITE: drawSatelliteMesh(); break;
+            default: break;
+        }
+    }
+    glPopMatrix();
+}
+
+// 首次使用时建立内置节点：根 -> 地面、阴影、接触阴影、地球 -> 卫星组，并生成卫星网格
+void ensureSceneGraph(SceneGraph& graph) {
+    if (sceneRoot >= 0) return;
+    if (satelliteMesh.empty()) buildSatelliteMesh(satelliteMesh);
+    Mat4 identity = mat4Identity();
+    const float quad[4] = {0.0f, 0.0f, 0.0f, 1.4142136f};
+    const float unit[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    sceneRoot = addSceneNode(graph, -1, SCENE_GROUP, SCENE_LAYER_FLOOR, identity, NULL);
+    sceneFloor = addSceneNode(graph, sceneRoot, SCENE_FLOOR, SCENE_LAYER_FLOOR, identity, NULL);
+    sceneShadow = addSceneNode(graph, sceneRoot, SCENE_SHADOW, SCENE_LAYER_SHADOW, identity, quad);
+    sceneGlobe = addSceneNode(graph, sceneRoot, SCENE_GLOBE, SCENE_LAYER_GLOBE, identity, unit);
+    // 接触阴影挂在根节点下：跟随缩放，不随地球转动
+    sceneContact = addSceneNode(graph, sceneRoot, SCENE_CONTACT, SCENE_LAYER_CONTACT, identity, NULL);
+    sceneSatellites = addSceneNode(graph, sceneGlobe, SCENE_GROUP, SCENE_LAYER_GLOBE, identity, NULL);
+}
+
+// 固定种子生成测试卫星：轨道高度 0.3~1.5 个地球半径，挂在地球节点下随地球转动
+void addSatellites(SceneGraph& graph, size_t count) {
+    ensureSceneGraph(graph);
+    unsigned int seed = 5150u;
+    const float unit[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    for (size_t i = 0; i < count; ++i) {
+        float lat = asin(randomUnit(seed) * 2.0f - 1.0f) * 180.0f / PI;
+        float lon = randomUnit(seed) * 360.0f - 180.0f;
+        float altitude = 1.3f + randomUnit(seed) * 1.2f;
+        float radius = 0.01f + randomUnit(seed) * 0.03f;
+        float p[3];
+        geoToSphere(lat, lon, p);
+        Mat4 local = mat4Multiply(mat4Translate(p[0] * altitude, p[1] * altitude, p[2] * altitude),
+                                  mat4Scale(radius, radius, radius));
+        addSceneNode(graph, sceneSatellites, SCENE_SATELLITE, SCENE_LAYER_GLOBE, local, unit);
+    }
+    cout << "场景图: " << count << " 颗卫星，共 " << graph.size() << " 个节点" << endl;
+}
+
+// 每帧把渲染状态同步到内置节点上（没有变化的节点不会变脏），然后更新、排序和剔除
+void syncSceneGraph(SceneGraph& graph, const SceneMatrices& matrices) {
+    ensureSceneGraph(graph);
+    setSceneLocal(graph, sceneGlobe, matrices.model);
+    setSceneLocal(graph, sceneContact, matrices.contactModel);
+    Mat4 shadow;
+    bool hasShadow = shadowEnabled && lightEnabled && shadowModelMatrix(shadow);
+    if (hasShadow) setSceneLocal(graph, sceneShadow, shadow);
+    setSceneVisible(graph, sceneShadow, hasShadow);
+    setSceneVisible(graph, sceneContact, shadowEnabled);
+    updateSceneGraph(graph);
+    buildSceneDrawList(graph);
+    cullSceneGraph(graph, matrices);
+}
+
+// ========================
+// 视图状态快照
+// ========================
+// 输入回调只修改 inputView 并通过无锁三缓冲发布快照；渲染方（窗口模式下是 display()，
+// CPU渲染窗口模式下是独立的渲染线程）每帧取走最新快照应用到渲染用的全局变量上。
+// 双方都不等待对方，较慢的渲染只会跳过中间状态，不会拖慢输入
+
+struct ViewState {
+    float rotationX, rotationY, zoom;
+    float cameraX, cameraY, cameraZ;
+    int light;
+    bool lightEnabled;
+    bool shadowEnabled;
+    float shadowIntensity;
+    bool globeImpostor;
+    int pointLights;                // 分簇着色的点光源数量
+    bool atmosphere;                // 是否绘制大气
+    bool realSun;                   // 太阳方向取真实太阳位置
+    bool clouds;                    // 是否绘制流式云层
+    bool markers;                   // 是否绘制标记图层
+    bool borders;                   // 是否绘制海岸线与国界
+    bool routes;                    // 是否绘制航线
+    bool field;                     // 是否绘制数据场
+    float fieldTime;                // 数据场时间轴游标
+    bool heatmap;                   // 是否绘制事件密度热力图
+    bool labels;                    // 是否绘制文字标注
+    int width, height;              // 0 表示不改变渲染尺寸
+    unsigned long long sequence;    // 发布序号，用于把画面对应回输入事件
+    
+    ViewState() : rotationX(0.0f), rotationY(0.0f), zoom(1.0f), cameraX(0.0f), cameraY(0.0f), cameraZ(5.0f),
+                  light(0), lightEnabled(true), shadowEnabled(true), shadowIntensity(0.6f),
+                  globeImpostor(false), pointLights(0), atmosphere(false), realSun(false), clouds(false), markers(false), borders(false), routes(false), field(false), fieldTime(0.0f), heatmap(false), labels(false), width(0), height(0), sequence(0) {}
+};
+
+// 单写者、单读者的无锁三缓冲。写者写完后备槽后用一次原子交换发布，
+// 读者用一次原子交换取走最新发布的槽；三个槽保证双方永远不会访问同一个槽
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : shared(1), writeIndex(0), readIndex(2) {}
+    
+    // 写者：填充 writeBuffer() 后调用 publish()
+    T& writeBuffer() { return slots[writeIndex]; }
+    
+    void publish() {
+        int previous = shared.exchange(writeIndex | FRESH, memory_order_acq_rel);
+        writeIndex = previous & INDEX_MASK;
+    }
+    
+    // 读者：有新发布的数据时切换过去并返回 true，之后通过 readBuffer() 读取
+    bool update() {
+        if (!hasFresh()) return false;
+        int previous = shared.exchange(readIndex, memory_order_acq_rel);
+        readIndex = previous & INDEX_MASK;
+        return true;
+    }
+    
+    bool hasFresh() const { return (shared.load(memory_order_acquire) & FRESH) != 0; }
+    T& readBuffer() { return slots[readIndex]; }
+    
+private:
+    static const int FRESH = 4;
+    static const int INDEX_MASK = 3;
+    T slots[3];
+    atomic<int> shared;   // 中间槽的序号，FRESH 位表示写者发布后读者尚未取走
+    int writeIndex;
+    int readIndex;
+};
+
+ViewState inputView;                 // 输入线程持有的最新视图状态
+TripleBuffer<ViewState> viewBuffer;  // 输入 -> 渲染
+
+// 可开关的图层：快照字段、渲染开关、视图描述的键名、切换按键和提示集中登记，
+// captureViewState / applyViewState / parseHeadlessView / keyboard 都遍历这张表
+struct LayerToggle {
+    const char* key;        // 视图描述中的键名
+    bool ViewState::*view;  // 快照中的字段
+    bool* enabled;          // 渲染方的开关
+    char hotkey;            // 小写切换按键
+    const char* title;      // 切换时打印的名称
+    bool (*ready)();        // 是否有数据可显示，空表示总能切换
+    const char* missing;    // 没有数据时的提示
+};
+
+const LayerToggle layerToggles[] = {
+    {"atmosphere", &ViewState::atmosphere, &atmosphereEnabled, 'a', "大气散射", nullptr, nullptr},
+    {"clouds", &ViewState::clouds, &cloudsEnabled, 'k', "云层",
+     []() { return !cloudFramePattern.empty(); }, "没有云层帧序列，请用 --clouds 指定"},
+    {"markers", &ViewState::markers, &markersEnabled, 'm', "标记图层",
+     []() { return markerLayer.pointCount != 0 || !markerData.empty(); },
+     "没有标记数据，请用 --markers 或 --markers-random 指定"},
+    {"borders", &ViewState::borders, &bordersEnabled, 'b', "海岸线与国界",
+     []() { return borderLayer.vertexCount != 0 || !borderData.empty(); },
+     "没有折线数据，请用 --coastlines、--borders 或 --borders-random 指定"},
+    {"routes", &ViewState::routes, &routesEnabled, 'o', "航线",
+     []() { return !routeLayer.arcs.empty(); }, "没有航线数据，请用 --routes 或 --routes-random 指定"},
+    {"field", &ViewState::field, &fieldEnabled, 'v', "数据场",
+     []() { return !fieldPath.empty(); }, "没有数据场，请用 --field 指定"},
+    {"heatmap", &ViewState::heatmap, &heatmapEnabled, 'd', "热力图",
+     []() { return !heatmapLayer.points.empty() || heatmapStreamRate > 0.0; },
+     "没有热力图数据，请用 --heatmap、--heatmap-random 或 --heatmap-stream 指定"},
+    {"labels", &ViewState::labels, &labelsEnabled, 'w', "文字标注", nullptr, nullptr},
+};
+const int LAYER_TOGGLE_COUNT = sizeof(layerToggles) / sizeof(layerToggles[0]);
+
+const LayerToggle* findLayerToggle(const string& key) {
+    for (int i = 0; i < LAYER_TOGGLE_COUNT; ++i) {
+        if (key == layerToggles[i].key) return &layerToggles[i];
+    }
+    return nullptr;
+}
+
+ViewState captureViewState() {
+    ViewState view;
+    view.rotationX = rotationX;
+    view.rotationY = rotationY;
+    view.zoom = zoom;
+    view.cameraX = cameraX;
+    view.cameraY = cameraY;
+    view.cameraZ = cameraZ;
+    view.light = currentLightPosition;
+    view.lightEnabled = lightEnabled;
+    view.shadowEnabled = shadowEnabled;
+    view.shadowIntensity = shadowIntensity;
+    view.globeImpostor = globeImpostor;
+    view.pointLights = pointLightCount;
+    view.realSun = realSunEnabled;
+    for (int i = 0; i < LAYER_TOGGLE_COUNT; ++i) {
+        view.*layerToggles[i].view = *layerToggles[i].enabled;
+    }
+    view.fieldTime = (float)fieldCursor;
+    view.width = WIDTH;
+    view.height = HEIGHT;
+    return view;
+}
+
+// 把快照应用到渲染用的全局状态上，只能在渲染方调用（GL模式下需要当前GL上下文）
+void applyViewState(const ViewState& view) {
+    rotationX = view.rotationX;
+    rotationY = view.rotationY;
+    zoom = view.zoom;
+    cameraX = view.cameraX;
+    cameraY = view.cameraY;
+    cameraZ = view.cameraZ;
+    currentLightPosition = view.light;
+    shadowEnabled = view.shadowEnabled;
+    globeImpostor = view.globeImpostor;
+    realSunEnabled = view.realSun;
+    for (int i = 0; i < LAYER_TOGGLE_COUNT; ++i) {
+        *layerToggles[i].enabled = view.*layerToggles[i].view;
+    }
+    if (view.fieldTime != fieldAppliedTime) {
+        fieldCursor = view.fieldTime;
+        fieldAppliedTime = view.fieldTime;
+    }
+    if (view.pointLights != pointLightCount) {
+        setPointLightCount(view.pointLights);
+    }
+    if (view.width > 0 && view.height > 0) {
+        WIDTH = view.width;
+        HEIGHT = view.height;
+    }
+    
+    // 软件渲染没有GL上下文，只更新CPU侧状态
+    if (softwareRenderer) {
+        lightEnabled = view.lightEnabled;
+        if (view.shadowIntensity != shadowIntensity) {
+            shadowIntensity = view.shadowIntensity;
+            buildSoftShadowPixels();
+        }
+        return;
+    }
+    
+    if (view.lightEnabled != lightEnabled) {
+        lightEnabled = view.lightEnabled;
+        if (lightEnabled) {
+            glEnable(GL_LIGHTING);
+            glEnable(GL_LIGHT0);
+        } else {
+            glDisable(GL_LIGHTING);
+        }
+    }
+    
+    // 阴影强度烘焙在阴影纹理里，只有变化时才重建
+    if (view.shadowIntensity != shadowIntensity) {
+        shadowIntensity = view.shadowIntensity;
+        if (shadowTextureID != 0) {
+            glDeleteTextures(1, &shadowTextureID);
+            shadowTextureID = 0;
+        }
+        createSoftShadowTexture();
+    }
+}
+
+// ========================
+// 鼠标拾取（解析求交）
+// ========================
+// 投影、相机和地球变换（SceneMatrices，与渲染器使用同一套矩阵）完全确定了
+// 光标下的视线，直接与单位球求交即可得到经纬度，不需要 glReadPixels 读回深度（会让CPU等待GPU），
+// 也不依赖GL状态，GL和软件渲染后端下都可以调用，每次只需几微秒。
+// 纹理颜色从 earthSnapshot 读取，不直接访问渲染线程会替换的 earthPixels
+
+struct GlobePick {
+    bool hit;
+    float latitude, longitude;     // 度，参数化与 geoToSphere 一致
+    float u, v;                    // 纹理坐标
+    int texelX, texelY;            // 地球纹理CPU副本中的列和行（第0行对应 t=0）
+    unsigned char rgb[3];          // 该纹理像素的颜色
+    double microseconds;           // 本次拾取耗时
+    GlobePick() : hit(false), latitude(0.0f), longitude(0.0f), u(0.0f), v(0.0f), texelX(-1), texelY(-1),
+                  microseconds(0.0) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+    }
+};
+
+GlobePick hoverPick;               // 光标悬停处的拾取结果（显示在性能面板上）
+int mouseDownX = 0, mouseDownY = 0; // 按下左键时的位置，松开时没有移动才算点击
+
+SceneMatrices inputMatrices;         // 输入方按 inputView 计算的矩阵（与渲染方用同一套代码，结果相同）
+
+// 窗口坐标 (x, y)（左上角为原点，与 GLUT 回调一致）处的视线与地球求交
+bool pickGlobe(const SceneMatrices& matrices, int x, int y, int width, int height, GlobePick& pick) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    pick = GlobePick();
+    if (width <= 0 || height <= 0) return false;
+    
+    // 像素中心的视线：眼空间方向由投影矩阵的焦距给出，再用地球矩阵的逆变换到物体空间，
+    // 起点为物体空间中的相机位置
+    float ndcX = 2.0f * (x + 0.5f) / width - 1.0f;
+    float ndcY = 1.0f - 2.0f * (y + 0.5f) / height;
+    float eye[4] = {ndcX / matrices.projection.m[0], ndcY / matrices.projection.m[5], -1.0f, 0.0f};
+    float dir[4];
+    mat4Transform(matrices.globeInverse, eye, dir);
+    const float* origin = matrices.cameraObject;
+    float dirLength = sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    // 缩放为0或相机在Y轴上（gluLookAt 没有定义）时矩阵退化
+    if (!(dirLength > 0.0f) || !isfinite(dirLength) || !isfinite(origin[0] + origin[1] + origin[2])) return false;
+    for (int i = 0; i < 3; ++i) dir[i] /= dirLength;
+    
+    // |o + t d| = 1，取最近的正根（相机在球内时取远根）
+    float b = origin[0] * dir[0] + origin[1] * dir[1] + origin[2] * dir[2];
+    float c = origin[0] * origin[0] + origin[1] * origin[1] + origin[2] * origin[2] - 1.0f;
+    float discriminant = b * b - c;
+    if (discriminant >= 0.0f) {
+        float root = sqrt(discriminant);
+        float t = -b - root < 0.0f ? -b + root : -b - root;
+        if (t >= 0.0f) {
+            float p[3];
+            for (int i = 0; i < 3; ++i) p[i] = origin[i] + t * dir[i];
+            // 与 generateSphere 相同的参数化：u 对应 theta = atan2(z, x)，v 对应 phi = acos(y)
+            float theta = atan2(p[2], p[0]);
+            if (theta < 0.0f) theta += 2.0f * PI;
+            float phi = acos(min(max(p[1], -1.0f), 1.0f));
+            pick.hit = true;
+            pick.u = theta / (2.0f * PI);
+            pick.v = phi / PI;
+            pick.latitude = 90.0f - phi * 180.0f / PI;
+            pick.longitude = theta * 180.0f / PI - 180.0f;
+            shared_ptr<const EarthImageSnapshot> image = atomic_load(&earthSnapshot);
+            if (image && image->width > 0 && image->height > 0) {
+                pick.texelX = min((int)(pick.u * image->width), image->width - 1);
+                pick.texelY = min((int)(pick.v * image->height), image->height - 1);
+                if (image->pixels.size() >= (size_t)image->width * image->height * 3) {
+                    const unsigned char* texel = &image->pixels[((size_t)pick.texelY * image->width + pick.texelX) * 3];
+                    memcpy(pick.rgb, texel, 3);
+                }
+            }
+        }
+    }
+    pick.microseconds = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    return pick.hit;
+}
+
+// 用输入方最新的视图状态拾取。只读主线程自己的 inputView（启动时由 captureViewState 填入窗口尺寸），
+// 软件渲染模式下 WIDTH/HEIGHT 由渲染线程改写，不能在这里读取
+bool pickAtCursor(int x, int y, GlobePick& pick) {
+    int width = inputView.width;
+    int height = inputView.height;
+    inputMatrices.update(width, height, inputView.cameraX, inputView.cameraY, inputView.cameraZ, inputView.zoom,
+                         inputView.rotationX, inputView.rotationY);
+    return pickGlobe(inputMatrices, x, y, width, height, pick);
+}
+
+void printPick(const GlobePick& pick) {
+    if (!pick.hit) {
+        cout << "拾取: 未点中地球" << endl;
+        return;
+    }
+    printf("拾取: 纬度 %.4f° 经度 %.4f°  纹理像素 (%d, %d) RGB(%d, %d, %d)  %.2f 微秒\n", pick.latitude,
+           pick.longitude, pick.texelX, pick.texelY, pick.rgb[0], pick.rgb[1], pick.rgb[2], pick.microseconds);
+}
+
+// ========================
+// 光照设置函数
+// ========================
+
+void setCurrentLight() {
+    if (!lightEnabled) return;
+    
+    LightPosition light = currentLight();
+    
+    // 设置光源位置
+    GLfloat lightPosition[] = {light.x, light.y, light.z, 1.0f};
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+    
+    // 设置光源颜色
+    GLfloat lightAmbient[] = {0.3f, 0.3f, 0.3f, 1.0f};
+    GLfloat lightDiffuse[] = {1.0f, 1.0f, 0.9f, 1.0f}; // 稍微偏暖色
+    GLfloat lightSpecular[] = {0.8f, 0.8f, 0.8f, 1.0f};
+    
+    glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
+}
+
+void nextLightPosition() {
+    inputView.light = (inputView.light + 1) % lightPositions.size();
+    LightPosition light = lightPositions[inputView.light];
+    cout << "光源位置: " << inputView.light << " - " << light.name 
+         << " (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
+}
+
+void prevLightPosition() {
+    inputView.light = (inputView.light - 1 + lightPositions.size()) % lightPositions.size();
+    LightPosition light = lightPositions[inputView.light];
+    cout << "光源位置: " << inputView.light << " - " << light.name 
+         << " (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
+}
+
+void setLightPosition(int index) {
+    if (index >= 0 && index < (int)lightPositions.size()) {
+        inputView.light = index;
+        LightPosition light = lightPositions[inputView.light];
+        cout << "光源位置: " << inputView.light << " - " << light.name 
+             << " (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
+    } else {
+        cout << "无效的光源位置索引: " << index << "，有效范围: 0-" << lightPositions.size()-1 << endl;
+    }
+}
+
+// 以下开关只修改输入侧状态，GL状态和阴影纹理由 applyViewState() 在渲染方更新
+void toggleLighting() {
+    inputView.lightEnabled = !inputView.lightEnabled;
+    cout << "光照: " << (inputView.lightEnabled ? "开启" : "关闭") << endl;
+}
+
+void toggleShadow() {
+    inputView.shadowEnabled = !inputView.shadowEnabled;
+    cout << "阴影: " << (inputView.shadowEnabled ? "开启" : "关闭") << endl;
+}
+
+void adjustShadowIntensity(float delta) {
+    inputView.shadowIntensity += delta;
+    if (inputView.shadowIntensity < 0.1f) inputView.shadowIntensity = 0.1f;
+    if (inputView.shadowIntensity > 1.0f) inputView.shadowIntensity = 1.0f;
+    cout << "阴影强度: " << inputView.shadowIntensity << endl;
+}
+
+// 打印光源信息
+void printLightInfo() {
+    cout << endl;
+    cout << "========================================" << endl;
+    cout << "当前光源位置: " << inputView.light << endl;
+    LightPosition light = lightPositions[inputView.light];
+    cout << "位置描述: " << light.name << endl;
+    cout << "坐标: (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
+    cout << "光照状态: " << (inputView.lightEnabled ? "开启" : "关闭") << endl;
+    cout << "阴影状态: " << (inputView.shadowEnabled ? "开启" : "关闭") << endl;
+    cout << "阴影强度: " << inputView.shadowIntensity << endl;
+    cout << "太阳方向: " << (inputView.realSun ? "真实太阳位置" : "当前光源位置") << endl;
+    cout << "========================================" << endl;
+}
+
+// ========================
+// 帧时间直方图
+// ========================
+// 每一帧的耗时记入对数分桶直方图（HDR直方图的简化版：128微秒以下精确计数，
+// 之后每个2的幂区间再分64个线性子桶，相对误差约1.6%）。记录一帧只需几次整数运算，
+// 不分配内存，因此可以常开。帧上附带这一帧之前发生的事件标签，用来区分纹理重载、
+// 光源切换等操作造成的卡顿
+
+enum FrameEvent {
+    EVENT_RELOAD = 1 << 0,
+    EVENT_LIGHT  = 1 << 1,
+    EVENT_SHADOW = 1 << 2,
+    EVENT_RESIZE = 1 << 3
+};
+
+const int FRAME_EVENT_COUNT = 4;
+const char* frameEventNames[FRAME_EVENT_COUNT] = {"reload", "light", "shadow", "resize"};
+
+class FrameHistogram {
+public:
+    FrameHistogram() { clear(); }
+    
+    void clear() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        sumUs = 0;
+        maxUs = 0;
+    }
+    
+    void record(long long us) {
+        if (us < 0) us = 0;
+        if (us > MAX_US) us = MAX_US;
+        ++counts[bucketIndex(us)];
+        ++total;
+        sumUs += us;
+        if (us > maxUs) maxUs = us;
+    }
+    
+    // 第 q 分位（0~1）的耗时，取所在桶的上界，单位毫秒
+    double percentileMs(double q) const {
+        if (total == 0) return 0.0;
+        long long target = (long long)ceil(q * total);
+        if (target < 1) target = 1;
+        long long seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                long long upper = bucketUpperBound(i);
+                return (upper < maxUs ? upper : maxUs) / 1000.0;
+            }
+        }
+        return maxUs / 1000.0;
+    }
+    
+    long long count() const { return total; }
+    double meanMs() const { return total ? sumUs / 1000.0 / total : 0.0; }
+    double maxMs() const { return maxUs / 1000.0; }
+    
+private:
+    static const int LINEAR = 128;   // 此值以下每微秒一个桶
+    static const int SUB_BITS = 6;   // 之后每个数量级 64 个子桶
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAGNITUDES = 34; // 覆盖到约 2^40 微秒
+    static const int BUCKETS = LINEAR + MAGNITUDES * SUB;
+    static const long long MAX_US = (1LL << 40) - 1;
+    
+    static int bucketIndex(long long us) {
+        if (us < LINEAR) return (int)us;
+        int shift = 0;
+        while ((us >> shift) >= 2 * SUB) ++shift;
+        // us >> shift 落在 [SUB, 2*SUB)
+        return LINEAR + (shift - 1) * SUB + (int)((us >> shift) - SUB);
+    }
+    
+    static long long bucketUpperBound(int index) {
+        if (index < LINEAR) return index;
+        int shift = (index - LINEAR) / SUB + 1;
+        long long sub = (index - LINEAR) % SUB + SUB;
+        return ((sub + 1) << shift) - 1;
+    }
+    
+    unsigned int counts[BUCKETS];
+    long long total;
+    long long sumUs;
+    long long maxUs;
+};
+
+// 卡顿帧记录，只保留最近的若干条
+struct HitchRecord {
+    long long frame;
+    double ms;
+    unsigned int events;
+};
+
+class FrameStats {
+public:
+    FrameStats() : hitchThresholdMs(1000.0 / 30.0), frames(0), pendingEvents(0), pendingWorkUs(0),
+                   inFrame(false), hitches(0), inputEvents(0), inputFrames(0) {
+        memset(eventHitches, 0, sizeof(eventHitches));
+    }
+    
+    // 记录事件；work 为事件处理本身在帧之间花费的时间（例如同步重载纹理），计入下一帧
+    void noteEvent(unsigned int event, long long workUs = 0) {
+        pendingEvents |= event;
+        pendingWorkUs += workUs;
+    }
+    
+    void beginFrame() {
+        frameStart = chrono::steady_clock::now();
+        inFrame = true;
+    }
+    
+    void endFrame() {
+        if (!inFrame) return;
+        inFrame = false;
+        recordFrame(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - frameStart).count());
+    }
+    
+    // 记录一帧在别处测得的耗时（例如CPU渲染线程交来的帧）
+    void recordFrame(long long us) {
+        us += pendingWorkUs;
+        double ms = us / 1000.0;
+        bool hitch = ms > hitchThresholdMs;
+        
+        all.record(us);
+        if (hitch) ++hitches;
+        for (int e = 0; e < FRAME_EVENT_COUNT; ++e) {
+            if (!(pendingEvents & (1u << e))) continue;
+            byEvent[e].record(us);
+            if (hitch) ++eventHitches[e];
+        }
+        if (hitch) {
+            HitchRecord record = {frames, ms, pendingEvents};
+            recentHitches.push_back(record);
+            if (recentHitches.size() > MAX_HITCH_RECORDS) recentHitches.pop_front();
+        }
+        
+        ++frames;
+        pendingEvents = 0;
+        pendingWorkUs = 0;
+    }
+    
+    // 记录一帧所反映的输入事件：每个事件从到达到该帧交换完成的延迟
+    void recordInputLatency(const vector<chrono::steady_clock::time_point>& eventTimes,
+                            chrono::steady_clock::time_point swapTime) {
+        if (eventTimes.empty()) return;
+        for (size_t i = 0; i < eventTimes.size(); ++i) {
+            inputLatency.record(chrono::duration_cast<chrono::microseconds>(swapTime - eventTimes[i]).count());
+        }
+        inputEvents += eventTimes.size();
+        ++inputFrames;
+    }
+    
+    // 按扩展名选择格式：.csv 输出CSV，其余输出JSON
+    bool writeReport(const string& path) const {
+        ofstream file(path.c_str());
+        if (!file) {
+            cerr << "错误: 无法写入帧时间报告 " << path << endl;
+            return false;
+        }
+        bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+        if (csv) {
+            file << "group,frames,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,hitches\n";
+            writeCsvRow(file, "all", all, hitches);
+            for (int e = 0; e < FRAME_EVENT_COUNT; ++e) {
+                writeCsvRow(file, frameEventNames[e], byEvent[e], eventHitches[e]);
+            }
+            writeCsvRow(file, "input_latency", inputLatency, 0);
+        } else {
+            file << "{\n";
+            file << "  \"hitch_threshold_ms\": " << hitchThresholdMs << ",\n";
+            file << "  \"all\": ";
+            writeJsonGroup(file, all, hitches);
+            file << ",\n  \"events\": {\n";
+            for (int e = 0; e < FRAME_EVENT_COUNT; ++e) {
+                file << "    \"" << frameEventNames[e] << "\": ";
+                writeJsonGroup(file, byEvent[e], eventHitches[e]);
+                file << (e + 1 < FRAME_EVENT_COUNT ? ",\n" : "\n");
+            }
+            file << "  },\n  \"input_latency\": ";
+            writeJsonGroup(file, inputLatency, 0);
+            file << ",\n  \"input_events_per_frame\": " << eventsPerInputFrame();
+            file << ",\n  \"recent_hitches\": [";
+            for (size_t i = 0; i < recentHitches.size(); ++i) {
+                const HitchRecord& h = recentHitches[i];
+                file << (i ? ",\n" : "\n") << "    {\"frame\": " << h.frame << ", \"ms\": " << h.ms << ", \"events\": [";
+                bool first = true;
+                for (int e = 0; e < FRAME_EVENT_COUNT; ++e) {
+                    if (!(h.events & (1u << e))) continue;
+                    file << (first ? "" : ", ") << "\"" << frameEventNames[e] << "\"";
+                    first = false;
+                }
+                file << "]}";
+            }
+            file << (recentHitches.empty() ? "]\n" : "\n  ]\n") << "}\n";
+        }
+        return true;
+    }
+    
+    void printSummary() const {
+        cout << "帧时间统计: " << all.count() << " 帧，p50 " << all.percentileMs(0.5)
+             << " ms，p90 " << all.percentileMs(0.9) << " ms，p99 " << all.percentileMs(0.99)
+             << " ms，最大 " << all.maxMs() << " ms，卡顿(>" << hitchThresholdMs << "ms) " << hitches << " 帧" << endl;
+        for (int e = 0; e < FRAME_EVENT_COUNT; ++e) {
+            if (byEvent[e].count() == 0) continue;
+            cout << "  " << frameEventNames[e] << ": " << byEvent[e].count() << " 帧，最大 "
+                 << byEvent[e].maxMs() << " ms，卡顿 " << eventHitches[e] << " 帧" << endl;
+        }
+        if (inputLatency.count() > 0) {
+            cout << "输入到上屏延迟: " << inputLatency.count() << " 个事件（平均每帧合并 " << eventsPerInputFrame()
+                 << " 个），p50 " << inputLatency.percentileMs(0.5) << " ms，p99 " << inputLatency.percentileMs(0.99)
+                 << " ms，最大 " << inputLatency.maxMs() << " ms" << endl;
+        }
+    }
+    
+    const FrameHistogram& histogram() const { return all; }
+    const FrameHistogram& inputLatencyHistogram() const { return inputLatency; }
+    double eventsPerInputFrame() const { return inputFrames ? (double)inputEvents / inputFrames : 0.0; }
+    long long hitchCount() const { return hitches; }
+    
+    double hitchThresholdMs;
+    
+private:
+    static const size_t MAX_HITCH_RECORDS = 256;
+    
+    static void writeCsvRow(ofstream& file, const char* name, const FrameHistogram& h, long long hitchCount) {
+        file << name << "," << h.count() << "," << h.meanMs() << "," << h.percentileMs(0.5) << ","
+             << h.percentileMs(0.9) << "," << h.percentileMs(0.99) << "," << h.maxMs() << "," << hitchCount << "\n";
+    }
+    
+    static void writeJsonGroup(ofstream& file, const FrameHistogram& h, long long hitchCount) {
+        file << "{\"frames\": " << h.count() << ", \"mean_ms\": " << h.meanMs()
+             << ", \"p50_ms\": " << h.percentileMs(0.5) << ", \"p90_ms\": " << h.percentileMs(0.9)
+             << ", \"p99_ms\": " << h.percentileMs(0.99) << ", \"max_ms\": " << h.maxMs()
+             << ", \"hitches\": " << hitchCount << "}";
+    }
+    
+    FrameHistogram all;
+    FrameHistogram byEvent[FRAME_EVENT_COUNT];
+    long long frames;
+    unsigned int pendingEvents;
+    long long pendingWorkUs;
+    chrono::steady_clock::time_point frameStart;
+    bool inFrame;
+    long long hitches;
+    long long eventHitches[FRAME_EVENT_COUNT];
+    deque<HitchRecord> recentHitches;
+    FrameHistogram inputLatency;
+    long long inputEvents;
+    long long inputFrames;
+};
+
+FrameStats frameStats;
+string frameReportPath = "frame_times.json"; // 'F' 键和退出时写入的报告路径
+bool frameReportRequested = false;            // 用 --frame-report 指定过路径，无窗口模式才写报告
+
+void writeFrameReport() {
+    if (frameStats.histogram().count() == 0 && frameStats.inputLatencyHistogram().count() == 0) return;
+    frameStats.printSummary();
+    if (frameStats.writeReport(frameReportPath)) {
+        cout << "帧时间报告已写入 " << frameReportPath << endl;
+    }
+}
+
+// ========================
+// 流式纹理（PBO环）
+// ========================
+// 云层和随时间变化的叠加层从磁盘上的帧序列播放。逐帧同步调用 glTexImage2D 时，驱动要在调用内
+// 拷贝整张图片，渲染线程因此停顿。StreamingTexture 维护一个像素缓冲对象（PBO）环：渲染线程把
+// 空闲的 PBO 映射出来交给解码线程直接写入，写好的 PBO 解除映射后用 glTexSubImage2D 从缓冲区
+// 上传（由驱动异步执行），GPU 读取上一块的同时解码线程填充下一块。每帧花在这些GL调用上的时间
+// 记入直方图，作为上传停顿的度量
+
+const int STREAM_RING_SIZE = 3;
+
+// 帧文件名模式中只允许一个 %d（可带宽度，如 %03d）
+bool formatFramePath(const string& pattern, int index, string& path) {
+    size_t percent = pattern.find('%');
+    if (percent == string::npos || pattern.find('%', percent + 1) != string::npos) return false;
+    size_t end = percent + 1;
+    while (end < pattern.size() && isdigit((unsigned char)pattern[end])) ++end;
+    if (end >= pattern.size() || pattern[end] != 'd') return false;
+    char number[32];
+    snprintf(number, sizeof(number), ("%" + pattern.substr(percent + 1, end - percent)).c_str(), index);
+    path = pattern.substr(0, percent) + number + pattern.substr(end + 1);
+    return true;
+}
+
+// 把一帧BMP解码为RGBA，亮度作为不透明度（黑色完全透明），dst 为 width*height*4 字节
+bool decodeStreamFrame(const string& path, int width, int height, unsigned char* dst) {
+    unsigned char* data = NULL;
+    int w = 0, h = 0;
+    if (!loadBMPFile(path.c_str(), data, w, h)) return false;
+    bool ok = w == width && h == height;
+    if (ok) {
+        for (int i = 0; i < width * height; ++i) {
+            const unsigned char* src = data + i * 3;
+            dst[i * 4 + 0] = src[0];
+            dst[i * 4 + 1] = src[1];
+            dst[i * 4 + 2] = src[2];
+            dst[i * 4 + 3] = (unsigned char)((src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8);
+        }
+    } else {
+        cerr << "警告: 帧 " << path << " 的尺寸 " << w << "x" << h << " 与第一帧不同，跳过" << endl;
+    }
+    delete[] data;
+    return ok;
+}
+
+class StreamingTexture {
+public:
+    StreamingTexture() : waitForDecode(false), texture(0), width(0), height(0), frameCount(0), framesPerSecond(0.0), synchronous(false),
+                         uploadIndex(0), mapIndex(0), nextDecodeFrame(0), shownFrame(-1), waitingLate(false),
+                         late(0), uploaded(0), decodeUsTotal(0), decodeCount(0), stopDecoding(false) {
+        for (int i = 0; i < STREAM_RING_SIZE; ++i) {
+            slots[i].pbo = 0;
+            slots[i].mapped = NULL;
+            slots[i].frame = 0;
+            slots[i].state = SLOT_FREE;
+        }
+    }
+    
+    ~StreamingTexture() { stopDecoder(); }
+    
+    bool waitForDecode; // 到切换时间时等待解码完成（离屏渲染需要每个视图都有确定的画面）
+    
+    // 从0开始探测连续的帧文件（按 printf 模式，如 clouds/%03d.bmp），创建纹理和PBO环并启动解码线程。
+    // fps <= 0 时每次 update() 都切换到下一帧；sync 为 true 时不用PBO，在渲染线程解码并 glTexImage2D（对照组）
+    bool open(const string& filePattern, double fps, bool sync) {
+        close();
+        pattern = filePattern;
+        framesPerSecond = fps;
+        synchronous = sync;
+        
+        string path;
+        if (!formatFramePath(pattern, 0, path)) {
+            cerr << "错误: 帧文件模式 " << pattern << " 中应包含一个 %d" << endl;
+            return false;
+        }
+        struct stat info;
+        frameCount = 0;
+        while (formatFramePath(pattern, frameCount, path) && stat(path.c_str(), &info) == 0) ++frameCount;
+        formatFramePath(pattern, 0, path);
+        unsigned char* data = NULL;
+        if (frameCount == 0 || !loadBMPFile(path.c_str(), data, width, height)) {
+            cerr << "错误: 找不到帧序列 " << pattern << endl;
+            frameCount = 0;
+            return false;
+        }
+        delete[] data;
+        
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        if (!synchronous) {
+            for (int i = 0; i < STREAM_RING_SIZE; ++i) glGenBuffers(1, &slots[i].pbo);
+            stopDecoding = false;
+            decoder = thread(&StreamingTexture::decodeLoop, this);
+        }
+        start = chrono::steady_clock::now();
+        nextFrameTime = 0.0;
+        cout << "流式纹理: " << pattern << "，" << frameCount << " 帧 " << width << "x" << height
+             << (synchronous ? "（同步上传）" : "（PBO环）") << endl;
+        return true;
+    }
+    
+    // 渲染线程每帧调用：到了切换时间就上传已解码好的下一帧，再把空闲的PBO交给解码线程
+    void update() {
+        if (!active()) return;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        double now = chrono::duration<double>(begin - start).count();
+        bool due = framesPerSecond <= 0.0 || now >= nextFrameTime;
+        
+        if (synchronous) {
+            if (due) uploadSynchronously();
+        } else {
+            if (waitForDecode && uploaded == 0) mapFreeSlots(); // 第一帧之前还没有交给解码线程的PBO
+            if (due) uploadReadySlot(now);
+            mapFreeSlots();
+        }
+        stall.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+    }
+    
+    // 只停止解码线程，不做GL调用（进程退出时使用）
+    void stopDecoder() {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopDecoding = true;
+        }
+        jobReady.notify_all();
+        if (decoder.joinable()) decoder.join();
+    }
+    
+    // 停止解码线程并释放GL对象（需要当前GL上下文）
+    void close() {
+        stopDecoder();
+        jobs.clear();
+        for (int i = 0; i < STREAM_RING_SIZE; ++i) {
+            Slot& slot = slots[i];
+            if (slot.pbo != 0) {
+                if (slot.mapped) {
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                }
+                glDeleteBuffers(1, &slot.pbo);
+            }
+            slot.pbo = 0;
+            slot.mapped = NULL;
+            slot.state = SLOT_FREE;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (texture != 0) glDeleteTextures(1, &texture);
+        texture = 0;
+        frameCount = 0;
+        uploadIndex = mapIndex = nextDecodeFrame = 0;
+        shownFrame = -1;
+        waitingLate = false;
+        late = uploaded = 0;
+        decodeUsTotal = decodeCount = 0;
+        stall.clear();
+    }
+    
+    bool active() const { return texture != 0 && frameCount > 0; }
+    bool hasFrame() const { return shownFrame >= 0; }
+    GLuint textureId() const { return texture; }
+    int currentFrame() const { return shownFrame; }
+    
+    // 上传停顿（渲染线程花在映射/解除映射/上传调用上的时间）
+    const FrameHistogram& stallHistogram() const { return stall; }
+    long long lateFrames() const { return late; }         // 到了切换时间但解码尚未完成的次数
+    long long uploadedFrames() const { return uploaded; }
+    double meanDecodeMs() const {
+        long long count = decodeCount.load();
+        return count ? decodeUsTotal.load() / 1000.0 / count : 0.0;
+    }
+    
+private:
+    enum SlotState { SLOT_FREE, SLOT_DECODING, SLOT_READY };
+    
+    struct Slot {
+        GLuint pbo;
+        unsigned char* mapped;  // 映射期间由解码线程写入
+        int frame;
+        atomic<int> state;
+    };
+    
+    void advanceClock(double now) {
+        if (framesPerSecond <= 0.0) return;
+        nextFrameTime += 1.0 / framesPerSecond;
+        if (nextFrameTime < now) nextFrameTime = now + 1.0 / framesPerSecond; // 落后太多时不追赶
+    }
+    
+    void uploadReadySlot(double now) {
+        Slot& slot = slots[uploadIndex];
+        while (waitForDecode && slot.state.load(memory_order_acquire) == SLOT_DECODING) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        if (slot.state.load(memory_order_acquire) != SLOT_READY) {
+            if (!waitingLate) ++late;
+            waitingLate = true;
+            return;
+        }
+        waitingLate = false;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        slot.mapped = NULL;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // 绑定了解包缓冲区时最后一个参数是缓冲区内的偏移，调用立即返回
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        shownFrame = slot.frame;
+        slot.state.store(SLOT_FREE, memory_order_release);
+        uploadIndex = (uploadIndex + 1) % STREAM_RING_SIZE;
+        ++uploaded;
+        advanceClock(now);
+    }
+    
+    // 按环的顺序映射空闲的PBO交给解码线程。先用 glBufferData(NULL) 丢弃旧存储，
+    // 即使上一次从它发起的上传还没完成也不必等待
+    void mapFreeSlots() {
+        size_t bytes = (size_t)width * height * 4;
+        while (slots[mapIndex].state.load(memory_order_acquire) == SLOT_FREE) {
+            Slot& slot = slots[mapIndex];
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+            slot.mapped = (unsigned char*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+            if (!slot.mapped) break;
+            slot.frame = nextDecodeFrame;
+            nextDecodeFrame = (nextDecodeFrame + 1) % frameCount;
+            slot.state.store(SLOT_DECODING, memory_order_release);
+            {
+                lock_guard<mutex> lock(jobMutex);
+                jobs.push_back(mapIndex);
+            }
+            jobReady.notify_one();
+            mapIndex = (mapIndex + 1) % STREAM_RING_SIZE;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    
+    void uploadSynchronously() {
+        string path;
+        formatFramePath(pattern, nextDecodeFrame, path);
+        syncPixels.resize((size_t)width * height * 4);
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        if (!decodeStreamFrame(path, width, height, syncPixels.data())) memset(syncPixels.data(), 0, syncPixels.size());
+        decodeUsTotal += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+        ++decodeCount;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, syncPixels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        shownFrame = nextDecodeFrame;
+        nextDecodeFrame = (nextDecodeFrame + 1) % frameCount;
+        ++uploaded;
+        advanceClock(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    
+    void decodeLoop() {
+        unique_lock<mutex> lock(jobMutex);
+        for (;;) {
+            jobReady.wait(lock, [this] { return stopDecoding || !jobs.empty(); });
+            if (stopDecoding) return;
+            int index = jobs.front();
+            jobs.pop_front();
+            lock.unlock();
+            
+            Slot& slot = slots[index];
+            string path;
+            formatFramePath(pattern, slot.frame, path);
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            if (!decodeStreamFrame(path, width, height, slot.mapped)) {
+                memset(slot.mapped, 0, (size_t)width * height * 4);
+            }
+            decodeUsTotal += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+            ++decodeCount;
+            slot.state.store(SLOT_READY, memory_order_release);
+            
+            lock.lock();
+        }
+    }
+    
+    string pattern;
+    GLuint texture;
+    int width, height;
+    int frameCount;
+    double framesPerSecond;
+    bool synchronous;
+    Slot slots[STREAM_RING_SIZE];
+    int uploadIndex;        // 下一个要上传的槽（渲染线程）
+    int mapIndex;           // 下一个要映射给解码线程的槽（渲染线程）
+    int nextDecodeFrame;
+    int shownFrame;
+    bool waitingLate;
+    long long late, uploaded;
+    atomic<long long> decodeUsTotal, decodeCount;
+    FrameHistogram stall;
+    vector<unsigned char> syncPixels;
+    chrono::steady_clock::time_point start;
+    double nextFrameTime;
+    
+    thread decoder;
+    mutex jobMutex;
+    condition_variable jobReady;
+    deque<int> jobs;
+    bool stopDecoding;
+};
+
+// 云层：地球外面稍大一圈的半透明球，纹理从帧序列流式播放
+const float CLOUD_LAYER_SCALE = 1.012f;
+bool cloudStreamFailed = false;
+StreamingTexture cloudStream;
+
+void stopCloudDecoder() {
+    cloudStream.stopDecoder();
+}
+
+// 在地球之后绘制云层，使用 frameMatrices 中放大后的地球矩阵。首次调用时打开帧序列
+void drawCloudLayer() {
+    if (cloudFramePattern.empty() || cloudStreamFailed) return;
+    if (!cloudStream.active()) {
+        if (!cloudStream.open(cloudFramePattern, cloudFramesPerSecond, false)) {
+            cloudStreamFailed = true;
+            return;
+        }
+        static bool exitHandlerRegistered = false;
+        if (!exitHandlerRegistered) atexit(stopCloudDecoder); // 窗口模式经 exit() 退出，先停掉解码线程
+        exitHandlerRegistered = true;
+    }
+    cloudStream.update();
+    if (!cloudStream.hasFrame()) return;
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glPushMatrix();
+    glLoadMatrixf(frameMatrices.shell(CLOUD_LAYER_SCALE).m);
+    drawSphereMesh(1.0f, sphereSlices, sphereStacks, cloudStream.textureId());
+    glPopMatrix();
+    glPopAttrib();
+}
+
+// ========================
+// 时间序列数据场叠加
+// ========================
+// 气温、降水等按经纬度网格逐时给出的标量场，以内存映射的二进制文件提供（可达数千个时间步）。
+// 时间轴游标附近的几帧由后台线程从映射区读出、量化为16位后放入暂存区，渲染线程每帧最多
+// 上传 FIELD_UPLOADS_PER_FRAME 帧到纹理环中；拖动时间轴时按移动方向预取，已经过时但还没开始
+// 解码的任务直接取消。当前帧还没准备好时继续显示环中离游标最近的一帧，渲染从不等待磁盘。
+// 着色器在相邻两帧之间插值，再经一维查找表映射为颜色，半透明地叠加在地球纹理上
+//
+// 文件格式（小端）：32字节文件头，之后是 帧数 x 高 x 宽 个 float32，每帧第0行为北纬90度，
+// 第0列为西经180度（与地球纹理一致），NaN 表示缺测
+//   char magic[8] = "GLBFLD01"; int32 width, height, frames; float minValue, maxValue, hoursPerFrame;
+
+const int FIELD_RING_SIZE = 6;           // 游标所在帧、插值用的下一帧，以及移动方向上的预取
+const int FIELD_UPLOADS_PER_FRAME = 2;
+const float FIELD_LAYER_SCALE = 1.003f;  // 略高于地表，替身地球（精确球面）下也不会深度冲突
+const int FIELD_LUT_SIZE = 256;
+
+struct FieldFileHeader {
+    char magic[8];
+    int width, height, frames;
+    float minValue, maxValue;
+    float hoursPerFrame;
+};
+
+class FieldTimeline {
+public:
+    FieldTimeline() : waitForDecode(false), mapping(NULL), mappingBytes(0), prefetchStride(1), lastTarget(-1),
+                      shownA(-1), shownB(-1), shownMix(0.0f), misses(0), requests(0), cancelled(0),
+                      decodeUsTotal(0), decodeCount(0), stopDecoding(false) {
+        memset(&header, 0, sizeof(header));
+        for (int i = 0; i < FIELD_RING_SIZE; ++i) {
+            slots[i].texture = 0;
+            slots[i].frame = -1;
+            slots[i].state = SLOT_FREE;
+        }
+    }
+    
+    ~FieldTimeline() { stopDecoder(); }
+    
+    bool waitForDecode; // 游标所在帧没准备好时等待（离屏渲染需要每个视图都有确定的画面）
+    
+    // 映射数据文件，创建纹理环并启动解码线程（需要当前GL上下文）
+    bool open(const string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "错误: 无法打开数据场文件 " << path << endl;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FieldFileHeader)) {
+            cerr << "错误: 数据场文件 " << path << " 太小" << endl;
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // 映射建立后文件描述符不再需要
+        if (address == MAP_FAILED) {
+            cerr << "错误: 无法映射数据场文件 " << path << endl;
+            return false;
+        }
+        mapping = (const unsigned char*)address;
+        mappingBytes = (size_t)info.st_size;
+        memcpy(&header, mapping, sizeof(header));
+        size_t expected = sizeof(FieldFileHeader) + (size_t)max(header.width, 0) * max(header.height, 0) *
+                                                        max(header.frames, 0) * sizeof(float);
+        if (memcmp(header.magic, "GLBFLD01", 8) != 0 || header.width <= 0 || header.height <= 0 ||
+            header.frames <= 0 || mappingBytes < expected || !(header.maxValue > header.minValue)) {
+            cerr << "错误: " << path << " 不是有效的数据场文件" << endl;
+            unmap();
+            return false;
+        }
+        
+        for (int i = 0; i < FIELD_RING_SIZE; ++i) {
+            Slot& slot = slots[i];
+            glGenTextures(1, &slot.texture);
+            glBindTexture(GL_TEXTURE_2D, slot.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE16, header.width, header.height, 0, GL_LUMINANCE,
+                         GL_UNSIGNED_SHORT, NULL);
+            slot.staging.resize((size_t)header.width * header.height);
+            slot.frame = -1;
+            slot.state = SLOT_FREE;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        stopDecoding = false;
+        decoder = thread(&FieldTimeline::decodeLoop, this);
+        cout << "数据场: " << path << "，" << header.frames << " 帧 " << header.width << "x" << header.height
+             << "，取值范围 " << header.minValue << " ~ " << header.maxValue << "，已映射 "
+             << mappingBytes / (1024 * 1024) << " MB" << endl;
+        return true;
+    }
+    
+    // 渲染线程每帧调用：按游标安排预取、上传已解码的帧，并选出要显示的两帧和插值系数
+    void update(double cursor) {
+        if (!active()) return;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        int frames = header.frames;
+        double wrapped = cursor - floor(cursor / frames) * frames;
+        int target = min((int)wrapped, frames - 1);
+        float mixFactor = (float)(wrapped - target);
+        int next = (target + 1) % frames;
+        if (lastTarget >= 0 && target != lastTarget) {
+            // 按环形时间轴上较短的方向估计拖动步长，跳得太远时视为随机跳转，恢复逐帧预取
+            int forward = (target - lastTarget + frames) % frames;
+            prefetchStride = forward <= frames / 2 ? forward : forward - frames;
+            if (abs(prefetchStride) > frames / (2 * FIELD_RING_SIZE)) prefetchStride = 1;
+        }
+        
+        // 当前帧和插值用的下一帧优先，其余的槽沿拖动方向按步长预取
+        int wanted[FIELD_RING_SIZE];
+        wanted[0] = target;
+        wanted[1] = next;
+        int filled = 2;
+        for (int step = 1; filled < FIELD_RING_SIZE && step <= FIELD_RING_SIZE; ++step) {
+            int frame = ((target + step * prefetchStride) % frames + frames) % frames;
+            if (frame != target && frame != next) wanted[filled++] = frame;
+        }
+        while (filled < FIELD_RING_SIZE) wanted[filled++] = next; // 帧数比纹理环还少
+        schedule(wanted);
+        
+        if (waitForDecode) {
+            waitFor(target);
+            if (mixFactor > 0.0f) waitFor(next);
+        }
+        int uploads = 0;
+        for (int k = 0; k < FIELD_RING_SIZE && uploads < FIELD_UPLOADS_PER_FRAME; ++k) {
+            int index = find(wanted[k]);
+            if (index >= 0 && slots[index].state.load(memory_order_acquire) == SLOT_READY) {
+                upload(slots[index]);
+                ++uploads;
+            }
+        }
+        
+        if (target != lastTarget) ++requests;
+        int a = findResident(target), b = findResident(next);
+        if (a >= 0) {
+            shownA = a;
+            shownB = b >= 0 ? b : a;
+            shownMix = b >= 0 ? mixFactor : 0.0f;
+        } else {
+            // 游标所在帧还没准备好：显示环中离游标最近的一帧，不等待
+            if (target != lastTarget) ++misses;
+            int best = -1, bestDistance = frames;
+            for (int i = 0; i < FIELD_RING_SIZE; ++i) {
+                if (slots[i].state.load(memory_order_acquire) != SLOT_RESIDENT) continue;
+                int d = abs(slots[i].frame - target);
+                d = min(d, frames - d);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = i;
+                }
+            }
+            if (best >= 0) {
+                shownA = shownB = best;
+                shownMix = 0.0f;
+            }
+        }
+        lastTarget = target;
+        stall.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+    }
+    
+    // 只停止解码线程，不做GL调用（进程退出时使用）
+    void stopDecoder() {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopDecoding = true;
+        }
+        jobReady.notify_all();
+        if (decoder.joinable()) decoder.join();
+    }
+    
+    // 停止解码线程，释放纹理并解除映射（需要当前GL上下文）
+    void close() {
+        stopDecoder();
+        for (int i = 0; i < FIELD_RING_SIZE; ++i) {
+            if (slots[i].texture != 0) glDeleteTextures(1, &slots[i].texture);
+            slots[i].texture = 0;
+            vector<unsigned short>().swap(slots[i].staging);
+        }
+        unmap();
+        clearRing();
+    }
+    
+    // 清空纹理环和统计，保留映射和纹理，重新启动解码线程（基准测试中每组从相同状态开始）
+    void reset() {
+        if (!active()) return;
+        stopDecoder();
+        clearRing();
+        stopDecoding = false;
+        decoder = thread(&FieldTimeline::decodeLoop, this);
+    }
+    
+    bool active() const { return mapping != NULL && slots[0].texture != 0; }
+    bool hasFrame() const { return shownA >= 0; }
+    int frameCount() const { return header.frames; }
+    float hoursPerFrame() const { return header.hoursPerFrame; }
+    GLuint textureA() const { return slots[shownA].texture; }
+    GLuint textureB() const { return slots[shownB].texture; }
+    int frameA() const { return shownA >= 0 ? slots[shownA].frame : -1; }
+    float mixFactor() const { return shownMix; }
+    
+    // 渲染线程花在调度和上传上的时间
+    const FrameHistogram& stallHistogram() const { return stall; }
+    long long missCount() const { return misses; }       // 游标移到新的一帧时该帧尚未就绪的次数
+    long long requestCount() const { return requests; }  // 游标移到新的一帧的次数
+    long long cancelledJobs() const { return cancelled; }
+    double meanDecodeMs() const {
+        long long count = decodeCount.load();
+        return count ? decodeUsTotal.load() / 1000.0 / count : 0.0;
+    }
+    int residentFrames() const {
+        int count = 0;
+        for (int i = 0; i < FIELD_RING_SIZE; ++i) count += slots[i].state.load() == SLOT_RESIDENT;
+        return count;
+    }
+    
+private:
+    // FREE -> QUEUED（渲染线程）-> DECODING -> READY（解码线程）-> RESIDENT（渲染线程上传后）
+    enum SlotState { SLOT_FREE, SLOT_QUEUED, SLOT_DECODING, SLOT_READY, SLOT_RESIDENT };
+    
+    struct Slot {
+        GLuint texture;
+        int frame;
+        atomic<int> state;
+        vector<unsigned short> staging; // 解码结果，0 表示缺测，1~65535 对应 minValue~maxValue
+    };
+    
+    void clearRing() {
+        jobs.clear();
+        for (int i = 0; i < FIELD_RING_SIZE; ++i) {
+            slots[i].frame = -1;
+            slots[i].state = SLOT_FREE;
+        }
+        lastTarget = shownA = shownB = -1;
+        shownMix = 0.0f;
+        prefetchStride = 1;
+        misses = requests = cancelled = 0;
+        decodeUsTotal = decodeCount = 0;
+        stall.clear();
+    }
+    
+    void unmap() {
+        if (mapping) munmap((void*)mapping, mappingBytes);
+        mapping = NULL;
+        mappingBytes = 0;
+    }
+    
+    int find(int frame) const {
+        for (int i = 0; i < FIELD_RING_SIZE; ++i) {
+            if (slots[i].frame == frame && slots[i].state.load(memory_order_acquire) != SLOT_FREE) return i;
+        }
+        return -1;
+    }
+    
+    int findResident(int frame) const {
+        int index = find(frame);
+        return index >= 0 && slots[index].state.load(memory_order_acquire) == SLOT_RESIDENT ? index : -1;
+    }
+    
+    // 取消不再需要的排队任务，再把缺少的帧按优先级分配给不再需要的槽
+    void schedule(const int wanted[FIELD_RING_SIZE]) {
+        struct Wanted {
+            static bool contains(const int* list, int frame) {
+                for (int k = 0; k < FIELD_RING_SIZE; ++k) {
+                    if (list[k] == frame) return true;
+                }
+                return false;
+            }
+        };
+        {
+            lock_guard<mutex> lock(jobMutex);
+            for (size_t j = 0; j < jobs.size();) {
+                Slot& slot = slots[jobs[j]];
+                if (!Wanted::contains(wanted, slot.frame)) {
+                    slot.state.store(SLOT_FREE, memory_order_release);
+                    jobs.erase(jobs.begin() + j);
+                    ++cancelled;
+                } else {
+                    ++j;
+                }
+            }
+        }
+        for (int k = 0; k < FIELD_RING_SIZE; ++k) {
+            if (find(wanted[k]) >= 0) continue;
+            int victim = -1;
+            for (int i = 0; i < FIELD_RING_SIZE && victim < 0; ++i) {
+                int state = slots[i].state.load(memory_order_acquire);
+                if (state == SLOT_FREE) victim = i;
+            }
+            for (int i = 0; i < FIELD_RING_SIZE && victim < 0; ++i) {
+                int state = slots[i].state.load(memory_order_acquire);
+                // 正在显示的帧在新帧上传之前保留，避免画面闪烁
+                if ((state == SLOT_READY || state == SLOT_RESIDENT) && !Wanted::contains(wanted, slots[i].frame) &&
+                    i != shownA && i != shownB) {
+                    victim = i;
+                }
+            }
+            if (victim < 0) break; // 其余的槽都在解码或仍然需要，下一帧再安排
+            Slot& slot = slots[victim];
+            slot.frame = wanted[k];
+            slot.state.store(SLOT_QUEUED, memory_order_release);
+            {
+                lock_guard<mutex> lock(jobMutex);
+                jobs.push_back(victim);
+            }
+            jobReady.notify_one();
+        }
+    }
+    
+    void waitFor(int frame) {
+        int index = find(frame);
+        if (index < 0) return;
+        while (slots[index].state.load(memory_order_acquire) == SLOT_QUEUED ||
+               slots[index].state.load(memory_order_acquire) == SLOT_DECODING) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    
+    void upload(Slot& slot) {
+        glBindTexture(GL_TEXTURE_2D, slot.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.width, header.height, GL_LUMINANCE, GL_UNSIGNED_SHORT,
+                        slot.staging.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        slot.state.store(SLOT_RESIDENT, memory_order_release);
+    }
+    
+    // 从映射区读出一帧并量化。读映射区时的缺页（真正的磁盘读取）发生在这里，而不是渲染线程
+    void decode(Slot& slot) {
+        size_t count = (size_t)header.width * header.height;
+        const float* values = (const float*)(mapping + sizeof(FieldFileHeader)) + count * slot.frame;
+        float scale = 65534.0f / (header.maxValue - header.minValue);
+        unsigned short* out = slot.staging.data();
+        for (size_t i = 0; i < count; ++i) {
+            float v = values[i];
+            if (v != v) {
+                out[i] = 0;
+                continue;
+            }
+            float q = (v - header.minValue) * scale;
+            out[i] = (unsigned short)(1.0f + min(max(q, 0.0f), 65534.0f) + 0.5f);
+        }
+    }
+    
+    void decodeLoop() {
+        unique_lock<mutex> lock(jobMutex);
+        for (;;) {
+            jobReady.wait(lock, [this] { return stopDecoding || !jobs.empty(); });
+            if (stopDecoding) return;
+            int index = jobs.front();
+            jobs.pop_front();
+            Slot& slot = slots[index];
+            slot.state.store(SLOT_DECODING, memory_order_release); // 持锁转换，渲染线程不会再取消它
+            lock.unlock();
+            
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            decode(slot);
+            decodeUsTotal += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+            ++decodeCount;
+            slot.state.store(SLOT_READY, memory_order_release);
+            
+            lock.lock();
+        }
+    }
+    
+    FieldFileHeader header;
+    const unsigned char* mapping;
+    size_t mappingBytes;
+    Slot slots[FIELD_RING_SIZE];
+    int prefetchStride;
+    int lastTarget;
+    int shownA, shownB;
+    float shownMix;
+    long long misses, requests, cancelled;
+    atomic<long long> decodeUsTotal, decodeCount;
+    FrameHistogram stall;
+    
+    thread decoder;
+    mutex jobMutex;
+    condition_variable jobReady;
+    deque<int> jobs;
+    bool stopDecoding;
+};
+
+FieldTimeline fieldTimeline;
+bool fieldFailed = false;
+GLuint fieldLutTexture = 0;
+GLuint fieldProgram = 0;
+float fieldOpacity = 0.65f;
+chrono::steady_clock::time_point fieldClock; // 自动播放的计时起点
+
+void stopFieldDecoder() {
+    fieldTimeline.stopDecoder();
+}
+
+// 内置色标：蓝 - 青 - 白 - 黄 - 红
+void buildDefaultFieldLut(vector<unsigned char>& rgba) {
+    const float stops[5][3] = {{0.15f, 0.25f, 0.75f}, {0.2f, 0.75f, 0.9f}, {0.95f, 0.95f, 0.9f},
+                               {0.98f, 0.8f, 0.25f}, {0.8f, 0.1f, 0.1f}};
+    rgba.resize(FIELD_LUT_SIZE * 4);
+    for (int i = 0; i < FIELD_LUT_SIZE; ++i) {
+        float x = i / (float)(FIELD_LUT_SIZE - 1) * 4.0f;
+        int k = min((int)x, 3);
+        float t = x - k;
+        for (int c = 0; c < 3; ++c) {
+            rgba[i * 4 + c] = (unsigned char)(255.0f * (stops[k][c] + (stops[k + 1][c] - stops[k][c]) * t) + 0.5f);
+        }
+        rgba[i * 4 + 3] = 255;
+    }
+}
+
+// 色标可以用 --field-lut 指定一张BMP，取其中间一行从左到右作为查找表
+bool loadFieldLut(const string& path, vector<unsigned char>& rgba) {
+    unsigned char* data = NULL;
+    int width = 0, height = 0;
+    if (!loadBMPFile(path.c_str(), data, width, height)) return false;
+    rgba.resize((size_t)width * 4);
+    const unsigned char* row = data + (size_t)(height / 2) * width * 3;
+    for (int i = 0; i < width; ++i) {
+        rgba[i * 4] = row[i * 3];
+        rgba[i * 4 + 1] = row[i * 3 + 1];
+        rgba[i * 4 + 2] = row[i * 3 + 2];
+        rgba[i * 4 + 3] = 255;
+    }
+    delete[] data;
+    return true;
+}
+
+const char* fieldVertexShader =
+    "#version 120\n"
+    "varying vec2 uv;\n"
+    "varying vec3 normal;\n"
+    "varying vec3 eye;\n"
+    "void main() {\n"
+    "    uv = gl_MultiTexCoord0.xy;\n"
+    "    normal = gl_NormalMatrix * gl_Normal;\n"
+    "    eye = (gl_ModelViewMatrix * gl_Vertex).xyz;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+const char* fieldFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D fieldA;\n"
+    "uniform sampler2D fieldB;\n"
+    "uniform sampler1D lut;\n"
+    "uniform float mixFactor;\n"
+    "uniform float opacity;\n"
+    "uniform bool lit;\n"
+    "varying vec2 uv;\n"
+    "varying vec3 normal;\n"
+    "varying vec3 eye;\n"
+    "void main() {\n"
+    "    float a = texture2D(fieldA, uv).r;\n"
+    "    float b = texture2D(fieldB, uv).r;\n"
+    "    if (min(a, b) < 0.5 / 65535.0) discard;\n" // 缺测
+    "    float v = (mix(a, b, mixFactor) * 65535.0 - 1.0) / 65534.0;\n"
+    "    vec4 color = texture1D(lut, v);\n"
+    "    float shade = 1.0;\n"
+    "    if (lit) {\n"
+    "        vec4 light = gl_LightSource[0].position;\n"
+    "        vec3 l = normalize(light.xyz - eye * light.w);\n"
+    "        shade = 0.35 + 0.65 * max(dot(normalize(normal), l), 0.0);\n"
+    "    }\n"
+    "    gl_FragColor = vec4(color.rgb * shade, color.a * opacity);\n"
+    "}\n";
+
+// 首次调用时映射数据文件、创建色标纹理和着色器
+bool ensureFieldLayer() {
+    if (fieldFailed) return false;
+    if (fieldTimeline.active()) return true;
+    fieldFailed = true;
+    if (fieldPath.empty() || !fieldTimeline.open(fieldPath)) return false;
+    static bool exitHandlerRegistered = false;
+    if (!exitHandlerRegistered) atexit(stopFieldDecoder); // 窗口模式经 exit() 退出，先停掉解码线程
+    exitHandlerRegistered = true;
+    
+    if (fieldProgram == 0) fieldProgram = createShaderProgram(fieldVertexShader, fieldFragmentShader, "field");
+    if (fieldProgram == 0) {
+        cerr << "警告: 数据场着色器不可用，不绘制数据场" << endl;
+        return false;
+    }
+    vector<unsigned char> lut;
+    if (fieldLutPath.empty() || !loadFieldLut(fieldLutPath, lut)) {
+        if (!fieldLutPath.empty()) cerr << "警告: 无法读取色标 " << fieldLutPath << "，使用内置色标" << endl;
+        buildDefaultFieldLut(lut);
+    }
+    glGenTextures(1, &fieldLutTexture);
+    glBindTexture(GL_TEXTURE_1D, fieldLutTexture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA, (GLsizei)(lut.size() / 4), 0, GL_RGBA, GL_UNSIGNED_BYTE, lut.data());
+    glBindTexture(GL_TEXTURE_1D, 0);
+    fieldClock = chrono::steady_clock::now();
+    fieldFailed = false;
+    return true;
+}
+
+// 自动播放时推进游标（帧/秒），返回是否仍在播放
+bool advanceFieldCursor() {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double elapsed = chrono::duration<double>(now - fieldClock).count();
+    fieldClock = now;
+    if (fieldFramesPerSecond <= 0.0 || !fieldTimeline.active()) return false;
+    fieldCursor += elapsed * fieldFramesPerSecond;
+    int frames = fieldTimeline.frameCount();
+    fieldCursor -= floor(fieldCursor / frames) * frames;
+    return true;
+}
+
+// 在地球之后绘制数据场，使用 frameMatrices 中放大后的地球矩阵
+void drawFieldLayer() {
+    if (!ensureFieldLayer()) return;
+    advanceFieldCursor();
+    fieldTimeline.update(fieldCursor);
+    if (!fieldTimeline.hasFrame()) return;
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(fieldProgram);
+    glUniform1i(glGetUniformLocation(fieldProgram, "fieldA"), 0);
+    glUniform1i(glGetUniformLocation(fieldProgram, "fieldB"), 1);
+    glUniform1i(glGetUniformLocation(fieldProgram, "lut"), 2);
+    glUniform1f(glGetUniformLocation(fieldProgram, "mixFactor"), fieldTimeline.mixFactor());
+    glUniform1f(glGetUniformLocation(fieldProgram, "opacity"), fieldOpacity);
+    glUniform1i(glGetUniformLocation(fieldProgram, "lit"), lightEnabled ? 1 : 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_1D, fieldLutTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, fieldTimeline.textureB());
+    glActiveTexture(GL_TEXTURE0);
+    glPushMatrix();
+    glLoadMatrixf(frameMatrices.shell(FIELD_LAYER_SCALE).m);
+    drawSphereMesh(1.0f, sphereSlices, sphereStacks, fieldTimeline.textureA());
+    glPopMatrix();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+    glPopAttrib();
+}
+
+// 生成测试数据：以 2024-06-21 00:00 UTC 起逐时的"气温"，包括随太阳直射点移动的日变化、
+// 向东移动的天气系统，以及一块缺测区域。逐帧写出，不需要把整个文件放进内存
+bool generateFieldFile(const string& path, int width, int height, int frames) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        cerr << "错误: 无法写入 " << path << endl;
+        return false;
+    }
+    FieldFileHeader header;
+    memcpy(header.magic, "GLBFLD01", 8);
+    header.width = width;
+    header.height = height;
+    header.frames = frames;
+    header.minValue = -40.0f;
+    header.maxValue = 45.0f;
+    header.hoursPerFrame = 1.0f;
+    fwrite(&header, sizeof(header), 1, file);
+    
+    const float DEG = PI / 180.0f;
+    const double start = 1718928000.0; // 2024-06-21T00:00:00Z
+    vector<float> values((size_t)width * height);
+    for (int f = 0; f < frames; ++f) {
+        double sunLat, sunLon;
+        subsolarPoint(start + f * 3600.0, sunLat, sunLon);
+        float sun[3];
+        geoToSphere((float)sunLat, (float)sunLon, sun);
+        for (int y = 0; y < height; ++y) {
+            float lat = 90.0f - (y + 0.5f) * 180.0f / height;
+            for (int x = 0; x < width; ++x) {
+                float lon = (x + 0.5f) * 360.0f / width - 180.0f;
+                float p[3];
+                geoToSphere(lat, lon, p);
+                float daylight = max(p[0] * sun[0] + p[1] * sun[1] + p[2] * sun[2], 0.0f);
+                float weather = sin(3.0f * lon * DEG - 0.05f * f) * cos(2.0f * lat * DEG + 0.02f * f);
+                float t = 62.0f * cos((lat - 0.3f * (float)sunLat) * DEG) - 38.0f + 9.0f * daylight + 7.0f * weather;
+                // 缺测：南太平洋上一块随时间缓慢移动的区域
+                float dx = lon + 120.0f - 10.0f * sin(0.01f * f), dy = lat + 30.0f;
+                values[(size_t)y * width + x] = dx * dx + dy * dy < 100.0f ? NAN : t;
+            }
+        }
+        fwrite(values.data(), sizeof(float), values.size(), file);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    cout << "已生成数据场 " << path << "：" << frames << " 帧 " << width << "x" << height << endl;
+    return ok;
+}
+
+// ========================
+// 帧录制（PBO环 + 栅栏）
+// ========================
+// --record 把窗口画面连续录制为 Y4M 视频（文件名以 .y4m 结尾）或BMP序列（如 frames/%05d.bmp），
+// 'E' 键暂停/继续。GL模式下每帧把 glReadPixels 发到PBO环中的下一个缓冲区并插入栅栏后立即返回，
+// 之后的帧用零超时查询栅栏，只映射已经完成的缓冲区，复制后交给编码线程做颜色转换和写盘，渲染方
+// 从不等待读回。GPU落后使环被占满、或编码跟不上使队列已满时丢弃该帧并计数，而不是阻塞渲染
+
+// 有界队列：生产者在队列满时阻塞（或用 tryPush 放弃该项），用于渲染线程与编码线程之间的背压
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+    
+    bool push(T item) {
+        unique_lock<mutex> lock(mtx);
+        notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    // 不阻塞：队列已满或已关闭时返回 false，item 保持不变
+    bool tryPush(T& item) {
+        lock_guard<mutex> lock(mtx);
+        if (closed || items.size() >= capacity) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    // 队列关闭且已取空时返回 false
+    bool pop(T& item) {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    void close() {
+        lock_guard<mutex> lock(mtx);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+    
+private:
+    size_t capacity;
+    bool closed;
+    deque<T> items;
+    mutex mtx;
+    condition_variable notEmpty;
+    condition_variable notFull;
+};
+
+// 读回的一帧图像（BGR，自下而上，行4字节对齐）
+struct CapturedFrame {
+    string filename;
+    int width, height;
+    vector<unsigned char> pixels;
+};
+
+// RGBA（紧密排列）转为 saveBMPFile 使用的BGR行，行序不变
+void rgbaToBMPRows(const unsigned char* rgba, int width, int height, unsigned char* bgr) {
+    int rowSize = (width * 3 + 3) & ~3;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* src = rgba + (size_t)y * width * 4;
+        unsigned char* dst = bgr + (size_t)y * rowSize;
+        for (int x = 0; x < width; ++x) {
+            dst[x * 3 + 0] = src[x * 4 + 2];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4 + 0];
+        }
+        memset(dst + width * 3, 0, rowSize - width * 3);
+    }
+}
+
+// BGR（自下而上，行4字节对齐）转为自上而下的 I420 平面（BT.601 有限范围，色度取2x2平均）
+void convertToI420(const unsigned char* bgr, int width, int height, vector<unsigned char>& planes) {
+    int rowSize = (width * 3 + 3) & ~3;
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    planes.resize((size_t)width * height + 2 * (size_t)chromaWidth * chromaHeight);
+    unsigned char* yPlane = planes.data();
+    unsigned char* uPlane = yPlane + (size_t)width * height;
+    unsigned char* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+    
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* src = bgr + (size_t)(height - 1 - y) * rowSize;
+        unsigned char* dst = yPlane + (size_t)y * width;
+        for (int x = 0; x < width; ++x) {
+            int b = src[x * 3], g = src[x * 3 + 1], r = src[x * 3 + 2];
+            dst[x] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+    }
+    for (int cy = 0; cy < chromaHeight; ++cy) {
+        const unsigned char* row0 = bgr + (size_t)(height - 1 - 2 * cy) * rowSize;
+        const unsigned char* row1 = bgr + (size_t)(height - 1 - min(2 * cy + 1, height - 1)) * rowSize;
+        for (int cx = 0; cx < chromaWidth; ++cx) {
+            int x0 = 2 * cx * 3, x1 = min(2 * cx + 1, width - 1) * 3;
+            int b = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2;
+            int g = (row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1] + 2) >> 2;
+            int r = (row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2] + 2) >> 2;
+            // 加上 128*256 使被移位的值非负
+            uPlane[(size_t)cy * chromaWidth + cx] = (unsigned char)((-38 * r - 74 * g + 112 * b + 128 + 32768) >> 8);
+            vPlane[(size_t)cy * chromaWidth + cx] = (unsigned char)((112 * r - 94 * g - 18 * b + 128 + 32768) >> 8);
+        }
+    }
+}
+
+// 一次异步读回：glReadPixels 到PBO并插入栅栏后立即返回，之后用零超时查询栅栏，完成了才映射复制，
+// CPU不必等待GPU画完这一帧。FrameRecorder 的PBO环和控制套接字的截图共用。没有栅栏时按发出后
+// 经过的帧数（tick() 计数）估计是否完成。需要当前GL上下文
+struct PixelReadback {
+    GLuint pbo;
+    GLsync fence;
+    int capacity;
+    int width, height;
+    int age;                        // 发出后经过的帧数
+    bool pending;
+    
+    PixelReadback() : pbo(0), fence(0), capacity(0), width(0), height(0), age(0), pending(false) {}
+    
+    // 每行4字节对齐的BGR，与 saveBMPFile 一致
+    static int imageSize(int w, int h) { return ((w * 3 + 3) & ~3) * h; }
+    
+    void start(int w, int h) {
+        if (pbo == 0) glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        if (capacity < imageSize(w, h)) {
+            capacity = imageSize(w, h);
+            glBufferData(GL_PIXEL_PACK_BUFFER, capacity, NULL, GL_STREAM_READ);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, w, h, GL_BGR, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fence = hasGLSync() ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+        width = w;
+        height = h;
+        age = 0;
+        pending = true;
+    }
+    
+    void tick() {
+        if (pending) ++age;
+    }
+    
+    bool ready(int minAge) const {
+        if (!pending) return false;
+        if (!fence) return age >= minAge;
+        return glClientWaitSync(fence, 0, 0) != GL_TIMEOUT_EXPIRED;
+    }
+    
+    // 阻塞等待（最多1秒），用于停止录制时取走环中剩余的读回
+    void wait() {
+        if (pending && fence) glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+    }
+    
+    // 把结果复制到 dst（至少 imageSize(width, height) 字节），映射失败时返回 false。之后可再次 start()
+    bool finish(unsigned char* dst) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        const unsigned char* mapped = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (mapped) {
+            memcpy(dst, mapped, imageSize(width, height));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (fence) glDeleteSync(fence);
+        fence = 0;
+        pending = false;
+        return mapped != NULL;
+    }
+    
+    void release() {
+        if (fence) glDeleteSync(fence);
+        if (pbo) glDeleteBuffers(1, &pbo);
+        *this = PixelReadback();
+    }
+};
+
+class FrameRecorder {
+public:
+    FrameRecorder() : synchronousReadback(false), queue(8), started(false), active(false), y4m(false), fps(30),
+                      initialized(false), next(0), captured(0), droppedRing(0),
+                      droppedQueue(0), elapsedSeconds(0.0), written(0), skipped(0), writtenBytes(0), encodeUs(0) {}
+    
+    bool synchronousReadback; // 基准测试用：直接 glReadPixels 到内存，作为对照
+    
+    // output 以 .y4m 结尾时写 Y4M 视频，否则为含一个 %d 的BMP文件名模式
+    bool start(const string& path, int framesPerSecond) {
+        output = path;
+        fps = max(1, framesPerSecond);
+        y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+        string probe;
+        if (!y4m && !formatFramePath(path, 0, probe)) {
+            cerr << "错误: --record 应为 .y4m 文件或含一个 %d 的BMP文件名模式（如 frames/%05d.bmp）" << endl;
+            return false;
+        }
+        if (y4m) {
+            video.open(path.c_str(), ios::binary);
+            if (!video.is_open()) {
+                cerr << "错误: 无法写入文件 " << path << endl;
+                return false;
+            }
+        }
+        started = active = true;
+        startTime = chrono::steady_clock::now();
+        encoder = thread(&FrameRecorder::encodeLoop, this);
+        return true;
+    }
+    
+    bool isStarted() const { return started; }
+    bool recording() const { return active; }
+    void setActive(bool on) { active = started && on; }
+    
+    // 渲染方在交换缓冲区之前调用，需要当前GL上下文
+    void captureFramebuffer(int width, int height) {
+        if (!active) return;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        initialized = true;
+        ++captured;
+        
+        if (synchronousReadback) {
+            CapturedFrame image;
+            image.width = width;
+            image.height = height;
+            acquireBuffer(image.pixels, PixelReadback::imageSize(width, height));
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, image.pixels.data());
+            submit(image);
+        } else {
+            // 按发出顺序收集已经完成的读回，遇到未完成的就停下，保证帧序。
+            // 没有栅栏时 RING-1 帧之前发出的读回视为已完成
+            for (int k = 0; k < RING; ++k) slots[k].tick();
+            for (int k = 0; k < RING; ++k) {
+                PixelReadback& slot = slots[(next + k) % RING];
+                if (!slot.pending) continue;
+                if (!slot.ready(RING - 1)) break;
+                collect(slot);
+            }
+            PixelReadback& slot = slots[next];
+            if (slot.pending) {
+                ++droppedRing; // 最老的读回仍未完成，等待它会阻塞本帧
+            } else {
+                slot.start(width, height);
+                next = (next + 1) % RING;
+            }
+        }
+        captureTimes.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+    }
+    
+    // CPU渲染窗口模式：画面已在内存中，只需转换格式后交给编码线程
+    void captureRGBA(const unsigned char* rgba, int width, int height) {
+        if (!active) return;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        ++captured;
+        CapturedFrame image;
+        image.width = width;
+        image.height = height;
+        acquireBuffer(image.pixels, ((width * 3 + 3) & ~3) * height);
+        rgbaToBMPRows(rgba, width, height, image.pixels.data());
+        submit(image);
+        captureTimes.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+    }
+    
+    // 等待环中剩余的读回，写完全部帧后停止编码线程。GL模式下需要当前GL上下文
+    void finish(bool report = true) {
+        if (!started) return;
+        for (int k = 0; k < RING && initialized; ++k) {
+            PixelReadback& slot = slots[(next + k) % RING];
+            if (!slot.pending) continue;
+            slot.wait();
+            collect(slot);
+        }
+        if (initialized) {
+            for (int i = 0; i < RING; ++i) slots[i].release();
+            initialized = false;
+        }
+        stopEncoder();
+        elapsedSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        if (report) printReport();
+    }
+    
+    // 只停止编码线程，不做GL调用（进程退出时使用）：已入队的帧照常写完，PBO环中还没取回的帧丢弃
+    void stopEncoder() {
+        if (!encoder.joinable()) return;
+        queue.close();
+        encoder.join();
+        video.close();
+        started = active = false;
+    }
+    
+    void printReport() const {
+        cout << "录制结束: " << output << endl;
+        cout << "  捕获 " << captured << " 帧，写出 " << written << " 帧（" << writtenBytes / (1024.0 * 1024.0)
+             << " MB），丢弃 " << droppedRing << " 帧（PBO环占满）、" << droppedQueue << " 帧（编码队列已满）";
+        if (skipped) cout << "、" << skipped << " 帧（尺寸变化）";
+        cout << endl;
+        cout << "  渲染方每帧增加 " << captureTimes.meanMs() << " ms（p99 " << captureTimes.percentileMs(0.99)
+             << " ms，最大 " << captureTimes.maxMs() << " ms）" << endl;
+        cout << "  编码 " << encodeMs() << " ms/帧，吞吐 " << framesPerSecond() << " 帧/秒（"
+             << writtenBytes / (1024.0 * 1024.0) / max(elapsedSeconds, 1e-9) << " MB/s）" << endl;
+    }
+    
+    // 以下统计在 finish() 之后读取；written 在录制过程中也可读取
+    long long capturedFrames() const { return captured; }
+    long long writtenFrames() const { return written.load(); }
+    long long droppedFrames() const { return droppedRing + droppedQueue + skipped; }
+    const FrameHistogram& captureHistogram() const { return captureTimes; }
+    double encodeMs() const { return written ? encodeUs / 1000.0 / written : 0.0; }
+    double framesPerSecond() const { return elapsedSeconds > 0.0 ? written / elapsedSeconds : 0.0; }
+    
+private:
+    static const int RING = 3;
+    
+    void collect(PixelReadback& slot) {
+        CapturedFrame image;
+        image.width = slot.width;
+        image.height = slot.height;
+        acquireBuffer(image.pixels, PixelReadback::imageSize(slot.width, slot.height));
+        if (slot.finish(image.pixels.data())) {
+            submit(image);
+        } else {
+            releaseBuffer(image.pixels);
+            ++droppedQueue;
+        }
+    }
+    
+    void submit(CapturedFrame& image) {
+        if (!queue.tryPush(image)) {
+            ++droppedQueue;
+            releaseBuffer(image.pixels);
+        }
+    }
+    
+    // 像素缓冲区在渲染方和编码线程之间循环使用，避免每帧分配整张图片
+    void acquireBuffer(vector<unsigned char>& buffer, size_t size) {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            if (!pool.empty()) {
+                buffer.swap(pool.back());
+                pool.pop_back();
+            }
+        }
+        buffer.resize(size);
+    }
+    
+    void releaseBuffer(vector<unsigned char>& buffer) {
+        lock_guard<mutex> lock(poolMutex);
+        pool.push_back(vector<unsigned char>());
+        pool.back().swap(buffer);
+    }
+    
+    void encodeLoop() {
+        CapturedFrame image;
+        vector<unsigned char> planes;
+        int videoWidth = 0, videoHeight = 0;
+        while (queue.pop(image)) {
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            if (y4m) {
+                if (videoWidth == 0) {
+                    videoWidth = image.width;
+                    videoHeight = image.height;
+                    video << "YUV4MPEG2 W" << videoWidth << " H" << videoHeight << " F" << fps
+                          << ":1 Ip A1:1 C420jpeg\n";
+                }
+                if (image.width == videoWidth && image.height == videoHeight) {
+                    convertToI420(image.pixels.data(), image.width, image.height, planes);
+                    video << "FRAME\n";
+                    video.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+                    writtenBytes += planes.size() + 6;
+                    ++written;
+                } else {
+                    ++skipped; // Y4M 不能改变尺寸，窗口缩放后的帧跳过
+                }
+            } else {
+                string path;
+                formatFramePath(output, (int)written.load(), path);
+                if (saveBMPFile(path.c_str(), image.pixels.data(), image.width, image.height)) {
+                    writtenBytes += 54 + image.pixels.size();
+                    ++written;
+                }
+            }
+            encodeUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+            releaseBuffer(image.pixels);
+        }
+    }
+    
+    BoundedQueue<CapturedFrame> queue;
+    thread encoder;
+    mutex poolMutex;
+    vector<vector<unsigned char> > pool;
+    string output;
+    ofstream video;
+    bool started;
+    bool active;
+    bool y4m;
+    int fps;
+    
+    // 渲染方
+    bool initialized;
+    PixelReadback slots[RING];
+    int next;
+    long long captured;
+    long long droppedRing;
+    long long droppedQueue;
+    FrameHistogram captureTimes; // 渲染方每帧花在录制上的时间
+    chrono::steady_clock::time_point startTime;
+    double elapsedSeconds;
+    
+    // 编码线程
+    atomic<long long> written;
+    atomic<long long> skipped;
+    long long writtenBytes;
+    long long encodeUs;
+};
+
+FrameRecorder frameRecorder;
+string recordPath;
+int recordFramesPerSecond = 30;
+
+// 按 ESC 退出前在GLUT回调中调用：GL上下文仍然有效，取回PBO环中的帧并写完
+void finishRecording() {
+    frameRecorder.finish();
+}
+
+// 窗口被关闭等其他 exit() 路径上只停掉编码线程
+void stopRecordingEncoder() {
+    frameRecorder.stopEncoder();
+}
+
+// ========================
+// 分阶段性能计时
+// ========================
+// display() 的每个阶段用作用域计时器包裹，同时记录CPU高精度时钟和 GL_TIME_ELAPSED 查询。
+// 查询对象按帧轮换，结果在若干帧之后才读取，读取前先检查是否可用，从不阻塞管线
+
+enum RenderPass {
+    PASS_CLEAR,
+    PASS_FLOOR,
+    PASS_SHADOW,
+    PASS_GLOBE,
+    PASS_FIELD,
+    PASS_HEATMAP,
+    PASS_CLOUDS,
+    PASS_MARKERS,
+    PASS_BORDERS,
+    PASS_ROUTES,
+    PASS_AO,
+    PASS_LIGHTS,
+    PASS_ATMOSPHERE,
+    PASS_LABELS,
+    PASS_CAPTURE,
+    PASS_SWAP,
+    PASS_COUNT
+};
+
+const char* passNames[PASS_COUNT] = {"clear", "floor", "shadow", "globe", "field", "heatmap", "clouds", "markers", "borders", "routes", "ao", "lights", "atmos", "labels", "capture", "swap"};
+
+struct PassTiming {
+    double cpuMs; // 滚动平均
+    double gpuMs; // 滚动平均，不支持计时查询时为 -1
+};
+
+// 固定窗口的滚动平均
+class RollingAverage {
+public:
+    RollingAverage() : count(0), next(0), sum(0.0) {}
+    
+    void add(double value) {
+        if (count == WINDOW) {
+            sum -= samples[next];
+        } else {
+            ++count;
+        }
+        samples[next] = value;
+        sum += value;
+        next = (next + 1) % WINDOW;
+    }
+    
+    double average() const { return count ? sum / count : 0.0; }
+    
+private:
+    static const int WINDOW = 60;
+    double samples[WINDOW];
+    int count;
+    int next;
+    double sum;
+};
+
+class PassProfiler {
+public:
+    PassProfiler() : initialized(false), gpuTimers(false), frame(0), inFrame(false) {}
+    
+    void beginFrame() {
+        if (!initialized) initialize();
+        
+        // 复用本槽位之前，收集它在 FRAMES_IN_FLIGHT 帧之前发出的查询结果
+        slot = frame % FRAMES_IN_FLIGHT;
+        if (gpuTimers) {
+            for (int pass = 0; pass < PASS_COUNT; ++pass) {
+                if (!issued[slot][pass]) continue;
+                issued[slot][pass] = false;
+                GLint available = 0;
+                glGetQueryObjectiv(queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint64 ns = 0;
+                    glGetQueryObjectui64v(queries[slot][pass], GL_QUERY_RESULT, &ns);
+                    gpuSamples[slot][pass] = ns / 1.0e6;
+                } else {
+                    gpuSamples[slot][pass] = -1.0; // GPU 落后太多，丢弃该样本
+                }
+            }
+            // 丢弃每个查询对象第一次使用的结果：部分驱动（如 llvmpipe）首次返回的是无效值
+            if (frame >= 2 * FRAMES_IN_FLIGHT) {
+                for (int pass = 0; pass < PASS_COUNT; ++pass) {
+                    if (gpuSamples[slot][pass] >= 0.0) gpuAverage[pass].add(gpuSamples[slot][pass]);
+                    gpuSamples[slot][pass] = 0.0;
+                }
+            }
+        }
+        
+        for (int pass = 0; pass < PASS_COUNT; ++pass) cpuFrame[pass] = 0.0;
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (frame > 0) {
+            frameAverage.add(chrono::duration<double, milli>(now - lastFrameStart).count());
+        }
+        lastFrameStart = now;
+        inFrame = true;
+    }
+    
+    void begin(RenderPass pass) {
+        if (!inFrame) return;
+        // 交换缓冲区不在GPU命令流中计时
+        if (gpuTimers && pass != PASS_SWAP) {
+            glBeginQuery(GL_TIME_ELAPSED, queries[slot][pass]);
+            issued[slot][pass] = true;
+        }
+        passStart = chrono::steady_clock::now();
+    }
+    
+    void end(RenderPass pass) {
+        if (!inFrame) return;
+        cpuFrame[pass] += chrono::duration<double, milli>(chrono::steady_clock::now() - passStart).count();
+        if (gpuTimers && pass != PASS_SWAP) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+    }
+    
+    void endFrame() {
+        if (!inFrame) return;
+        for (int pass = 0; pass < PASS_COUNT; ++pass) cpuAverage[pass].add(cpuFrame[pass]);
+        inFrame = false;
+        ++frame;
+    }
+    
+    // 各阶段的滚动平均耗时（毫秒）
+    void timings(PassTiming out[PASS_COUNT]) const {
+        for (int pass = 0; pass < PASS_COUNT; ++pass) {
+            out[pass].cpuMs = cpuAverage[pass].average();
+            out[pass].gpuMs = (gpuTimers && pass != PASS_SWAP) ? gpuAverage[pass].average() : -1.0;
+        }
+    }
+    
+    double averageFrameMs() const { return frameAverage.average(); }
+    bool hasGpuTimers() const { return gpuTimers; }
+    
+private:
+    static const int FRAMES_IN_FLIGHT = 4;
+    
+    void initialize() {
+        initialized = true;
+        const char* version = (const char*)glGetString(GL_VERSION);
+        int major = 0, minor = 0;
+        if (version) sscanf(version, "%d.%d", &major, &minor);
+        gpuTimers = major > 3 || (major == 3 && minor >= 3) ||
+                    hasGLExtension("GL_ARB_timer_query") || hasGLExtension("GL_EXT_timer_query");
+        if (gpuTimers) {
+            glGenQueries(FRAMES_IN_FLIGHT * PASS_COUNT, &queries[0][0]);
+        }
+        memset(issued, 0, sizeof(issued));
+        memset(gpuSamples, 0, sizeof(gpuSamples));
+    }
+    
+    bool initialized;
+    bool gpuTimers;
+    GLuint queries[FRAMES_IN_FLIGHT][PASS_COUNT];
+    bool issued[FRAMES_IN_FLIGHT][PASS_COUNT];
+    double gpuSamples[FRAMES_IN_FLIGHT][PASS_COUNT];
+    long frame;
+    int slot;
+    bool inFrame;
+    double cpuFrame[PASS_COUNT];
+    chrono::steady_clock::time_point passStart;
+    chrono::steady_clock::time_point lastFrameStart;
+    RollingAverage cpuAverage[PASS_COUNT];
+    RollingAverage gpuAverage[PASS_COUNT];
+    RollingAverage frameAverage;
+};
+
+PassProfiler passProfiler;
+
+// 在作用域内为某个阶段计时
+struct ScopedPassTimer {
+    RenderPass pass;
+    explicit ScopedPassTimer(RenderPass pass) : pass(pass) { passProfiler.begin(pass); }
+    ~ScopedPassTimer() { passProfiler.end(pass); }
+};
+
+// 供外部读取各阶段的滚动平均耗时
+void getPassTimings(PassTiming out[PASS_COUNT]) {
+    passProfiler.timings(out);
+}
+
+void printPassTimings() {
+    PassTiming timing[PASS_COUNT];
+    getPassTimings(timing);
+    cout << "各阶段平均耗时（最近60帧，毫秒）:" << endl;
+    for (int pass = 0; pass < PASS_COUNT; ++pass) {
+        cout << "  " << passNames[pass] << "  CPU " << timing[pass].cpuMs;
+        if (timing[pass].gpuMs >= 0) cout << "  GPU " << timing[pass].gpuMs;
+        cout << endl;
+    }
+}
+
+void drawHudText(float x, float y, const string& text) {
+    glRasterPos2f(x, y);
+    for (size_t i = 0; i < text.size(); ++i) {
+        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, text[i]);
+    }
+}
+
+// 性能叠加层上来自渲染方的统计。软件渲染模式下各图层和点光源由渲染线程修改，
+// 由渲染线程在出帧时填好随 SoftFrame 交给主线程，主线程绘制叠加层时只读这份副本
+struct HudStats {
+    int lights, maxPerCluster;
+    double binMs;
+    double streamP50Ms, streamP99Ms;
+    long long streamLate;
+    long long drawnMarkers, markerCount;
+    int markerNodes, markerCalls;
+    int borderLevel;
+    long long borderSegments, borderVertices;
+    int routes;
+    size_t routeVertices;
+    int routeUpdated;
+    double routeUpdateMs;
+    size_t routeUploadedBytes;
+    int routeUploadCalls;
+    int fieldFrame, fieldFrames, fieldResident;
+    long long fieldMisses, fieldRequests;
+    double fieldP99Ms;
+    size_t heatPoints, heatSplatted;
+    double heatSplatMs, heatReduceMs;
+    int heatTiles, heatCalls;
+    double heatUploadMs;
+    int labelsPlaced, labelCandidates;
+    size_t labelCount;
+    double labelLayoutMs;
+    size_t glyphs;
+    size_t sceneNodes;
+    int sceneUpdated;
+    double sceneUpdateMs;
+    bool cullReused;
+    double cullMs;
+    size_t sceneDrawn;
+};
+
+// 只能在渲染方调用
+HudStats collectHudStats() {
+    HudStats stats;
+    stats.lights = (int)pointLights.size();
+    stats.maxPerCluster = clusterGrid.maxPerCluster;
+    stats.binMs = clusterGrid.binMs;
+    const FrameHistogram& stall = cloudStream.stallHistogram();
+    stats.streamP50Ms = stall.percentileMs(0.5);
+    stats.streamP99Ms = stall.percentileMs(0.99);
+    stats.streamLate = cloudStream.lateFrames();
+    stats.drawnMarkers = markerLayer.drawnMarkers;
+    stats.markerCount = (long long)markerLayer.pointCount;
+    stats.markerNodes = markerLayer.drawnNodes;
+    stats.markerCalls = markerLayer.drawCalls;
+    stats.borderLevel = borderLayer.level;
+    stats.borderSegments = borderLayer.drawnSegments;
+    stats.borderVertices = (long long)borderLayer.vertexCount;
+    stats.routes = (int)routeLayer.arcs.size();
+    stats.routeVertices = routeLayer.used;
+    stats.routeUpdated = routeLayer.updatedArcs;
+    stats.routeUpdateMs = routeLayer.updateMs;
+    stats.routeUploadedBytes = routeLayer.uploadedBytes;
+    stats.routeUploadCalls = routeLayer.uploadCalls;
+    stats.fieldFrame = fieldTimeline.frameA();
+    stats.fieldFrames = fieldTimeline.frameCount();
+    stats.fieldResident = fieldTimeline.residentFrames();
+    stats.fieldMisses = fieldTimeline.missCount();
+    stats.fieldRequests = fieldTimeline.requestCount();
+    stats.fieldP99Ms = fieldTimeline.stallHistogram().percentileMs(0.99);
+    stats.heatPoints = heatmapLayer.livePoints;
+    stats.heatSplatted = heatmapLayer.splattedPoints;
+    stats.heatSplatMs = heatmapLayer.splatMs;
+    stats.heatReduceMs = heatmapLayer.reduceMs;
+    stats.heatTiles = heatmapLayer.uploadedTiles;
+    stats.heatCalls = heatmapLayer.uploadCalls;
+    stats.heatUploadMs = heatmapLayer.uploadMs;
+    stats.labelsPlaced = labelLayer.placed;
+    stats.labelCandidates = labelLayer.candidates;
+    stats.labelCount = labelLayer.labels.size();
+    stats.labelLayoutMs = labelLayer.layoutMs;
+    stats.glyphs = glyphAtlas.glyphs.size();
+    stats.sceneNodes = sceneGraph.size();
+    stats.sceneUpdated = sceneGraph.updatedNodes;
+    stats.sceneUpdateMs = sceneGraph.updateMs;
+    stats.cullReused = sceneGraph.cullReused;
+    stats.cullMs = sceneGraph.cullMs;
+    stats.sceneDrawn = sceneGraph.culled.size();
+    return stats;
+}
+
+// 性能叠加层（GLUT位图字体只支持ASCII，因此使用英文标签）
+void drawHud(int width, int height, int drawCalls, const HudStats& stats) {
+    PassTiming timing[PASS_COUNT];
+    getPassTimings(timing);
+    
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, width, 0, height);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    // 先收集所有行，背景框按行数和最长一行的宽度（9x15 位图字体）确定
+    vector<string> lines;
+    char line[128];
+    double frameMs = passProfiler.averageFrameMs();
+    snprintf(line, sizeof(line), "frame %6.2f ms  (%5.1f fps)", frameMs, frameMs > 0 ? 1000.0 / frameMs : 0.0);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "pass      cpu ms    gpu ms");
+    lines.push_back(line);
+    for (int pass = 0; pass < PASS_COUNT; ++pass) {
+        if (timing[pass].gpuMs >= 0) {
+            snprintf(line, sizeof(line), "%-8s %7.3f   %7.3f", passNames[pass], timing[pass].cpuMs, timing[pass].gpuMs);
+        } else {
+            snprintf(line, sizeof(line), "%-8s %7.3f       -", passNames[pass], timing[pass].cpuMs);
+        }
+        lines.push_back(line);
+    }
+    snprintf(line, sizeof(line), "draw calls %d", drawCalls);
+    lines.push_back(line);
+    const FrameHistogram& histogram = frameStats.histogram();
+    snprintf(line, sizeof(line), "p99 %6.2f ms  max %6.2f  hitch %lld",
+             histogram.percentileMs(0.99), histogram.maxMs(), frameStats.hitchCount());
+    lines.push_back(line);
+    const FrameHistogram& latency = frameStats.inputLatencyHistogram();
+    snprintf(line, sizeof(line), "input p50 %5.1f p99 %5.1f ms  %.1f/frame",
+             latency.percentileMs(0.5), latency.percentileMs(0.99), frameStats.eventsPerInputFrame());
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "lights %d  max/cluster %d  bin %.2f ms",
+             stats.lights, stats.maxPerCluster, stats.binMs);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "stream p50 %5.2f p99 %5.2f ms  late %lld",
+             stats.streamP50Ms, stats.streamP99Ms, stats.streamLate);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "markers %lld/%lld  nodes %d  calls %d",
+             stats.drawnMarkers, stats.markerCount, stats.markerNodes, stats.markerCalls);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "borders level %d  segments %lld  vertices %lld",
+             stats.borderLevel, stats.borderSegments, stats.borderVertices);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "routes %d  verts %zu  update %d arcs %.2f ms  %zu KB/%d calls",
+             stats.routes, stats.routeVertices, stats.routeUpdated, stats.routeUpdateMs,
+             stats.routeUploadedBytes / 1024, stats.routeUploadCalls);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "field %d/%d  resident %d  miss %lld/%lld  p99 %.2f ms",
+             stats.fieldFrame, stats.fieldFrames, stats.fieldResident,
+             stats.fieldMisses, stats.fieldRequests, stats.fieldP99Ms);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "heat %zu  +%zu  splat %.2f reduce %.2f  %d tiles/%d %.2f ms",
+             stats.heatPoints, stats.heatSplatted, stats.heatSplatMs, stats.heatReduceMs,
+             stats.heatTiles, stats.heatCalls, stats.heatUploadMs);
+    lines.push_back(line);
+    if (hoverPick.hit) {
+        snprintf(line, sizeof(line), "pick lat %.3f lon %.3f  texel %d,%d  %.1f us", hoverPick.latitude,
+                 hoverPick.longitude, hoverPick.texelX, hoverPick.texelY, hoverPick.microseconds);
+    } else {
+        snprintf(line, sizeof(line), "pick -");
+    }
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "labels %d/%d/%zu  layout %.2f ms  glyphs %zu", stats.labelsPlaced,
+             stats.labelCandidates, stats.labelCount, stats.labelLayoutMs, stats.glyphs);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "scene %zu nodes  upd %d %.2f ms  cull %s %.2f ms  draw %zu", stats.sceneNodes,
+             stats.sceneUpdated, stats.sceneUpdateMs, stats.cullReused ? "cached" : "run", stats.cullMs,
+             stats.sceneDrawn);
+    lines.push_back(line);
+    if (frameRecorder.isStarted()) {
+        snprintf(line, sizeof(line), "record %s  %lld/%lld frames  drop %lld  +%.2f ms",
+                 frameRecorder.recording() ? "on" : "paused", frameRecorder.writtenFrames(),
+                 frameRecorder.capturedFrames(), frameRecorder.droppedFrames(),
+                 frameRecorder.captureHistogram().meanMs());
+    } else {
+        snprintf(line, sizeof(line), "record -");
+    }
+    lines.push_back(line);
+    
+    const int lineHeight = 16;
+    size_t longest = 0;
+    for (size_t i = 0; i < lines.size(); ++i) longest = max(longest, lines[i].size());
+    float top = height - 8.0f;
+    glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+    glRectf(4.0f, top - lines.size() * lineHeight - 6.0f, 16.0f + longest * 9.0f, top + 4.0f);
+    glColor3f(0.9f, 1.0f, 0.6f);
+    for (size_t i = 0; i < lines.size(); ++i) drawHudText(10.0f, top - (i + 1) * lineHeight, lines[i]);
+    
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
+
+// ========================
+// 输入合并
+// ========================
+// 鼠标、键盘回调直接修改 inputView 并发布快照，渲染方每帧只取最新的一份，
+// 高回报率鼠标在两帧之间产生的大量移动事件只会被应用一次。每个改变画面的事件
+// 记录到达时间和发布序号，第一次显示序号不小于它的画面在交换缓冲区返回后计算
+// 输入到上屏的延迟（交换返回时刻作为上屏时刻的近似，驱动中排队的时间不在统计范围内）
+
+struct InputEvent {
+    unsigned long long sequence;
+    chrono::steady_clock::time_point time;
+};
+
+unsigned long long inputSequence = 0;
+deque<InputEvent> pendingInputEvents; // 已发布、尚未显示的事件（只在主线程访问）
+bool redisplayPosted = false;
+bool softRenderThreadRunning = false;   // CPU渲染窗口模式下由渲染线程消费快照
+mutex renderWakeMutex;
+condition_variable renderWake;
+
+// 发布 inputView，并记录一个改变画面的输入事件
+void publishInputView() {
+    inputView.sequence = ++inputSequence;
+    viewBuffer.writeBuffer() = inputView;
+    viewBuffer.publish();
+    
+    const size_t maxTrackedEvents = 1024; // 超出部分只合并、不再单独计延迟
+    if (pendingInputEvents.size() < maxTrackedEvents) {
+        InputEvent event = {inputSequence, chrono::steady_clock::now()};
+        pendingInputEvents.push_back(event);
+    }
+    if (softRenderThreadRunning) {
+        renderWake.notify_one();
+    } else if (!redisplayPosted) {
+        redisplayPosted = true;
+        glutPostRedisplay();
+    }
+}
+
+void queueRotation(float dx, float dy) {
+    inputView.rotationX += dx;
+    inputView.rotationY += dy;
+    publishInputView();
+}
+
+void queueZoom(float factor) {
+    inputView.zoom *= factor;
+    publishInputView();
+}
+
+void queueViewReset() {
+    inputView.rotationX = inputView.rotationY = 0.0f;
+    inputView.zoom = 1.0f;
+    publishInputView();
+}
+
+// 显示了发布序号为 sequence 的画面后调用，统计所有已被反映的输入事件的延迟
+void recordPresentedInput(unsigned long long sequence) {
+    vector<chrono::steady_clock::time_point> times;
+    while (!pendingInputEvents.empty() && pendingInputEvents.front().sequence <= sequence) {
+        times.push_back(pendingInputEvents.front().time);
+        pendingInputEvents.pop_front();
+    }
+    frameStats.recordInputLatency(times, chrono::steady_clock::now());
+}
+
+// ========================
+// 异步纹理重载
+// ========================
+// 'T' 键在后台线程解码图片（可能还要调用外部脚本转换JPG），完成后由渲染方在帧开始时
+// 替换CPU副本并上传，输入和渲染都不会因为磁盘读取和解码而停顿
+
+struct DecodedImage {
+    vector<unsigned char> pixels;
+    int width, height;
+};
+
+atomic<bool> textureReloadBusy(false);
+atomic<DecodedImage*> reloadedImage(nullptr);
+thread textureReloadThread;
+
+// 退出时等待正在进行的解码结束，并释放还没被渲染方取走的结果
+void stopTextureReload() {
+    if (textureReloadThread.joinable()) textureReloadThread.join();
+    delete reloadedImage.exchange(nullptr);
+}
+
+void startTextureReload() {
+    bool expected = false;
+    if (!textureReloadBusy.compare_exchange_strong(expected, true)) {
+        cout << "纹理正在后台加载，请稍候" << endl;
+        return;
+    }
+    // 上一次的结果已被取走，线程最多只差返回这一步
+    if (textureReloadThread.joinable()) textureReloadThread.join();
+    static bool exitHandlerRegistered = false;
+    if (!exitHandlerRegistered) atexit(stopTextureReload); // 窗口模式经 exit() 退出，先等解码线程结束
+    exitHandlerRegistered = true;
+    // 结果通过原子指针交给渲染方
+    textureReloadThread = thread([]() {
+        DecodedImage* image = new DecodedImage;
+        decodeEarthImage(image->pixels, image->width, image->height);
+        reloadedImage.store(image, memory_order_release);
+    });
+}
+
+// 渲染方调用：后台加载完成时替换地球纹理（GL模式下重新上传），返回是否替换
+bool takeReloadedTexture() {
+    DecodedImage* image = reloadedImage.exchange(nullptr, memory_order_acquire);
+    if (!image) return false;
+    setEarthImage(image->pixels.data(), image->width, image->height);
+    delete image;
+    if (!softwareRenderer) {
+        if (textureID != 0) glDeleteTextures(1, &textureID);
+        uploadEarthTexture();
+    }
+    textureReloadBusy.store(false);
+    return true;
+}
+
+// ========================
+// 控制套接字
+// ========================
+// --control 在本地 Unix 域套接字（参数全是数字时为 127.0.0.1 上的TCP端口）上接受按行的文本命令，
+// 供其他进程驱动查看器，并以 Prometheus 文本格式输出帧时间和内存指标。监听、解析、指标格式化和
+// 截图写盘都在控制线程中完成：改变视图的命令排队后由主线程定时器取走，和键盘事件一样发布视图快照；
+// 指标是渲染方每隔 100ms 经三缓冲交出的统计副本；截图由渲染方在帧末复制像素，交回控制线程编码
+
+// 当前常驻内存（字节），无法获取时返回峰值
+long peakResidentMemory() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+}
+
+long currentResidentMemory() {
+#ifdef __linux__
+    ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return peakResidentMemory();
+}
+
+enum ControlCommandType {
+    CONTROL_ROTATE,
+    CONTROL_ZOOM,
+    CONTROL_LIGHT,
+    CONTROL_SHADOW,
+    CONTROL_RELOAD,
+    CONTROL_CAPTURE
+};
+
+struct ControlCommand {
+    ControlCommandType type;
+    float a, b;
+    string path;                    // 截图文件
+    unsigned long long client;      // 截图完成后回复的连接
+};
+
+// 截图：请求在主线程排队，渲染方填入像素后交回控制线程
+struct ControlCapture {
+    unsigned long long client;
+    string path;
+    unsigned long long sequence;    // 画面至少要反映到这个发布序号
+    vector<unsigned char> pixels;
+    int width, height;
+    bool rgba;                      // true: RGBA 紧密排列；false: 每行4字节对齐的BGR（glReadPixels）
+                                    // pixels 为空表示读回失败，回复错误且不写文件
+};
+
+// 渲染方交给控制线程的统计副本
+struct ControlMetrics {
+    FrameHistogram frameTimes;
+    FrameHistogram inputLatency;
+    long long hitches;
+    PassTiming passes[PASS_COUNT];
+    bool passTimings;               // CPU渲染窗口模式没有分阶段计时
+    int drawCalls;
+    ViewState view;                 // 最近一次发布的视图
+    
+    ControlMetrics() : hitches(0), passTimings(false), drawCalls(0) {}
+};
+
+string controlAddress;                      // --control 参数
+bool controlServerRunning = false;
+mutex controlMutex;
+vector<ControlCommand> controlCommands;     // 控制线程 -> 主线程
+vector<ControlCapture> controlCaptures;     // 渲染方 -> 控制线程
+vector<ControlCapture> pendingCaptures;     // 已应用、等待画面的截图请求（只在主线程访问）
+TripleBuffer<ControlMetrics> controlMetrics; // 渲染方 -> 控制线程
+chrono::steady_clock::time_point controlMetricsPublished;
+unsigned long long controlMetricsSequence = 0;
+int controlListenFd = -1;
+int controlWakePipe[2] = {-1, -1};          // 唤醒控制线程的 poll
+thread* controlThread = NULL;
+atomic<bool> controlStop(false);
+long long controlCommandsHandled = 0;       // 以下两项只在控制线程访问
+long long controlCapturesWritten = 0;
+
+void wakeControlThread() {
+    char byte = 1;
+    if (write(controlWakePipe[1], &byte, 1) < 0) {
+        // 管道已满说明控制线程本来就会被唤醒
+    }
+}
+
+// 渲染方每帧调用，最多每 100ms 交出一份统计副本（视图变化时立即交出）
+void publishControlMetrics(int drawCalls) {
+    if (!controlServerRunning) return;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (now - controlMetricsPublished < chrono::milliseconds(100) && inputSequence == controlMetricsSequence) return;
+    controlMetricsPublished = now;
+    controlMetricsSequence = inputSequence;
+    
+    ControlMetrics& metrics = controlMetrics.writeBuffer();
+    metrics.frameTimes = frameStats.histogram();
+    metrics.inputLatency = frameStats.inputLatencyHistogram();
+    metrics.hitches = frameStats.hitchCount();
+    metrics.passTimings = !softRenderThreadRunning;
+    if (metrics.passTimings) passProfiler.timings(metrics.passes);
+    metrics.drawCalls = drawCalls;
+    metrics.view = inputView;
+    controlMetrics.publish();
+}
+
+// GL模式下截图的异步读回（PixelReadback），同一帧的请求共用一次读回
+struct ControlReadback {
+    PixelReadback pixels;
+    vector<ControlCapture> captures;
+};
+
+vector<ControlReadback> controlReadbacks;   // 进行中的读回（只在主线程访问）
+vector<PixelReadback> controlIdleReadbacks; // 读回完成后留待复用（保留PBO）
+
+// 同一帧的多个请求共用一份像素
+void handOverCaptures(vector<ControlCapture>& ready, vector<unsigned char>& pixels, int width, int height, bool rgba) {
+    for (size_t i = 0; i < ready.size(); ++i) {
+        ready[i].width = width;
+        ready[i].height = height;
+        ready[i].rgba = rgba;
+        if (i + 1 < ready.size()) {
+            ready[i].pixels = pixels;
+        } else {
+            ready[i].pixels.swap(pixels);
+        }
+    }
+    {
+        lock_guard<mutex> lock(controlMutex);
+        controlCaptures.insert(controlCaptures.end(), ready.begin(), ready.end());
+    }
+    wakeControlThread();
+}
+
+// 每帧调用一次，按发出顺序交出已完成的读回，遇到未完成的就停下
+void collectControlReadbacks() {
+    for (size_t i = 0; i < controlReadbacks.size(); ++i) controlReadbacks[i].pixels.tick();
+    while (!controlReadbacks.empty()) {
+        ControlReadback& readback = controlReadbacks.front();
+        if (!readback.pixels.ready(2)) break;
+        
+        int width = readback.pixels.width, height = readback.pixels.height;
+        vector<unsigned char> pixels(PixelReadback::imageSize(width, height));
+        // 映射失败时交出空像素，控制线程回复错误而不写文件
+        if (!readback.pixels.finish(pixels.data())) pixels.clear();
+        controlIdleReadbacks.push_back(readback.pixels);
+        handOverCaptures(readback.captures, pixels, width, height, false);
+        controlReadbacks.erase(controlReadbacks.begin());
+    }
+}
+
+// 渲染方调用：画面已反映到 sequence，把满足条件的截图请求交给控制线程。
+// rgba 为 NULL 时从当前帧缓冲发起异步读回（GL模式，在交换缓冲区之前调用），完成后由 collectControlReadbacks 交出
+void serviceControlCaptures(unsigned long long sequence, int width, int height, const unsigned char* rgba) {
+    vector<ControlCapture> ready;
+    for (size_t i = 0; i < pendingCaptures.size();) {
+        if (pendingCaptures[i].sequence <= sequence) {
+            ready.push_back(pendingCaptures[i]);
+            pendingCaptures.erase(pendingCaptures.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+    if (ready.empty()) return;
+    
+    // 同一帧的多个请求只读回一次
+    if (rgba) {
+        vector<unsigned char> pixels(rgba, rgba + (size_t)width * height * 4);
+        handOverCaptures(ready, pixels, width, height, true);
+        return;
+    }
+    ControlReadback readback;
+    if (!controlIdleReadbacks.empty()) {
+        readback.pixels = controlIdleReadbacks.back();
+        controlIdleReadbacks.pop_back();
+    }
+    readback.pixels.start(width, height);
+    readback.captures.swap(ready);
+    controlReadbacks.push_back(readback);
+}
+
+void applyControlCommand(const ControlCommand& command) {
+    switch (command.type) {
+        case CONTROL_ROTATE:
+            inputView.rotationX = command.a;
+            inputView.rotationY = command.b;
+            publishInputView();
+            break;
+        case CONTROL_ZOOM:
+            inputView.zoom = command.a;
+            publishInputView();
+            break;
+        case CONTROL_LIGHT:
+            frameStats.noteEvent(EVENT_LIGHT);
+            setLightPosition((int)command.a);
+            publishInputView();
+            break;
+        case CONTROL_SHADOW:
+            frameStats.noteEvent(EVENT_SHADOW);
+            adjustShadowIntensity(command.a - inputView.shadowIntensity);
+            publishInputView();
+            break;
+        case CONTROL_RELOAD:
+            startTextureReload();
+            break;
+        case CONTROL_CAPTURE: {
+            ControlCapture capture;
+            capture.client = command.client;
+            capture.path = command.path;
+            capture.sequence = inputSequence;
+            pendingCaptures.push_back(capture);
+            // 画面没有变化时也要重绘一次才能截图
+            if (softRenderThreadRunning) {
+                glutPostRedisplay();
+            } else if (!redisplayPosted) {
+                redisplayPosted = true;
+                glutPostRedisplay();
+            }
+            break;
+        }
+    }
+}
+
+// 主线程定时取走控制命令（控制线程不能调用 GLUT，也不能直接改 inputView）。
+// value 为本次的间隔：有命令、截图或纹理加载在进行时每 10ms 查看一次，空闲时逐次加倍到 100ms
+const int CONTROL_POLL_MIN_MS = 10, CONTROL_POLL_MAX_MS = 100;
+
+void controlTimer(int interval) {
+    vector<ControlCommand> commands;
+    {
+        lock_guard<mutex> lock(controlMutex);
+        commands.swap(controlCommands);
+    }
+    for (size_t i = 0; i < commands.size(); ++i) {
+        applyControlCommand(commands[i]);
+    }
+    // GL模式下后台加载完成的纹理要等下一次重绘才会上传
+    if (!softRenderThreadRunning && !redisplayPosted && reloadedImage.load() != nullptr) {
+        redisplayPosted = true;
+        glutPostRedisplay();
+    }
+    bool busy = !commands.empty() || !pendingCaptures.empty() || !controlReadbacks.empty() || textureReloadBusy.load();
+    int next = busy ? CONTROL_POLL_MIN_MS : min(interval * 2, CONTROL_POLL_MAX_MS);
+    glutTimerFunc(next, controlTimer, next);
+}
+
+// 以下在控制线程中运行
+
+void writeMetricHeader(ostringstream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+void writeMetricSummary(ostringstream& out, const char* name, const char* help, const FrameHistogram& h) {
+    writeMetricHeader(out, name, "summary", help);
+    const double quantiles[] = {0.5, 0.9, 0.99};
+    for (int i = 0; i < 3; ++i) {
+        out << name << "{quantile=\"" << quantiles[i] << "\"} " << h.percentileMs(quantiles[i]) / 1000.0 << "\n";
+    }
+    out << name << "_sum " << h.meanMs() * h.count() / 1000.0 << "\n";
+    out << name << "_count " << h.count() << "\n";
+}
+
+string formatControlMetrics() {
+    controlMetrics.update();
+    const ControlMetrics& m = controlMetrics.readBuffer();
+    ostringstream out;
+    
+    writeMetricHeader(out, "globe_frames_total", "counter", "已显示的帧数");
+    out << "globe_frames_total " << m.frameTimes.count() << "\n";
+    writeMetricHeader(out, "globe_frame_hitches_total", "counter", "超过卡顿阈值的帧数");
+    out << "globe_frame_hitches_total " << m.hitches << "\n";
+    writeMetricSummary(out, "globe_frame_seconds", "帧时间", m.frameTimes);
+    writeMetricHeader(out, "globe_frame_max_seconds", "gauge", "最长帧时间");
+    out << "globe_frame_max_seconds " << m.frameTimes.maxMs() / 1000.0 << "\n";
+    writeMetricSummary(out, "globe_input_latency_seconds", "输入到上屏的延迟", m.inputLatency);
+    
+    if (m.passTimings) {
+        writeMetricHeader(out, "globe_pass_cpu_seconds", "gauge", "各绘制阶段的CPU耗时（滚动平均）");
+        for (int pass = 0; pass < PASS_COUNT; ++pass) {
+            out << "globe_pass_cpu_seconds{pass=\"" << passNames[pass] << "\"} " << m.passes[pass].cpuMs / 1000.0 << "\n";
+        }
+        writeMetricHeader(out, "globe_pass_gpu_seconds", "gauge", "各绘制阶段的GPU耗时（滚动平均，不支持计时查询时不输出）");
+        for (int pass = 0; pass < PASS_COUNT; ++pass) {
+            if (m.passes[pass].gpuMs < 0.0) continue;
+            out << "globe_pass_gpu_seconds{pass=\"" << passNames[pass] << "\"} " << m.passes[pass].gpuMs / 1000.0 << "\n";
+        }
+    }
+    writeMetricHeader(out, "globe_draw_calls", "gauge", "最近一帧的绘制调用数");
+    out << "globe_draw_calls " << m.drawCalls << "\n";
+    
+    writeMetricHeader(out, "globe_view_rotation_degrees", "gauge", "视图旋转角");
+    out << "globe_view_rotation_degrees{axis=\"x\"} " << m.view.rotationX << "\n";
+    out << "globe_view_rotation_degrees{axis=\"y\"} " << m.view.rotationY << "\n";
+    writeMetricHeader(out, "globe_view_zoom", "gauge", "视图缩放");
+    out << "globe_view_zoom " << m.view.zoom << "\n";
+    writeMetricHeader(out, "globe_light_index", "gauge", "光源位置序号");
+    out << "globe_light_index " << m.view.light << "\n";
+    writeMetricHeader(out, "globe_shadow_intensity", "gauge", "阴影强度");
+    out << "globe_shadow_intensity " << m.view.shadowIntensity << "\n";
+    
+    writeMetricHeader(out, "globe_resident_memory_bytes", "gauge", "常驻内存");
+    out << "globe_resident_memory_bytes " << currentResidentMemory() << "\n";
+    writeMetricHeader(out, "globe_peak_resident_memory_bytes", "gauge", "常驻内存峰值");
+    out << "globe_peak_resident_memory_bytes " << peakResidentMemory() << "\n";
+    
+    writeMetricHeader(out, "globe_control_commands_total", "counter", "控制套接字处理的命令数");
+    out << "globe_control_commands_total " << controlCommandsHandled << "\n";
+    writeMetricHeader(out, "globe_control_captures_total", "counter", "经控制套接字写出的截图数");
+    out << "globe_control_captures_total " << controlCapturesWritten << "\n";
+    return out.str();
+}
+
+// 把截图编码为BMP写盘，返回回复
+string writeControlCapture(ControlCapture& capture) {
+    if (capture.pixels.empty()) return "error 读回画面失败，未写入 " + capture.path + "\n";
+    if (capture.rgba) {
+        // CPU渲染的画面：RGBA -> 每行4字节对齐的BGR，行序同为自下而上
+        vector<unsigned char> bgr((size_t)((capture.width * 3 + 3) & ~3) * capture.height);
+        rgbaToBMPRows(capture.pixels.data(), capture.width, capture.height, bgr.data());
+        capture.pixels.swap(bgr);
+    }
+    if (!saveBMPFile(capture.path.c_str(), capture.pixels.data(), capture.width, capture.height)) {
+        return "error 无法写入 " + capture.path + "\n";
+    }
+    ++controlCapturesWritten;
+    ostringstream reply;
+    reply << "ok " << capture.path << " " << capture.width << "x" << capture.height << "\n";
+    return reply.str();
+}
+
+bool parseControlFloat(istringstream& in, float& value) {
+    return (in >> value) && std::isfinite(value);
+}
+
+// 处理一行命令；截图的回复要等画面交回后才发送，此时返回空串
+string handleControlLine(const string& line, unsigned long long client) {
+    istringstream in(line);
+    string name;
+    if (!(in >> name)) return "";
+    ++controlCommandsHandled;
+    
+    ControlCommand command;
+    command.a = command.b = 0.0f;
+    command.client = client;
+    if (name == "rotate") {
+        command.type = CONTROL_ROTATE;
+        if (!parseControlFloat(in, command.a) || !parseControlFloat(in, command.b)) {
+            return "error 用法: rotate 绕X轴角度 绕Y轴角度\n";
+        }
+    } else if (name == "zoom") {
+        command.type = CONTROL_ZOOM;
+        if (!parseControlFloat(in, command.a) || command.a <= 0.0f) return "error 用法: zoom 正数\n";
+    } else if (name == "light") {
+        command.type = CONTROL_LIGHT;
+        int index = -1;
+        if (!(in >> index) || index < 0 || index >= (int)lightPositions.size()) {
+            ostringstream reply;
+            reply << "error 用法: light 序号（0-" << lightPositions.size() - 1 << "）\n";
+            return reply.str();
+        }
+        command.a = (float)index;
+    } else if (name == "shadow") {
+        command.type = CONTROL_SHADOW;
+        if (!parseControlFloat(in, command.a)) return "error 用法: shadow 强度（0.1-1.0）\n";
+    } else if (name == "reload") {
+        command.type = CONTROL_RELOAD;
+    } else if (name == "capture") {
+        command.type = CONTROL_CAPTURE;
+        if (!(in >> command.path)) return "error 用法: capture 文件.bmp\n";
+    } else if (name == "metrics") {
+        return formatControlMetrics() + "ok\n";
+    } else {
+        return "error 未知命令 " + name + "，可用: rotate zoom light shadow reload capture metrics\n";
+    }
+    
+    {
+        lock_guard<mutex> lock(controlMutex);
+        controlCommands.push_back(command);
+    }
+    return command.type == CONTROL_CAPTURE ? "" : "ok\n";
+}
+
+struct ControlClient {
+    int fd;
+    unsigned long long id;
+    string input;
+    bool http;          // 收到 HTTP 请求行，等待请求头结束
+    string httpPath;
+};
+
+bool sendControlReply(int fd, const string& text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = write(fd, text.data() + sent, text.size() - sent);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// HTTP 请求（如 curl http://127.0.0.1:端口/metrics）只支持 GET /metrics，回复后关闭连接
+string controlHttpResponse(const string& path) {
+    if (path != "/metrics") {
+        return "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    string body = formatControlMetrics();
+    ostringstream head;
+    head << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+         << "Content-Length: " << body.size() << "\r\nConnection: close\r\n\r\n";
+    return head.str() + body;
+}
+
+// 处理缓冲区里的完整行，返回 false 表示应关闭连接
+bool processControlInput(ControlClient& client) {
+    size_t end;
+    while ((end = client.input.find('\n')) != string::npos) {
+        string line = client.input.substr(0, end);
+        client.input.erase(0, end + 1);
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        
+        if (client.http) {
+            if (!line.empty()) continue; // 忽略请求头
+            sendControlReply(client.fd, controlHttpResponse(client.httpPath));
+            return false;
+        }
+        if (line.compare(0, 4, "GET ") == 0) {
+            client.http = true;
+            istringstream request(line.substr(4));
+            request >> client.httpPath;
+            continue;
+        }
+        string reply = handleControlLine(line, client.id);
+        if (!reply.empty() && !sendControlReply(client.fd, reply)) return false;
+    }
+    return client.input.size() <= 65536; // 一行过长时断开
+}
+
+void controlServerLoop() {
+    vector<ControlClient> clients;
+    unsigned long long nextClientId = 1;
+    
+    while (!controlStop.load()) {
+        vector<pollfd> fds(2 + clients.size());
+        fds[0].fd = controlListenFd;
+        fds[1].fd = controlWakePipe[0];
+        for (size_t i = 0; i < clients.size(); ++i) fds[2 + i].fd = clients[i].fd;
+        for (size_t i = 0; i < fds.size(); ++i) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) continue;
+        
+        // 渲染方交回的截图：编码写盘后回复发起请求的连接
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(controlWakePipe[0], drain, sizeof(drain)) > 0) {}
+            vector<ControlCapture> captures;
+            {
+                lock_guard<mutex> lock(controlMutex);
+                captures.swap(controlCaptures);
+            }
+            for (size_t i = 0; i < captures.size(); ++i) {
+                string reply = writeControlCapture(captures[i]);
+                for (size_t c = 0; c < clients.size(); ++c) {
+                    if (clients[c].id == captures[i].client) sendControlReply(clients[c].fd, reply);
+                }
+            }
+        }
+        
+        vector<bool> closing(clients.size(), false);
+        for (size_t i = 0; i < clients.size(); ++i) {
+            short revents = fds[2 + i].revents;
+            if (!(revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            char buffer[4096];
+            ssize_t n = read(clients[i].fd, buffer, sizeof(buffer));
+            if (n <= 0) {
+                closing[i] = true;
+                continue;
+            }
+            clients[i].input.append(buffer, n);
+            closing[i] = !processControlInput(clients[i]);
+        }
+        for (size_t i = clients.size(); i-- > 0;) {
+            if (!closing[i]) continue;
+            close(clients[i].fd);
+            clients.erase(clients.begin() + i);
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(controlListenFd, NULL, NULL);
+            if (fd >= 0) {
+                ControlClient client;
+                client.fd = fd;
+                client.id = nextClientId++;
+                client.http = false;
+                clients.push_back(client);
+            }
+        }
+    }
+    for (size_t i = 0; i < clients.size(); ++i) close(clients[i].fd);
+}
+
+// 参数全是数字时监听 127.0.0.1 上的该端口，否则为 Unix 域套接字路径
+bool startControlServer(const string& address) {
+    bool tcp = !address.empty() && address.find_first_not_of("0123456789") == string::npos;
+    if (tcp) {
+        controlListenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(controlListenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(address.c_str()));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (controlListenFd < 0 || ::bind(controlListenFd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            cerr << "错误: 无法监听 127.0.0.1:" << address << ": " << strerror(errno) << endl;
+            return false;
+        }
+    } else {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) {
+            cerr << "错误: 控制套接字路径过长: " << address << endl;
+            return false;
+        }
+        strcpy(addr.sun_path, address.c_str());
+        unlink(address.c_str()); // 上次异常退出留下的套接字文件
+        controlListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (controlListenFd < 0 || ::bind(controlListenFd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            cerr << "错误: 无法创建控制套接字 " << address << ": " << strerror(errno) << endl;
+            return false;
+        }
+    }
+    if (listen(controlListenFd, 8) != 0 || pipe(controlWakePipe) != 0) {
+        cerr << "错误: 控制套接字初始化失败: " << strerror(errno) << endl;
+        return false;
+    }
+    fcntl(controlWakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(controlWakePipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN); // 客户端提前断开时 write 返回错误而不是终止进程
+    
+    controlServerRunning = true;
+    controlThread = new thread(controlServerLoop);
+    cout << "控制套接字: " << (tcp ? "127.0.0.1:" : "") << address << endl;
+    return true;
+}
+
+void stopControlServer() {
+    if (!controlThread) return;
+    controlStop.store(true);
+    wakeControlThread();
+    controlThread->join();
+    delete controlThread;
+    controlThread = NULL;
+    close(controlListenFd);
+    if (controlAddress.find_first_not_of("0123456789") != string::npos) {
+        unlink(controlAddress.c_str());
+    }
+}
+
+// ========================
+// 显示回调函数
+// ========================
+
+// 绘制整个场景（不交换缓冲区，窗口模式和离屏模式共用）
+void renderScene() {
+    frameDrawCalls = 0;
+    {
+        ScopedPassTimer timer(PASS_CLEAR);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    
+    // 本帧的投影、相机和地球矩阵（输入没变时沿用上一帧）
+    updateFrameMatrices();
+    const float* viewMatrix = frameMatrices.view.m;
+    const float* globeMatrix = frameMatrices.globe.m;
+    
+    // 设置投影矩阵
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(frameMatrices.projection.m);
+    
+    // 设置模型视图矩阵为相机矩阵
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(viewMatrix);
+    
+    // 设置光源
+    setCurrentLight();
+    
+    // 场景图：只重算变化了的节点，相机和场景都没变时沿用上一帧的剔除结果
+    syncSceneGraph(sceneGraph, frameMatrices);
+    
+    // 绘制地面
+    {
+        ScopedPassTimer timer(PASS_FLOOR);
+        drawSceneLayer(sceneGraph, SCENE_LAYER_FLOOR);
+    }
+    
+    // 绘制阴影（在地面之上）
+    if (shadowEnabled && lightEnabled) {
+        ScopedPassTimer timer(PASS_SHADOW);
+        drawSceneLayer(sceneGraph, SCENE_LAYER_SHADOW);
+    }
+    
+    // 启用深度测试
+    glEnable(GL_DEPTH_TEST);
+    
+    // 绘制地球和挂在地球下的物体
+    {
+        ScopedPassTimer timer(PASS_GLOBE);
+        drawSceneLayer(sceneGraph, SCENE_LAYER_GLOBE);
+    }
+    
+    // 以下叠加层都在地球坐标系中绘制
+    glLoadMatrixf(globeMatrix);
+    
+    // 叠加时间序列数据场（后台预取，纹理环）
+    if (fieldEnabled) {
+        ScopedPassTimer timer(PASS_FIELD);
+        drawFieldLayer();
+    }
+    
+    // 叠加事件密度热力图（只上传改动的块）
+    if (heatmapEnabled) {
+        ScopedPassTimer timer(PASS_HEATMAP);
+        drawHeatmap();
+    }
+    
+    // 绘制云层（帧序列经PBO环流式上传）
+    if (cloudsEnabled) {
+        ScopedPassTimer timer(PASS_CLOUDS);
+        drawCloudLayer();
+    }
+    
+    // 绘制地理标记点（实例化，层次LOD）
+    if (markersEnabled) {
+        ScopedPassTimer timer(PASS_MARKERS);
+        drawMarkers(frameMatrices);
+    }
+    
+    // 绘制海岸线与国界（按缩放选择简化级别）
+    if (bordersEnabled) {
+        ScopedPassTimer timer(PASS_BORDERS);
+        drawBorders(frameMatrices);
+    }
+    
+    // 绘制航线（常驻顶点缓冲，一次绘制调用）
+    if (routesEnabled) {
+        ScopedPassTimer timer(PASS_ROUTES);
+        drawRoutes();
+    }
+        
+    // 绘制环境光遮蔽（接触阴影）
+    if (shadowEnabled) {
+        ScopedPassTimer timer(PASS_AO);
+        drawSceneLayer(sceneGraph, SCENE_LAYER_CONTACT);
+    }
+    
+    // 叠加点光源（分簇着色）
+    if (!pointLights.empty()) {
+        ScopedPassTimer timer(PASS_LIGHTS);
+        drawClusteredLights(viewMatrix, globeMatrix);
+    }
+    
+    // 叠加大气散射（最后绘制，城市灯光也会被大气衰减）
+    if (atmosphereEnabled) {
+        ScopedPassTimer timer(PASS_ATMOSPHERE);
+        drawAtmosphere(viewMatrix, globeMatrix);
+    }
+    
+    // 文字标注画在最上层
+    if (labelsEnabled) {
+        ScopedPassTimer timer(PASS_LABELS);
+        drawLabels();
+    }
+    
+    // 如果禁用了光照，重新启用它
+    if (lightEnabled) {
+        glEnable(GL_LIGHTING);
+    }
+}
+
+void display() {
+    redisplayPosted = false;
+    frameStats.beginFrame();
+    
+    // 取最新的视图快照和后台加载完成的纹理（上传耗时计入本帧）
+    if (viewBuffer.update()) {
+        applyViewState(viewBuffer.readBuffer());
+    }
+    unsigned long long sequence = viewBuffer.readBuffer().sequence;
+    if (takeReloadedTexture()) {
+        frameStats.noteEvent(EVENT_RELOAD);
+    }
+    
+    passProfiler.beginFrame();
+    renderScene();
+    if (!controlReadbacks.empty()) {
+        collectControlReadbacks();
+    }
+    if (!pendingCaptures.empty()) {
+        serviceControlCaptures(sequence, WIDTH, HEIGHT, NULL); // 截图不含性能叠加层
+    }
+    if (frameRecorder.recording()) {
+        ScopedPassTimer timer(PASS_CAPTURE);
+        frameRecorder.captureFramebuffer(WIDTH, HEIGHT);
+    }
+    if (hudEnabled) {
+        drawHud(WIDTH, HEIGHT, frameDrawCalls, collectHudStats());
+    }
+    {
+        ScopedPassTimer timer(PASS_SWAP);
+        glutSwapBuffers();
+    }
+    recordPresentedInput(sequence);
+    passProfiler.endFrame();
+    frameStats.endFrame();
+    publishControlMetrics(frameDrawCalls);
+    
+    // 叠加层打开、录制中、截图读回未完成、大气查找表在后台计算、云层或数据场在播放、热力图有事件流时持续刷新
+    if (hudEnabled || frameRecorder.recording() || !controlReadbacks.empty() ||
+        (atmosphereEnabled && !atmosphere.ready && !atmosphere.unavailable) ||
+        (cloudsEnabled && cloudStream.active()) ||
+        (fieldEnabled && fieldFramesPerSecond > 0.0 && fieldTimeline.active()) ||
+        (heatmapEnabled && heatmapStreamRate > 0.0)) {
+        glutPostRedisplay();
+    }
+}
+
+void reshape(int width, int height) {
+    if (width <= 0 || height <= 0) return;
+    frameStats.noteEvent(EVENT_RESIZE);
+    glViewport(0, 0, width, height); // 主线程始终持有窗口的GL上下文
+    inputView.width = width;
+    inputView.height = height;
+    publishInputView();
+}
+
+// ========================
+// 交互函数
+// ========================
+
+void mouse(int button, int state, int x, int y) {
+    if (button == GLUT_LEFT_BUTTON) {
+        mouseLeftDown = (state == GLUT_DOWN);
+        lastMouseX = x;
+        lastMouseY = y;
+        if (state == GLUT_DOWN) {
+            mouseDownX = x;
+            mouseDownY = y;
+        } else if (abs(x - mouseDownX) <= 2 && abs(y - mouseDownY) <= 2) { // 没有拖动，视为点击
+            GlobePick pick;
+            pickAtCursor(x, y, pick);
+            printPick(pick);
+        }
+    } else if (button == 3) { // 滚轮向上
+        queueZoom(1.1f);
+    } else if (button == 4) { // 滚轮向下
+        queueZoom(1.0f / 1.1f);
+    }
+}
+
+void motion(int x, int y) {
+    if (mouseLeftDown) {
+        queueRotation((y - lastMouseY) * 0.5f, (x - lastMouseX) * 0.5f);
+        lastMouseX = x;
+        lastMouseY = y;
+    }
+}
+
+// 悬停时更新拾取结果（只在性能面板打开时计算）
+void passiveMotion(int x, int y) {
+    if (!hudEnabled) return;
+    pickAtCursor(x, y, hoverPick);
+    if (!softRenderThreadRunning && !redisplayPosted) {
+        redisplayPosted = true;
+        glutPostRedisplay();
+    }
+}
+
+// 按键对应 layerToggles 中的图层时切换它，没有数据的图层只打印提示
+void toggleLayerHotkey(unsigned char key) {
+    for (int i = 0; i < LAYER_TOGGLE_COUNT; ++i) {
+        const LayerToggle& layer = layerToggles[i];
+        if (tolower(key) != layer.hotkey) continue;
+        if (layer.ready && !layer.ready()) {
+            cout << layer.missing << endl;
+            return;
+        }
+        inputView.*layer.view = !(inputView.*layer.view);
+        cout << layer.title << ": " << (inputView.*layer.view ? "开启" : "关闭") << endl;
+        publishInputView();
+        return;
+    }
+}
+
+void keyboard(unsigned char key, int x, int y) {
+    switch (key) {
+        case 27: // ESC键退出
+            finishRecording();
+            exit(0);
+            break;
+            
+        case '+': // 放大
+        case '=':
+            queueZoom(1.1f);
+            break;
+            
+        case '-': // 缩小
+        case '_':
+            queueZoom(1.0f / 1.1f);
+            break;
+            
+        case 'r': // 重置
+        case 'R':
+            queueViewReset();
+            break;
+            
+        case 't': // 重新加载纹理
+        case 'T':
+            startTextureReload();
+            break;
+            
+        case 'l': // 切换光照开关
+        case 'L':
+            frameStats.noteEvent(EVENT_LIGHT);
+            toggleLighting();
+            publishInputView();
+            break;
+            
+        case 's': // 切换阴影开关
+        case 'S':
+            frameStats.noteEvent(EVENT_SHADOW);
+            toggleShadow();
+            publishInputView();
+            break;
+            
+        case '[': // 减少阴影强度
+            frameStats.noteEvent(EVENT_SHADOW);
+            adjustShadowIntensity(-0.1f);
+            publishInputView();
+            break;
+            
+        case ']': // 增加阴影强度
+            frameStats.noteEvent(EVENT_SHADOW);
+            adjustShadowIntensity(0.1f);
+            publishInputView();
+            break;
+            
+        case 'n': // 下一个光源位置
+        case 'N':
+            frameStats.noteEvent(EVENT_LIGHT);
+            nextLightPosition();
+            printLightInfo();
+            publishInputView();
+            break;
+            
+        case 'p': // 上一个光源位置
+        case 'P':
+            frameStats.noteEvent(EVENT_LIGHT);
+            prevLightPosition();
+            printLightInfo();
+            publishInputView();
+            break;
+            
+        case 'g': // 切换地球绘制方式（网格 / 替身）
+        case 'G':
+            inputView.globeImpostor = !inputView.globeImpostor;
+            cout << "地球绘制方式: " << (inputView.globeImpostor ? "光线求交替身" : "三角网格") << endl;
+            publishInputView();
+            break;
+            
+        case 'h': // 切换性能叠加层
+        case 'H':
+            hudEnabled = !hudEnabled;
+            cout << "性能叠加层: " << (hudEnabled ? "开启" : "关闭") << endl;
+            publishInputView();
+            break;
+            
+        case 'c': // 切换点光源数量（0 / 64 / 256 / 1024）
+        case 'C':
+            frameStats.noteEvent(EVENT_LIGHT);
+            inputView.pointLights = inputView.pointLights == 0 ? 64 :
+                                    inputView.pointLights >= 1024 ? 0 : inputView.pointLights * 4;
+            cout << "点光源数量: " << inputView.pointLights << endl;
+            publishInputView();
+            break;
+            
+        case 'u': // 切换太阳方向（光源位置 / 真实太阳位置）
+        case 'U':
+            frameStats.noteEvent(EVENT_LIGHT);
+            inputView.realSun = !inputView.realSun;
+            cout << "太阳方向: " << (inputView.realSun ? "真实太阳位置" : "当前光源位置") << endl;
+            publishInputView();
+            break;
+            
+        case 'e': // 暂停/继续录制
+        case 'E':
+            if (!frameRecorder.isStarted()) {
+                cout << "没有录制输出，请用 --record 指定" << endl;
+                break;
+            }
+            frameRecorder.setActive(!frameRecorder.recording());
+            cout << "录制: " << (frameRecorder.recording() ? "继续" : "暂停") << endl;
+            if (frameRecorder.recording() && !softRenderThreadRunning && !redisplayPosted) {
+                redisplayPosted = true;
+                glutPostRedisplay();
+            }
+            break;
+            
+        case ',': // 数据场时间轴后退 / 前进一步，< > 一次移动24步
+        case '.':
+        case '<':
+        case '>':
+            if (fieldTimeline.active()) {
+                int step = key == ',' ? -1 : key == '.' ? 1 : key == '<' ? -24 : 24;
+                int frames = fieldTimeline.frameCount();
+                double time = floor(fieldCursor + 0.5) + step;
+                inputView.fieldTime = (float)(time - floor(time / frames) * frames);
+                cout << "数据场时间步: " << (int)inputView.fieldTime << " / " << frames << "（"
+                     << inputView.fieldTime * fieldTimeline.hoursPerFrame() << " 小时）" << endl;
+                publishInputView();
+            }
+            break;
+            
+        case 'f': // 输出帧时间统计
+        case 'F':
+            writeFrameReport();
+            break;
+            
+        case 'i': // 显示当前光源信息
+        case 'I':
+            printLightInfo();
+            break;
+            
+        // 数字键选择光源位置（0-7对应8个光源位置）
+        case '0': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(0); publishInputView(); break;
+        case '1': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(1); publishInputView(); break;
+        case '2': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(2); publishInputView(); break;
+        case '3': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(3); publishInputView(); break;
+        case '4': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(4); publishInputView(); break;
+        case '5': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(5); publishInputView(); break;
+        case '6': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(6); publishInputView(); break;
+        case '7': frameStats.noteEvent(EVENT_LIGHT); setLightPosition(7); publishInputView(); break;
+        
+        // 其他数字键提示
+        case '8':
+        case '9':
+            cout << "提示：光源位置只有0-7，共8个位置" << endl;
+            break;
+            
+        default: // 图层开关见 layerToggles
+            toggleLayerHotkey(key);
+            break;
+    }
+}
+
+// ========================
+// 初始化函数
+// ========================
+
+void init() {
+    glClearColor(0.0f, 0.0f, 0.1f, 1.0f);
+    
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+    
+    // 启用颜色混合
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    initTexture();
+    createSoftShadowTexture();
+}
+
+void initAntialiasing() {
+    // 启用多重采样抗锯齿
+    glEnable(GL_MULTISAMPLE);
+    glEnable(GL_POINT_SMOOTH);
+    glEnable(GL_LINE_SMOOTH);
+    glEnable(GL_POLYGON_SMOOTH);
+    glHint(GL_POINT_SMOOTH_HINT, GL_NICEST);
+    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
+}
+
+// ========================
+// CPU 软件光栅化后端
+// ========================
+// 在CPU上重现固定管线下的整个场景：Gouraud 光照的纹理地球、网格地面、
+// 混合的阴影四边形和接触阴影。三角形先按 64x64 屏幕分块装箱，
+// 再由多个线程并行光栅化各个分块，每次用 SIMD 处理一行中的4个像素
+
+const int SOFT_TILE_SIZE = 64;
+
+struct SoftTexture {
+    const unsigned char* pixels;
+    int width, height, channels;
+    bool repeat; // GL_REPEAT 或 GL_CLAMP_TO_EDGE
+};
+
+// 裁剪空间顶点
+struct SoftVertex {
+    float clip[4];
+    float color[4];
+    float tex[2];
+};
+
+// 屏幕空间顶点，属性已乘以 1/w 以便透视校正插值
+struct SoftScreenVertex {
+    float x, y, z, invW;
+    float attr[6]; // r, g, b, a, s, t
+};
+
+struct SoftTriangle {
+    float edgeA[3], edgeB[3], edgeC[3]; // 边函数 e(x,y) = A*x + B*y + C
+    bool topLeft[3];
+    float z[3];
+    float invW[3];
+    float attr[3][6];
+    int minX, minY, maxX, maxY;
+    int texture;     // -1 表示无纹理
+    bool blend;
+    bool depthWrite;
+};
+
+struct SoftRenderer {
+    int width, height;
+    int pitch;                   // 每行像素数（向上取整到4的倍数）
+    vector<unsigned char> color; // RGBA，第0行为画面底部（与GL一致）
+    vector<float> depth;
+    int tilesX, tilesY;
+    vector<vector<int> > bins;   // 每个分块覆盖的三角形序号（保持提交顺序）
+    vector<SoftTriangle> triangles;
+    vector<SoftTexture> textures;
+    int globeBegin, globeEnd;    // 地球三角形在 triangles 中的范围
+    Mat4 globeMatrix;
+    float lightEye[3];
+    
+    // 当前绘制状态
+    Mat4 projection;
+    Mat4 modelView;
+    int texture;
+    bool blend;
+    bool depthWrite;
+};
+
+SoftRenderer softRenderer;
+
+void softResize(SoftRenderer& r, int width, int height) {
+    r.width = width;
+    r.height = height;
+    r.pitch = (width + 3) & ~3;
+    r.color.resize(r.pitch * height * 4);
+    r.depth.resize(r.pitch * height);
+    r.tilesX = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    r.tilesY = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    r.bins.resize(r.tilesX * r.tilesY);
+}
+
+SoftVertex softMakeVertex(const SoftRenderer& r, float x, float y, float z,
+                          const float color[4], float s = 0.0f, float t = 0.0f) {
+    SoftVertex v;
+    float object[4] = {x, y, z, 1.0f};
+    float eye[4];
+    mat4Transform(r.modelView, object, eye);
+    mat4Transform(r.projection, eye, v.clip);
+    for (int i = 0; i < 4; ++i) v.color[i] = color[i];
+    v.tex[0] = s;
+    v.tex[1] = t;
+    return v;
+}
+
+SoftScreenVertex softToScreen(const SoftRenderer& r, const SoftVertex& v) {
+    SoftScreenVertex out;
+    out.invW = 1.0f / v.clip[3];
+    out.x = (v.clip[0] * out.invW * 0.5f + 0.5f) * r.width;
+    out.y = (v.clip[1] * out.invW * 0.5f + 0.5f) * r.height;
+    out.z = v.clip[2] * out.invW * 0.5f + 0.5f;
+    for (int i = 0; i < 4; ++i) out.attr[i] = v.color[i] * out.invW;
+    out.attr[4] = v.tex[0] * out.invW;
+    out.attr[5] = v.tex[1] * out.invW;
+    return out;
+}
+
+void softSetupTriangle(SoftRenderer& r, const SoftScreenVertex& a, const SoftScreenVertex& b0,
+                       const SoftScreenVertex& c0) {
+    // 统一为逆时针，使内部像素的边函数值为正（场景未开启背面剔除）
+    float area = (b0.x - a.x) * (c0.y - a.y) - (c0.x - a.x) * (b0.y - a.y);
+    if (fabs(area) < 1e-8f) return;
+    const SoftScreenVertex* v[3] = {&a, &b0, &c0};
+    if (area < 0) swap(v[1], v[2]);
+    
+    SoftTriangle tri;
+    float minXf = v[0]->x, maxXf = v[0]->x, minYf = v[0]->y, maxYf = v[0]->y;
+    for (int i = 0; i < 3; ++i) {
+        const SoftScreenVertex& p = *v[(i + 1) % 3];
+        const SoftScreenVertex& q = *v[(i + 2) % 3];
+        tri.edgeA[i] = p.y - q.y;
+        tri.edgeB[i] = q.x - p.x;
+        tri.edgeC[i] = p.x * q.y - q.x * p.y;
+        // 左上填充规则：上边（水平且向左）或左边（向下）上的像素属于本三角形
+        tri.topLeft[i] = (tri.edgeA[i] == 0 && tri.edgeB[i] < 0) || tri.edgeA[i] > 0;
+        
+        tri.z[i] = v[i]->z;
+        tri.invW[i] = v[i]->invW;
+        for (int k = 0; k < 6; ++k) tri.attr[i][k] = v[i]->attr[k];
+        
+        minXf = min(minXf, v[i]->x); maxXf = max(maxXf, v[i]->x);
+        minYf = min(minYf, v[i]->y); maxYf = max(maxYf, v[i]->y);
+    }
+    
+    tri.minX = max(0, (int)floor(minXf));
+    tri.minY = max(0, (int)floor(minYf));
+    tri.maxX = min(r.width - 1, (int)ceil(maxXf));
+    tri.maxY = min(r.height - 1, (int)ceil(maxYf));
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY) return;
+    
+    tri.texture = r.texture;
+    tri.blend = r.blend;
+    tri.depthWrite = r.depthWrite;
+    r.triangles.push_back(tri);
+}
+
+// 在近平面处裁剪（z >= -w），其余平面由屏幕范围和深度测试处理
+void softSubmitTriangle(SoftRenderer& r, const SoftVertex& a, const SoftVertex& b, const SoftVertex& c) {
+    const SoftVertex* in[3] = {&a, &b, &c};
+    SoftVertex poly[4];
+    int count = 0;
+    
+    for (int i = 0; i < 3; ++i) {
+        const SoftVertex& p = *in[i];
+        const SoftVertex& q = *in[(i + 1) % 3];
+        float dp = p.clip[2] + p.clip[3];
+        float dq = q.clip[2] + q.clip[3];
+        if (dp >= 0) poly[count++] = p;
+        if ((dp >= 0) != (dq >= 0)) {
+            float t = dp / (dp - dq);
+            SoftVertex& v = poly[count++];
+            for (int k = 0; k < 4; ++k) v.clip[k] = p.clip[k] + t * (q.clip[k] - p.clip[k]);
+            for (int k = 0; k < 4; ++k) v.color[k] = p.color[k] + t * (q.color[k] - p.color[k]);
+            for (int k = 0; k < 2; ++k) v.tex[k] = p.tex[k] + t * (q.tex[k] - p.tex[k]);
+        }
+    }
+    
+    for (int i = 1; i + 1 < count; ++i) {
+        softSetupTriangle(r, softToScreen(r, poly[0]), softToScreen(r, poly[i]), softToScreen(r, poly[i + 1]));
+    }
+}
+
+// 宽度为1像素的线段，展开为屏幕空间中的细长四边形
+void softSubmitLine(SoftRenderer& r, const SoftVertex& a, const SoftVertex& b) {
+    const float nearW = 1e-4f;
+    if (a.clip[3] < nearW || b.clip[3] < nearW) return;
+    
+    SoftScreenVertex p = softToScreen(r, a);
+    SoftScreenVertex q = softToScreen(r, b);
+    float dx = q.x - p.x, dy = q.y - p.y;
+    float len = sqrt(dx*dx + dy*dy);
+    if (len < 1e-6f) return;
+    float nx = -dy / len * 0.5f, ny = dx / len * 0.5f;
+    
+    SoftScreenVertex quad[4] = {p, q, q, p};
+    quad[0].x += nx; quad[0].y += ny;
+    quad[1].x += nx; quad[1].y += ny;
+    quad[2].x -= nx; quad[2].y -= ny;
+    quad[3].x -= nx; quad[3].y -= ny;
+    softSetupTriangle(r, quad[0], quad[1], quad[2]);
+    softSetupTriangle(r, quad[0], quad[2], quad[3]);
+}
+
+void softSubmitQuad(SoftRenderer& r, const SoftVertex& a, const SoftVertex& b,
+                    const SoftVertex& c, const SoftVertex& d) {
+    softSubmitTriangle(r, a, b, c);
+    softSubmitTriangle(r, a, c, d);
+}
+
+// 固定管线的光照方程（GL_LIGHT0 点光源，非局部观察者），eye/n 均在视空间
+void softLightEye(const float eye[3], const float n[3], const float lightEye[3], float outColor[4]) {
+    const float sceneAmbient = 0.2f;
+    const float lightAmbient = 0.3f;
+    const float lightDiffuse[3] = {1.0f, 1.0f, 0.9f};
+    const float lightSpecular = 0.8f;
+    const float matAmbient = 0.7f, matDiffuse = 0.9f, matSpecular = 0.3f, matShininess = 30.0f;
+    
+    float l[3] = {lightEye[0] - eye[0], lightEye[1] - eye[1], lightEye[2] - eye[2]};
+    float ll = sqrt(l[0]*l[0] + l[1]*l[1] + l[2]*l[2]);
+    for (int i = 0; i < 3; ++i) l[i] /= ll;
+    
+    float nDotL = n[0]*l[0] + n[1]*l[1] + n[2]*l[2];
+    float diffuse = max(nDotL, 0.0f);
+    float specular = 0.0f;
+    if (nDotL > 0) {
+        float h[3] = {l[0], l[1], l[2] + 1.0f};
+        float hl = sqrt(h[0]*h[0] + h[1]*h[1] + h[2]*h[2]);
+        float nDotH = max((n[0]*h[0] + n[1]*h[1] + n[2]*h[2]) / hl, 0.0f);
+        specular = pow(nDotH, matShininess) * lightSpecular * matSpecular;
+    }
+    
+    for (int i = 0; i < 3; ++i) {
+        float c = (sceneAmbient + lightAmbient) * matAmbient + diffuse * lightDiffuse[i] * matDiffuse + specular;
+        outColor[i] = min(max(c, 0.0f), 1.0f);
+    }
+    outColor[3] = 1.0f;
+}
+
+// softLightEye 的4路版本：eye、n 为4个像素的视空间位置和法线，color 为 RGB 三个分量
+void softLightEye4(const F4 eye[3], const F4 n[3], const float lightEye[3], F4 color[3]) {
+    const float lightDiffuse[3] = {1.0f, 1.0f, 0.9f};
+    const float ambient = (0.2f + 0.3f) * 0.7f, matDiffuse = 0.9f, specularScale = 0.8f * 0.3f;
+    const F4 zero = f4Set1(0.0f), one = f4Set1(1.0f);
+    
+    F4 l[3];
+    for (int i = 0; i < 3; ++i) l[i] = f4Sub(f4Set1(lightEye[i]), eye[i]);
+    F4 ll = f4Sqrt(f4Add(f4Add(f4Mul(l[0], l[0]), f4Mul(l[1], l[1])), f4Mul(l[2], l[2])));
+    for (int i = 0; i < 3; ++i) l[i] = f4Div(l[i], ll);
+    
+    F4 nDotL = f4Add(f4Add(f4Mul(n[0], l[0]), f4Mul(n[1], l[1])), f4Mul(n[2], l[2]));
+    F4 diffuse = f4Max(nDotL, zero);
+    F4 h2 = f4Add(l[2], one);
+    F4 hl = f4Sqrt(f4Add(f4Add(f4Mul(l[0], l[0]), f4Mul(l[1], l[1])), f4Mul(h2, h2)));
+    F4 nDotH = f4Max(f4Div(f4Add(f4Add(f4Mul(n[0], l[0]), f4Mul(n[1], l[1])), f4Mul(n[2], h2)), hl), zero);
+    // nDotH^30 = x^16 * x^8 * x^4 * x^2
+    F4 x2 = f4Mul(nDotH, nDotH), x4 = f4Mul(x2, x2), x8 = f4Mul(x4, x4), x16 = f4Mul(x8, x8);
+    F4 specular = f4Mul(f4Mul(f4Mul(x16, x8), f4Mul(x4, x2)), f4Set1(specularScale));
+    specular = f4Select(f4CmpGT(nDotL, zero), specular, zero);
+    
+    for (int i = 0; i < 3; ++i) {
+        F4 c = f4Add(f4Add(f4Set1(ambient), f4Mul(diffuse, f4Set1(lightDiffuse[i] * matDiffuse))), specular);
+        color[i] = f4Min(f4Max(c, zero), one);
+    }
+}
+
+// 固定管线的逐顶点光照（未开启 GL_NORMALIZE，法线按模型视图矩阵缩放）
+void softLightVertex(const Mat4& modelView, const float normalMatrix[9], const float lightEye[3],
+                     const float position[3], const float normal[3], float outColor[4]) {
+    float object[4] = {position[0], position[1], position[2], 1.0f};
+    float eye[4];
+    mat4Transform(modelView, object, eye);
+    
+    float n[3];
+    for (int i = 0; i < 3; ++i) {
+        n[i] = normalMatrix[i] * normal[0] + normalMatrix[3 + i] * normal[1] + normalMatrix[6 + i] * normal[2];
+    }
+    softLightEye(eye, n, lightEye, outColor);
+}
+
+// 模型视图矩阵左上 3x3 的逆转置，用于变换法线
+void softNormalMatrix(const Mat4& mv, float out[9]) {
+    const float* m = mv.m;
+    float a = m[0], b = m[4], c = m[8];
+    float d = m[1], e = m[5], f = m[9];
+    float g = m[2], h = m[6], k = m[10];
+    float det = a*(e*k - f*h) - b*(d*k - f*g) + c*(d*h - e*g);
+    float inv = 1.0f / det;
+    // 逆矩阵的转置，按列主序存储
+    out[0] = (e*k - f*h) * inv; out[3] = -(d*k - f*g) * inv; out[6] = (d*h - e*g) * inv;
+    out[1] = -(b*k - c*h) * inv; out[4] = (a*k - c*g) * inv; out[7] = -(a*h - b*g) * inv;
+    out[2] = (b*f - c*e) * inv; out[5] = -(a*f - c*d) * inv; out[8] = (a*e - b*d) * inv;
+}
+
+void softDrawFloor(SoftRenderer& r, const Mat4& view) {
+    ++frameDrawCalls;
+    r.modelView = view;
+    r.texture = -1;
+    r.blend = false;
+    r.depthWrite = true;
+    
+    const float base[4] = {0.5f, 0.5f, 0.5f, 1.0f};
+    softSubmitQuad(r,
+        softMakeVertex(r, -floorSize, floorY, -floorSize, base),
+        softMakeVertex(r, floorSize, floorY, -floorSize, base),
+        softMakeVertex(r, floorSize, floorY, floorSize, base),
+        softMakeVertex(r, -floorSize, floorY, floorSize, base));
+    
+    const float line[4] = {0.7f, 0.7f, 0.7f, 1.0f};
+    for (float x = -floorSize; x <= floorSize; x += 0.5f) {
+        softSubmitLine(r, softMakeVertex(r, x, floorY + 0.001f, -floorSize, line),
+                          softMakeVertex(r, x, floorY + 0.001f, floorSize, line));
+    }
+    for (float z = -floorSize; z <= floorSize; z += 0.5f) {
+        softSubmitLine(r, softMakeVertex(r, -floorSize, floorY + 0.001f, z, line),
+                          softMakeVertex(r, floorSize, floorY + 0.001f, z, line));
+    }
+}
+
+void softDrawShadow(SoftRenderer& r, const Mat4& view, int shadowTexture) {
+    Mat4 model;
+    if (!shadowModelMatrix(model)) return;
+    ++frameDrawCalls;
+    
+    r.modelView = mat4Multiply(view, model);
+    r.texture = shadowTexture;
+    r.blend = true;
+    r.depthWrite = false;
+    
+    const float color[4] = {0.0f, 0.0f, 0.0f, shadowIntensity};
+    softSubmitQuad(r,
+        softMakeVertex(r, -1.0f, 0.0f, -1.0f, color, 0.0f, 0.0f),
+        softMakeVertex(r, 1.0f, 0.0f, -1.0f, color, 1.0f, 0.0f),
+        softMakeVertex(r, 1.0f, 0.0f, 1.0f, color, 1.0f, 1.0f),
+        softMakeVertex(r, -1.0f, 0.0f, 1.0f, color, 0.0f, 1.0f));
+}
+
+void softDrawGlobe(SoftRenderer& r, const Mat4& globe, const float lightEye[3], int earthTexture) {
+    ++frameDrawCalls;
+    const int slices = sphereSlices, stacks = sphereStacks;
+    static vector<float> vertices, normals, texCoords;
+    static int cachedSlices = 0, cachedStacks = 0;
+    if (slices != cachedSlices || stacks != cachedStacks) {
+        vertices.clear();
+        normals.clear();
+        texCoords.clear();
+        generateSphere(1.0f, slices, stacks, vertices, normals, texCoords);
+        cachedSlices = slices;
+        cachedStacks = stacks;
+    }
+    
+    r.modelView = globe;
+    r.texture = earthTexture;
+    r.blend = false;
+    r.depthWrite = true;
+    
+    // 每个顶点只计算一次光照和变换，再按三角形带组装
+    int vertexCount = (int)vertices.size() / 3;
+    vector<SoftVertex> lit(vertexCount);
+    float normalMatrix[9];
+    softNormalMatrix(globe, normalMatrix);
+    const float white[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    
+    for (int i = 0; i < vertexCount; ++i) {
+        float color[4];
+        if (lightEnabled) {
+            softLightVertex(globe, normalMatrix, lightEye, &vertices[i * 3], &normals[i * 3], color);
+        } else {
+            memcpy(color, white, sizeof(color));
+        }
+        lit[i] = softMakeVertex(r, vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2], color,
+                                texCoords[i * 2], texCoords[i * 2 + 1]);
+    }
+    
+    for (int i = 0; i < stacks; ++i) {
+        for (int j = 0; j < slices; ++j) {
+            int a = i * (slices + 1) + j;
+            int b = (i + 1) * (slices + 1) + j;
+            softSubmitTriangle(r, lit[a], lit[b], lit[a + 1]);
+            softSubmitTriangle(r, lit[a + 1], lit[b], lit[b + 1]);
+        }
+    }
+}
+
+void softDrawAmbientOcclusion(SoftRenderer& r, const Mat4& contact) {
+    ++frameDrawCalls;
+    // 与 drawAmbientOcclusion 一致：以地球半径为单位，只缩放不转动
+    r.modelView = contact;
+    r.texture = -1;
+    r.blend = true;
+    r.depthWrite = true;
+    
+    float earthBottomY = -1.0f;
+    int segments = 32;
+    float contactRadius = 0.2f;
+    
+    const float centerColor[4] = {0.0f, 0.0f, 0.0f, 0.3f * shadowIntensity};
+    const float edgeColor[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    SoftVertex center = softMakeVertex(r, 0.0f, earthBottomY - 0.001f, 0.0f, centerColor);
+    SoftVertex previous = softMakeVertex(r, contactRadius, earthBottomY - 0.001f, 0.0f, edgeColor);
+    for (int i = 1; i <= segments; i++) {
+        float angle = 2.0f * M_PI * i / segments;
+        SoftVertex current = softMakeVertex(r, contactRadius * cos(angle), earthBottomY - 0.001f,
+                                            contactRadius * sin(angle), edgeColor);
+        softSubmitTriangle(r, center, previous, current);
+        previous = current;
+    }
+}
+
+// 组装与 renderScene() 相同的场景
+void softBuildScene(SoftRenderer& r) {
+    frameDrawCalls = 0;
+    r.triangles.clear();
+    r.textures.clear();
+    
+    SoftTexture earth = {earthPixels.data(), earthTexWidth, earthTexHeight, 3, true};
+    SoftTexture shadow = {shadowPixels.data(), shadowTexSize, shadowTexSize, 4, false};
+    r.textures.push_back(earth);
+    r.textures.push_back(shadow);
+    
+    updateFrameMatrices();
+    r.projection = frameMatrices.projection;
+    const Mat4& view = frameMatrices.view;
+    
+    LightPosition light = currentLight();
+    float lightWorld[4] = {light.x, light.y, light.z, 1.0f};
+    float lightEye[4];
+    mat4Transform(view, lightWorld, lightEye);
+    
+    softDrawFloor(r, view);
+    if (shadowEnabled && lightEnabled) {
+        softDrawShadow(r, view, 1);
+    }
+    
+    const Mat4& globe = frameMatrices.globe;
+    r.globeMatrix = globe;
+    memcpy(r.lightEye, lightEye, sizeof(r.lightEye));
+    
+    // 光线求交模式下地球不产生三角形，由 softRaycastGlobe 单独绘制
+    r.globeBegin = (int)r.triangles.size();
+    if (!softRaycastGlobe) {
+        softDrawGlobe(r, globe, lightEye, 0);
+    }
+    r.globeEnd = (int)r.triangles.size();
+    if (softRaycastGlobe) ++frameDrawCalls;
+    
+    if (shadowEnabled) {
+        softDrawAmbientOcclusion(r, frameMatrices.contact);
+    }
+}
+
+// 三角形按包围盒分配到屏幕分块
+void softBinTriangles(SoftRenderer& r) {
+    for (size_t i = 0; i < r.bins.size(); ++i) r.bins[i].clear();
+    
+    for (size_t i = 0; i < r.triangles.size(); ++i) {
+        const SoftTriangle& tri = r.triangles[i];
+        int tx0 = tri.minX / SOFT_TILE_SIZE, tx1 = tri.maxX / SOFT_TILE_SIZE;
+        int ty0 = tri.minY / SOFT_TILE_SIZE, ty1 = tri.maxY / SOFT_TILE_SIZE;
+        for (int ty = ty0; ty <= ty1; ++ty) {
+            for (int tx = tx0; tx <= tx1; ++tx) {
+                r.bins[ty * r.tilesX + tx].push_back((int)i);
+            }
+        }
+    }
+}
+
+// 双线性纹理采样，结果为 0..1 的 RGBA
+void softSampleTexture(const SoftTexture& tex, float s, float t, float out[4]) {
+    float u = s * tex.width - 0.5f;
+    float v = t * tex.height - 0.5f;
+    int x0 = (int)floor(u), y0 = (int)floor(v);
+    float fx = u - x0, fy = v - y0;
+    
+    int xs[2] = {x0, x0 + 1};
+    int ys[2] = {y0, y0 + 1};
+    for (int i = 0; i < 2; ++i) {
+        if (tex.repeat) {
+            xs[i] = ((xs[i] % tex.width) + tex.width) % tex.width;
+            ys[i] = ((ys[i] % tex.height) + tex.height) % tex.height;
+        } else {
+            xs[i] = min(max(xs[i], 0), tex.width - 1);
+            ys[i] = min(max(ys[i], 0), tex.height - 1);
+        }
+    }
+    
+    const unsigned char* p00 = tex.pixels + (ys[0] * tex.width + xs[0]) * tex.channels;
+    const unsigned char* p10 = tex.pixels + (ys[0] * tex.width + xs[1]) * tex.channels;
+    const unsigned char* p01 = tex.pixels + (ys[1] * tex.width + xs[0]) * tex.channels;
+    const unsigned char* p11 = tex.pixels + (ys[1] * tex.width + xs[1]) * tex.channels;
+    for (int c = 0; c < 4; ++c) {
+        if (c >= tex.channels) {
+            out[c] = 1.0f;
+            continue;
+        }
+        float top = p00[c] + (p10[c] - p00[c]) * fx;
+        float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+        out[c] = (top + (bottom - top) * fy) / 255.0f;
+    }
+}
+
+// 光栅化一个分块中序号位于 [first, last) 的三角形
+void softRasterTile(SoftRenderer& r, int tile, int first, int last, bool clear) {
+    int tileX0 = (tile % r.tilesX) * SOFT_TILE_SIZE;
+    int tileY0 = (tile / r.tilesX) * SOFT_TILE_SIZE;
+    int tileX1 = min(tileX0 + SOFT_TILE_SIZE, r.width) - 1;
+    int tileY1 = min(tileY0 + SOFT_TILE_SIZE, r.height) - 1;
+    
+    // 清屏（与 glClearColor(0, 0, 0.1, 1) 一致）
+    const unsigned char clearColor[4] = {0, 0, 26, 255};
+    for (int y = tileY0; clear && y <= tileY1; ++y) {
+        for (int x = tileX0; x <= tileX1; ++x) {
+            memcpy(&r.color[(y * r.pitch + x) * 4], clearColor, 4);
+            r.depth[y * r.pitch + x] = 1.0f;
+        }
+    }
+    
+    const F4 laneOffset = f4Set(0.5f, 1.5f, 2.5f, 3.5f);
+    const F4 zero = f4Set1(0.0f);
+    const vector<int>& bin = r.bins[tile];
+    
+    for (size_t b = 0; b < bin.size(); ++b) {
+        if (bin[b] < first) continue;
+        if (bin[b] >= last) break;
+        const SoftTriangle& tri = r.triangles[bin[b]];
+        int x0 = max(tri.minX, tileX0) & ~3; // 对齐到4，分块宽度是4的倍数，不会越界到相邻分块
+        int x1 = min(tri.maxX, tileX1);
+        int y0 = max(tri.minY, tileY0);
+        int y1 = min(tri.maxY, tileY1);
+        if (x0 > x1 || y0 > y1) continue;
+        
+        const SoftTexture* tex = tri.texture >= 0 ? &r.textures[tri.texture] : NULL;
+        F4 a[3], zPlane[3];
+        for (int i = 0; i < 3; ++i) {
+            a[i] = f4Set1(tri.edgeA[i]);
+            zPlane[i] = f4Set1(tri.z[i]);
+        }
+        float invArea = 1.0f / (tri.edgeC[0] + tri.edgeC[1] + tri.edgeC[2]);
+        F4 invAreaV = f4Set1(invArea);
+        
+        for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            float* depthRow = &r.depth[y * r.pitch];
+            unsigned char* colorRow = &r.color[y * r.pitch * 4];
+            
+            for (int x = x0; x <= x1; x += 4) {
+                F4 px = f4Add(f4Set1((float)x), laneOffset);
+                F4 w[3];
+                F4 inside = f4CmpGE(zero, zero);
+                for (int i = 0; i < 3; ++i) {
+                    w[i] = f4Add(f4Mul(a[i], px), f4Set1(tri.edgeB[i] * py + tri.edgeC[i]));
+                    inside = f4And(inside, tri.topLeft[i] ? f4CmpGE(w[i], zero) : f4CmpGT(w[i], zero));
+                }
+                int mask = f4Mask(inside);
+                if (x1 - x < 3) mask &= (1 << (x1 - x + 1)) - 1;
+                if (!mask) continue;
+                
+                // 屏幕空间线性插值深度并做深度测试（GL_LESS）
+                F4 z = f4Mul(f4Add(f4Add(f4Mul(w[0], zPlane[0]), f4Mul(w[1], zPlane[1])),
+                                   f4Mul(w[2], zPlane[2])), invAreaV);
+                mask &= f4Mask(f4CmpLT(z, f4Load(depthRow + x)));
+                if (!mask) continue;
+                
+                float wv[3][4], zv[4];
+                for (int i = 0; i < 3; ++i) f4Store(wv[i], w[i]);
+                f4Store(zv, z);
+                
+                for (int lane = 0; lane < 4; ++lane) {
+                    if (!(mask & (1 << lane))) continue;
+                    
+                    float b0 = wv[0][lane] * tri.invW[0];
+                    float b1 = wv[1][lane] * tri.invW[1];
+                    float b2 = wv[2][lane] * tri.invW[2];
+                    float norm = 1.0f / (b0 + b1 + b2);
+                    float attr[6];
+                    for (int k = 0; k < 6; ++k) {
+                        attr[k] = (wv[0][lane] * tri.attr[0][k] + wv[1][lane] * tri.attr[1][k] +
+                                   wv[2][lane] * tri.attr[2][k]) * norm;
+                    }
+                    
+                    float color[4] = {attr[0], attr[1], attr[2], attr[3]};
+                    if (tex) {
+                        float texel[4];
+                        softSampleTexture(*tex, attr[4], attr[5], texel);
+                        for (int c = 0; c < 4; ++c) color[c] *= texel[c]; // GL_MODULATE
+                    }
+                    
+                    unsigned char* dst = colorRow + (x + lane) * 4;
+                    if (tri.blend) {
+                        float alpha = min(max(color[3], 0.0f), 1.0f);
+                        for (int c = 0; c < 4; ++c) {
+                            color[c] = color[c] * alpha + dst[c] / 255.0f * (1.0f - alpha);
+                        }
+                    }
+                    for (int c = 0; c < 4; ++c) {
+                        dst[c] = (unsigned char)(min(max(color[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+                    }
+                    if (tri.depthWrite) depthRow[x + lane] = zv[lane];
+                }
+            }
+        }
+    }
+}
+
+// ========================
+// 逐像素光线-球体求交绘制地球
+// ========================
+// 地球是一个精确的球体：每个像素的视线与球求交，由交点换算经纬度直接查纹理，
+// 轮廓完全圆滑、无三角化误差。按扫描线并行，每次用 SIMD 处理4个像素的求交与深度测试，
+// 纹理由光线微分计算的足迹选择 mip 层级（三线性过滤），经线接缝处没有有限差分的跳变
+
+struct SoftMipChain {
+    const unsigned char* source; // 生成时的源像素，用于判断是否需要重建
+    int sourceWidth, sourceHeight;
+    vector<vector<unsigned char> > levels;
+    vector<SoftTexture> textures;
+};
+
+SoftMipChain earthMipChain;
+
+// 为地球纹理生成 2x2 盒式滤波的 mip 链
+void softBuildEarthMips(SoftMipChain& chain) {
+    if (chain.source == earthPixels.data() && chain.sourceWidth == earthTexWidth &&
+        chain.sourceHeight == earthTexHeight && !chain.textures.empty()) {
+        return;
+    }
+    chain.source = earthPixels.data();
+    chain.sourceWidth = earthTexWidth;
+    chain.sourceHeight = earthTexHeight;
+    chain.levels.clear();
+    chain.levels.push_back(earthPixels);
+    
+    vector<int> widths(1, earthTexWidth), heights(1, earthTexHeight);
+    while (widths.back() > 1 || heights.back() > 1) {
+        int sw = widths.back(), sh = heights.back();
+        int dw = max(sw / 2, 1), dh = max(sh / 2, 1);
+        const vector<unsigned char>& src = chain.levels.back();
+        vector<unsigned char> dst(dw * dh * 3);
+        for (int y = 0; y < dh; ++y) {
+            int y0 = min(y * 2, sh - 1), y1 = min(y * 2 + 1, sh - 1);
+            for (int x = 0; x < dw; ++x) {
+                int x0 = min(x * 2, sw - 1), x1 = min(x * 2 + 1, sw - 1);
+                for (int c = 0; c < 3; ++c) {
+                    int sum = src[(y0 * sw + x0) * 3 + c] + src[(y0 * sw + x1) * 3 + c] +
+                              src[(y1 * sw + x0) * 3 + c] + src[(y1 * sw + x1) * 3 + c];
+                    dst[(y * dw + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        chain.levels.push_back(dst);
+        widths.push_back(dw);
+        heights.push_back(dh);
+    }
+    
+    chain.textures.clear();
+    for (size_t i = 0; i < chain.levels.size(); ++i) {
+        SoftTexture tex = {chain.levels[i].data(), widths[i], heights[i], 3, true};
+        chain.textures.push_back(tex);
+    }
+}
+
+// 三线性采样，footprint 为一个像素在基础层上覆盖的纹素数
+void softSampleMipmapped(const SoftMipChain& chain, float s, float t, float footprint, float out[4]) {
+    float lod = footprint > 1.0f ? log2(footprint) : 0.0f;
+    int maxLevel = (int)chain.textures.size() - 1;
+    if (lod >= maxLevel) {
+        softSampleTexture(chain.textures[maxLevel], s, t, out);
+        return;
+    }
+    int level = (int)lod;
+    float frac = lod - level;
+    softSampleTexture(chain.textures[level], s, t, out);
+    if (frac > 0.0f) {
+        float next[4];
+        softSampleTexture(chain.textures[level + 1], s, t, next);
+        for (int c = 0; c < 4; ++c) out[c] += (next[c] - out[c]) * frac;
+    }
+}
+
+// 与 generateSphere 相同的参数化：u 对应 theta = atan2(z, x)，v 对应 phi = acos(y)
+void sphereDirectionToUV(const float o[3], float& u, float& v) {
+    u = atan2(o[2], o[0]) / (2.0f * (float)M_PI);
+    if (u < 0.0f) u += 1.0f;
+    v = acos(min(max(o[1], -1.0f), 1.0f)) / (float)M_PI;
+}
+
+void softRaycastGlobeRows(SoftRenderer& r, int threads) {
+    softBuildEarthMips(earthMipChain);
+    
+    const Mat4& mv = r.globeMatrix;
+    const float* p = r.projection.m;
+    
+    // 视空间中球心和半径；旋转部分的转置把视空间方向变回物体空间
+    float center[3] = {mv.m[12], mv.m[13], mv.m[14]};
+    float radius = sqrt(mv.m[0]*mv.m[0] + mv.m[1]*mv.m[1] + mv.m[2]*mv.m[2]);
+    if (radius <= 0.0f) return;
+    float objectFromEye[9];
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 3; ++col) {
+            objectFromEye[row * 3 + col] = mv.m[row * 4 + col] / radius;
+        }
+    }
+    
+    // 像素 (x, y) 的视线方向为 (ndcX / P00, ndcY / P11, -1)
+    float dirScaleX = 2.0f / (r.width * p[0]);
+    float dirScaleY = 2.0f / (r.height * p[5]);
+    float cc = center[0]*center[0] + center[1]*center[1] + center[2]*center[2];
+    
+    // 屏幕上的包围范围：由视点到球的切锥估计，球包含视点时覆盖全屏
+    int rowMin = 0, rowMax = r.height - 1, colMin = 0, colMax = r.width - 1;
+    if (cc > radius * radius && -center[2] > radius) {
+        float dist = sqrt(cc);
+        float sinAngle = radius / dist;
+        float spread = sinAngle / sqrt(1.0f - sinAngle * sinAngle) * dist / (-center[2]) * 1.5f + 0.05f;
+        float cx = center[0] / -center[2], cy = center[1] / -center[2];
+        colMin = max(0, (int)floor(((cx - spread) * p[0] * 0.5f + 0.5f) * r.width) - 1);
+        colMax = min(r.width - 1, (int)ceil(((cx + spread) * p[0] * 0.5f + 0.5f) * r.width) + 1);
+        rowMin = max(0, (int)floor(((cy - spread) * p[5] * 0.5f + 0.5f) * r.height) - 1);
+        rowMax = min(r.height - 1, (int)ceil(((cy + spread) * p[5] * 0.5f + 0.5f) * r.height) + 1);
+    }
+    if (colMin > colMax || rowMin > rowMax) return;
+    colMin &= ~3;
+    
+    const F4 laneOffset = f4Set(0.5f, 1.5f, 2.5f, 3.5f);
+    const F4 zero = f4Set1(0.0f), one = f4Set1(1.0f), half = f4Set1(0.5f);
+    const F4 cx = f4Set1(center[0]), cy = f4Set1(center[1]), cz = f4Set1(center[2]);
+    const F4 radiusV = f4Set1(radius), ccV = f4Set1(cc);
+    // 一个像素在单位距离处对应的视空间宽度，用于估算轮廓覆盖率
+    const F4 pixelAngle = f4Set1(dirScaleY);
+    const float texW = (float)earthTexWidth, texH = (float)earthTexHeight;
+    
+    parallelFor(rowMax - rowMin + 1, threads, [&](int item, int) {
+        int y = rowMin + item;
+        float* depthRow = &r.depth[y * r.pitch];
+        unsigned char* colorRow = &r.color[y * r.pitch * 4];
+        F4 dy = f4Set1(((y + 0.5f) * 2.0f / r.height - 1.0f) / p[5]);
+        
+        for (int x = colMin; x <= colMax; x += 4) {
+            F4 dx = f4Mul(f4Sub(f4Mul(f4Add(f4Set1((float)x), laneOffset), f4Set1(2.0f / r.width)), one),
+                          f4Set1(1.0f / p[0]));
+            // 光线 o + t*d（o 为视点原点，dz = -1）
+            F4 a = f4Add(f4Add(f4Mul(dx, dx), f4Mul(dy, dy)), one);
+            F4 b = f4Sub(f4Add(f4Mul(dx, cx), f4Mul(dy, cy)), cz);
+            F4 tClosest = f4Div(b, a);
+            F4 perp2 = f4Max(f4Sub(ccV, f4Mul(b, tClosest)), zero);
+            F4 perp = f4Sqrt(perp2);
+            F4 disc = f4Max(f4Sub(f4Mul(radiusV, radiusV), perp2), zero);
+            
+            // 轮廓覆盖率：按光线到球心的距离与像素尺寸之比做解析抗锯齿
+            F4 pixelSize = f4Mul(f4Mul(tClosest, f4Sqrt(a)), pixelAngle);
+            F4 coverage = f4Min(f4Max(f4Add(half, f4Div(f4Sub(radiusV, perp), pixelSize)), zero), one);
+            
+            F4 t = f4Div(f4Sub(b, f4Sqrt(f4Mul(disc, a))), a);
+            F4 hitZ = f4Sub(zero, t);
+            // 视空间深度换算到窗口深度：ndcZ = (P10 * z + P14) / -z
+            F4 depth = f4Add(f4Mul(f4Div(f4Add(f4Mul(f4Set1(p[10]), hitZ), f4Set1(p[14])), t), half), half);
+            
+            int mask = f4Mask(f4And(f4CmpGT(coverage, zero), f4CmpGT(t, zero)));
+            mask &= f4Mask(f4CmpLT(depth, f4Load(depthRow + x)));
+            if (x + 3 > colMax) mask &= (1 << (colMax - x + 1)) - 1;
+            if (!mask) continue;
+            
+            // 交点、法线、物体空间方向、纹理层级和光照4路一起算，只有纹理采样和混合逐像素进行
+            F4 d[3] = {dx, dy, f4Set1(-1.0f)};
+            F4 hit[3] = {f4Mul(dx, t), f4Mul(dy, t), hitZ};
+            F4 n[3] = {f4Sub(hit[0], cx), f4Sub(hit[1], cy), f4Sub(hit[2], cz)};
+            F4 nl = f4Sqrt(f4Add(f4Add(f4Mul(n[0], n[0]), f4Mul(n[1], n[1])), f4Mul(n[2], n[2])));
+            for (int k = 0; k < 3; ++k) n[k] = f4Div(n[k], nl);
+            F4 o[3];
+            for (int k = 0; k < 3; ++k) {
+                o[k] = f4Add(f4Add(f4Mul(f4Set1(objectFromEye[k * 3]), n[0]), f4Mul(f4Set1(objectFromEye[k * 3 + 1]), n[1])),
+                             f4Mul(f4Set1(objectFromEye[k * 3 + 2]), n[2]));
+            }
+            
+            // 光线微分：相邻像素的视线变化 dd/dx = (dirScaleX, 0, 0)、dd/dy = (0, dirScaleY, 0)
+            // 交点变化 dp = t*dd + dt*d，其中 dt = -t*(dd·n)/(d·n)
+            // 两极附近经线方向的纹素被强烈压缩，按最大各向异性 8 限制该方向对层级的影响，
+            // 避免各向同性选层把纬线方向也一起模糊
+            F4 dDotN = f4Sub(f4Add(f4Mul(dx, n[0]), f4Mul(dy, n[1])), n[2]);
+            F4 rxz = f4Max(f4Add(f4Mul(o[0], o[0]), f4Mul(o[2], o[2])), f4Set1(1e-6f));
+            F4 uScale = f4Div(f4Set1(texW / (2.0f * (float)M_PI)), rxz);
+            F4 vScale = f4Div(f4Set1(-texH / (float)M_PI), f4Sqrt(rxz));
+            F4 rhoU = zero, rhoV = zero;
+            for (int axis = 0; axis < 2; ++axis) {
+                F4 scale = f4Set1(axis == 0 ? dirScaleX : dirScaleY);
+                F4 dt = f4Div(f4Mul(f4Sub(zero, t), f4Mul(scale, n[axis])), dDotN);
+                F4 dp[3], dobj[3];
+                for (int k = 0; k < 3; ++k) {
+                    F4 along = k == axis ? f4Mul(t, scale) : zero;
+                    dp[k] = f4Mul(f4Add(along, f4Mul(dt, d[k])), f4Set1(1.0f / radius));
+                }
+                for (int k = 0; k < 3; ++k) {
+                    dobj[k] = f4Add(f4Add(f4Mul(f4Set1(objectFromEye[k * 3]), dp[0]),
+                                          f4Mul(f4Set1(objectFromEye[k * 3 + 1]), dp[1])),
+                                    f4Mul(f4Set1(objectFromEye[k * 3 + 2]), dp[2]));
+                }
+                F4 du = f4Mul(f4Sub(f4Mul(o[0], dobj[2]), f4Mul(o[2], dobj[0])), uScale);
+                F4 dv = f4Mul(dobj[1], vScale);
+                rhoU = f4Max(rhoU, f4Max(du, f4Sub(zero, du)));
+                rhoV = f4Max(rhoV, f4Max(dv, f4Sub(zero, dv)));
+            }
+            const F4 maxAnisotropy = f4Set1(1.0f / 8.0f);
+            F4 footprint = f4Max(f4Min(rhoU, rhoV), f4Mul(f4Max(rhoU, rhoV), maxAnisotropy));
+            footprint = f4Select(f4CmpLT(dDotN, f4Set1(-1e-4f)), footprint, f4Set1(max(texW, texH))); // 掠射角处退化为最粗层级
+            
+            F4 color[3] = {one, one, one};
+            if (lightEnabled) {
+                // 与网格路径一致：未开启 GL_NORMALIZE 时法线长度为 1/zoom
+                F4 scaled[3];
+                for (int k = 0; k < 3; ++k) scaled[k] = f4Div(n[k], radiusV);
+                softLightEye4(hit, scaled, r.lightEye, color);
+            }
+            
+            float ov[3][4], rv[3][4], fv[4], cov[4], dv[4];
+            for (int k = 0; k < 3; ++k) {
+                f4Store(ov[k], o[k]);
+                f4Store(rv[k], color[k]);
+            }
+            f4Store(fv, footprint);
+            f4Store(cov, coverage);
+            f4Store(dv, depth);
+            
+            for (int lane = 0; lane < 4; ++lane) {
+                if (!(mask & (1 << lane))) continue;
+                
+                float dir[3] = {ov[0][lane], ov[1][lane], ov[2][lane]};
+                float u, v;
+                sphereDirectionToUV(dir, u, v);
+                float texel[4];
+                softSampleMipmapped(earthMipChain, u, v, fv[lane], texel);
+                
+                unsigned char* dst = colorRow + (x + lane) * 4;
+                float alpha = cov[lane];
+                for (int c = 0; c < 3; ++c) {
+                    float value = rv[c][lane] * texel[c] * alpha + dst[c] / 255.0f * (1.0f - alpha);
+                    dst[c] = (unsigned char)(min(max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+                }
+                if (alpha >= 0.5f) depthRow[x + lane] = dv[lane];
+            }
+        }
+    });
+}
+
+// 用CPU渲染一帧到 softRenderer
+void softRenderScene(SoftRenderer& r, int threads) {
+    softResize(r, WIDTH, HEIGHT);
+    softBuildScene(r);
+    softBinTriangles(r);
+    
+    // 地球之前的三角形（地面、阴影）-> 地球 -> 地球之后的三角形（接触阴影），保持绘制顺序
+    int total = (int)r.triangles.size();
+    parallelFor(r.tilesX * r.tilesY, threads, [&r, total](int tile, int) {
+        softRasterTile(r, tile, 0, softRaycastGlobe ? r.globeBegin : total, true);
+    });
+    if (softRaycastGlobe) {
+        softRaycastGlobeRows(r, threads);
+        parallelFor(r.tilesX * r.tilesY, threads, [&r, total](int tile, int) {
+            softRasterTile(r, tile, r.globeEnd, total, false);
+        });
+    }
+}
+
+// 转换为 BMP 像素布局（BGR，自下而上，行4字节对齐）
+void softReadBGR(const SoftRenderer& r, vector<unsigned char>& out) {
+    int rowSize = (r.width * 3 + 3) & ~3;
+    out.assign(rowSize * r.height, 0);
+    for (int y = 0; y < r.height; ++y) {
+        const unsigned char* src = &r.color[y * r.pitch * 4];
+        unsigned char* dst = &out[y * rowSize];
+        for (int x = 0; x < r.width; ++x) {
+            dst[x * 3] = src[x * 4 + 2];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4];
+        }
+    }
+}
+
+// ========================
+// 基准测试工具
+// ========================
+// 各个 --xxx-bench 共用：预热一帧后计时，以及按列对齐输出的结果表。
+// 离屏上下文的建立与清理见 runHeadlessBenchmark（在离屏渲染一节之后）
+
+struct BenchTimer {
+    static double elapsedMs(chrono::steady_clock::time_point start) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    
+    // 先以 frame = -1 调用一次用于预热（编译着色器、烘焙、上传等一次性开销），不计时；
+    // 再依次调用 frame = 0 .. frames-1，返回平均 ms/帧。需要等GPU画完时由 frame 自己调用 glFinish
+    static double perFrame(int frames, const function<void(int)>& frame) {
+        frame(-1);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int f = 0; f < frames; ++f) frame(f);
+        return elapsedMs(start) / max(frames, 1);
+    }
+    
+    // 运行 runs 次，返回最快一次的耗时（ms），用于纯CPU的批处理
+    static double best(int runs, const function<void()>& body) {
+        double fastest = 1e30;
+        for (int run = 0; run < runs; ++run) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            body();
+            fastest = min(fastest, elapsedMs(start));
+        }
+        return fastest;
+    }
+};
+
+// 终端中的显示宽度：U+1000 以上的字符（汉字、全角符号）按两格计
+int displayWidth(const string& text) {
+    int width = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if ((c & 0xC0) == 0x80) continue; // UTF-8 续字节
+        width += c >= 0xE1 ? 2 : 1;
+    }
+    return width;
+}
+
+// 基准结果表：列宽取标题宽度和指定的最小宽度中较大的一个，数值列右对齐、文字列（left）左对齐，
+// 列前空两格。按列的顺序追加单元格，凑满一行时输出
+class BenchTable {
+public:
+    BenchTable() : filled(0) {}
+    
+    BenchTable& column(const string& title, int width = 0, bool left = false) {
+        titles.push_back(title);
+        widths.push_back(max(width, displayWidth(title)));
+        leftAligned.push_back(left);
+        return *this;
+    }
+    
+    void printHeader() const {
+        string line;
+        for (size_t i = 0; i < titles.size(); ++i) line += pad(titles[i], i);
+        printf("%s\n", line.c_str());
+    }
+    
+    // printf 格式的单元格
+    BenchTable& cell(const char* format, ...) {
+        char text[128];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        row += pad(text, filled);
+        if (++filled == widths.size()) {
+            printf("%s\n", row.c_str());
+            row.clear();
+            filled = 0;
+        }
+        return *this;
+    }
+    
+private:
+    string pad(const string& text, size_t column) const {
+        string spaces(max(widths[column] - displayWidth(text), 0), ' ');
+        return "  " + (leftAligned[column] ? text + spaces : spaces + text);
+    }
+    
+    vector<string> titles;
+    vector<int> widths;
+    vector<bool> leftAligned;
+    string row;
+    size_t filled;
+};
+
+// 按不同线程数测量软件渲染帧率
+int runSoftwareBenchmark(int frames) {
+    loadEarthImage();
+    buildSoftShadowPixels();
+    rotationX = 20.0f;
+    rotationY = 30.0f;
+    
+    int maxThreads = defaultThreadCount();
+    cout << "软件渲染基准: " << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧" << endl;
+    BenchTable table;
+    table.column("线程数").column("帧时间(ms)").column("FPS", 8).column("每核FPS");
+    table.printHeader();
+    
+    vector<int> counts;
+    for (int t = 1; t < maxThreads; t *= 2) counts.push_back(t);
+    counts.push_back(maxThreads);
+    
+    for (size_t i = 0; i < counts.size(); ++i) {
+        int threads = counts[i];
+        double frameMs = BenchTimer::perFrame(frames, [&](int f) {
+            if (f >= 0) rotationY += 1.0f;
+            softRenderScene(softRenderer, threads);
+        });
+        double fps = 1000.0 / frameMs;
+        table.cell("%d", threads).cell("%.2f", frameMs).cell("%.1f", fps).cell("%.1f", fps / threads);
+    }
+    return 0;
+}
+
+// ========================
+// CPU渲染窗口模式
+// ========================
+// --soft 不带 --headless 时打开窗口，由独立的渲染线程运行CPU光栅化：渲染线程每次取最新的
+// 视图快照渲染一帧，完成的画面再经第二个三缓冲交给主线程用 glDrawPixels 显示。
+// GLUT 的GL上下文只能留在主线程，因此主线程只负责输入和显示，渲染再慢也不会阻塞输入
+
+struct SoftFrame {
+    vector<unsigned char> pixels;   // RGBA，第0行为画面底部，每行 width 个像素
+    int width, height;
+    unsigned long long sequence;    // 渲染所用视图快照的发布序号
+    long long renderUs;
+    int drawCalls;
+    unsigned int events;            // 渲染这一帧之前发生的事件（如纹理重载）
+    HudStats hud;                   // 渲染线程出帧时的叠加层统计
+    
+    SoftFrame() : width(0), height(0), sequence(0), renderUs(0), drawCalls(0), events(0), hud() {}
+};
+
+TripleBuffer<SoftFrame> softFrames; // 渲染线程 -> 主线程
+atomic<bool> softRenderStop(false);
+thread* softRenderThread = NULL;
+
+void softRenderLoop() {
+    int threads = renderThreads > 0 ? renderThreads : defaultThreadCount();
+    bool rendered = false;
+    unsigned int events = 0;
+    
+    while (!softRenderStop.load()) {
+        bool changed = viewBuffer.update();
+        if (changed) {
+            applyViewState(viewBuffer.readBuffer());
+        }
+        if (takeReloadedTexture()) {
+            events |= EVENT_RELOAD;
+            changed = true;
+        }
+        if (rendered && !changed) {
+            // 画面没有变化时休眠；发布方通知时不持锁，用超时兜底避免错过唤醒
+            unique_lock<mutex> lock(renderWakeMutex);
+            renderWake.wait_for(lock, chrono::milliseconds(10));
+            continue;
+        }
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        softRenderScene(softRenderer, threads);
+        
+        SoftFrame& frame = softFrames.writeBuffer();
+        frame.width = softRenderer.width;
+        frame.height = softRenderer.height;
+        frame.pixels.resize((size_t)frame.width * frame.height * 4);
+        for (int y = 0; y < frame.height; ++y) {
+            memcpy(&frame.pixels[(size_t)y * frame.width * 4], &softRenderer.color[(size_t)y * softRenderer.pitch * 4],
+                   frame.width * 4);
+        }
+        frame.sequence = viewBuffer.readBuffer().sequence;
+        frame.renderUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        frame.drawCalls = frameDrawCalls;
+        frame.events = events;
+        frame.hud = collectHudStats();
+        softFrames.publish();
+        
+        events = 0;
+        rendered = true;
+    }
+}
+
+void startSoftRenderThread() {
+    softRenderThreadRunning = true;
+    softRenderThread = new thread(softRenderLoop);
+}
+
+// 退出前停止渲染线程，避免它在全局对象析构后继续访问
+void stopSoftRenderThread() {
+    if (!softRenderThread) return;
+    softRenderStop.store(true);
+    renderWake.notify_one();
+    softRenderThread->join();
+    delete softRenderThread;
+    softRenderThread = NULL;
+}
+
+// 主线程：显示渲染线程交来的最新画面（窗口重绘时复用上一帧）
+void softDisplay() {
+    bool fresh = softFrames.update();
+    const SoftFrame& frame = softFrames.readBuffer();
+    
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (frame.width > 0) {
+        glPushAttrib(GL_ENABLE_BIT);
+        glDisable(GL_LIGHTING);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_TEXTURE_2D);
+        glDisable(GL_BLEND);
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        glRasterPos2f(-1.0f, -1.0f);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glDrawPixels(frame.width, frame.height, GL_RGBA, GL_UNSIGNED_BYTE, frame.pixels.data());
+        glPopAttrib();
+        
+        if (!pendingCaptures.empty()) {
+            serviceControlCaptures(frame.sequence, frame.width, frame.height, frame.pixels.data());
+        }
+        if (hudEnabled) {
+            drawHud(frame.width, frame.height, frame.drawCalls, frame.hud);
+        }
+    }
+    glutSwapBuffers();
+    
+    if (fresh) {
+        if (frame.events) frameStats.noteEvent(frame.events);
+        frameStats.recordFrame(frame.renderUs);
+        recordPresentedInput(frame.sequence);
+        publishControlMetrics(frame.drawCalls);
+        frameRecorder.captureRGBA(frame.pixels.data(), frame.width, frame.height);
+    }
+}
+
+// 渲染线程不能调用 GLUT，主线程定时检查是否有新画面
+void softPresentTimer(int) {
+    if (softFrames.hasFresh()) {
+        glutPostRedisplay();
+    }
+    glutTimerFunc(2, softPresentTimer, 0);
+}
+
+// ========================
+// 无窗口（离屏）批量渲染
+// ========================
+
+// 一个离屏视图的渲染参数
+struct HeadlessView : ViewState {
+    string output;
+};
+
+HeadlessView currentHeadlessView() {
+    HeadlessView view;
+    static_cast<ViewState&>(view) = captureViewState();
+    return view;
+}
+
+// 解析一行视图描述，格式为若干 key=value：
+//   out=view.bmp rx=20 ry=45 zoom=1.2 cam=0,1,5 light=3 lighting=1 shadow=1 intensity=0.6 impostor=0 lights=0 atmosphere=0 realsun=0 clouds=0 markers=0 borders=0 routes=0 field=0 time=0 heatmap=0 labels=0
+bool parseHeadlessView(const string& line, HeadlessView& view) {
+    view = currentHeadlessView();
+    
+    istringstream tokens(line);
+    string token;
+    while (tokens >> token) {
+        size_t eq = token.find('=');
+        if (eq == string::npos) {
+            cerr << "错误: 无法解析参数 " << token << endl;
+            return false;
+        }
+        string key = token.substr(0, eq);
+        string value = token.substr(eq + 1);
+        
+        if (key == "out") view.output = value;
+        else if (key == "rx") view.rotationX = (float)atof(value.c_str());
+        else if (key == "ry") view.rotationY = (float)atof(value.c_str());
+        else if (key == "zoom") view.zoom = (float)atof(value.c_str());
+        else if (key == "light") view.light = atoi(value.c_str());
+        else if (key == "lighting") view.lightEnabled = atoi(value.c_str()) != 0;
+        else if (key == "shadow") view.shadowEnabled = atoi(value.c_str()) != 0;
+        else if (key == "intensity") view.shadowIntensity = (float)atof(value.c_str());
+        else if (key == "impostor") view.globeImpostor = atoi(value.c_str()) != 0;
+        else if (key == "lights") view.pointLights = max(0, atoi(value.c_str()));
+        else if (key == "realsun") view.realSun = atoi(value.c_str()) != 0;
+        else if (key == "time") view.fieldTime = (float)atof(value.c_str());
+        else if (const LayerToggle* layer = findLayerToggle(key)) view.*layer->view = atoi(value.c_str()) != 0;
+        else if (key == "cam") {
+            if (sscanf(value.c_str(), "%f,%f,%f", &view.cameraX, &view.cameraY, &view.cameraZ) != 3) {
+                cerr << "错误: cam 参数格式应为 x,y,z" << endl;
+                return false;
+            }
+        } else {
+            cerr << "错误: 未知参数 " << key << endl;
+            return false;
+        }
+    }
+    
+    if (view.light < 0 || view.light >= (int)lightPositions.size()) {
+        cerr << "错误: 光源位置索引超出范围: " << view.light << endl;
+        return false;
+    }
+    if (view.shadowIntensity < 0.1f) view.shadowIntensity = 0.1f;
+    if (view.shadowIntensity > 1.0f) view.shadowIntensity = 1.0f;
+    return true;
+}
+
+// 读取视图列表文件，每行一个视图，# 开头为注释
+bool loadHeadlessViews(const char* filename, vector<HeadlessView>& views) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "错误: 无法打开视图列表 " << filename << endl;
+        return false;
+    }
+    
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos || line[start] == '#') continue;
+        
+        HeadlessView view;
+        if (!parseHeadlessView(line, view)) {
+            cerr << "  位于 " << filename << " 第 " << lineNumber << " 行" << endl;
+            return false;
+        }
+        if (view.output.empty()) {
+            ostringstream name;
+            name << "view_" << views.size() << ".bmp";
+            view.output = name.str();
+        }
+        views.push_back(view);
+    }
+    return true;
+}
+
+
+#ifdef GLOBE_HAS_EGL
+
+struct HeadlessContext {
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+    GLuint fbo;
+    GLuint colorBuffer;
+    GLuint depthBuffer;
+};
+
+// 创建 EGL 离屏上下文（优先 Mesa surfaceless，可在无显示、无GPU的服务器上用 llvmpipe 运行），
+// 并绑定一个 WIDTH x HEIGHT 的帧缓冲对象
+bool createHeadlessContext(HeadlessContext& ctx) {
+    ctx.display = EGL_NO_DISPLAY;
+    ctx.context = EGL_NO_CONTEXT;
+    ctx.surface = EGL_NO_SURFACE;
+    
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    bool surfaceless = false;
+    if (getPlatformDisplay) {
+        ctx.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        surfaceless = ctx.display != EGL_NO_DISPLAY;
+    }
+    if (!surfaceless) {
+        ctx.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    
+    EGLint major, minor;
+    if (ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, &major, &minor)) {
+        cerr << "错误: EGL 初始化失败" << endl;
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = NULL;
+    EGLint numConfigs = 0;
+    eglChooseConfig(ctx.display, configAttribs, &config, 1, &numConfigs);
+    
+    ctx.context = eglCreateContext(ctx.display, numConfigs > 0 ? config : NULL, EGL_NO_CONTEXT, NULL);
+    if (ctx.context == EGL_NO_CONTEXT) {
+        cerr << "错误: 无法创建 EGL 上下文" << endl;
+        return false;
+    }
+    
+    if (!surfaceless && numConfigs > 0) {
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        ctx.surface = eglCreatePbufferSurface(ctx.display, config, pbufferAttribs);
+    }
+    if (!eglMakeCurrent(ctx.display, ctx.surface, ctx.surface, ctx.context)) {
+        cerr << "错误: 无法激活 EGL 上下文" << endl;
+        return false;
+    }
+    
+    glGenFramebuffers(1, &ctx.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx.fbo);
+    
+    glGenRenderbuffers(1, &ctx.colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx.colorBuffer);
+    
+    glGenRenderbuffers(1, &ctx.depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WIDTH, HEIGHT);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ctx.depthBuffer);
+    
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cerr << "错误: 离屏帧缓冲不完整" << endl;
+        return false;
+    }
+    
+    glViewport(0, 0, WIDTH, HEIGHT);
+    cout << "离屏渲染器: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")" << endl;
+    return true;
+}
+
+void destroyHeadlessContext(HeadlessContext& ctx) {
+    glDeleteRenderbuffers(1, &ctx.colorBuffer);
+    glDeleteRenderbuffers(1, &ctx.depthBuffer);
+    glDeleteFramebuffers(1, &ctx.fbo);
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (ctx.surface != EGL_NO_SURFACE) eglDestroySurface(ctx.display, ctx.surface);
+    eglDestroyContext(ctx.display, ctx.context);
+    eglTerminate(ctx.display);
+}
+
+#endif
+
+// 使用CPU软件光栅化批量渲染视图列表，不需要任何GL环境
+int runHeadlessSoftware(const char* viewsFile) {
+    loadEarthImage();
+    buildSoftShadowPixels();
+    
+    vector<HeadlessView> views;
+    if (!loadHeadlessViews(viewsFile, views)) return 1;
+    int threads = defaultThreadCount();
+    cout << "共 " << views.size() << " 个视图，输出尺寸 " << WIDTH << "x" << HEIGHT
+         << "，软件渲染线程数 " << threads << endl;
+    
+    BoundedQueue<CapturedFrame> queue(4);
+    int failedWrites = 0; // 只在编码线程中修改，join 之后读取
+    thread encoder([&queue, &failedWrites] {
+        CapturedFrame frame;
+        while (queue.pop(frame)) {
+            if (!saveBMPFile(frame.filename.c_str(), frame.pixels.data(), frame.width, frame.height)) {
+                ++failedWrites;
+            }
+        }
+    });
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < views.size(); ++i) {
+        applyViewState(views[i]);
+        softRenderScene(softRenderer, threads);
+        
+        CapturedFrame frame;
+        frame.filename = views[i].output;
+        frame.width = WIDTH;
+        frame.height = HEIGHT;
+        softReadBGR(softRenderer, frame.pixels);
+        queue.push(std::move(frame));
+    }
+    queue.close();
+    encoder.join();
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "✓ 已渲染 " << views.size() << " 个视图，用时 " << seconds << " 秒";
+    if (seconds > 0) cout << "（" << views.size() / seconds << " 视图/秒）";
+    cout << endl;
+    if (failedWrites > 0) {
+        cerr << "错误: " << failedWrites << " 个视图未能写出" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 批量渲染视图列表并写出BMP图片
+// 读回使用两个PBO轮换：第 i 个视图的 glReadPixels 异步进行，同时渲染第 i+1 个视图；
+// 编码写盘在独立线程中完成，二者通过有界队列衔接
+int runHeadless(const char* viewsFile) {
+    if (softwareRenderer) {
+        return runHeadlessSoftware(viewsFile);
+    }
+#ifdef GLOBE_HAS_EGL
+    vector<HeadlessView> views;
+    HeadlessContext ctx;
+    if (!createHeadlessContext(ctx)) return 1;
+    
+    init();
+    initAntialiasing();
+    cloudStream.waitForDecode = true;
+    fieldTimeline.waitForDecode = true;
+    atmosphereWaitForTables = true;
+    
+    // 视图解析依赖当前状态作为默认值，放在初始化之后
+    if (!loadHeadlessViews(viewsFile, views)) {
+        destroyHeadlessContext(ctx);
+        return 1;
+    }
+    cout << "共 " << views.size() << " 个视图，输出尺寸 " << WIDTH << "x" << HEIGHT << endl;
+    
+    BoundedQueue<CapturedFrame> queue(4);
+    int failedWrites = 0; // 只在编码线程中修改，join 之后读取
+    thread encoder([&queue, &failedWrites] {
+        CapturedFrame frame;
+        while (queue.pop(frame)) {
+            if (!saveBMPFile(frame.filename.c_str(), frame.pixels.data(), frame.width, frame.height)) {
+                ++failedWrites;
+            }
+        }
+    });
+    
+    const int rowSize = (WIDTH * 3 + 3) & ~3;
+    const int imageSize = rowSize * HEIGHT;
+    
+    GLuint pbos[2];
+    glGenBuffers(2, pbos);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, imageSize, NULL, GL_STREAM_READ);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    
+    // 将某个PBO中已完成的读回结果交给编码线程，映射失败的视图不写出
+    int failedReadbacks = 0;
+    auto collect = [&](GLuint pbo, const string& filename) {
+        CapturedFrame frame;
+        frame.filename = filename;
+        frame.width = WIDTH;
+        frame.height = HEIGHT;
+        frame.pixels.resize(imageSize);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        const unsigned char* mapped = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (!mapped) {
+            cerr << "错误: 无法读回视图 " << filename << endl;
+            ++failedReadbacks;
+            return;
+        }
+        memcpy(frame.pixels.data(), mapped, imageSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        queue.push(std::move(frame));
+    };
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    
+    for (size_t i = 0; i < views.size(); ++i) {
+        if (i > 0 && (views[i].light != views[i - 1].light || views[i].lightEnabled != views[i - 1].lightEnabled)) {
+            frameStats.noteEvent(EVENT_LIGHT);
+        }
+        if (i > 0 && (views[i].shadowEnabled != views[i - 1].shadowEnabled ||
+                      views[i].shadowIntensity != views[i - 1].shadowIntensity)) {
+            frameStats.noteEvent(EVENT_SHADOW);
+        }
+        // 视图切换（如阴影强度变化时重建阴影纹理）也计入本帧
+        frameStats.beginFrame();
+        applyViewState(views[i]);
+        passProfiler.beginFrame();
+        renderScene();
+        passProfiler.endFrame();
+        
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i % 2]);
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_BGR, GL_UNSIGNED_BYTE, 0);
+        
+        if (i > 0) {
+            collect(pbos[(i - 1) % 2], views[i - 1].output);
+        }
+        frameStats.endFrame();
+    }
+    if (!views.empty()) {
+        collect(pbos[(views.size() - 1) % 2], views.back().output);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    queue.close();
+    encoder.join();
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "✓ 已渲染 " << views.size() << " 个视图，用时 " << seconds << " 秒";
+    if (seconds > 0) cout << "（" << views.size() / seconds << " 视图/秒）";
+    cout << endl;
+    
+    printPassTimings();
+    
+    glDeleteBuffers(2, pbos);
+    if (textureID != 0) glDeleteTextures(1, &textureID);
+    if (shadowTextureID != 0) glDeleteTextures(1, &shadowTextureID);
+    destroyHeadlessContext(ctx);
+    if (failedWrites + failedReadbacks > 0) {
+        cerr << "错误: " << failedWrites + failedReadbacks << " 个视图未能写出" << endl;
+        return 1;
+    }
+    return 0;
+#else
+    (void)viewsFile;
+    cerr << "错误: 当前平台未启用 EGL，无法使用离屏渲染模式" << endl;
+    return 1;
+#endif
+}
+
+// 在离屏上下文中运行基准：建立EGL上下文并初始化场景（antialiasing 为 true 时与窗口模式一样启用抗锯齿），
+// 返回 body 的结果，之后删除地球和阴影纹理并销毁上下文。name 只用于没有EGL时的错误信息
+int runHeadlessBenchmark(const char* name, bool antialiasing, const function<int()>& body) {
+#ifdef GLOBE_HAS_EGL
+    HeadlessContext ctx;
+    if (!createHeadlessContext(ctx)) return 1;
+    init();
+    if (antialiasing) initAntialiasing();
+    int status = body();
+    if (textureID != 0) glDeleteTextures(1, &textureID);
+    if (shadowTextureID != 0) glDeleteTextures(1, &shadowTextureID);
+    textureID = shadowTextureID = 0;
+    destroyHeadlessContext(ctx);
+    return status;
+#else
+    (void)antialiasing;
+    (void)body;
+    cerr << "错误: 当前平台未启用 EGL，无法运行" << name << endl;
+    return 1;
+#endif
+}
+
+// 替身与网格两种地球绘制方式的吞吐对比：
+// 从单个大地球到上万个小地球，按每个地球在屏幕上的直径分组
+int runImpostorBenchmark(int frames) {
+    return runHeadlessBenchmark("替身基准", true, [&]() -> int {
+        if (!ensureImpostorProgram()) return 1;
+        
+        struct Scenario { int diameter; int count; };
+        const Scenario scenarios[] = {{1024, 1}, {256, 1}, {64, 100}, {16, 1000}, {4, 10000}};
+        
+        // 相机距离5、视角45度时每个世界单位对应的像素数
+        float pixelsPerUnit = HEIGHT / (2.0f * cameraZ * tan(22.5f * (float)M_PI / 180.0f));
+        
+        cout << "替身/网格吞吐对比: " << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧" << endl;
+        BenchTable table;
+        table.column("直径(像素)").column("数量", 6).column("网格(ms/帧)").column("替身(ms/帧)").column("加速比");
+        table.printHeader();
+        
+        for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); ++s) {
+            const Scenario& sc = scenarios[s];
+            float radius = sc.diameter * 0.5f / pixelsPerUnit;
+            int columns = (int)ceil(sqrt((float)sc.count));
+            float spacing = radius * 2.2f;
+            
+            vector<float> spheres;
+            for (int i = 0; i < sc.count; ++i) {
+                spheres.push_back(((i % columns) - (columns - 1) * 0.5f) * spacing);
+                spheres.push_back(((i / columns) - (columns - 1) * 0.5f) * spacing);
+                spheres.push_back(0.0f);
+                spheres.push_back(radius);
+            }
+            
+            double ms[2];
+            for (int mode = 0; mode < 2; ++mode) {
+                ms[mode] = BenchTimer::perFrame(frames, [&](int) {
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    updateFrameMatrices();
+                    glMatrixMode(GL_PROJECTION);
+                    glLoadMatrixf(frameMatrices.projection.m);
+                    glMatrixMode(GL_MODELVIEW);
+                    glLoadMatrixf(frameMatrices.view.m);
+                    setCurrentLight();
+                    
+                    if (mode == 0) {
+                        for (int i = 0; i < sc.count; ++i) {
+                            Mat4 local = mat4Multiply(mat4Translate(spheres[i * 4], spheres[i * 4 + 1], spheres[i * 4 + 2]),
+                                                      mat4Scale(radius, radius, radius));
+                            glLoadMatrixf(mat4Multiply(frameMatrices.view, local).m);
+                            drawCustomSphere(1.0f, 36, 18);
+                        }
+                    } else {
+                        drawSphereImpostors(spheres.data(), sc.count);
+                    }
+                    glFinish();
+                });
+            }
+            
+            table.cell("%d", sc.diameter).cell("%d", sc.count).cell("%.3f", ms[0]).cell("%.3f", ms[1]);
+            table.cell("%.2fx", ms[0] / ms[1]);
+        }
+        return 0;
+    });
+}
+
+// 点光源数量扫描：分簇着色与逐片元遍历全部光源的帧时间对比
+int runLightsBenchmark(int frames) {
+    return runHeadlessBenchmark("分簇光照基准", true, [&]() -> int {
+        if (!ensureClusteredPrograms()) return 1;
+        rotationX = 20.0f;
+        
+        const int counts[] = {0, 16, 64, 256, 1024, 4096};
+        cout << "分簇光照基准: " << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧" << endl;
+        BenchTable table;
+        table.column("光源数", 6).column("分簇(ms/帧)").column("全部遍历(ms/帧)").column("分簇耗时(ms)").column("簇内最多");
+        table.printHeader();
+        
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            setPointLightCount(counts[c]);
+            // 全部遍历的开销随光源数线性增长，光源过多时只测分簇
+            double ms[2] = {0.0, -1.0};
+            int modes = counts[c] <= 1024 ? 2 : 1;
+            for (int mode = 0; mode < modes; ++mode) {
+                clusteredForceAllLights = mode == 1;
+                ms[mode] = BenchTimer::perFrame(frames, [](int f) {
+                    rotationY = f * 3.0f;
+                    renderScene();
+                    glFinish();
+                });
+            }
+            table.cell("%d", counts[c]).cell("%.3f", ms[0]);
+            if (ms[1] >= 0) {
+                table.cell("%.3f", ms[1]);
+            } else {
+                table.cell("-");
+            }
+            table.cell("%.3f", clusterGrid.binMs).cell("%d", clusterGrid.maxPerCluster);
+        }
+        clusteredForceAllLights = false;
+        return 0;
+    });
+}
+
+// 对同一段帧序列分别用同步 glTexImage2D 和 PBO 环上传，比较渲染线程每帧的停顿。
+// 每帧都切换到下一帧纹理（相当于纹理帧率等于渲染帧率的最坏情况）
+int runStreamBenchmark(int frames) {
+    if (cloudFramePattern.empty()) {
+        cerr << "错误: --stream-bench 需要用 --clouds 指定帧序列" << endl;
+        return 1;
+    }
+    return runHeadlessBenchmark("流式纹理基准", true, [&]() -> int {
+        rotationX = 20.0f;
+        
+        cout << "流式纹理基准: " << WIDTH << "x" << HEIGHT << "，每种方式 " << frames << " 帧" << endl;
+        BenchTable table;
+        table.column("方式", 8, true).column("停顿p50(ms)").column("停顿p99(ms)").column("停顿最大(ms)");
+        table.column("帧时间(ms)").column("解码(ms)").column("未就绪");
+        table.printHeader();
+        const char* names[2] = {"同步上传", "PBO环"};
+        for (int mode = 0; mode < 2; ++mode) {
+            if (!cloudStream.open(cloudFramePattern, 0.0, mode == 0)) return 1;
+            // 逐帧记录帧时间（不预热：首帧的停顿也是要比较的一部分）
+            FrameHistogram frameTimes;
+            for (int f = 0; f < frames; ++f) {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                rotationY = f * 3.0f;
+                renderScene();
+                glFinish();
+                frameTimes.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+            }
+            const FrameHistogram& stall = cloudStream.stallHistogram();
+            table.cell("%s", names[mode]).cell("%.3f", stall.percentileMs(0.5)).cell("%.3f", stall.percentileMs(0.99));
+            table.cell("%.3f", stall.maxMs()).cell("%.3f", frameTimes.meanMs()).cell("%.3f", cloudStream.meanDecodeMs());
+            table.cell("%lld", cloudStream.lateFrames());
+            cloudStream.close();
+        }
+        return 0;
+    });
+}
+
+// 数据场时间轴：顺序播放、快速拖动和随机跳转三种游标轨迹下，预取纹理环与在渲染线程中
+// 同步读取、量化并上传的每帧停顿对比（需要 --field）
+int runFieldBenchmark(int steps) {
+    if (fieldPath.empty()) {
+        cerr << "错误: --field-bench 需要用 --field 指定数据文件" << endl;
+        return 1;
+    }
+    return runHeadlessBenchmark("数据场基准", true, [&]() -> int {
+        rotationX = 20.0f;
+        fieldFramesPerSecond = 0.0;
+        if (!ensureFieldLayer()) return 1;
+        FILE* file = fopen(fieldPath.c_str(), "rb");
+        FieldFileHeader header;
+        if (!file || fread(&header, sizeof(header), 1, file) != 1) {
+            if (file) fclose(file);
+            return 1;
+        }
+        int frames = header.frames;
+        size_t count = (size_t)header.width * header.height;
+        vector<float> values(count);
+        vector<unsigned short> quantized(count);
+        GLuint syncTexture = 0;
+        glGenTextures(1, &syncTexture);
+        glBindTexture(GL_TEXTURE_2D, syncTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE16, header.width, header.height, 0, GL_LUMINANCE, GL_UNSIGNED_SHORT,
+                     NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        cout << "数据场基准: " << fieldPath << "，" << frames << " 帧，" << WIDTH << "x" << HEIGHT << "，每种轨迹 "
+             << steps << " 步" << endl;
+        BenchTable table;
+        table.column("轨迹", 4, true).column("方式", 8, true).column("停顿p50(ms)").column("停顿p99(ms)");
+        table.column("停顿最大(ms)").column("未就绪").column("后台解码(ms)");
+        table.printHeader();
+        const char* patterns[3] = {"播放", "拖动", "跳转"};
+        for (int pattern = 0; pattern < 3; ++pattern) {
+            for (int mode = 0; mode < 2; ++mode) {
+                fieldTimeline.reset(); // 每组从空的纹理环开始
+                unsigned int seed = 1234u;
+                double cursor = 0.0;
+                int loaded = -1;
+                FrameHistogram syncStall;
+                for (int f = 0; f < steps; ++f) {
+                    if (pattern == 0) {
+                        cursor += 1.0;
+                    } else if (pattern == 1) {
+                        cursor += 5.0;
+                    } else if (f % 10 == 0) {
+                        cursor = (int)(randomUnit(seed) * frames);
+                    } else {
+                        cursor += 1.0;
+                    }
+                    cursor -= floor(cursor / frames) * frames;
+                    fieldCursor = cursor;
+                    rotationY = f * 3.0f;
+                    if (mode == 0) {
+                        renderScene();
+                    } else {
+                        // 对照组：渲染线程自己读文件、量化、上传
+                        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+                        int target = (int)cursor;
+                        if (target != loaded) {
+                            fseek(file, (long)(sizeof(FieldFileHeader) + count * sizeof(float) * target), SEEK_SET);
+                            size_t got = fread(values.data(), sizeof(float), count, file);
+                            float scale = 65534.0f / (header.maxValue - header.minValue);
+                            for (size_t i = 0; i < count; ++i) {
+                                float v = i < got ? values[i] : NAN;
+                                quantized[i] = v != v ? 0 : (unsigned short)(1.0f + min(max((v - header.minValue) * scale, 0.0f), 65534.0f) + 0.5f);
+                            }
+                            glBindTexture(GL_TEXTURE_2D, syncTexture);
+                            glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+                            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.width, header.height, GL_LUMINANCE,
+                                            GL_UNSIGNED_SHORT, quantized.data());
+                            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                            glBindTexture(GL_TEXTURE_2D, 0);
+                            loaded = target;
+                        }
+                        syncStall.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+                        fieldEnabled = false;
+                        renderScene();
+                        fieldEnabled = true;
+                    }
+                    glFinish();
+                }
+                const FrameHistogram& stall = mode == 0 ? fieldTimeline.stallHistogram() : syncStall;
+                table.cell("%s", patterns[pattern]).cell("%s", mode == 0 ? "预取环" : "同步读取");
+                table.cell("%.3f", stall.percentileMs(0.5)).cell("%.3f", stall.percentileMs(0.99)).cell("%.3f", stall.maxMs());
+                if (mode == 0) {
+                    table.cell("%lld", fieldTimeline.missCount()).cell("%.3f", fieldTimeline.meanDecodeMs());
+                } else {
+                    table.cell("-").cell("-");
+                }
+            }
+        }
+        fclose(file);
+        glDeleteTextures(1, &syncTexture);
+        fieldTimeline.close();
+        return 0;
+    });
+}
+
+// 1万、100万、1000万个标记点：建树耗时，以及远、中、近三种缩放下LOD绘制的帧时间和实际绘制的点数。
+// 不使用LOD（每帧绘制全部点）的对照只测到100万个点
+int runMarkersBenchmark(int frames) {
+    return runHeadlessBenchmark("标记点基准", true, [&]() -> int {
+        if (!ensureMarkerProgram()) return 1;
+        rotationX = 20.0f;
+        markersEnabled = true;
+        
+        const size_t counts[] = {10000, 1000000, 10000000};
+        const float zooms[] = {0.6f, 1.0f, 4.0f};
+        cout << "标记点基准: " << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧" << endl;
+        BenchTable table;
+        table.column("点数", 8).column("缩放").column("LOD(ms/帧)").column("绘制点数").column("节点").column("调用");
+        table.column("遍历(ms)").column("全部绘制(ms/帧)");
+        table.printHeader();
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            generateMarkers(counts[c], markerData);
+            buildMarkerLayer(markerLayer, markerData);
+            vector<GeoMarker>().swap(markerData);
+            
+            for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z) {
+                zoom = zooms[z];
+                double ms[2] = {0.0, -1.0};
+                long long drawn = 0;
+                int nodes = 0, calls = 0;
+                double traverse = 0.0;
+                int modes = counts[c] <= 1000000 ? 2 : 1;
+                for (int mode = 0; mode < modes; ++mode) {
+                    markerLodEnabled = mode == 0;
+                    ms[mode] = BenchTimer::perFrame(frames, [&](int f) {
+                        rotationY = f * 3.0f;
+                        renderScene();
+                        glFinish();
+                        if (mode == 0 && f >= 0) traverse += markerLayer.traverseMs;
+                    });
+                    if (mode == 0) {
+                        drawn = markerLayer.drawnMarkers;
+                        nodes = markerLayer.drawnNodes;
+                        calls = markerLayer.drawCalls;
+                    }
+                }
+                table.cell("%zu", counts[c]).cell("%.1f", zooms[z]).cell("%.3f", ms[0]).cell("%lld", drawn);
+                table.cell("%d", nodes).cell("%d", calls).cell("%.3f", traverse / frames);
+                if (ms[1] >= 0) {
+                    table.cell("%.3f", ms[1]);
+                } else {
+                    table.cell("-");
+                }
+            }
+        }
+        markerLodEnabled = true;
+        return 0;
+    });
+}
+
+// 折线简化的效果：远、中、近几种缩放下，按缩放选级与始终绘制完整精度的帧时间和线段数。
+// 没有用 --coastlines/--borders 指定数据时生成约400万个顶点的测试折线
+int runBordersBenchmark(int frames) {
+    return runHeadlessBenchmark("折线基准", true, [&]() -> int {
+        if (borderData.empty()) generateBorders(4000000, borderData);
+        buildBorderLayer(borderLayer, borderData);
+        vector<BorderPolyline>().swap(borderData);
+        rotationX = 20.0f;
+        bordersEnabled = true;
+        
+        const float zooms[] = {0.6f, 1.0f, 2.0f, 4.0f};
+        cout << "折线基准: " << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧" << endl;
+        BenchTable table;
+        table.column("缩放").column("级别").column("线段数", 8).column("选级(ms/帧)").column("完整精度(ms/帧)");
+        table.printHeader();
+        for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z) {
+            zoom = zooms[z];
+            double ms[2] = {0.0, 0.0};
+            int level = 0;
+            long long segments = 0;
+            for (int mode = 0; mode < 2; ++mode) {
+                borderForcedLevel = mode == 0 ? -1 : 0;
+                ms[mode] = BenchTimer::perFrame(frames, [](int f) {
+                    rotationY = f * 3.0f;
+                    renderScene();
+                    glFinish();
+                });
+                if (mode == 0) {
+                    level = borderLayer.level;
+                    segments = borderLayer.drawnSegments;
+                }
+            }
+            table.cell("%.1f", zooms[z]).cell("%d", level).cell("%lld", segments).cell("%.3f", ms[0]).cell("%.3f", ms[1]);
+        }
+        borderForcedLevel = -1;
+        return 0;
+    });
+}
+
+// 航线：批量绘制与逐条立即模式绘制的帧时间，以及每帧修改1%航线时增量更新与整体重建的耗时。
+// 没有用 --routes 指定数据时生成10万条测试航线
+int runRoutesBenchmark(int frames) {
+    return runHeadlessBenchmark("航线基准", true, [&]() -> int {
+        if (routeLayer.arcs.empty()) {
+            vector<RouteArc> arcs;
+            generateRoutes(100000, arcs);
+            setRoutes(routeLayer, arcs);
+        }
+        rotationX = 20.0f;
+        routesEnabled = true;
+        size_t arcCount = routeLayer.arcs.size();
+        cout << "航线基准: " << arcCount << " 条，" << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧" << endl;
+        
+        // 同一场景只绘制航线，排除地球等其他部分的干扰。submit 为提交绘制命令的CPU耗时（不含等待GPU），
+        // 立即模式的开销主要在这里；软件驱动上总耗时往往由线段光栅化决定
+        auto timeDraw = [&](const function<void()>& draw, double& submit) {
+            submit = 0.0;
+            double total = BenchTimer::perFrame(frames, [&](int f) {
+                rotationY = f * 3.0f;
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                updateFrameMatrices();
+                glMatrixMode(GL_PROJECTION);
+                glLoadMatrixf(frameMatrices.projection.m);
+                glMatrixMode(GL_MODELVIEW);
+                glLoadMatrixf(frameMatrices.globe.m);
+                chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+                draw();
+                if (f >= 0) submit += BenchTimer::elapsedMs(begin);
+                glFinish();
+            });
+            submit /= max(frames, 1);
+            return total;
+        };
+        
+        BenchTable table;
+        table.column("缩放").column("级别").column("顶点数", 8).column("重建(ms)").column("批量提交(ms/帧)");
+        table.column("批量总计(ms/帧)").column("立即模式提交(ms/帧)").column("立即模式总计(ms/帧)");
+        table.printHeader();
+        const float zooms[] = {1.0f, 4.0f};
+        for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z) {
+            zoom = zooms[z];
+            int detail = routeDetailLevel(zoom);
+            routeLayer.rebuild = true;
+            syncRouteBuffer(routeLayer, detail);
+            double rebuildMs = routeLayer.updateMs;
+            double batchedSubmit, immediateSubmit;
+            double batched = timeDraw(drawRoutes, batchedSubmit);
+            double immediate = timeDraw([&]() {
+                glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                glDisable(GL_LIGHTING);
+                glDisable(GL_TEXTURE_2D);
+                glEnable(GL_DEPTH_TEST);
+                glDepthFunc(GL_LEQUAL);
+                glDepthMask(GL_FALSE);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                for (size_t i = 0; i < arcCount; ++i) {
+                    glBegin(GL_LINE_STRIP);
+                    const RouteVertex* v = &routeLayer.vertices[routeLayer.first[i]];
+                    for (int k = 0; k < routeLayer.count[i]; ++k) {
+                        glColor4ubv(v[k].color);
+                        glVertex3fv(v[k].position);
+                    }
+                    glEnd();
+                }
+                glPopAttrib();
+            }, immediateSubmit);
+            table.cell("%.1f", zoom).cell("%d", detail).cell("%zu", routeLayer.used).cell("%.2f", rebuildMs);
+            table.cell("%.3f", batchedSubmit).cell("%.3f", batched).cell("%.3f", immediateSubmit).cell("%.3f", immediate);
+        }
+        
+        // 每帧修改1%的航线（换一个终点），比较增量更新与整体重建
+        zoom = 1.0f;
+        syncRouteBuffer(routeLayer, routeDetailLevel(zoom));
+        unsigned int seed = 4242u;
+        size_t changes = max(arcCount / 100, (size_t)1);
+        double incremental = 0.0, full = 0.0;
+        size_t bytes = 0;
+        int calls = 0;
+        for (int f = 0; f < frames; ++f) {
+            for (size_t k = 0; k < changes; ++k) {
+                size_t index = (size_t)(randomUnit(seed) * arcCount);
+                RouteArc arc = routeLayer.arcs[index];
+                arc.lat1 = routeLayer.arcs[(index * 7 + f) % arcCount].lat1;
+                arc.lon1 = routeLayer.arcs[(index * 7 + f) % arcCount].lon1;
+                updateRoute(routeLayer, index, arc);
+            }
+            syncRouteBuffer(routeLayer, 0);
+            glFinish();
+            incremental += routeLayer.updateMs;
+            bytes += routeLayer.uploadedBytes;
+            calls += routeLayer.uploadCalls;
+        }
+        for (int f = 0; f < frames; ++f) {
+            routeLayer.rebuild = true;
+            syncRouteBuffer(routeLayer, 0);
+            glFinish();
+            full += routeLayer.updateMs;
+        }
+        printf("每帧修改 %zu 条: 增量更新 %.3f ms/帧（上传 %.1f KB，%.1f 次调用），整体重建 %.3f ms/帧\n", changes,
+               incremental / frames, bytes / 1024.0 / frames, (double)calls / frames, full / frames);
+        return 0;
+    });
+}
+
+// 热力图：10万、100万个事件一次性累加时串行与多线程（局部网格 + SIMD归并）的耗时，
+// 以及每帧新增、删除同样数量的事件时增量更新和分块上传的耗时，与每帧上传整张纹理对照
+int runHeatmapBenchmark(int frames) {
+    return runHeadlessBenchmark("热力图基准", false, [&]() -> int {
+        int threads = defaultThreadCount();
+        cout << "热力图基准: 网格 " << HEATMAP_WIDTH << "x" << HEATMAP_HEIGHT << "，块 " << HEATMAP_TILE << "x"
+             << HEATMAP_TILE << "，" << threads << " 个线程，每组 " << frames << " 帧" << endl;
+        BenchTable batch;
+        batch.column("事件数", 10).column("串行(ms)").column("多线程累加(ms)").column("归并(ms)").column("最大相对差异");
+        batch.printHeader();
+        const size_t counts[] = {100000, 1000000};
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            HeatmapLayer serial, parallel;
+            generateHeatPoints(counts[c], serial);
+            generateHeatPoints(counts[c], parallel);
+            double serialMs = BenchTimer::best(1, [&]() { updateHeatmap(serial, 1); });
+            // 线程数为1时也走局部网格 + 归并的路径，便于与串行对照
+            updateHeatmap(parallel, max(threads, 2));
+            double difference = 0.0;
+            for (size_t i = 0; i < serial.grid.size(); ++i) {
+                difference = max(difference, (double)fabs(serial.grid[i] - parallel.grid[i]));
+            }
+            batch.cell("%zu", counts[c]).cell("%.2f", serialMs).cell("%.2f", parallel.splatMs);
+            batch.cell("%.2f", parallel.reduceMs).cell("%.2e", difference / max(serial.maxDensity, 1e-6f));
+        }
+        
+        // 100万个事件的基础上，每帧删除最早的一批、加入新的一批
+        HeatmapLayer layer;
+        generateHeatPoints(1000000, layer);
+        updateHeatmap(layer, 0);
+        uploadHeatmapTiles(layer);
+        glFinish();
+        BenchTable incremental;
+        incremental.column("每帧增删", 8).column("累加(ms)").column("归并(ms)").column("上传块数").column("调用次数");
+        incremental.column("分块上传(ms)").column("整张上传(ms)");
+        incremental.printHeader();
+        HeatEventGenerator generator(97531u);
+        deque<int> live;
+        for (int id = 0; id < (int)layer.points.size(); ++id) live.push_back(id);
+        const int batches[] = {10, 100, 1000};
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b) {
+            double splat = 0.0, reduce = 0.0, upload = 0.0;
+            long long tiles = 0, calls = 0;
+            for (int f = 0; f < frames; ++f) {
+                for (int k = 0; k < batches[b]; ++k) {
+                    removeHeatPoint(layer, live.front());
+                    live.pop_front();
+                    HeatPoint point = generator.event();
+                    live.push_back(addHeatPoint(layer, point.lat, point.lon, point.weight));
+                }
+                updateHeatmap(layer, 0);
+                uploadHeatmapTiles(layer);
+                glFinish();
+                splat += layer.splatMs;
+                reduce += layer.reduceMs;
+                upload += layer.uploadMs;
+                tiles += layer.uploadedTiles;
+                calls += layer.uploadCalls;
+            }
+            double full = BenchTimer::perFrame(frames, [&](int) {
+                glBindTexture(GL_TEXTURE_2D, layer.texture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, HEATMAP_WIDTH, HEATMAP_HEIGHT, GL_LUMINANCE, GL_FLOAT,
+                                layer.grid.data());
+                glBindTexture(GL_TEXTURE_2D, 0);
+                glFinish();
+            });
+            incremental.cell("%d", batches[b]).cell("%.3f", splat / frames).cell("%.3f", reduce / frames);
+            incremental.cell("%.1f", (double)tiles / frames).cell("%.1f", (double)calls / frames);
+            incremental.cell("%.3f", upload / frames).cell("%.3f", full);
+        }
+        glDeleteTextures(1, &layer.texture);
+        return 0;
+    });
+}
+
+// 批量坐标变换与逐点 libm 实现的吞吐（百万点/秒，取5次中最快的一次）和误差（与双精度结果比较）。
+// 不需要GL上下文
+int runTransformBenchmark(int count) {
+    const double DEG = M_PI / 180.0;
+    size_t n = (size_t)max(count, 4);
+    vector<float> lat(n), lon(n), x(n), y(n), z(n), a(n), b(n), c(n);
+    vector<double> rx(n), ry(n), rz(n);
+    unsigned int seed = 8642u;
+    for (size_t i = 0; i < n; ++i) {
+        lat[i] = (float)(asin(randomUnit(seed) * 2.0 - 1.0) / DEG);
+        lon[i] = (float)(randomUnit(seed) * 360.0 - 180.0);
+    }
+    Mat4 mvp = mat4Multiply(mat4Perspective(45.0f, 4.0f / 3.0f, 0.1f, 100.0f),
+                            mat4LookAt(0.0f, 0.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f));
+    
+    // 双精度参照：与 batchGeodeticToGlobe 相同的公式
+    struct Reference {
+        static void forward(double latDeg, double lonDeg, double e2, double out[3]) {
+            double phi = latDeg * M_PI / 180.0, lambda = lonDeg * M_PI / 180.0;
+            double nRadius = 1.0 / sqrt(1.0 - e2 * sin(phi) * sin(phi));
+            out[0] = -nRadius * cos(phi) * cos(lambda);
+            out[1] = nRadius * (1.0 - e2) * sin(phi);
+            out[2] = -nRadius * cos(phi) * sin(lambda);
+        }
+    };
+    double checksum = 0.0;
+    cout << "坐标变换基准: " << n << " 个点，" <<
+#if defined(GLOBE_SIMD_SSE2)
+        "SSE2"
+#elif defined(GLOBE_SIMD_NEON)
+        "NEON"
+#else
+        "标量回退"
+#endif
+        << endl;
+    BenchTable table;
+    table.column("变换", 22, true).column("逐点libm(Mpts/s)").column("批量SIMD(Mpts/s)").column("加速比");
+    table.column("libm误差", 10).column("批量误差", 12);
+    table.printHeader();
+    
+    for (int shape = 0; shape < 2; ++shape) {
+        GeoShapeParams params((GeoShape)shape);
+        double e2 = shape == GEO_WGS84 ? WGS84_FLATTENING * (2.0 - WGS84_FLATTENING) : 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            double r[3];
+            Reference::forward(lat[i], lon[i], e2, r);
+            rx[i] = r[0]; ry[i] = r[1]; rz[i] = r[2];
+        }
+        // 正变换：球面的逐点路径就是 geoToSphere，椭球的逐点路径是同一公式的 libm 单精度实现
+        double scalarMs = BenchTimer::best(5, [&]() {
+            for (size_t i = 0; i < n; ++i) {
+                if (shape == GEO_SPHERE) {
+                    float p[3];
+                    geoToSphere(lat[i], lon[i], p);
+                    x[i] = p[0]; y[i] = p[1]; z[i] = p[2];
+                } else {
+                    float phi = lat[i] * (float)DEG, lambda = lon[i] * (float)DEG;
+                    float s = sin(phi), nRadius = 1.0f / sqrt(1.0f - params.e2 * s * s);
+                    x[i] = -nRadius * cos(phi) * cos(lambda);
+                    y[i] = nRadius * (1.0f - params.e2) * s;
+                    z[i] = -nRadius * cos(phi) * sin(lambda);
+                }
+            }
+        });
+        double scalarError = 0.0, batchError = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            scalarError = max(scalarError, max(fabs(x[i] - rx[i]), max(fabs(y[i] - ry[i]), fabs(z[i] - rz[i]))));
+        }
+        double batchMs = BenchTimer::best(5, [&]() {
+            batchGeodeticToGlobe(lat.data(), lon.data(), NULL, n, (GeoShape)shape, x.data(), y.data(), z.data());
+        });
+        for (size_t i = 0; i < n; ++i) {
+            batchError = max(batchError, max(fabs(x[i] - rx[i]), max(fabs(y[i] - ry[i]), fabs(z[i] - rz[i]))));
+        }
+        table.cell("经纬度->物体空间 %s", shape ? "WGS84" : "球面").cell("%.1f", n / scalarMs / 1000.0);
+        table.cell("%.1f", n / batchMs / 1000.0).cell("%.2f", scalarMs / batchMs);
+        table.cell("%.2f米", scalarError * WGS84_SEMI_MAJOR).cell("%.2f米", batchError * WGS84_SEMI_MAJOR);
+        
+        // 反变换：输入取上面的双精度结果，误差换算为地面距离
+        for (size_t i = 0; i < n; ++i) {
+            x[i] = (float)rx[i]; y[i] = (float)ry[i]; z[i] = (float)rz[i];
+        }
+        struct AngleError {
+            static double meters(const vector<float>& la, const vector<float>& lo, const vector<float>& lat0,
+                                 const vector<float>& lon0) {
+                double worst = 0.0;
+                for (size_t i = 0; i < la.size(); ++i) {
+                    double dLon = fabs(lo[i] - lon0[i]);
+                    dLon = min(dLon, 360.0 - dLon) * cos(lat0[i] * M_PI / 180.0);
+                    worst = max(worst, max(fabs((double)la[i] - lat0[i]), dLon));
+                }
+                return worst * M_PI / 180.0 * WGS84_SEMI_MAJOR;
+            }
+        };
+        scalarMs = BenchTimer::best(5, [&]() {
+            for (size_t i = 0; i < n; ++i) {
+                float p = sqrt(x[i] * x[i] + z[i] * z[i]);
+                float u = atan2(y[i], p * params.polar);
+                float su = sin(u), cu = cos(u);
+                a[i] = atan2(y[i] + params.ep2 * params.polar * su * su * su, p - params.e2 * cu * cu * cu) * (float)(1.0 / DEG);
+                b[i] = atan2(-z[i], -x[i]) * (float)(1.0 / DEG);
+            }
+        });
+        scalarError = AngleError::meters(a, b, lat, lon);
+        batchMs = BenchTimer::best(5, [&]() {
+            batchGlobeToGeodetic(x.data(), y.data(), z.data(), n, (GeoShape)shape, a.data(), b.data(), c.data());
+        });
+        batchError = AngleError::meters(a, b, lat, lon);
+        table.cell("物体空间->经纬度 %s", shape ? "WGS84" : "球面").cell("%.1f", n / scalarMs / 1000.0);
+        table.cell("%.1f", n / batchMs / 1000.0).cell("%.2f", scalarMs / batchMs);
+        table.cell("%.2f米", scalarError).cell("%.2f米", batchError);
+        for (size_t i = 0; i < n; i += 97) checksum += a[i] + b[i] + c[i];
+    }
+    
+    // 投影到 800x600 窗口，误差以像素计（只统计可见的点）
+    double scalarMs = BenchTimer::best(5, [&]() {
+        for (size_t i = 0; i < n; ++i) {
+            float in[4] = {x[i], y[i], z[i], 1.0f}, out[4];
+            mat4Transform(mvp, in, out);
+            bool visible = out[3] > 0.0f && fabs(out[0]) <= out[3] && fabs(out[1]) <= out[3] && fabs(out[2]) <= out[3];
+            float inverse = out[3] > 0.0f ? 1.0f / out[3] : 0.0f;
+            a[i] = (out[0] * inverse * 0.5f + 0.5f) * 800.0f;
+            b[i] = (out[1] * inverse * 0.5f + 0.5f) * 600.0f;
+            c[i] = visible ? out[2] * inverse * 0.5f + 0.5f : -1.0f;
+        }
+    });
+    vector<float> sx(n), sy(n), depth(n);
+    vector<unsigned char> visible(n);
+    double batchMs = BenchTimer::best(5, [&]() {
+        batchGlobeToScreen(mvp.m, x.data(), y.data(), z.data(), n, 800, 600, sx.data(), sy.data(), depth.data(),
+                           visible.data());
+    });
+    double pixelError = 0.0;
+    size_t mismatched = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if ((c[i] >= 0.0f) != (visible[i] != 0)) ++mismatched;
+        if (visible[i]) pixelError = max(pixelError, (double)max(fabs(sx[i] - a[i]), fabs(sy[i] - b[i])));
+        checksum += sx[i] * 1e-6;
+    }
+    // 投影没有双精度参照，误差一栏为批量与逐点结果之差
+    table.cell("物体空间->屏幕").cell("%.1f", n / scalarMs / 1000.0).cell("%.1f", n / batchMs / 1000.0);
+    table.cell("%.2f", scalarMs / batchMs).cell("-").cell("%.2e像素", pixelError);
+    printf("  投影的可见性判断不一致 %zu 个\n", mismatched);
+    printf("  (校验和 %.3f)\n", checksum);
+    return 0;
+}
+
+// 场景图：1千、1万、10万颗卫星时每帧同步场景图（更新世界矩阵、绘制列表、视锥剔除）的CPU耗时。
+// 分别测量画面静止、相机移动、地球旋转（整棵子树变脏）、每帧移动1%的卫星，
+// 以及每帧经 setSceneLocal 改写全部卫星的局部变换（相当于每帧逐个重建所有物体的变换）作对照。不需要GL上下文
+int runSceneBenchmark(int frames) {
+    cout << "场景图基准: 每组 " << frames << " 帧" << endl;
+    BenchTable table;
+    table.column("卫星数", 8).column("场景", 10, true).column("更新节点/帧").column("更新(ms)").column("剔除(ms)");
+    table.column("剔除沿用").column("合计(ms/帧)");
+    table.printHeader();
+    const size_t counts[] = {1000, 10000, 100000};
+    const char* names[] = {"静止", "相机移动", "地球旋转", "移动1%卫星", "全部重算"};
+    float baseCameraX = cameraX, baseRotationY = rotationY;
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        sceneGraph = SceneGraph();
+        sceneRoot = -1;
+        addSatellites(sceneGraph, counts[c]);
+        int firstSatellite = sceneSatellites + 1;
+        int satelliteCount = (int)sceneGraph.size() - firstSatellite;
+        unsigned int seed = 777u;
+        for (int scenario = 0; scenario < 5; ++scenario) {
+            long long updated = 0;
+            int reused = 0;
+            double update = 0.0, cull = 0.0;
+            double total = BenchTimer::perFrame(frames, [&](int f) {
+                if (f < 0) {
+                    // 预热：回到初始视图并同步一次，之后每帧只有本场景的改动
+                    cameraX = baseCameraX;
+                    rotationY = baseRotationY;
+                    updateFrameMatrices();
+                    syncSceneGraph(sceneGraph, frameMatrices);
+                    return;
+                }
+                if (scenario == 1) cameraX = baseCameraX + 0.01f * (f + 1);
+                if (scenario == 2) rotationY = baseRotationY + 0.5f * (f + 1);
+                if (scenario == 3) {
+                    for (int k = 0; k < max(satelliteCount / 100, 1); ++k) {
+                        int id = firstSatellite + (int)(randomUnit(seed) * satelliteCount);
+                        Mat4 local = sceneGraph.local[id];
+                        local.m[13] += 0.001f;
+                        setSceneLocal(sceneGraph, id, local);
+                    }
+                }
+                if (scenario == 4) {
+                    float offset = (f & 1) ? 0.001f : -0.001f;
+                    for (int id = firstSatellite; id < (int)sceneGraph.size(); ++id) {
+                        Mat4 local = sceneGraph.local[id];
+                        local.m[13] += offset;
+                        setSceneLocal(sceneGraph, id, local);
+                    }
+                }
+                updateFrameMatrices();
+                syncSceneGraph(sceneGraph, frameMatrices);
+                updated += sceneGraph.updatedNodes;
+                update += sceneGraph.updateMs;
+                cull += sceneGraph.cullMs;
+                reused += sceneGraph.cullReused ? 1 : 0;
+            });
+            table.cell("%zu", counts[c]).cell("%s", names[scenario]).cell("%lld", updated / frames);
+            table.cell("%.3f", update / frames).cell("%.3f", cull / frames).cell("%d/%d", reused, frames);
+            table.cell("%.3f", total);
+        }
+    }
+    cameraX = baseCameraX;
+    rotationY = baseRotationY;
+    return 0;
+}
+
+// 文字标注：1万、5万个候选标注在不同缩放下每帧排版（投影 + 碰撞剔除）的耗时，网格剔除与逐个两两比较对照，
+// 以及包含绘制的整帧耗时。没有用 --labels 指定数据时生成测试标注
+int runLabelsBenchmark(int frames) {
+    return runHeadlessBenchmark("文字标注基准", false, [&]() -> int {
+        vector<Label> loaded = labelLayer.labels;
+        ensureLabelFont();
+        cout << "文字标注基准: " << WIDTH << "x" << HEIGHT << "，字高 " << labelPixels << " 像素，每组 " << frames
+             << " 帧" << endl;
+        
+        // 与 renderScene 相同的投影和地球矩阵
+        auto setup = [](int frame) {
+            rotationX = 20.0f;
+            rotationY = frame * 3.0f;
+            updateFrameMatrices();
+        };
+        // 只排版：取 layoutLabels 自己计的时
+        auto layout = [&]() {
+            double total = 0.0;
+            for (int f = 0; f < frames; ++f) {
+                setup(f);
+                layoutLabels(labelLayer, frameMatrices, WIDTH, HEIGHT);
+                total += labelLayer.layoutMs;
+            }
+            return total / max(frames, 1);
+        };
+        
+        BenchTable table;
+        table.column("标注数", 10).column("缩放").column("候选", 5).column("保留").column("网格排版(ms)");
+        table.column("两两比较(ms)").column("排版+绘制(ms/帧)");
+        table.printHeader();
+        const size_t counts[] = {10000, 50000};
+        const float zooms[] = {1.0f, 3.0f};
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            vector<Label> labels;
+            if (loaded.empty()) {
+                generateLabels(counts[c], labels);
+            } else {
+                // 用户数据重复到指定数量，位置稍作偏移
+                for (size_t i = 0; i < counts[c]; ++i) {
+                    Label label = loaded[i % loaded.size()];
+                    label.lon += (float)(i / loaded.size()) * 0.37f;
+                    labels.push_back(label);
+                }
+            }
+            setLabels(labelLayer, labels);
+            prepareLabels(labelLayer);
+            for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z) {
+                zoom = zooms[z];
+                labelGridEnabled = true;
+                double grid = layout();
+                int candidates = labelLayer.candidates, placed = labelLayer.placed;
+                labelGridEnabled = false;
+                double pairwise = layout();
+                if (labelLayer.placed != placed) cerr << "警告: 两种剔除方式保留的标注数不同 (" << labelLayer.placed << ")" << endl;
+                labelGridEnabled = true;
+                // 预热帧烘焙字形、上传图集
+                double total = BenchTimer::perFrame(frames, [&](int f) {
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    setup(f);
+                    drawLabels();
+                    glFinish();
+                });
+                table.cell("%zu", counts[c]).cell("%.1f", zoom).cell("%d", candidates).cell("%d", placed);
+                table.cell("%.3f", grid).cell("%.3f", pairwise).cell("%.3f", total);
+            }
+        }
+        return 0;
+    });
+}
+
+int runRecordBenchmark(int frames) {
+    return runHeadlessBenchmark("帧录制基准", true, [&]() -> int {
+        string output = recordPath.empty() ? "record_bench.y4m" : recordPath;
+        cout << "帧录制基准: " << WIDTH << "x" << HEIGHT << "，每组 " << frames << " 帧，输出 " << output << endl;
+        BenchTable table;
+        table.column("方式", 10, true).column("帧时间(ms)").column("增加(ms)").column("录制p99(ms)");
+        table.column("写出/丢弃").column("编码(ms/帧)").column("吞吐(帧/秒)");
+        table.printHeader();
+        const char* names[] = {"不录制", "同步读回", "PBO环+栅栏"};
+        
+        double baseline = 0.0;
+        for (int mode = 0; mode < 3; ++mode) {
+            FrameRecorder recorder;
+            recorder.synchronousReadback = mode == 1;
+            if (mode > 0 && !recorder.start(output, recordFramesPerSecond)) return 1;
+            double frameMs = BenchTimer::perFrame(frames, [&](int f) {
+                rotationY = f * 2.0f;
+                renderScene();
+                if (f >= 0) recorder.captureFramebuffer(WIDTH, HEIGHT); // 预热帧不录制，写出帧数与 frames 一致
+                glFlush(); // 相当于窗口模式下不等垂直同步的交换缓冲区
+            });
+            recorder.finish(false);
+            
+            table.cell("%s", names[mode]).cell("%.3f", frameMs);
+            if (mode == 0) {
+                baseline = frameMs;
+                table.cell("-").cell("-").cell("-").cell("-").cell("-");
+                continue;
+            }
+            table.cell("%.3f", frameMs - baseline).cell("%.3f", recorder.captureHistogram().percentileMs(0.99));
+            table.cell("%lld/%lld", recorder.writtenFrames(), recorder.droppedFrames());
+            table.cell("%.3f", recorder.encodeMs()).cell("%.1f", recorder.framesPerSecond());
+        }
+        if (recordPath.empty()) remove(output.c_str());
+        return 0;
+    });
+}
+
+// ========================
+// 回归测试（参考图像 + 性能）
+// ========================
+// 以固定的场景集合离屏渲染：每个光源位置 × 阴影开关 × 若干缩放和旋转。
+// 每个场景与参考图像做感知差异比较（CIE Lab 色差，允许1像素内的抗锯齿偏移），
+// 同时记录帧时间、绘制调用数和内存占用，结果写入 JSON 报告
+
+struct RegressionScene {
+    string name;
+    HeadlessView view;
+};
+
+struct RegressionResult {
+    string name;
+    bool hasReference;
+    bool passed;
+    double meanDeltaE;
+    double badPixelRatio;
+    double frameMs;
+    int drawCalls;
+    long residentBytes;
+};
+
+vector<RegressionScene> buildRegressionScenes() {
+    const float zooms[] = {0.6f, 1.0f, 1.6f};
+    const float rotations[][2] = {{0.0f, 0.0f}, {25.0f, 120.0f}};
+    
+    vector<RegressionScene> scenes;
+    for (size_t light = 0; light < lightPositions.size(); ++light) {
+        for (int shadow = 0; shadow < 2; ++shadow) {
+            for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z) {
+                for (size_t rot = 0; rot < sizeof(rotations) / sizeof(rotations[0]); ++rot) {
+                    RegressionScene scene;
+                    scene.view.rotationX = rotations[rot][0];
+                    scene.view.rotationY = rotations[rot][1];
+                    scene.view.zoom = zooms[z];
+                    scene.view.cameraX = 0.0f;
+                    scene.view.cameraY = 0.0f;
+                    scene.view.cameraZ = 5.0f;
+                    scene.view.light = (int)light;
+                    scene.view.lightEnabled = true;
+                    scene.view.shadowEnabled = shadow != 0;
+                    scene.view.shadowIntensity = 0.6f;
+                    scene.view.globeImpostor = false;
+                    
+                    char name[96];
+                    snprintf(name, sizeof(name), "light%d_shadow%d_zoom%.1f_rx%d_ry%d", (int)light, shadow,
+                             zooms[z], (int)rotations[rot][0], (int)rotations[rot][1]);
+                    scene.name = name;
+                    scenes.push_back(scene);
+                }
+            }
+        }
+    }
+    return scenes;
+}
+
+// sRGB(0-255) 转 CIE Lab（D65）
+void rgbToLab(const unsigned char* rgb, float lab[3]) {
+    float c[3];
+    for (int i = 0; i < 3; ++i) {
+        float v = rgb[i] / 255.0f;
+        c[i] = v <= 0.04045f ? v / 12.92f : pow((v + 0.055f) / 1.055f, 2.4f);
+    }
+    float xyz[3] = {
+        (0.4124f * c[0] + 0.3576f * c[1] + 0.1805f * c[2]) / 0.95047f,
+        0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2],
+        (0.0193f * c[0] + 0.1192f * c[1] + 0.9505f * c[2]) / 1.08883f
+    };
+    for (int i = 0; i < 3; ++i) {
+        xyz[i] = xyz[i] > 0.008856f ? cbrt(xyz[i]) : 7.787f * xyz[i] + 16.0f / 116.0f;
+    }
+    lab[0] = 116.0f * xyz[1] - 16.0f;
+    lab[1] = 500.0f * (xyz[0] - xyz[1]);
+    lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+// 比较两幅 RGB 图像（自上而下，无行填充）。每个像素取参考图 3x3 邻域中最小的色差，
+// 以容忍光栅化和抗锯齿带来的亚像素偏移；色差超过 badDeltaE 的像素视为不一致
+void compareImages(const unsigned char* image, const unsigned char* reference, int width, int height,
+                   float badDeltaE, double& meanDeltaE, double& badPixelRatio) {
+    vector<float> refLab(width * height * 3);
+    for (int i = 0; i < width * height; ++i) rgbToLab(reference + i * 3, &refLab[i * 3]);
+    
+    double sum = 0.0;
+    long bad = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float lab[3];
+            rgbToLab(image + (y * width + x) * 3, lab);
+            float best = 1e30f;
+            for (int ny = max(y - 1, 0); ny <= min(y + 1, height - 1); ++ny) {
+                for (int nx = max(x - 1, 0); nx <= min(x + 1, width - 1); ++nx) {
+                    const float* r = &refLab[(ny * width + nx) * 3];
+                    float d = (lab[0]-r[0])*(lab[0]-r[0]) + (lab[1]-r[1])*(lab[1]-r[1]) + (lab[2]-r[2])*(lab[2]-r[2]);
+                    best = min(best, d);
+                }
+            }
+            float deltaE = sqrt(best);
+            sum += deltaE;
+            if (deltaE > badDeltaE) ++bad;
+        }
+    }
+    meanDeltaE = sum / (width * height);
+    badPixelRatio = (double)bad / (width * height);
+}
+
+// BMP 布局（BGR，自下而上，行对齐）转为与 loadBMPFile 输出一致的 RGB（自上而下）
+void bmpPixelsToRGB(const vector<unsigned char>& bgr, int width, int height, vector<unsigned char>& rgb) {
+    int rowSize = (width * 3 + 3) & ~3;
+    rgb.resize(width * height * 3);
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* src = &bgr[(height - 1 - y) * rowSize];
+        unsigned char* dst = &rgb[y * width * 3];
+        for (int x = 0; x < width; ++x) {
+            dst[x * 3] = src[x * 3 + 2];
+            dst[x * 3 + 1] = src[x * 3 + 1];
+            dst[x * 3 + 2] = src[x * 3];
+        }
+    }
+}
+
+// 渲染当前状态并以BMP布局读回
+void renderAndReadBack(vector<unsigned char>& pixels) {
+    if (softwareRenderer) {
+        softRenderScene(softRenderer, defaultThreadCount());
+        softReadBGR(softRenderer, pixels);
+        return;
+    }
+    renderScene();
+    pixels.resize(((WIDTH * 3 + 3) & ~3) * HEIGHT);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_BGR, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+string jsonEscape(const string& text) {
+    string out;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
+// refDir 中缺少参考图或 update 为 true 时写入新的参考图
+int runRegression(const char* refDir, bool update, const char* reportPath) {
+    const int timedFrames = 5;
+    const float badDeltaE = 10.0f;      // 明显可见的色差
+    const double maxBadPixelRatio = 0.005;
+    const double maxMeanDeltaE = 1.0;
+    
+#ifdef GLOBE_HAS_EGL
+    HeadlessContext ctx;
+#endif
+    string rendererName;
+    if (softwareRenderer) {
+        loadEarthImage();
+        buildSoftShadowPixels();
+        rendererName = softRaycastGlobe ? "software-raycast" : "software";
+    } else {
+#ifdef GLOBE_HAS_EGL
+        if (!createHeadlessContext(ctx)) return 1;
+        init();
+        initAntialiasing();
+        rendererName = (const char*)glGetString(GL_RENDERER);
+#else
+        cerr << "错误: 当前平台未启用 EGL，请使用 --soft 运行回归测试" << endl;
+        return 1;
+#endif
+    }
+    mkdir(refDir, 0755);
+    
+    vector<RegressionScene> scenes = buildRegressionScenes();
+    vector<RegressionResult> results;
+    int failed = 0;
+    
+    for (size_t i = 0; i < scenes.size(); ++i) {
+        const RegressionScene& scene = scenes[i];
+        applyViewState(scene.view);
+        
+        vector<unsigned char> pixels;
+        renderAndReadBack(pixels); // 预热，同时得到用于比较的图像
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<unsigned char> scratch;
+        for (int f = 0; f < timedFrames; ++f) {
+            renderAndReadBack(scratch);
+        }
+        
+        RegressionResult result;
+        result.name = scene.name;
+        result.frameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / timedFrames;
+        result.drawCalls = frameDrawCalls;
+        result.residentBytes = currentResidentMemory();
+        result.meanDeltaE = 0.0;
+        result.badPixelRatio = 0.0;
+        
+        string refPath = string(refDir) + "/" + scene.name + ".bmp";
+        unsigned char* refData = NULL;
+        int refWidth = 0, refHeight = 0;
+        ifstream refTest(refPath.c_str());
+        result.hasReference = !update && refTest.good();
+        refTest.close();
+        
+        if (update) {
+            saveBMPFile(refPath.c_str(), pixels.data(), WIDTH, HEIGHT);
+            result.passed = true;
+        } else if (!result.hasReference) {
+            // 缺少参考图说明参考集不完整（新增了场景或目录写错），不能当作通过
+            cerr << "错误: 缺少参考图 " << refPath << "，请用 --update 生成" << endl;
+            result.passed = false;
+        } else if (loadBMPFile(refPath.c_str(), refData, refWidth, refHeight) &&
+                   refWidth == WIDTH && refHeight == HEIGHT) {
+            vector<unsigned char> rgb;
+            bmpPixelsToRGB(pixels, WIDTH, HEIGHT, rgb);
+            compareImages(rgb.data(), refData, WIDTH, HEIGHT, badDeltaE, result.meanDeltaE, result.badPixelRatio);
+            result.passed = result.meanDeltaE <= maxMeanDeltaE && result.badPixelRatio <= maxBadPixelRatio;
+        } else {
+            cerr << "错误: 参考图 " << refPath << " 尺寸不符，请用 --update 重新生成" << endl;
+            result.passed = false;
+        }
+        delete[] refData;
+        
+        if (!result.passed) {
+            ++failed;
+            string diffPath = string(refDir) + "/" + scene.name + ".actual.bmp";
+            saveBMPFile(diffPath.c_str(), pixels.data(), WIDTH, HEIGHT);
+        }
+        cout << (result.passed ? "  ✓ " : "  ✗ ") << scene.name
+             << (update ? "（已写入参考图）" : result.hasReference ? "" : "（缺少参考图）")
+             << "  ΔE均值 " << result.meanDeltaE << "  异常像素 " << result.badPixelRatio * 100 << "%"
+             << "  " << result.frameMs << " ms  " << result.drawCalls << " 次绘制" << endl;
+        results.push_back(result);
+    }
+    
+    ofstream report(reportPath);
+    report << "{\n";
+    report << "  \"renderer\": \"" << jsonEscape(rendererName) << "\",\n";
+    report << "  \"width\": " << WIDTH << ",\n";
+    report << "  \"height\": " << HEIGHT << ",\n";
+    report << "  \"tolerance\": {\"bad_delta_e\": " << badDeltaE << ", \"max_bad_pixel_ratio\": " << maxBadPixelRatio
+           << ", \"max_mean_delta_e\": " << maxMeanDeltaE << "},\n";
+    report << "  \"passed\": " << (results.size() - failed) << ",\n";
+    report << "  \"failed\": " << failed << ",\n";
+    report << "  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RegressionResult& r = results[i];
+        report << "    {\"name\": \"" << r.name << "\", \"passed\": " << (r.passed ? "true" : "false")
+               << ", \"compared\": " << (r.hasReference ? "true" : "false")
+               << ", \"mean_delta_e\": " << r.meanDeltaE << ", \"bad_pixel_ratio\": " << r.badPixelRatio
+               << ", \"frame_ms\": " << r.frameMs << ", \"draw_calls\": " << r.drawCalls
+               << ", \"rss_bytes\": " << r.residentBytes << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    report << "  ]\n}\n";
+    report.close();
+    
+    cout << "回归测试: " << results.size() - failed << " 通过, " << failed << " 失败，报告已写入 " << reportPath << endl;
+    
+#ifdef GLOBE_HAS_EGL
+    if (!softwareRenderer) destroyHeadlessContext(ctx);
+#endif
+    return failed > 0 ? 1 : 0;
+}
+
+// ========================
+// 相机路径基准测试
+// ========================
+// 按时间线回放 rotationX / rotationY / zoom / 光源 / 阴影的变化，不依赖鼠标操作，
+// 不同版本、不同机器之间的结果可以直接比较。时间线由若干段组成，每段一行：
+//   名称 frames=帧数 rx=起:止 ry=起:止 zoom=起:止 light=起:止 shadow=0|1|toggle tess=经x纬 tex=宽度
+// 数值参数写成 起:止 时在段内线性插值，只写一个值则保持不变；tess 与 tex 在段开始时切换，
+// 用于细分级别和纹理尺寸的扫描。以 # 开头的行是注释
+
+struct BenchSegment {
+    string name;
+    int frames;
+    float rotationX[2], rotationY[2], zoom[2];
+    int light[2];
+    int shadow;          // 0 关，1 开，2 每帧切换
+    int slices, stacks;
+    int textureWidth;    // 0 表示使用原始纹理
+};
+
+struct BenchResult {
+    string name;
+    int frames;
+    double seconds;
+    double meanMs, p50Ms, p99Ms, maxMs;
+    int drawCalls;
+    int slices, stacks;
+    int textureWidth, textureHeight;
+};
+
+BenchSegment defaultBenchSegment(const string& name) {
+    BenchSegment seg;
+    seg.name = name;
+    seg.frames = 60;
+    seg.rotationX[0] = seg.rotationX[1] = 20.0f;
+    seg.rotationY[0] = 0.0f;
+    seg.rotationY[1] = 360.0f;
+    seg.zoom[0] = seg.zoom[1] = 1.0f;
+    seg.light[0] = seg.light[1] = 0;
+    seg.shadow = 1;
+    seg.slices = 36;
+    seg.stacks = 18;
+    seg.textureWidth = 0;
+    return seg;
+}
+
+bool parseBenchRange(const string& value, float range[2]) {
+    if (sscanf(value.c_str(), "%f:%f", &range[0], &range[1]) == 2) return true;
+    if (sscanf(value.c_str(), "%f", &range[0]) == 1) {
+        range[1] = range[0];
+        return true;
+    }
+    return false;
+}
+
+bool parseBenchSegment(const string& line, BenchSegment& seg) {
+    istringstream tokens(line);
+    string token;
+    if (!(tokens >> token) || token.find('=') != string::npos) return false;
+    seg = defaultBenchSegment(token);
+    
+    while (tokens >> token) {
+        size_t eq = token.find('=');
+        if (eq == string::npos) return false;
+        string key = token.substr(0, eq);
+        string value = token.substr(eq + 1);
+        float range[2];
+        
+        if (key == "frames") {
+            seg.frames = atoi(value.c_str());
+        } else if (key == "rx" && parseBenchRange(value, range)) {
+            seg.rotationX[0] = range[0]; seg.rotationX[1] = range[1];
+        } else if (key == "ry" && parseBenchRange(value, range)) {
+            seg.rotationY[0] = range[0]; seg.rotationY[1] = range[1];
+        } else if (key == "zoom" && parseBenchRange(value, range)) {
+            seg.zoom[0] = range[0]; seg.zoom[1] = range[1];
+        } else if (key == "light" && parseBenchRange(value, range)) {
+            seg.light[0] = (int)range[0]; seg.light[1] = (int)range[1];
+        } else if (key == "shadow") {
+            seg.shadow = value == "toggle" ? 2 : atoi(value.c_str()) != 0;
+        } else if (key == "tess") {
+            if (sscanf(value.c_str(), "%dx%d", &seg.slices, &seg.stacks) != 2) return false;
+        } else if (key == "tex") {
+            seg.textureWidth = atoi(value.c_str());
+        } else {
+            cerr << "警告: 未知的时间线参数 " << token << endl;
+        }
+    }
     
-    glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
+    int lightCount = (int)lightPositions.size();
+    return seg.frames > 0 && seg.slices >= 3 && seg.stacks >= 2 &&
+           seg.light[0] >= 0 && seg.light[0] < lightCount && seg.light[1] >= 0 && seg.light[1] < lightCount;
 }
 
-void nextLightPosition() {
-    currentLightPosition = (currentLightPosition + 1) % lightPositions.size();
-    LightPosition light = lightPositions[currentLightPosition];
-    cout << "光源位置: " << currentLightPosition << " - " << light.name 
-         << " (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
+// 内置时间线：环绕、缩放、光源与阴影切换，再加细分级别和纹理尺寸扫描
+vector<BenchSegment> builtinBenchTimeline() {
+    const char* lines[] = {
+        "orbit          ry=0:360 rx=20",
+        "tilt           rx=-60:60 ry=45",
+        "zoom-in        zoom=1:2.5 ry=0:90",
+        "zoom-out       zoom=2.5:0.5 ry=90:180",
+        "light-cycle    light=0:7 ry=0:180",
+        "shadow-toggle  shadow=toggle ry=0:180",
+        "no-shadow      shadow=0",
+        "tess-18x9      tess=18x9",
+        "tess-36x18     tess=36x18",
+        "tess-72x36     tess=72x36",
+        "tess-144x72    tess=144x72",
+        "tess-288x144   tess=288x144",
+        "tex-256        tex=256",
+        "tex-512        tex=512",
+        "tex-1024       tex=1024",
+        "tex-2048       tex=2048",
+        "tex-4096       tex=4096",
+        NULL
+    };
+    vector<BenchSegment> timeline;
+    for (int i = 0; lines[i]; ++i) {
+        BenchSegment seg;
+        parseBenchSegment(lines[i], seg);
+        timeline.push_back(seg);
+    }
+    return timeline;
 }
 
-void prevLightPosition() {
-    currentLightPosition = (currentLightPosition - 1 + lightPositions.size()) % lightPositions.size();
-    LightPosition light = lightPositions[currentLightPosition];
-    cout << "光源位置: " << currentLightPosition << " - " << light.name 
-         << " (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
+bool loadBenchTimeline(const char* filename, vector<BenchSegment>& timeline) {
+    ifstream file(filename);
+    if (!file) {
+        cerr << "错误: 无法打开时间线文件 " << filename << endl;
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        ++lineNumber;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#') continue;
+        BenchSegment seg;
+        if (!parseBenchSegment(line, seg)) {
+            cerr << "错误: 时间线第 " << lineNumber << " 行格式不正确" << endl;
+            return false;
+        }
+        timeline.push_back(seg);
+    }
+    return !timeline.empty();
 }
 
-void setLightPosition(int index) {
-    if (index >= 0 && index < (int)lightPositions.size()) {
-        currentLightPosition = index;
-        LightPosition light = lightPositions[currentLightPosition];
-        cout << "光源位置: " << currentLightPosition << " - " << light.name 
-             << " (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
-    } else {
-        cout << "无效的光源位置索引: " << index << "，有效范围: 0-" << lightPositions.size()-1 << endl;
+// 双线性重采样 RGB 图像
+void resampleImage(const vector<unsigned char>& src, int srcWidth, int srcHeight,
+                   vector<unsigned char>& dst, int dstWidth, int dstHeight) {
+    dst.resize((size_t)dstWidth * dstHeight * 3);
+    for (int y = 0; y < dstHeight; ++y) {
+        float fy = (y + 0.5f) * srcHeight / dstHeight - 0.5f;
+        int y0 = max(0, min(srcHeight - 1, (int)floor(fy)));
+        int y1 = min(srcHeight - 1, y0 + 1);
+        float wy = max(0.0f, min(1.0f, fy - y0));
+        for (int x = 0; x < dstWidth; ++x) {
+            float fx = (x + 0.5f) * srcWidth / dstWidth - 0.5f;
+            int x0 = max(0, min(srcWidth - 1, (int)floor(fx)));
+            int x1 = min(srcWidth - 1, x0 + 1);
+            float wx = max(0.0f, min(1.0f, fx - x0));
+            for (int c = 0; c < 3; ++c) {
+                float top = src[(y0 * srcWidth + x0) * 3 + c] * (1 - wx) + src[(y0 * srcWidth + x1) * 3 + c] * wx;
+                float bottom = src[(y1 * srcWidth + x0) * 3 + c] * (1 - wx) + src[(y1 * srcWidth + x1) * 3 + c] * wx;
+                dst[((size_t)y * dstWidth + x) * 3 + c] = (unsigned char)(top * (1 - wy) + bottom * wy + 0.5f);
+            }
+        }
     }
 }
 
-void toggleLighting() {
-    lightEnabled = !lightEnabled;
-    if (lightEnabled) {
-        glEnable(GL_LIGHTING);
-        glEnable(GL_LIGHT0);
-        cout << "光照: 开启" << endl;
-    } else {
-        glDisable(GL_LIGHTING);
-        cout << "光照: 关闭" << endl;
+// 基准测试的运行状态，无窗口循环和窗口模式的显示回调共用
+struct BenchRun {
+    vector<BenchSegment> timeline;
+    vector<BenchResult> results;
+    size_t segment;
+    int frame;                 // -1 表示当前段尚未开始
+    bool window;
+    FrameHistogram histogram;
+    chrono::steady_clock::time_point segmentStart;
+    vector<unsigned char> originalImage;
+    int originalWidth, originalHeight;
+    int currentTextureWidth;
+    string reportPath;
+};
+
+BenchRun benchRun;
+
+void benchFinishGPU() {
+    if (softwareRenderer) return;
+    if (benchRun.window) {
+        glutSwapBuffers();
     }
+    // 每帧同步，使单帧耗时包含GPU执行时间
+    glFinish();
 }
 
-void toggleShadow() {
-    shadowEnabled = !shadowEnabled;
-    cout << "阴影: " << (shadowEnabled ? "开启" : "关闭") << endl;
+void benchRenderFrame() {
+    if (softwareRenderer) {
+        softRenderScene(softRenderer, renderThreads > 0 ? renderThreads : defaultThreadCount());
+    } else {
+        renderScene();
+    }
+    benchFinishGPU();
 }
 
-void adjustShadowIntensity(float delta) {
-    shadowIntensity += delta;
-    if (shadowIntensity < 0.1f) shadowIntensity = 0.1f;
-    if (shadowIntensity > 1.0f) shadowIntensity = 1.0f;
-    cout << "阴影强度: " << shadowIntensity << endl;
+// 段开始时切换细分级别和纹理尺寸（不计入计时）
+void configureBenchSegment(const BenchSegment& seg) {
+    sphereSlices = seg.slices;
+    sphereStacks = seg.stacks;
+    if (seg.textureWidth == benchRun.currentTextureWidth) return;
     
-    // 更新阴影纹理
-    if (shadowTextureID != 0) {
-        glDeleteTextures(1, &shadowTextureID);
-        shadowTextureID = 0;
+    int width = seg.textureWidth;
+    if (!softwareRenderer && width > 0) {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (width > maxSize) {
+            cout << "  " << seg.name << ": 纹理宽度 " << width << " 超过 GL_MAX_TEXTURE_SIZE，改用 " << maxSize << endl;
+            width = maxSize;
+        }
     }
-    createSoftShadowTexture();
+    if (width > 0) {
+        vector<unsigned char> resized;
+        resampleImage(benchRun.originalImage, benchRun.originalWidth, benchRun.originalHeight,
+                      resized, width, max(1, width / 2));
+        setEarthImage(resized.data(), width, max(1, width / 2));
+    } else {
+        setEarthImage(benchRun.originalImage.data(), benchRun.originalWidth, benchRun.originalHeight);
+    }
+    if (!softwareRenderer) {
+        if (textureID != 0) glDeleteTextures(1, &textureID);
+        uploadEarthTexture();
+    }
+    benchRun.currentTextureWidth = seg.textureWidth;
 }
 
-// 打印光源信息
-void printLightInfo() {
-    cout << endl;
-    cout << "========================================" << endl;
-    cout << "当前光源位置: " << currentLightPosition << endl;
-    LightPosition light = lightPositions[currentLightPosition];
-    cout << "位置描述: " << light.name << endl;
-    cout << "坐标: (" << light.x << ", " << light.y << ", " << light.z << ")" << endl;
-    cout << "光照状态: " << (lightEnabled ? "开启" : "关闭") << endl;
-    cout << "阴影状态: " << (shadowEnabled ? "开启" : "关闭") << endl;
-    cout << "阴影强度: " << shadowIntensity << endl;
-    cout << "========================================" << endl;
+// 按段内进度插值出当前帧的视图状态
+void applyBenchFrame(const BenchSegment& seg, int frame) {
+    float t = seg.frames > 1 ? (float)frame / (seg.frames - 1) : 0.0f;
+    rotationX = seg.rotationX[0] + (seg.rotationX[1] - seg.rotationX[0]) * t;
+    rotationY = seg.rotationY[0] + (seg.rotationY[1] - seg.rotationY[0]) * t;
+    zoom = seg.zoom[0] + (seg.zoom[1] - seg.zoom[0]) * t;
+    currentLightPosition = (int)floor(seg.light[0] + (seg.light[1] - seg.light[0]) * t + 0.5f);
+    shadowEnabled = seg.shadow == 2 ? (frame % 2 == 0) : seg.shadow != 0;
 }
 
-// ========================
-// 显示回调函数
-// ========================
-
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    
-    // 设置投影矩阵
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, (double)WIDTH/HEIGHT, 0.1, 100.0);
-    
-    // 设置模型视图矩阵
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    
-    // 设置相机位置
-    gluLookAt(0, 0, 5, 0, 0, 0, 0, 1, 0);
-    
-    // 设置光源
-    setCurrentLight();
+// 渲染时间线上的下一帧，全部完成时返回 false
+bool benchStep() {
+    BenchRun& run = benchRun;
+    if (run.segment >= run.timeline.size()) return false;
+    const BenchSegment& seg = run.timeline[run.segment];
     
-    // 绘制地面
-    drawFloor();
-    
-    // 绘制阴影（在地面之上）
-    if (shadowEnabled && lightEnabled) {
-        drawNaturalShadow();
+    if (run.frame < 0) {
+        configureBenchSegment(seg);
+        applyBenchFrame(seg, 0);
+        benchRenderFrame(); // 预热，同时完成纹理上传和网格生成
+        run.histogram.clear();
+        run.frame = 0;
+        run.segmentStart = chrono::steady_clock::now();
+        return true;
     }
     
-    // 应用地球变换
-    glScalef(zoom, zoom, zoom);
-    glRotatef(rotationX, 1.0f, 0.0f, 0.0f);
-    glRotatef(rotationY, 0.0f, 1.0f, 0.0f);
-    
-    // 启用深度测试
-    glEnable(GL_DEPTH_TEST);
+    chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+    applyBenchFrame(seg, run.frame);
+    benchRenderFrame();
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    run.histogram.record(chrono::duration_cast<chrono::microseconds>(now - frameStart).count());
     
-    // 设置地球材质属性
-    if (lightEnabled) {
-        GLfloat matAmbient[] = {0.7f, 0.7f, 0.7f, 1.0f};
-        GLfloat matDiffuse[] = {0.9f, 0.9f, 0.9f, 1.0f};
-        GLfloat matSpecular[] = {0.3f, 0.3f, 0.3f, 1.0f};
-        GLfloat matShininess = 30.0f;
+    if (++run.frame == seg.frames) {
+        BenchResult result;
+        result.name = seg.name;
+        result.frames = seg.frames;
+        result.seconds = chrono::duration<double>(now - run.segmentStart).count();
+        result.meanMs = run.histogram.meanMs();
+        result.p50Ms = run.histogram.percentileMs(0.5);
+        result.p99Ms = run.histogram.percentileMs(0.99);
+        result.maxMs = run.histogram.maxMs();
+        result.drawCalls = frameDrawCalls;
+        result.slices = seg.slices;
+        result.stacks = seg.stacks;
+        result.textureWidth = earthTexWidth;
+        result.textureHeight = earthTexHeight;
+        run.results.push_back(result);
         
-        glMaterialfv(GL_FRONT, GL_AMBIENT, matAmbient);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
-        glMaterialf(GL_FRONT, GL_SHININESS, matShininess);
-    } else {
-        glDisable(GL_LIGHTING);
-        glColor3f(1.0f, 1.0f, 1.0f);
+        char line[256];
+        snprintf(line, sizeof(line), "  %-16s %6d %9.1f %8.3f %8.3f %8.3f %7d %9s %11s",
+                 result.name.c_str(), result.frames, result.frames / result.seconds, result.meanMs,
+                 result.p99Ms, result.maxMs, result.drawCalls,
+                 (to_string(result.slices) + "x" + to_string(result.stacks)).c_str(),
+                 (to_string(result.textureWidth) + "x" + to_string(result.textureHeight)).c_str());
+        cout << line << endl;
+        
+        ++run.segment;
+        run.frame = -1;
     }
-    
-    // 绘制地球
-    drawCustomSphere(1.0f, 36, 18);
-    
-    // 绘制环境光遮蔽（接触阴影）
-    if (shadowEnabled) {
-        drawAmbientOcclusion();
+    return true;
+}
+
+bool writeBenchReport(const string& path) {
+    ofstream file(path.c_str());
+    if (!file) {
+        cerr << "错误: 无法写入基准报告 " << path << endl;
+        return false;
     }
-    
-    // 如果禁用了光照，重新启用它
-    if (lightEnabled) {
-        glEnable(GL_LIGHTING);
+    file << "segment,frames,seconds,fps,mean_ms,p50_ms,p99_ms,max_ms,draw_calls,slices,stacks,texture_width,texture_height\n";
+    for (size_t i = 0; i < benchRun.results.size(); ++i) {
+        const BenchResult& r = benchRun.results[i];
+        file << r.name << "," << r.frames << "," << r.seconds << "," << r.frames / r.seconds << ","
+             << r.meanMs << "," << r.p50Ms << "," << r.p99Ms << "," << r.maxMs << "," << r.drawCalls << ","
+             << r.slices << "," << r.stacks << "," << r.textureWidth << "," << r.textureHeight << "\n";
     }
-    
-    glutSwapBuffers();
+    cout << "基准报告已写入 " << path << endl;
+    return true;
 }
 
-// ========================
-// 交互函数
-// ========================
+// 准备时间线和纹理；返回 false 表示时间线无效
+bool prepareBenchRun(const char* timelineFile, const char* reportPath, bool window) {
+    benchRun.timeline.clear();
+    if (timelineFile) {
+        if (!loadBenchTimeline(timelineFile, benchRun.timeline)) return false;
+    } else {
+        benchRun.timeline = builtinBenchTimeline();
+    }
+    benchRun.results.clear();
+    benchRun.segment = 0;
+    benchRun.frame = -1;
+    benchRun.window = window;
+    benchRun.originalImage = earthPixels;
+    benchRun.originalWidth = earthTexWidth;
+    benchRun.originalHeight = earthTexHeight;
+    benchRun.currentTextureWidth = 0;
+    benchRun.reportPath = reportPath ? reportPath : "";
+    
+    cout << "相机路径基准: " << benchRun.timeline.size() << " 段，" << WIDTH << "x" << HEIGHT
+         << (softwareRenderer ? "，CPU软件渲染" : window ? "，窗口模式（不限帧率）" : "，离屏渲染") << endl;
+    cout << "  段名              帧数       FPS   平均ms    p99ms    最大ms  绘制调用   网格分段    纹理尺寸" << endl;
+    return true;
+}
 
-void mouse(int button, int state, int x, int y) {
-    if (button == GLUT_LEFT_BUTTON) {
-        mouseLeftDown = (state == GLUT_DOWN);
-        lastMouseX = x;
-        lastMouseY = y;
-    } else if (button == 3) { // 滚轮向上
-        zoom *= 1.1f;
-        glutPostRedisplay();
-    } else if (button == 4) { // 滚轮向下
-        zoom /= 1.1f;
-        glutPostRedisplay();
+void finishBenchRun() {
+    double totalFrames = 0, totalSeconds = 0;
+    for (size_t i = 0; i < benchRun.results.size(); ++i) {
+        totalFrames += benchRun.results[i].frames;
+        totalSeconds += benchRun.results[i].seconds;
+    }
+    if (totalSeconds > 0) {
+        cout << "合计 " << totalFrames << " 帧，" << totalSeconds << " 秒，平均 " << totalFrames / totalSeconds << " FPS" << endl;
+    }
+    if (!benchRun.reportPath.empty()) {
+        writeBenchReport(benchRun.reportPath);
     }
 }
 
-void motion(int x, int y) {
-    if (mouseLeftDown) {
-        rotationY += (x - lastMouseX) * 0.5f;
-        rotationX += (y - lastMouseY) * 0.5f;
-        lastMouseX = x;
-        lastMouseY = y;
+// 窗口模式：显示回调每次渲染一帧并立即请求下一帧，不等待用户输入
+void benchDisplay() {
+    if (benchStep()) {
         glutPostRedisplay();
+    } else {
+        finishBenchRun();
+        exit(0);
     }
 }
 
-void keyboard(unsigned char key, int x, int y) {
-    switch (key) {
-        case 27: // ESC键退出
-            exit(0);
-            break;
-            
-        case '+': // 放大
-        case '=':
-            zoom *= 1.1f;
-            glutPostRedisplay();
-            break;
-            
-        case '-': // 缩小
-        case '_':
-            zoom /= 1.1f;
-            glutPostRedisplay();
-            break;
-            
-        case 'r': // 重置
-        case 'R':
-            rotationX = rotationY = 0.0f;
-            zoom = 1.0f;
-            glutPostRedisplay();
-            break;
-            
-        case 't': // 重新加载纹理
-        case 'T':
-            if (textureID != 0) {
-                glDeleteTextures(1, &textureID);
-                textureID = 0;
-            }
-            initTexture();
-            glutPostRedisplay();
-            break;
-            
-        case 'l': // 切换光照开关
-        case 'L':
-            toggleLighting();
-            glutPostRedisplay();
-            break;
-            
-        case 's': // 切换阴影开关
-        case 'S':
-            toggleShadow();
-            glutPostRedisplay();
-            break;
-            
-        case '[': // 减少阴影强度
-            adjustShadowIntensity(-0.1f);
-            glutPostRedisplay();
-            break;
-            
-        case ']': // 增加阴影强度
-            adjustShadowIntensity(0.1f);
-            glutPostRedisplay();
-            break;
-            
-        case 'n': // 下一个光源位置
-        case 'N':
-            nextLightPosition();
-            printLightInfo();
-            glutPostRedisplay();
-            break;
-            
-        case 'p': // 上一个光源位置
-        case 'P':
-            prevLightPosition();
-            printLightInfo();
-            glutPostRedisplay();
-            break;
-            
-        case 'i': // 显示当前光源信息
-        case 'I':
-            printLightInfo();
-            break;
-            
-        // 数字键选择光源位置（0-7对应8个光源位置）
-        case '0': setLightPosition(0); glutPostRedisplay(); break;
-        case '1': setLightPosition(1); glutPostRedisplay(); break;
-        case '2': setLightPosition(2); glutPostRedisplay(); break;
-        case '3': setLightPosition(3); glutPostRedisplay(); break;
-        case '4': setLightPosition(4); glutPostRedisplay(); break;
-        case '5': setLightPosition(5); glutPostRedisplay(); break;
-        case '6': setLightPosition(6); glutPostRedisplay(); break;
-        case '7': setLightPosition(7); glutPostRedisplay(); break;
-        
-        // 其他数字键提示
-        case '8':
-        case '9':
-            cout << "提示：光源位置只有0-7，共8个位置" << endl;
-            break;
-    }
+// 尽量关闭垂直同步，使窗口模式的帧率不受显示器刷新率限制（需在创建窗口前调用）
+void requestUncappedSwap() {
+    setenv("vblank_mode", "0", 1);          // Mesa
+    setenv("__GL_SYNC_TO_VBLANK", "0", 1);  // NVIDIA
 }
 
-// ========================
-// 初始化函数
-// ========================
+void disableSwapInterval() {
+#ifdef __APPLE__
+    GLint interval = 0;
+    CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &interval);
+#endif
+}
 
-void init() {
-    glClearColor(0.0f, 0.0f, 0.1f, 1.0f);
-    
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    
-    // 启用颜色混合
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
-    initTexture();
-    createSoftShadowTexture();
+// 无窗口运行整条时间线；没有 EGL 的平台返回 -1，由调用方改用窗口模式
+int runBenchmark(const char* timelineFile, const char* reportPath) {
+    if (softwareRenderer) {
+        loadEarthImage();
+        buildSoftShadowPixels();
+        if (!prepareBenchRun(timelineFile, reportPath, false)) return 1;
+        while (benchStep()) {}
+        finishBenchRun();
+        return 0;
+    }
+#ifdef GLOBE_HAS_EGL
+    HeadlessContext ctx;
+    if (!createHeadlessContext(ctx)) return 1;
+    init();
+    initAntialiasing();
+    if (!prepareBenchRun(timelineFile, reportPath, false)) {
+        destroyHeadlessContext(ctx);
+        return 1;
+    }
+    while (benchStep()) {}
+    finishBenchRun();
+    if (textureID != 0) glDeleteTextures(1, &textureID);
+    if (shadowTextureID != 0) glDeleteTextures(1, &shadowTextureID);
+    destroyHeadlessContext(ctx);
+    return 0;
+#else
+    return -1;
+#endif
 }
 
 // ========================
@@ -916,27 +11492,338 @@ void init() {
 // ========================
 
 int main(int argc, char** argv) {
+    // 命令行参数：
+    //   --headless views.txt  按视图列表离屏渲染并输出图片，不创建窗口
+    //   --size WxH            渲染尺寸
+    //   --soft                离屏模式改用CPU软件光栅化
+    //   --raycast             软件渲染时逐像素光线求交绘制地球（隐含 --soft）
+    //   --threads N           软件渲染线程数
+    //   --soft-bench [帧数]   测量软件渲染在不同线程数下的帧率
+    //   --impostor            用替身四边形绘制地球
+    //   --impostor-bench [帧数] 比较替身与网格在不同屏幕尺寸下的吞吐
+    //   --lights N            放置 N 个点光源（分簇着色）
+    //   --lights-bench [帧数] 比较分簇着色与遍历全部光源在不同光源数下的帧时间
+    //   --atmosphere          绘制大气散射
+    //   --atmosphere-cache 文件 大气查找表缓存路径（默认 ~/.cache/earth-globe/atmosphere_lut.bin）
+    //   --sun-time 时间       太阳方向取该 UTC 时间（YYYY-MM-DDTHH:MM[:SS]）的真实太阳位置
+    //   --clouds 模式         云层帧序列（如 clouds/%03d.bmp），经PBO环流式上传
+    //   --clouds-fps N        云层播放帧率（默认 10）
+    //   --stream-bench [帧数] 比较同步上传与PBO环上传的每帧停顿（需要 --clouds）
+    //   --field 文件          时间序列数据场（内存映射，格式见"时间序列数据场叠加"一节）
+    //   --field-fps N         数据场自动播放速度（时间步/秒，默认 0 不播放）
+    //   --field-lut 图片      数据场色标（BMP，取中间一行）
+    //   --field-generate 文件 WxHxN  生成 N 个逐时时间步的测试数据场后退出
+    //   --field-bench [步数]  比较预取纹理环与同步读取在播放、拖动、跳转时的每帧停顿（需要 --field）
+    //   --markers 文件        标记点文件（每行 纬度,经度[,r,g,b]）
+    //   --markers-random N    生成 N 个测试标记点
+    //   --markers-bench [帧数] 测量1万/100万/1000万个标记点的建树和绘制耗时
+    //   --coastlines 文件     海岸线折线文件（GMT 多段格式，'>' 分隔折线，每行 经度 纬度）
+    //   --borders 文件        国界折线文件（格式同上）
+    //   --borders-random N    生成约 N 个顶点的测试折线
+    //   --borders-bench [帧数] 比较按缩放选级与完整精度绘制的帧时间
+    //   --routes 文件         航线文件（每行 起点纬度,起点经度,终点纬度,终点经度[,r,g,b[,a]]）
+    //   --routes-random N     生成 N 条测试航线
+    //   --routes-bench [帧数] 测量批量绘制、逐条立即模式绘制、增量更新与整体重建的耗时
+    //   --heatmap 文件        热力图事件文件（每行 纬度,经度[,权重]）
+    //   --heatmap-random N    生成 N 个测试事件
+    //   --heatmap-stream N    模拟每秒到达 N 个事件、每个事件存在8秒的事件流
+    //   --heatmap-bench [帧数] 测量批量累加（串行/多线程）、增量更新与分块上传的耗时
+    //   --font 文件           标注用的 GNU Unifont .hex 字形文件（默认查找 unifont.hex、/usr/share/unifont/unifont.hex）
+    //   --labels 文件         地名标注文件（每行 纬度,经度,名称[,优先级]，UTF-8）
+    //   --labels-random N     生成 N 个测试标注
+    //   --labels-bench [帧数] 测量1万/5万个候选标注的排版（网格剔除/两两比较）和绘制耗时
+    //   --satellites N        在地球周围加入 N 颗测试卫星（场景图节点）
+    //   --scene-bench [帧数]  测量1千/1万/10万颗卫星时场景图每帧更新和剔除的耗时
+    //   --transform-bench [点数] 比较批量SIMD坐标变换与逐点 libm 实现的吞吐和误差（默认100万个点）
+    //   --regress 目录        按固定场景集做参考图像与性能回归测试
+    //   --update              回归测试时重新生成参考图
+    //   --report 文件         回归测试报告路径（默认 regression_report.json）
+    //   --frame-report 文件   帧时间报告路径（.csv 或 .json，默认 frame_times.json）
+    //   --hitch-ms 毫秒       超过该耗时的帧记为卡顿（默认 33.3）
+    //   --bench [时间线文件]  回放相机路径时间线并输出每段吞吐（默认内置时间线），结果写入 --report 指定的CSV
+    //   --bench-window        基准测试使用窗口并关闭垂直同步，而不是离屏渲染
+    //   --record 文件         录制窗口画面：.y4m 视频或BMP序列（如 frames/%05d.bmp）
+    //   --record-fps N        Y4M 文件头中的帧率（默认 30）
+    //   --record-bench [帧数] 比较不录制、同步读回与PBO环+栅栏读回的帧时间和录制吞吐
+    //   --control 路径|端口   在 Unix 域套接字（或 127.0.0.1 上的TCP端口）接受控制命令并输出 Prometheus 指标
+    const char* headlessViews = NULL;
+    const char* regressDir = NULL;
+    const char* reportPath = "regression_report.json";
+    bool updateReferences = false;
+    int softBenchFrames = 0;
+    int impostorBenchFrames = 0;
+    int lightsBenchFrames = 0;
+    int streamBenchFrames = 0;
+    int fieldBenchSteps = 0;
+    int markersBenchFrames = 0;
+    int bordersBenchFrames = 0;
+    int routesBenchFrames = 0;
+    int heatmapBenchFrames = 0;
+    int labelsBenchFrames = 0;
+    int sceneBenchFrames = 0;
+    int transformBenchPoints = 0;
+    int recordBenchFrames = 0;
+    bool benchMode = false;
+    bool benchWindow = false;
+    const char* benchTimeline = NULL;
+    const char* benchReport = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headlessViews = argv[++i];
+        } else if (strcmp(argv[i], "--soft") == 0) {
+            softwareRenderer = true;
+        } else if (strcmp(argv[i], "--raycast") == 0) {
+            softwareRenderer = true;
+            softRaycastGlobe = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            renderThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--soft-bench") == 0) {
+            softBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 50;
+        } else if (strcmp(argv[i], "--regress") == 0 && i + 1 < argc) {
+            regressDir = argv[++i];
+        } else if (strcmp(argv[i], "--update") == 0) {
+            updateReferences = true;
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportPath = argv[++i];
+            benchReport = reportPath;
+        } else if (strcmp(argv[i], "--frame-report") == 0 && i + 1 < argc) {
+            frameReportPath = argv[++i];
+            frameReportRequested = true;
+        } else if (strcmp(argv[i], "--hitch-ms") == 0 && i + 1 < argc) {
+            frameStats.hitchThresholdMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchMode = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') benchTimeline = argv[++i];
+        } else if (strcmp(argv[i], "--bench-window") == 0) {
+            benchMode = true;
+            benchWindow = true;
+        } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            setPointLightCount(max(0, atoi(argv[++i])));
+        } else if (strcmp(argv[i], "--lights-bench") == 0) {
+            lightsBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if (strcmp(argv[i], "--atmosphere-cache") == 0 && i + 1 < argc) {
+            atmosphereCachePath = argv[++i];
+        } else if (strcmp(argv[i], "--atmosphere") == 0) {
+            atmosphereEnabled = true;
+        } else if (strcmp(argv[i], "--sun-time") == 0 && i + 1 < argc) {
+            sunTimeOverride = parseUtcTime(argv[++i]);
+            if (sunTimeOverride < 0.0) {
+                cerr << "错误: --sun-time 参数格式应为 YYYY-MM-DDTHH:MM[:SS]（UTC）" << endl;
+                return 1;
+            }
+            realSunEnabled = true;
+        } else if (strcmp(argv[i], "--clouds") == 0 && i + 1 < argc) {
+            cloudFramePattern = argv[++i];
+            cloudsEnabled = true;
+        } else if (strcmp(argv[i], "--clouds-fps") == 0 && i + 1 < argc) {
+            cloudFramesPerSecond = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stream-bench") == 0) {
+            streamBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 100;
+        } else if (strcmp(argv[i], "--field") == 0 && i + 1 < argc) {
+            fieldPath = argv[++i];
+            fieldEnabled = true;
+        } else if (strcmp(argv[i], "--field-fps") == 0 && i + 1 < argc) {
+            fieldFramesPerSecond = max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--field-lut") == 0 && i + 1 < argc) {
+            fieldLutPath = argv[++i];
+        } else if (strcmp(argv[i], "--field-generate") == 0 && i + 2 < argc) {
+            const char* path = argv[++i];
+            int w = 0, h = 0, n = 0;
+            if (sscanf(argv[++i], "%dx%dx%d", &w, &h, &n) != 3 || w <= 0 || h <= 0 || n <= 0) {
+                cerr << "错误: --field-generate 的尺寸应为 宽x高x帧数" << endl;
+                return 1;
+            }
+            return generateFieldFile(path, w, h, n) ? 0 : 1;
+        } else if (strcmp(argv[i], "--field-bench") == 0) {
+            fieldBenchSteps = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 200;
+        } else if (strcmp(argv[i], "--markers") == 0 && i + 1 < argc) {
+            if (!loadMarkerFile(argv[++i], markerData)) return 1;
+            markersEnabled = true;
+        } else if (strcmp(argv[i], "--markers-random") == 0 && i + 1 < argc) {
+            generateMarkers((size_t)max(0L, atol(argv[++i])), markerData);
+            markersEnabled = true;
+        } else if (strcmp(argv[i], "--markers-bench") == 0) {
+            markersBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if ((strcmp(argv[i], "--coastlines") == 0 || strcmp(argv[i], "--borders") == 0) && i + 1 < argc) {
+            int kind = strcmp(argv[i], "--coastlines") == 0 ? BORDER_COASTLINE : BORDER_COUNTRY;
+            if (!loadBorderFile(argv[++i], kind, borderData)) return 1;
+            bordersEnabled = true;
+        } else if (strcmp(argv[i], "--borders-random") == 0 && i + 1 < argc) {
+            generateBorders((size_t)max(0L, atol(argv[++i])), borderData);
+            bordersEnabled = true;
+        } else if (strcmp(argv[i], "--borders-bench") == 0) {
+            bordersBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if (strcmp(argv[i], "--routes") == 0 && i + 1 < argc) {
+            vector<RouteArc> arcs;
+            if (!loadRouteFile(argv[++i], arcs)) return 1;
+            setRoutes(routeLayer, arcs);
+            routesEnabled = true;
+        } else if (strcmp(argv[i], "--routes-random") == 0 && i + 1 < argc) {
+            vector<RouteArc> arcs;
+            generateRoutes((size_t)max(0L, atol(argv[++i])), arcs);
+            setRoutes(routeLayer, arcs);
+            routesEnabled = true;
+        } else if (strcmp(argv[i], "--routes-bench") == 0) {
+            routesBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            if (!loadHeatmapFile(argv[++i], heatmapLayer)) return 1;
+            heatmapEnabled = true;
+        } else if (strcmp(argv[i], "--heatmap-random") == 0 && i + 1 < argc) {
+            generateHeatPoints((size_t)max(0L, atol(argv[++i])), heatmapLayer);
+            heatmapEnabled = true;
+        } else if (strcmp(argv[i], "--heatmap-stream") == 0 && i + 1 < argc) {
+            heatmapStreamRate = max(0.0, atof(argv[++i]));
+            heatmapStreamClock = chrono::steady_clock::now();
+            heatmapEnabled = true;
+        } else if (strcmp(argv[i], "--heatmap-bench") == 0) {
+            heatmapBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if (strcmp(argv[i], "--satellites") == 0 && i + 1 < argc) {
+            addSatellites(sceneGraph, (size_t)max(0L, atol(argv[++i])));
+        } else if (strcmp(argv[i], "--scene-bench") == 0) {
+            sceneBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 100;
+        } else if (strcmp(argv[i], "--font") == 0 && i + 1 < argc) {
+            labelFontPath = argv[++i];
+        } else if (strcmp(argv[i], "--labels") == 0 && i + 1 < argc) {
+            vector<Label> labels;
+            if (!loadLabelFile(argv[++i], labels)) return 1;
+            setLabels(labelLayer, labels);
+            labelsEnabled = true;
+        } else if (strcmp(argv[i], "--labels-random") == 0 && i + 1 < argc) {
+            vector<Label> labels;
+            generateLabels((size_t)max(0L, atol(argv[++i])), labels);
+            setLabels(labelLayer, labels);
+            labelsEnabled = true;
+        } else if (strcmp(argv[i], "--labels-bench") == 0) {
+            labelsBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if (strcmp(argv[i], "--transform-bench") == 0) {
+            transformBenchPoints = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 1000000;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--record-fps") == 0 && i + 1 < argc) {
+            recordFramesPerSecond = max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--record-bench") == 0) {
+            recordBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 100;
+        } else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+            controlAddress = argv[++i];
+        } else if (strcmp(argv[i], "--impostor") == 0) {
+            globeImpostor = true;
+        } else if (strcmp(argv[i], "--impostor-bench") == 0) {
+            impostorBenchFrames = (i + 1 < argc && isdigit(argv[i + 1][0])) ? atoi(argv[++i]) : 20;
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &WIDTH, &HEIGHT) != 2 || WIDTH <= 0 || HEIGHT <= 0) {
+                cerr << "错误: --size 参数格式应为 宽x高" << endl;
+                return 1;
+            }
+        }
+    }
+    
+    if (transformBenchPoints > 0) {
+        return runTransformBenchmark(transformBenchPoints);
+    }
+    if (softBenchFrames > 0) {
+        softwareRenderer = true;
+        return runSoftwareBenchmark(softBenchFrames);
+    }
+    if (regressDir) {
+        return runRegression(regressDir, updateReferences, reportPath);
+    }
+    if (impostorBenchFrames > 0) {
+        return runImpostorBenchmark(impostorBenchFrames);
+    }
+    if (lightsBenchFrames > 0) {
+        return runLightsBenchmark(lightsBenchFrames);
+    }
+    if (streamBenchFrames > 0) {
+        return runStreamBenchmark(streamBenchFrames);
+    }
+    if (fieldBenchSteps > 0) {
+        return runFieldBenchmark(fieldBenchSteps);
+    }
+    if (markersBenchFrames > 0) {
+        return runMarkersBenchmark(markersBenchFrames);
+    }
+    if (bordersBenchFrames > 0) {
+        return runBordersBenchmark(bordersBenchFrames);
+    }
+    if (routesBenchFrames > 0) {
+        return runRoutesBenchmark(routesBenchFrames);
+    }
+    if (heatmapBenchFrames > 0) {
+        return runHeatmapBenchmark(heatmapBenchFrames);
+    }
+    if (labelsBenchFrames > 0) {
+        return runLabelsBenchmark(labelsBenchFrames);
+    }
+    if (sceneBenchFrames > 0) {
+        return runSceneBenchmark(sceneBenchFrames);
+    }
+    if (recordBenchFrames > 0) {
+        return runRecordBenchmark(recordBenchFrames);
+    }
+    if (benchMode && !benchWindow) {
+        int status = runBenchmark(benchTimeline, benchReport);
+        if (status >= 0) return status;
+        benchWindow = true; // 没有无窗口上下文，改用窗口模式
+    }
+    
+    if (headlessViews) {
+        if (!controlAddress.empty()) cerr << "警告: --control 只在窗口模式下可用" << endl;
+        if (!recordPath.empty()) cerr << "警告: --record 只在窗口模式下可用" << endl;
+        int status = runHeadless(headlessViews);
+        if (frameReportRequested) writeFrameReport();
+        return status;
+    }
+    
+    // 窗口模式按 ESC 经 exit() 退出，用 atexit 保证退出时写出帧时间报告
+    atexit(writeFrameReport);
+    
+    if (benchWindow) {
+        requestUncappedSwap();
+    }
+    
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_MULTISAMPLE);
     glutInitWindowSize(WIDTH, HEIGHT);
     glutCreateWindow("真实地球仪 - 自然阴影效果");
     
-    // 启用多重采样抗锯齿
-    glEnable(GL_MULTISAMPLE);
-    glEnable(GL_POINT_SMOOTH);
-    glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_POLYGON_SMOOTH);
-    glHint(GL_POINT_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-    
+    initAntialiasing();
     init();
+    inputView = captureViewState();
+    
+    if (benchWindow) {
+        disableSwapInterval();
+        if (!prepareBenchRun(benchTimeline, benchReport, true)) return 1;
+        glutDisplayFunc(benchDisplay);
+        glutMainLoop();
+        return 0;
+    }
     
-    glutDisplayFunc(display);
+    if (softwareRenderer) {
+        // CPU渲染在独立线程进行，主线程只处理输入和显示
+        glutDisplayFunc(softDisplay);
+        glutTimerFunc(2, softPresentTimer, 0);
+        startSoftRenderThread();
+        atexit(stopSoftRenderThread);
+    } else {
+        glutDisplayFunc(display);
+    }
+    glutReshapeFunc(reshape);
     glutMouseFunc(mouse);
     glutMotionFunc(motion);
+    glutPassiveMotionFunc(passiveMotion);
     glutKeyboardFunc(keyboard);
     
+    if (!recordPath.empty()) {
+        if (!frameRecorder.start(recordPath, recordFramesPerSecond)) return 1;
+        atexit(stopRecordingEncoder);
+        cout << "录制到 " << recordPath << "（E 键暂停/继续）" << endl;
+    }
+    if (!controlAddress.empty()) {
+        if (!startControlServer(controlAddress)) return 1;
+        atexit(stopControlServer);
+        glutTimerFunc(CONTROL_POLL_MIN_MS, controlTimer, CONTROL_POLL_MIN_MS);
+    }
+    
     // 打印操作说明
     cout << endl;
     cout << "========================================" << endl;
@@ -955,6 +11842,21 @@ int main(int argc, char** argv) {
     cout << "  N 键 - 下一个光源位置" << endl;
     cout << "  P 键 - 上一个光源位置" << endl;
     cout << "  I 键 - 显示当前光源信息" << endl;
+    cout << "  G 键 - 切换地球绘制方式（网格/替身）" << endl;
+    cout << "  H 键 - 显示/隐藏性能叠加层" << endl;
+    cout << "  F 键 - 输出帧时间统计（p50/p90/p99/卡顿）" << endl;
+    cout << "  C 键 - 切换点光源数量（0/64/256/1024，分簇着色）" << endl;
+    cout << "  A 键 - 切换大气散射" << endl;
+    cout << "  U 键 - 切换太阳方向（光源位置/真实太阳位置）" << endl;
+    cout << "  K 键 - 切换云层（需要 --clouds）" << endl;
+    cout << "  M 键 - 切换标记图层（需要 --markers 或 --markers-random）" << endl;
+    cout << "  B 键 - 切换海岸线与国界（需要 --coastlines、--borders 或 --borders-random）" << endl;
+    cout << "  O 键 - 切换航线（需要 --routes 或 --routes-random）" << endl;
+    cout << "  D 键 - 切换事件密度热力图（需要 --heatmap、--heatmap-random 或 --heatmap-stream）" << endl;
+    cout << "  W 键 - 切换文字标注（地名来自 --labels 或 --labels-random，另有当前光源说明）" << endl;
+    cout << "  E 键 - 暂停/继续录制（需要 --record）" << endl;
+    cout << "  V 键 - 切换数据场（需要 --field）" << endl;
+    cout << "  , . 键 - 数据场时间轴后退/前进一步（< > 一次24步）" << endl;
     cout << "  0-7 键 - 选择特定光源位置" << endl;
     cout << "  ESC 键 - 退出程序" << endl;
     cout << endl;
@@ -4,8 +4,8 @@ echo "========================================"
 echo "真实地球仪"
 echo "========================================"
 
-# 检查 Xcode Command Line Tools
-if ! xcode-select -p &>/dev/null; then
+# 检查 Xcode Command Line Tools（仅 macOS）
+if [ "$(uname)" = "Darwin" ] && ! xcode-select -p &>/dev/null; then
     echo "未检测到 Xcode Command Line Tools，正在安装..."
     xcode-select --install
     echo "请安装完成后重新运行本脚本"
@@ -32,7 +32,11 @@ else
 fi
 
 # 编译程序
-g++ -std=c++11 main.cpp -o earth -framework GLUT -framework OpenGL
+if [ "$(uname)" = "Darwin" ]; then
+    g++ -std=c++11 main.cpp -o earth -framework GLUT -framework OpenGL
+else
+    g++ -std=c++11 main.cpp -o earth -lglut -lGLU -lGL -lEGL -pthread
+fi
 
 if [ $? -ne 0 ]; then
     echo "✗ 编译失败"
@@ -44,5 +48,5 @@ echo
 echo "运行地球仪..."
 
 
-# 运行程序
-./earth
+# 运行程序（额外参数原样传给程序，例如 ./run.sh --headless views.txt）
+./earth "$@"